@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Bench.hpp"
+
+#include "Logging.hpp"
+
+using namespace std;
+using namespace modbusSMA;
+using namespace modbusSMA::bench;
+
+//! Checks whether a benchmark matches the filter (substring of `suite/name`).
+bool Runner::enabled(string const &_suite, string const &_name) const {
+  return mOpts.filter.empty() || (_suite + "/" + _name).find(mOpts.filter) != string::npos;
+}
+
+//! Stores the result of a benchmark and prints a short summary to stderr.
+void Runner::addResult(
+    string const &_suite, string const &_name, uint64_t _iterations, uint64_t _items, vector<double> _samples) {
+  sort(begin(_samples), end(_samples));
+
+  double median = _samples[_samples.size() / 2];
+  if (_samples.size() % 2 == 0) { median = (median + _samples[_samples.size() / 2 - 1]) / 2.0; }
+
+  Result res = {_suite, _name, _iterations, _items, median, _samples.front(), _samples.back(), 0.0};
+  res.itemsPerSec = median > 0.0 ? (double)_items * 1e9 / median : 0.0;
+
+  fmt::print(stderr, "{:<10} {:<28} {:>14.1f} ns/op {:>16.0f} items/s\n", _suite, _name, median, res.itemsPerSec);
+  mResults.push_back(res);
+}
+
+//! Returns all results as a JSON document.
+string Runner::toJSON() const {
+  string out = fmt::format("{{\n  \"version\": \"{}\",\n  \"benchmarks\": [", SMA_MODBUS_SMA_VERSION);
+
+  for (size_t i = 0; i < mResults.size(); ++i) {
+    Result const &r = mResults[i];
+    out += i == 0 ? "\n" : ",\n";
+    out += fmt::format("    {{\"suite\":\"{}\",\"name\":\"{}\",\"iterations\":{},\"items\":{},\"ns_per_op\":{:.3f},"
+                       "\"ns_per_op_min\":{:.3f},\"ns_per_op_max\":{:.3f},\"items_per_second\":{:.3f}}}",
+                       r.suite,
+                       r.name,
+                       r.iterations,
+                       r.items,
+                       r.nsMedian,
+                       r.nsMin,
+                       r.nsMax,
+                       r.itemsPerSec);
+  }
+
+  out += "\n  ]\n}\n";
+  return out;
+}
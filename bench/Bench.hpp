@@ -0,0 +1,128 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "Enums.hpp"
+
+namespace modbusSMA::bench {
+
+//! Prevents the compiler from optimizing away a computed value.
+template <typename T>
+inline void doNotOptimize(T const &_value) {
+  asm volatile("" : : "g"(&_value) : "memory");
+}
+
+//! Global benchmark options.
+struct Options {
+  std::string db       = SMA_MODBUS_DEFAULT_DB; //!< The register database.
+  std::string filter   = "";                    //!< Only run benchmarks containing this string.
+  double      minTime  = 0.1;                   //!< Minimum measurement time per sample in seconds.
+  size_t      samples  = 5;                     //!< Number of samples per benchmark.
+  uint16_t    simPort  = 25020;                 //!< First port for the in process simulator.
+  uint16_t    simUnits = 4;                     //!< Simulated devices for the end-to-end benchmarks.
+};
+
+//! The result of one benchmark.
+struct Result {
+  std::string suite;       //!< The benchmark suite.
+  std::string name;        //!< The benchmark name.
+  uint64_t    iterations;  //!< Total number of measured iterations.
+  uint64_t    items;       //!< Items processed per iteration (registers, batches, ...).
+  double      nsMedian;    //!< Median time per iteration in ns.
+  double      nsMin;       //!< Fastest sample (time per iteration in ns).
+  double      nsMax;       //!< Slowest sample (time per iteration in ns).
+  double      itemsPerSec; //!< Throughput based on the median.
+};
+
+/*!
+ * \brief Minimal benchmark runner with JSON output
+ *
+ * Each benchmark is calibrated so that one sample takes at least Options::minTime. The median of all samples is
+ * reported, so single outliers (page faults, scheduling) do not distort the result.
+ */
+class Runner {
+ private:
+  Options             mOpts;
+  std::vector<Result> mResults;
+
+ public:
+  Runner() = delete;
+  Runner(Options _opts) : mOpts(_opts) {} //!< Creates the runner.
+
+  bool enabled(std::string const &_suite, std::string const &_name) const;
+  void addResult(std::string const & _suite,
+                 std::string const & _name,
+                 uint64_t            _iterations,
+                 uint64_t            _items,
+                 std::vector<double> _samples);
+
+  /*!
+   * \brief Measures _func
+   *
+   * \param _suite The benchmark suite
+   * \param _name  The benchmark name
+   * \param _func  The function to measure (called once per iteration)
+   * \param _items Number of items processed by one call of _func (for the throughput)
+   */
+  template <typename F>
+  void run(std::string const &_suite, std::string const &_name, F &&_func, uint64_t _items = 1) {
+    using namespace std::chrono;
+    if (!enabled(_suite, _name)) { return; }
+
+    // Calibrate: double the number of iterations until one sample takes long enough
+    uint64_t iterations = 1;
+    while (true) {
+      auto start = steady_clock::now();
+      for (uint64_t i = 0; i < iterations; ++i) { _func(); }
+      if (duration<double>(steady_clock::now() - start).count() >= mOpts.minTime || iterations >= (1ull << 40)) {
+        break;
+      }
+
+      iterations *= 2;
+    }
+
+    std::vector<double> samples;
+    for (size_t s = 0; s < mOpts.samples; ++s) {
+      auto start = steady_clock::now();
+      for (uint64_t i = 0; i < iterations; ++i) { _func(); }
+      samples.push_back(duration<double, std::nano>(steady_clock::now() - start).count() / (double)iterations);
+    }
+
+    addResult(_suite, _name, iterations * mOpts.samples, _items, std::move(samples));
+  }
+
+  std::string toJSON() const;
+
+  inline Options const &            options() const { return mOpts; }    //!< Returns the options.
+  inline std::vector<Result> const &results() const { return mResults; } //!< Returns all results.
+};
+
+ErrorCode benchRegister(Runner &_runner);
+ErrorCode benchContainer(Runner &_runner);
+ErrorCode benchDataBase(Runner &_runner);
+ErrorCode benchPlan(Runner &_runner);
+ErrorCode benchCycle(Runner &_runner);
+
+} // namespace modbusSMA::bench
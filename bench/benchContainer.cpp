@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Bench.hpp"
+#include "DataBase.hpp"
+#include "RegisterContainer.hpp"
+
+using namespace std;
+using namespace modbusSMA;
+using namespace modbusSMA::bench;
+
+//! Lookups and inserts in the RegisterContainer (filled with the STP_TL_10 registers).
+ErrorCode modbusSMA::bench::benchContainer(Runner &_runner) {
+  DataBase db(_runner.options().db);
+
+  ErrorCode err = db.connect();
+  if (err != ErrorCode::OK) { return err; } // DataBase::connect() already logged the reason
+
+  vector<Register> allTable    = db.getRegisters("ALL");
+  vector<Register> deviceTable = db.getRegisters("STP_TL_10");
+
+  RegisterContainer container;
+  container.addRegisters(allTable);
+  container.addRegisters(deviceTable);
+
+  vector<uint16_t> few      = {30529, 30775, 30783, 30803};
+  vector<uint16_t> readable = container.getAddresses(0, UINT16_MAX, true);
+  vector<uint16_t> data     = {0x0000, 0x59E4};
+
+  _runner.run("container", "addRegisters", [&]() {
+    RegisterContainer tmp;
+    tmp.addRegisters(allTable);
+    tmp.addRegisters(deviceTable);
+    doNotOptimize(tmp);
+  }, deviceTable.size() + allTable.size());
+
+  _runner.run("container", "getRegisters_4", [&]() { doNotOptimize(container.getRegisters(few)); }, few.size());
+  _runner.run("container", "getRegisters_readable", [&]() {
+    doNotOptimize(container.getRegisters(readable));
+  }, readable.size());
+
+  _runner.run("container", "forEach_readable", [&]() {
+    uint64_t sum = 0;
+    container.forEach(readable, [&](Register const &_reg) { sum += _reg.raw()[0]; });
+    doNotOptimize(sum);
+  }, readable.size());
+
+  _runner.run("container", "getAddresses", [&]() { doNotOptimize(container.getAddresses(30000, 40000, true)); });
+  _runner.run("container", "getRegisters_copy_all", [&]() { doNotOptimize(container.getRegisters()); });
+  _runner.run("container", "updateRegister", [&]() { doNotOptimize(container.updateRegister(30783, data)); });
+
+  return ErrorCode::OK;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <thread>
+
+#include "Bench.hpp"
+#include "Logging.hpp"
+#include "ModbusAPI.hpp"
+#include "Simulator.hpp"
+
+using namespace std;
+using namespace modbusSMA;
+using namespace modbusSMA::bench;
+using namespace modbusSMA::sim;
+
+//! End-to-end cycles against an in process simulator (loopback TCP, no injected latency).
+ErrorCode modbusSMA::bench::benchCycle(Runner &_runner) {
+  Options const &opts = _runner.options();
+  auto           db   = make_shared<DataBase>(opts.db);
+
+  ErrorCode err = db->connect();
+  if (err != ErrorCode::OK) { return err; } // DataBase::connect() already logged the reason
+
+  auto devices = db->getDeviceEnums();
+  auto iter    = find_if(begin(devices), end(devices), [](auto const &i) { return i.table == "STP_TL_10"; });
+  if (iter == end(devices)) {
+    log::get()->error("benchCycle: the database has no STP_TL_10 device");
+    return ErrorCode::DATA_BASE_ERROR;
+  }
+
+  CFG simCfg;
+  simCfg.port     = opts.simPort;
+  simCfg.numUnits = opts.simUnits;
+
+  Simulator sim(simCfg, {make_shared<DeviceModel const>(*db, *iter)}, 0);
+  if (sim.addPort(opts.simPort) != ErrorCode::OK) {
+    log::get()->error("benchCycle: failed to start the simulator on port {}", opts.simPort);
+    return ErrorCode::ERROR;
+  }
+
+  thread simThread(&Simulator::run, &sim);
+
+  ModbusAPI mapi("127.0.0.1", opts.simPort, db);
+  ErrorCode result = mapi.setup();
+  if (result == ErrorCode::OK) {
+    vector<uint16_t> all = mapi.getRegisters()->getAddresses(0, UINT16_MAX, true);
+    vector<uint16_t> few = {30529, 30775, 30783, 30803};
+
+    _runner.run("cycle", "update_4", [&]() { doNotOptimize(mapi.updateRegisters(few)); }, few.size());
+    _runner.run("cycle", "update_readable", [&]() { doNotOptimize(mapi.updateRegisters(all)); }, all.size());
+    _runner.run("cycle", "setup", [&]() {
+      mapi.reset();
+      doNotOptimize(mapi.setup());
+    });
+  } else {
+    log::get()->error("benchCycle: ModbusAPI setup failed");
+  }
+
+  sim.stop();
+  simThread.join();
+  return result;
+}
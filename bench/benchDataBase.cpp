@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Bench.hpp"
+#include "DataBase.hpp"
+
+using namespace std;
+using namespace modbusSMA;
+using namespace modbusSMA::bench;
+
+//! Loading the register catalog from the shipped database.
+ErrorCode modbusSMA::bench::benchDataBase(Runner &_runner) {
+  string   path = _runner.options().db;
+  DataBase db(path);
+
+  ErrorCode err = db.connect();
+  if (err != ErrorCode::OK) { return err; } // DataBase::connect() already logged the reason
+
+  size_t numRegs = db.getRegisters("STP_TL_10").size();
+
+  _runner.run("database", "connect", [&]() {
+    DataBase tmp(path);
+    doNotOptimize(tmp.connect());
+  });
+
+  _runner.run("database", "getRegisters", [&]() { doNotOptimize(db.getRegisters("STP_TL_10")); }, numRegs);
+  _runner.run("database", "getDeviceEnums", [&]() { doNotOptimize(db.getDeviceEnums()); });
+  _runner.run("database", "getTableList", [&]() { doNotOptimize(db.getTableList()); });
+  _runner.run("database", "validate", [&]() { doNotOptimize(db.validate()); });
+
+  return ErrorCode::OK;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Bench.hpp"
+#include "DataBase.hpp"
+#include "ReadPlan.hpp"
+#include "RegisterContainer.hpp"
+#include "RegisterSet.hpp"
+
+using namespace std;
+using namespace modbusSMA;
+using namespace modbusSMA::bench;
+
+namespace {
+
+using PowerSet = RegisterSet<regs::Condition,
+                             regs::TotalYield,
+                             regs::DailyYield,
+                             regs::GridPower,
+                             regs::GridPowerL1,
+                             regs::GridPowerL2,
+                             regs::GridPowerL3,
+                             regs::GridVoltageL1,
+                             regs::GridVoltageL2,
+                             regs::GridVoltageL3,
+                             regs::GridFrequency>;
+
+} // namespace
+
+//! Batch planning of updateRegisters().
+ErrorCode modbusSMA::bench::benchPlan(Runner &_runner) {
+  DataBase db(_runner.options().db);
+
+  ErrorCode err = db.connect();
+  if (err != ErrorCode::OK) { return err; } // DataBase::connect() already logged the reason
+
+  RegisterContainer container;
+  container.addRegisters(db.getRegisters("ALL"));
+  container.addRegisters(db.getRegisters("STP_TL_10"));
+
+  vector<Register> readable = container.getRegisters(container.getAddresses(0, UINT16_MAX, true));
+  vector<Register> sparse;
+  for (size_t i = 0; i < readable.size(); i += 8) { sparse.push_back(readable[i]); }
+
+  _runner.run("plan", "readable", [&]() { doNotOptimize(ReadPlan(readable)); }, readable.size());
+  _runner.run("plan", "sparse", [&]() { doNotOptimize(ReadPlan(sparse)); }, sparse.size());
+  _runner.run("plan", "readable_max16", [&]() { doNotOptimize(ReadPlan(readable, 16)); }, readable.size());
+
+  // Plan and decode of a small fixed set: runtime (ReadPlan + RegisterContainer) vs compile time (RegisterSet)
+  vector<uint16_t> setAddrs = {30201, 30529, 30535, 30775, 30777, 30779, 30781, 30783, 30785, 30787, 30803};
+  vector<Register> setRegs  = container.getRegisters(setAddrs);
+  vector<vector<uint16_t>> raw;
+  for (auto const &i : PowerSet::plan()) { raw.emplace_back(i.size, (uint16_t)1234); }
+
+  _runner.run("plan", "set_dynamic", [&]() {
+    ReadPlan plan(setRegs);
+    double   sum = 0;
+    for (size_t i = 0; i < plan.size() && i < raw.size(); ++i) {
+      for (auto const &j : plan.batches()[i].regs) {
+        container.updateRegister(j.reg, {raw[i].data() + j.offset, j.size});
+        sum += container.get(j.reg)->valueDouble();
+      }
+    }
+    doNotOptimize(sum);
+  }, setRegs.size());
+
+  PowerSet::Values values;
+  _runner.run("plan", "set_static", [&]() {
+    PowerSet::decode(raw, values);
+    doNotOptimize(values);
+  }, PowerSet::NUM_REGISTERS);
+
+  return ErrorCode::OK;
+}
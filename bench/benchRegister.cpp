@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Bench.hpp"
+#include "Register.hpp"
+
+using namespace std;
+using namespace modbusSMA;
+using namespace modbusSMA::bench;
+
+const char CONDITION_DESC[] = "Condition:\n35\t=\tFault\n303\t=\tOff\n307\t=\tOk\n455\t=\tWarning";
+
+//! Decoding and formatting of single registers.
+ErrorCode modbusSMA::bench::benchRegister(Runner &_runner) {
+  Register u32(30783, "Grid voltage phase L1", "V", DataType::U32, DataFormat::FIX2, DataAccess::RO);
+  Register s32(30775, "Power", "W", DataType::S32, DataFormat::FIX0, DataAccess::RO);
+  Register u64(30513, "Total yield", "Wh", DataType::U64, DataFormat::FIX0, DataAccess::RO);
+  Register cond(30201, CONDITION_DESC, "", DataType::U32, DataFormat::ENUM, DataAccess::RO);
+  Register fw(30059, "Software package", "", DataType::U32, DataFormat::FW, DataAccess::RO);
+  Register dt(30193, "System time", "", DataType::U32, DataFormat::DT, DataAccess::RO);
+  Register str(40631, "Device name", "", DataType::STR32, DataFormat::UTF8, DataAccess::RW);
+
+  u32.setRaw({0x0000, 0x59E4});
+  s32.setRaw({0xFFFF, 0xD8F0});
+  u64.setRaw({0x0000, 0x0001, 0x2345, 0x6789});
+  cond.setRaw({0x0000, 307});
+  fw.setRaw({0x020A, 0x0504});
+  dt.setRaw({0x5B00, 0x0000});
+  str.setRaw({0x534D, 0x4120, 0x5369, 0x6D75, 0x6C61, 0x746F, 0x7200, 0, 0, 0, 0, 0, 0, 0, 0, 0});
+
+  _runner.run("register", "valueUInt_u64", [&]() { doNotOptimize(u64.valueUInt()); });
+  _runner.run("register", "valueInt_s32", [&]() { doNotOptimize(s32.valueInt()); });
+  _runner.run("register", "valueDouble_fix2", [&]() { doNotOptimize(u32.valueDouble()); });
+  _runner.run("register", "value_fix2", [&]() { doNotOptimize(u32.value()); });
+  _runner.run("register", "value_s32", [&]() { doNotOptimize(s32.value()); });
+  _runner.run("register", "value_enum", [&]() { doNotOptimize(cond.value()); });
+  _runner.run("register", "value_fw", [&]() { doNotOptimize(fw.value()); });
+  _runner.run("register", "value_dt", [&]() { doNotOptimize(dt.value()); });
+  _runner.run("register", "value_str32", [&]() { doNotOptimize(str.value()); });
+  _runner.run("register", "setRaw_u32", [&]() { doNotOptimize(u32.setRaw({0x0000, 0x59E4})); });
+  _runner.run("register", "construct_enum", [&]() {
+    Register reg(30201, CONDITION_DESC, "", DataType::U32, DataFormat::ENUM, DataAccess::RO);
+    doNotOptimize(reg);
+  });
+
+  return ErrorCode::OK;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fstream>
+#include <iostream>
+
+#include "Bench.hpp"
+#include "CLI11.hpp"
+#include "Logging.hpp"
+
+using namespace std;
+using namespace spdlog;
+using namespace modbusSMA;
+using namespace modbusSMA::bench;
+
+int main(int argc, char *argv[]) {
+  auto           logger = log::get();
+  Options        opts;
+  vector<string> suites = {"register", "container", "database", "plan", "cycle"};
+  string         output = "-";
+
+  CLI::App app{"modbusSMA benchmarks"};
+
+  app.add_option("-d,--database", opts.db, "Path to the modbusSMA database", true)->check(CLI::ExistingFile);
+  app.add_option("-s,--suite", suites, "Benchmark suites to run", true);
+  app.add_option("-f,--filter", opts.filter, "Only run benchmarks whose 'suite/name' contains this string");
+  app.add_option("-t,--min-time", opts.minTime, "Minimum time per sample in seconds", true);
+  app.add_option("-n,--samples", opts.samples, "Number of samples per benchmark", true);
+  app.add_option("-P,--port", opts.simPort, "Port of the in process simulator", true);
+  app.add_option("-o,--output", output, "Where to write the JSON results ('-' for stdout)", true);
+
+  auto lFlagV = app.add_flag("-v,--verbose", "Verbose logging");
+
+  CLI11_PARSE(app, argc, argv);
+
+  logger->set_level(lFlagV->count() > 0 ? level::debug : level::warn); // Benchmarks must not be slowed down by logging
+  if (opts.samples == 0) { opts.samples = 1; }
+
+  Runner runner(opts);
+  bool   failed = false;
+  for (auto const &i : suites) {
+    ErrorCode res = ErrorCode::OK;
+    if (i == "register") {
+      res = benchRegister(runner);
+    } else if (i == "container") {
+      res = benchContainer(runner);
+    } else if (i == "database") {
+      res = benchDataBase(runner);
+    } else if (i == "plan") {
+      res = benchPlan(runner);
+    } else if (i == "cycle") {
+      res = benchCycle(runner);
+    } else {
+      logger->error("Unknown benchmark suite '{}'", i);
+      return 2;
+    }
+
+    if (res != ErrorCode::OK) {
+      logger->error("Benchmark suite '{}' failed with '{}'", i, enum2Str::toStr(res));
+      failed = true;
+    }
+  }
+
+  if (output == "-") {
+    cout << runner.toJSON();
+    return failed ? 1 : 0;
+  }
+
+  ofstream outFile(output);
+  if (!outFile.is_open()) {
+    logger->error("Failed to open '{}' for writing", output);
+    return 2;
+  }
+
+  outFile << runner.toJSON(); // Partial results are still written
+  return failed ? 1 : 0;
+}
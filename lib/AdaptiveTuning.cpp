@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "AdaptiveTuning.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <modbus/modbus.h>
+#include <vector>
+
+#include "Logging.hpp"
+#include "Statistics.hpp"
+
+using namespace std;
+using namespace std::chrono;
+using namespace modbusSMA;
+
+namespace {
+
+const double   DECAY       = 1.0 / 32.0; //!< Weight of the oldest sample in the linear model.
+const uint32_t MIN_SAMPLES = 8;          //!< Samples required before the estimates are used.
+
+} // namespace
+
+AdaptiveTuning::AdaptiveTuning(Settings _settings) : mSettings(_settings) {}
+
+/*!
+ * \brief Sets the initial response timeout (the libmodbus default of a new connection)
+ *
+ * Does nothing if the timeout was already adapted, so a reconnect keeps the learned values.
+ */
+void AdaptiveTuning::initialize(microseconds _timeout) {
+  int64_t expected = 0;
+  mTimeout.compare_exchange_strong(expected, _timeout.count());
+}
+
+//! Enables or disables the tuning. Disabling keeps the learned values.
+void AdaptiveTuning::setEnabled(bool _enabled) { mEnabled.store(_enabled); }
+
+//! Discards all learned values. Must not be called while record() is running.
+void AdaptiveTuning::reset() {
+  mWindow    = {};
+  mSamples   = 0;
+  mW         = 0;
+  mN         = 0;
+  mT         = 0;
+  mNN        = 0;
+  mNT        = 0;
+  mRTT       = 0;
+  mWC        = 0;
+  mAIMDLimit = SMA_MODBUS_MAX_REGISTER_COUNT;
+  mSuccesses = 0;
+  mBackoff   = false;
+  mTimeout.store(0);
+  mBatchLimit.store(SMA_MODBUS_MAX_REGISTER_COUNT);
+  mRTTOut.store(0);
+  mWCOut.store(0);
+}
+
+//! Returns the response timeout (0 if not known yet).
+microseconds AdaptiveTuning::timeout() const { return microseconds(mTimeout.load(memory_order_relaxed)); }
+
+//! Returns the maximum batch size (SMA_MODBUS_MAX_REGISTER_COUNT if disabled).
+uint32_t AdaptiveTuning::batchLimit() const {
+  return isEnabled() ? mBatchLimit.load(memory_order_relaxed) : SMA_MODBUS_MAX_REGISTER_COUNT;
+}
+
+//! Returns the current state. Can be called from any thread.
+AdaptiveTuning::Snapshot AdaptiveTuning::snapshot() const {
+  Snapshot snap;
+  snap.enabled    = isEnabled();
+  snap.timeout    = timeout();
+  snap.batchLimit = batchLimit();
+  snap.rtt        = mRTTOut.load(memory_order_relaxed);
+  snap.wordCost   = mWCOut.load(memory_order_relaxed);
+  return snap;
+}
+
+/*!
+ * \brief Records the result of one read request
+ *
+ * \param _numRegisters Number of requested registers
+ * \param _duration     Duration of the request
+ * \param _errno        errno of the failed request or 0
+ *
+ * \returns true if the response timeout has changed and has to be applied to the connection
+ */
+bool AdaptiveTuning::record(uint32_t _numRegisters, microseconds _duration, int _errno) {
+  if (!isEnabled()) { return false; }
+
+  int64_t oldTimeout = mTimeout.load(memory_order_relaxed);
+
+  if (_errno == 0) {
+    mWindow[mSamples % WINDOW_SIZE] = _duration.count();
+    ++mSamples;
+    updateModel(_numRegisters, _duration.count());
+
+    if (mSamples >= MIN_SAMPLES && (mBackoff || mSamples % MIN_SAMPLES == 0)) {
+      mTimeout.store(timeoutFromWindow());
+      mBackoff = false;
+    }
+
+    uint32_t limit        = mAIMDLimit;
+    bool     closeToLimit = 2 * _numRegisters >= limit && limit < SMA_MODBUS_MAX_REGISTER_COUNT;
+    if (closeToLimit && ++mSuccesses >= mSettings.increaseAfter) { limit += mSettings.increaseStep; }
+
+    setBatchLimit(limit);
+    return mTimeout.load(memory_order_relaxed) != oldTimeout;
+  }
+
+  auto errClass = Statistics::classifyError(_errno);
+  if (errClass == Statistics::ErrorClass::TIMEOUT && oldTimeout > 0) {
+    mTimeout.store(min<int64_t>(oldTimeout * 2, mSettings.maxTimeout.count()));
+    mBackoff = true;
+  }
+
+  bool sizeRelated = errClass == Statistics::ErrorClass::TIMEOUT || errClass == Statistics::ErrorClass::OTHER ||
+                     _errno == EMBXILVAL;
+  if (sizeRelated && _numRegisters > mSettings.minBatch && _numRegisters / 2 < mAIMDLimit) {
+    setBatchLimit(_numRegisters / 2);
+  }
+
+  return mTimeout.load(memory_order_relaxed) != oldTimeout;
+}
+
+//! Adds a sample to the linear model `duration = rtt + n * wordCost`.
+void AdaptiveTuning::updateModel(uint32_t _numRegisters, int64_t _duration) {
+  double n = _numRegisters;
+  double t = (double)_duration;
+
+  mW  = mW * (1 - DECAY) + 1;
+  mN  = mN * (1 - DECAY) + n;
+  mT  = mT * (1 - DECAY) + t;
+  mNN = mNN * (1 - DECAY) + n * n;
+  mNT = mNT * (1 - DECAY) + n * t;
+
+  double meanN = mN / mW;
+  double meanT = mT / mW;
+  double varN  = mNN / mW - meanN * meanN;
+
+  if (varN > 1.0) { mWC = max((mNT / mW - meanN * meanT) / varN, 0.0); } // Keep the old estimate for constant sizes
+  mRTT = max(meanT - mWC * meanN, 0.0);
+
+  mRTTOut.store(mRTT, memory_order_relaxed);
+  mWCOut.store(mWC, memory_order_relaxed);
+}
+
+//! Computes the response timeout from the recorded durations.
+int64_t AdaptiveTuning::timeoutFromWindow() const {
+  vector<int64_t> durations(begin(mWindow), begin(mWindow) + min(mSamples, WINDOW_SIZE));
+  size_t          idx = (size_t)ceil(mSettings.percentile * durations.size());
+  idx                 = min(max<size_t>(idx, 1), durations.size()) - 1;
+  nth_element(begin(durations), begin(durations) + idx, end(durations));
+
+  auto timeout = (int64_t)(mSettings.timeoutFactor * durations[idx]);
+  return min(max(timeout, mSettings.minTimeout.count()), mSettings.maxTimeout.count());
+}
+
+//! The largest batch that is predicted to finish in half of Settings::maxTimeout.
+uint32_t AdaptiveTuning::modelLimit() const {
+  if (mSamples < MIN_SAMPLES || mWC <= 0) { return SMA_MODBUS_MAX_REGISTER_COUNT; }
+
+  double limit = (mSettings.maxTimeout.count() / 2.0 - mRTT) / mWC;
+  return (uint32_t)min<double>(max<double>(limit, mSettings.minBatch), SMA_MODBUS_MAX_REGISTER_COUNT);
+}
+
+//! Sets the AIMD limit and publishes it (with the model cap).
+void AdaptiveTuning::setBatchLimit(uint32_t _limit) {
+  _limit = min<uint32_t>(max(_limit, mSettings.minBatch), SMA_MODBUS_MAX_REGISTER_COUNT);
+  if (_limit != mAIMDLimit) { mSuccesses = 0; }
+  mAIMDLimit = _limit;
+
+  uint32_t published = min(_limit, modelLimit());
+  if (published == mBatchLimit.load(memory_order_relaxed)) { return; }
+
+  SPDLOG_LOGGER_DEBUG(log::get(),
+                      "AdaptiveTuning: batch limit {} --> {} (rtt: {:.0f}us; per register: {:.1f}us)",
+                      mBatchLimit.load(memory_order_relaxed),
+                      published,
+                      mRTT,
+                      mWC);
+  mBatchLimit.store(published);
+}
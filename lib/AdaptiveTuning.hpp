@@ -0,0 +1,120 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+
+namespace modbusSMA {
+
+/*!
+ * \brief Adapts the response timeout and the batch size of one connection to the measured request durations
+ *
+ * The durations of the successful requests are used for two estimates:
+ *  - A linear model `duration = rtt + n * wordCost` (exponentially weighted least squares over the batch size n)
+ *  - The percentile (Settings::percentile) of the last WINDOW_SIZE durations
+ *
+ * The response timeout is `Settings::timeoutFactor * percentile`, limited to [Settings::minTimeout,
+ * Settings::maxTimeout]. It is doubled after every timeout (until the next successful request).
+ *
+ * The batch size limit starts at SMA_MODBUS_MAX_REGISTER_COUNT. Since the cost per register `rtt / n + wordCost`
+ * decreases with the batch size, the limit is only reduced when large requests fail (timeouts, corrupt frames or the
+ * ILLEGAL_DATA_VALUE exception): it is set to half the size of the failed request. After Settings::increaseAfter
+ * successful requests close to the limit, it is increased by Settings::increaseStep again (AIMD). The limit is also
+ * capped, so the model predicts the largest request to finish in half of Settings::maxTimeout.
+ *
+ * record() must only be called by the thread using the connection. The current values can be read from any thread.
+ */
+class AdaptiveTuning {
+ public:
+  static constexpr size_t WINDOW_SIZE = 64; //!< Number of durations used for the percentile.
+
+  //! Tuning parameters.
+  struct Settings {
+    std::chrono::microseconds minTimeout    = std::chrono::milliseconds(100); //!< Lower bound of the timeout.
+    std::chrono::microseconds maxTimeout    = std::chrono::seconds(10);       //!< Upper bound of the timeout.
+    double                    percentile    = 0.99;                           //!< Percentile of the durations.
+    double                    timeoutFactor = 2.0;                            //!< Timeout / percentile.
+    uint32_t                  minBatch      = 8;                              //!< Lower bound of the batch limit.
+    uint32_t                  increaseStep  = 8;                              //!< Additive increase.
+    uint32_t                  increaseAfter = 16;                             //!< Successes before an increase.
+  };
+
+  //! The current state.
+  struct Snapshot {
+    bool                      enabled    = false; //!< Whether the tuning is enabled.
+    std::chrono::microseconds timeout    = {};    //!< The current response timeout.
+    uint32_t                  batchLimit = 0;     //!< The current batch size limit.
+    double                    rtt        = 0;     //!< Estimated round trip time in µs.
+    double                    wordCost   = 0;     //!< Estimated transfer time per register in µs.
+  };
+
+ private:
+  Settings mSettings;
+
+  std::array<int64_t, WINDOW_SIZE> mWindow  = {}; //!< Durations of the last successful requests in µs.
+  size_t                           mSamples = 0;  //!< Total number of successful requests.
+
+  // Exponentially weighted sums for the linear model
+  double mW   = 0;
+  double mN   = 0;
+  double mT   = 0;
+  double mNN  = 0;
+  double mNT  = 0;
+  double mRTT = 0;
+  double mWC  = 0;
+
+  uint32_t mAIMDLimit = SMA_MODBUS_MAX_REGISTER_COUNT; //!< The batch limit without the model cap.
+  uint32_t mSuccesses = 0;                             //!< Successes close to the limit since the last change.
+  bool     mBackoff   = false;                         //!< A timeout occurred (recompute the timeout on success).
+
+  std::atomic<bool>     mEnabled    = {true};
+  std::atomic<int64_t>  mTimeout    = {0}; //!< The current timeout in µs (0 ==> unknown).
+  std::atomic<uint32_t> mBatchLimit = {SMA_MODBUS_MAX_REGISTER_COUNT};
+  std::atomic<double>   mRTTOut     = {0};
+  std::atomic<double>   mWCOut      = {0};
+
+  void     updateModel(uint32_t _numRegisters, int64_t _duration);
+  int64_t  timeoutFromWindow() const;
+  uint32_t modelLimit() const;
+  void     setBatchLimit(uint32_t _limit);
+
+ public:
+  AdaptiveTuning() = default;
+  AdaptiveTuning(Settings _settings);
+
+  AdaptiveTuning(AdaptiveTuning const &) = delete;
+  void operator=(AdaptiveTuning const &) = delete;
+
+  bool record(uint32_t _numRegisters, std::chrono::microseconds _duration, int _errno);
+  void initialize(std::chrono::microseconds _timeout);
+  void setEnabled(bool _enabled);
+  void reset();
+
+  std::chrono::microseconds timeout() const;
+  uint32_t                  batchLimit() const;
+  Snapshot                  snapshot() const;
+
+  inline bool            isEnabled() const { return mEnabled.load(std::memory_order_relaxed); } //!< Checks if enabled.
+  inline Settings const &settings() const { return mSettings; }                             //!< Returns the settings.
+};
+
+} // namespace modbusSMA
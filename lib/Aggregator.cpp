@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Aggregator.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+using namespace std;
+using namespace modbusSMA;
+
+namespace {
+
+const int64_t MINUTE = 60 * 1000;
+
+//! The current UNIX time in ms.
+int64_t currentTime() {
+  return chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+//! Default windows: tumbling 1 min, 15 min and 1 h and a sliding 1 min window.
+Aggregator::Aggregator()
+    : Aggregator({{MINUTE, Kind::TUMBLING},
+                  {15 * MINUTE, Kind::TUMBLING},
+                  {60 * MINUTE, Kind::TUMBLING},
+                  {MINUTE, Kind::SLIDING}}) {}
+
+//! Uses the windows _windows (windows with a length <= 0 are ignored).
+Aggregator::Aggregator(vector<Window> _windows) {
+  for (auto const &i : _windows) {
+    if (i.length > 0) { mWindows.push_back(i); }
+  }
+}
+
+//! Adds a sample to a sliding window (mMutex must be locked).
+void Aggregator::addSliding(State &_state, int64_t _time, double _value) {
+  Sample sample = {_state.nextSeq++, _time, _value};
+
+  _state.samples.push_back(sample);
+  _state.sum += _value;
+
+  while (!_state.minQueue.empty() && _state.minQueue.back().value >= _value) { _state.minQueue.pop_back(); }
+  while (!_state.maxQueue.empty() && _state.maxQueue.back().value <= _value) { _state.maxQueue.pop_back(); }
+  _state.minQueue.push_back(sample);
+  _state.maxQueue.push_back(sample);
+  _state.last = _value;
+
+  evictSliding(_state, _time);
+}
+
+//! Removes the samples of a sliding window that are not in (_now - length, _now] (mMutex must be locked).
+void Aggregator::evictSliding(State &_state, int64_t _now) {
+  int64_t cutoff = _now - _state.window.length;
+  while (!_state.samples.empty() && _state.samples.front().time <= cutoff) {
+    uint64_t seq = _state.samples.front().seq;
+    _state.sum -= _state.samples.front().value;
+    _state.samples.pop_front();
+    if (_state.minQueue.front().seq == seq) { _state.minQueue.pop_front(); }
+    if (_state.maxQueue.front().seq == seq) { _state.maxQueue.pop_front(); }
+  }
+
+  _state.start = max(_state.start, cutoff); // The window never moves back (query time before the newest sample)
+  _state.count = _state.samples.size();
+  if (_state.samples.empty()) {
+    _state.sum = 0; // No accumulated rounding errors
+    return;
+  }
+
+  _state.first = _state.samples.front().value;
+  _state.min   = _state.minQueue.front().value;
+  _state.max   = _state.maxQueue.front().value;
+}
+
+/*!
+ * \brief Adds a sample to a tumbling window (mMutex must be locked)
+ * \returns true if the sample started a new window (the finished window is stored in _closed)
+ */
+bool Aggregator::addTumbling(uint16_t _reg, State &_state, int64_t _time, double _value, Result &_closed) {
+  int64_t length = _state.window.length;
+  int64_t start  = _time - ((_time % length) + length) % length;
+  bool    closed = false;
+
+  if (_state.count > 0 && start != _state.start) {
+    _closed      = toResult(_reg, _state);
+    closed       = true;
+    _state.count = 0;
+  }
+
+  if (_state.count == 0) {
+    _state.start = start;
+    _state.sum   = 0;
+    _state.first = _value;
+    _state.min   = _value;
+    _state.max   = _value;
+  }
+
+  ++_state.count;
+  _state.sum += _value;
+  _state.last = _value;
+  _state.min  = min(_state.min, _value);
+  _state.max  = max(_state.max, _value);
+  return closed;
+}
+
+/*!
+ * \brief Brings a window up to the time _now (mMutex must be locked)
+ *
+ * Sliding windows drop their old samples. A finished tumbling window stays in the state until a sample of the next
+ * window arrives (it is passed to the subscribers then), but it is no longer the current window.
+ *
+ * \returns true if the window has current samples
+ */
+bool Aggregator::refresh(State &_state, int64_t _now) {
+  if (_state.window.kind == Kind::SLIDING) {
+    evictSliding(_state, _now);
+  } else if (_now >= _state.start + _state.window.length) {
+    return false;
+  }
+
+  return _state.count > 0;
+}
+
+//! Converts the state of a window to a Result.
+Aggregator::Result Aggregator::toResult(uint16_t _reg, State const &_state) {
+  Result res;
+  res.reg    = _reg;
+  res.window = _state.window;
+  res.start  = _state.start;
+  res.end    = _state.start + _state.window.length;
+  res.count  = _state.count;
+  res.min    = _state.min;
+  res.max    = _state.max;
+  res.mean   = _state.count > 0 ? _state.sum / (double)_state.count : 0;
+  res.delta  = _state.last - _state.first;
+  return res;
+}
+
+/*!
+ * \brief Adds a sample to all windows of _reg
+ *
+ * Samples older than the newest sample of a window and non finite values are ignored.
+ *
+ * \param _reg   The register
+ * \param _time  UNIX timestamp in ms
+ * \param _value The value
+ */
+void Aggregator::add(uint16_t _reg, int64_t _time, double _value) {
+  if (!isfinite(_value)) { return; }
+
+  vector<Result>     closed;
+  vector<Subscriber> subscribers;
+
+  {
+    lock_guard<mutex> lock(mMutex);
+    auto &            states = mStates[_reg];
+    if (states.empty()) {
+      states.resize(mWindows.size());
+      for (size_t i = 0; i < mWindows.size(); ++i) { states[i].window = mWindows[i]; }
+    }
+
+    Result res;
+    for (State &i : states) {
+      bool isNewest = i.count == 0 || _time >= (i.window.kind == Kind::SLIDING ? i.samples.back().time : i.start);
+      if (!isNewest) { continue; }
+
+      if (i.window.kind == Kind::SLIDING) {
+        addSliding(i, _time, _value);
+      } else if (addTumbling(_reg, i, _time, _value, res)) {
+        closed.push_back(res);
+      }
+    }
+
+    if (!closed.empty()) { subscribers = mSubscribers; }
+  }
+
+  for (auto const &i : closed) {
+    for (auto const &j : subscribers) { j(i); }
+  }
+}
+
+/*!
+ * \brief Adds the current values of the registers in _regList
+ *
+ * Signature compatible with ModbusAPI::UpdateListener. NaN values and strings are skipped.
+ *
+ * \param _container The registers
+ * \param _regList   The updated registers
+ * \param _time      UNIX timestamp in ms
+ */
+void Aggregator::update(RegisterContainer const &_container, vector<uint16_t> const &_regList, int64_t _time) {
+  _container.forEach(_regList, [&](Register const &_reg) {
+    if (_reg.type() == DataType::STR32 || _reg.isNaN()) { return; }
+    add(_reg.reg(), _time, _reg.valueDouble());
+  });
+}
+
+//! Registers a function that is called for every finished tumbling window.
+void Aggregator::subscribe(Subscriber _fn) {
+  lock_guard<mutex> lock(mMutex);
+  mSubscribers.push_back(move(_fn));
+}
+
+//! Returns the current aggregates of one window of _reg at the current time (see the overload below).
+bool Aggregator::query(uint16_t _reg, size_t _window, Result &_out) {
+  return query(_reg, _window, _out, currentTime());
+}
+
+/*!
+ * \brief Returns the aggregates of one window of _reg at the time _now
+ *
+ * For tumbling windows this is the window that contains _now. Sliding windows drop the samples that are older than
+ * `_now - length`, even if no new sample arrived.
+ *
+ * \param _reg    The register
+ * \param _window Index of the window (see windows())
+ * \param _out    The aggregates
+ * \param _now    UNIX timestamp in ms
+ * \returns false if there are no samples in the window (e.g. the tumbling window ended without a newer sample)
+ */
+bool Aggregator::query(uint16_t _reg, size_t _window, Result &_out, int64_t _now) {
+  lock_guard<mutex> lock(mMutex);
+  auto              iter = mStates.find(_reg);
+  if (iter == end(mStates) || _window >= iter->second.size()) { return false; }
+
+  State &state = iter->second[_window];
+  if (!refresh(state, _now)) { return false; }
+
+  _out = toResult(_reg, state);
+  return true;
+}
+
+//! Returns the aggregates of all windows of _reg at the current time (windows without samples are skipped).
+vector<Aggregator::Result> Aggregator::query(uint16_t _reg) { return query(_reg, currentTime()); }
+
+//! Returns the aggregates of all windows of _reg at the time _now (windows without samples are skipped).
+vector<Aggregator::Result> Aggregator::query(uint16_t _reg, int64_t _now) {
+  vector<Result>    results;
+  lock_guard<mutex> lock(mMutex);
+  auto              iter = mStates.find(_reg);
+  if (iter == end(mStates)) { return results; }
+
+  for (State &i : iter->second) {
+    if (refresh(i, _now)) { results.push_back(toResult(_reg, i)); }
+  }
+
+  return results;
+}
+
+//! Returns the name of the window type.
+string Aggregator::toStr(Kind _kind) { return _kind == Kind::SLIDING ? "sliding" : "tumbling"; }
@@ -0,0 +1,144 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "RegisterContainer.hpp"
+
+namespace modbusSMA {
+
+/*!
+ * \brief Incremental min / max / mean / delta aggregations over time windows
+ *
+ * Every sample is added to all configured windows of its register:
+ *
+ *   - TUMBLING windows are aligned to multiples of their length (UNIX time). When a sample of the next window arrives,
+ *     the finished window is passed to the subscribers. Queries only return the window that contains the query time.
+ *   - SLIDING windows always cover the last `length` ms before the newest sample or the query time, whichever is
+ *     later. Min and max are maintained with monotonic deques, so adding a sample is amortized O(1).
+ *
+ * `delta` is the difference between the last and the first value of the window (energy counters). NaN values (see
+ * Register::isNaN()) and strings are ignored.
+ *
+ * The aggregator is fed by update() (see ModbusAPI::addUpdateListener()) or add(), queries and subscriptions never
+ * need the history of the values.
+ *
+ * \code{.cpp}
+ * Aggregator agg;
+ * agg.subscribe([](Aggregator::Result const &_res) { fmt::print("{} max: {}\n", _res.reg, _res.max); });
+ * mapi.addUpdateListener([&](auto const &_cont, auto const &_regs, int64_t _ts) { agg.update(_cont, _regs, _ts); });
+ * \endcode
+ *
+ * \note Thread safe. The subscribers are called from the thread that added the sample (without holding any lock).
+ */
+class Aggregator {
+ public:
+  //! The window types.
+  enum class Kind {
+    TUMBLING, //!< Fixed, non overlapping windows.
+    SLIDING,  //!< The last `length` ms.
+  };
+
+  //! Configuration of one window.
+  struct Window {
+    int64_t length; //!< Length of the window in ms.
+    Kind    kind;   //!< The window type.
+  };
+
+  //! The aggregates of one window.
+  struct Result {
+    uint16_t reg    = 0;                   //!< The register.
+    Window   window = {0, Kind::TUMBLING}; //!< The window configuration.
+    int64_t  start  = 0;                   //!< Timestamp of the window start (ms).
+    int64_t  end    = 0;                   //!< Timestamp of the window end (ms).
+    size_t   count  = 0;                   //!< Number of samples.
+    double   min    = 0;                   //!< The smallest value.
+    double   max    = 0;                   //!< The largest value.
+    double   mean   = 0;                   //!< The arithmetic mean.
+    double   delta  = 0;                   //!< Last value - first value.
+  };
+
+  typedef std::function<void(Result const &)> Subscriber; //!< Receives finished tumbling windows.
+
+ private:
+  struct Sample {
+    uint64_t seq;
+    int64_t  time;
+    double   value;
+  };
+
+  //! The state of one window of one register.
+  struct State {
+    Window  window = {0, Kind::TUMBLING};
+    int64_t start  = 0;
+    size_t  count  = 0;
+    double  sum    = 0;
+    double  first  = 0;
+    double  last   = 0;
+    double  min    = 0;
+    double  max    = 0;
+
+    uint64_t           nextSeq = 0; //!< Sliding windows only.
+    std::deque<Sample> samples;     //!< Sliding windows only.
+    std::deque<Sample> minQueue;    //!< Sliding windows only (increasing values).
+    std::deque<Sample> maxQueue;    //!< Sliding windows only (decreasing values).
+  };
+
+  std::vector<Window> mWindows;
+
+  mutable std::mutex                               mMutex;
+  std::unordered_map<uint16_t, std::vector<State>> mStates;
+  std::vector<Subscriber>                          mSubscribers;
+
+  void addSliding(State &_state, int64_t _time, double _value);
+  void evictSliding(State &_state, int64_t _now);
+  bool addTumbling(uint16_t _reg, State &_state, int64_t _time, double _value, Result &_closed);
+  bool refresh(State &_state, int64_t _now);
+
+  static Result toResult(uint16_t _reg, State const &_state);
+
+ public:
+  Aggregator();
+  Aggregator(std::vector<Window> _windows);
+
+  Aggregator(Aggregator const &) = delete;
+  void operator=(Aggregator const &) = delete;
+
+  void add(uint16_t _reg, int64_t _time, double _value);
+  void update(RegisterContainer const &_container, std::vector<uint16_t> const &_regList, int64_t _time);
+  void subscribe(Subscriber _fn);
+
+  bool                query(uint16_t _reg, size_t _window, Result &_out);
+  bool                query(uint16_t _reg, size_t _window, Result &_out, int64_t _now);
+  std::vector<Result> query(uint16_t _reg);
+  std::vector<Result> query(uint16_t _reg, int64_t _now);
+
+  inline std::vector<Window> const &windows() const { return mWindows; } //!< The configured windows.
+
+  static std::string toStr(Kind _kind);
+};
+
+} // namespace modbusSMA
@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "AlertEngine.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+#include "Logging.hpp"
+#include "Trace.hpp"
+
+using namespace std;
+using namespace modbusSMA;
+
+namespace {
+
+string trim(string const &_str) {
+  auto first = _str.find_first_not_of(" \t\r");
+  auto last  = _str.find_last_not_of(" \t\r");
+  return first == string::npos ? "" : _str.substr(first, last - first + 1);
+}
+
+//! Parses a limit (empty ==> _default).
+double parseLimit(string const &_str, double _default) { return _str.empty() ? _default : stod(_str); }
+
+//! Parses a raw value ('*' or empty ==> ANY).
+int64_t parseRaw(string const &_str) { return _str.empty() || _str == "*" ? AlertEngine::ANY : stoll(_str); }
+
+} // namespace
+
+AlertEngine::AlertEngine(size_t _maxEvents) : mMaxEvents(max<size_t>(_maxEvents, 1)) {}
+
+//! Adds a rule (fails for inconsistent limits).
+ErrorCode AlertEngine::add(Rule _rule) {
+  bool valid = true;
+  switch (_rule.kind) {
+    case Kind::THRESHOLD:
+    case Kind::RATE: valid = _rule.low <= _rule.high; break;
+    case Kind::HYSTERESIS: valid = _rule.set != _rule.clear; break;
+    case Kind::TRANSITION: valid = _rule.from == ANY || _rule.to == ANY || _rule.from != _rule.to; break;
+  }
+
+  if (!valid || isnan(_rule.low) || isnan(_rule.high) || isnan(_rule.set) || isnan(_rule.clear)) {
+    log::get()->error("AlertEngine: invalid limits for the {} rule '{}'", toStr(_rule.kind), _rule.name);
+    return ErrorCode::ERROR;
+  }
+
+  Watch &watch = mWatches[_rule.reg];
+  watch.rules.push_back(mRules.size());
+  watch.hasRate = watch.hasRate || _rule.kind == Kind::RATE;
+
+  lock_guard<mutex> lock(mMutex);
+  mRules.push_back(move(_rule));
+  mActive.push_back(false);
+  return ErrorCode::OK;
+}
+
+/*!
+ * \brief Loads rules from a file
+ *
+ * One `name;register;kind;a;b` per line, `#` starts a comment. `a` and `b` are `low;high` for threshold and rate,
+ * `set;clear` for hysteresis and `from;to` for transition rules. Empty limits are unbounded, `*` matches every raw
+ * value.
+ *
+ * \code
+ * # name;register;kind;a;b
+ * grid voltage L1;30783;threshold;20700;25300
+ * insulation;30225;hysteresis;500;1000
+ * power ramp;30775;rate;-2000;2000
+ * fault;30201;transition;*;35
+ * \endcode
+ */
+ErrorCode AlertEngine::loadFile(string const &_path) {
+  auto const &logger = log::get();
+  ifstream    in(_path);
+  if (!in.is_open()) {
+    logger->error("AlertEngine: failed to open '{}'", _path);
+    return ErrorCode::FILE_NOT_FOUND;
+  }
+
+  string line;
+  size_t lineNum = 0;
+  while (getline(in, line)) {
+    ++lineNum;
+    line = trim(line.substr(0, line.find('#')));
+    if (line.empty()) { continue; }
+
+    vector<string> fields;
+    for (size_t pos = 0; pos != string::npos;) {
+      size_t next = line.find(';', pos);
+      fields.push_back(trim(line.substr(pos, next == string::npos ? string::npos : next - pos)));
+      pos = next == string::npos ? next : next + 1;
+    }
+
+    if (fields.size() != 5) {
+      logger->error("AlertEngine: {}:{}: expected 5 fields separated by ';'", _path, lineNum);
+      return ErrorCode::ERROR;
+    }
+
+    Rule   rule;
+    string kind = fields[2];
+    transform(begin(kind), end(kind), begin(kind), [](unsigned char c) { return (char)tolower(c); });
+
+    try {
+      unsigned long reg = stoul(fields[1]);
+      if (reg > UINT16_MAX) { throw out_of_range(fields[1]); }
+
+      rule.name = fields[0];
+      rule.reg  = (uint16_t)reg;
+
+      if (kind == "threshold" || kind == "rate") {
+        rule.kind = kind == "rate" ? Kind::RATE : Kind::THRESHOLD;
+        rule.low  = parseLimit(fields[3], -HUGE_VAL);
+        rule.high = parseLimit(fields[4], HUGE_VAL);
+      } else if (kind == "hysteresis") {
+        rule.kind  = Kind::HYSTERESIS;
+        rule.set   = stod(fields[3]);
+        rule.clear = stod(fields[4]);
+      } else if (kind == "transition") {
+        rule.kind = Kind::TRANSITION;
+        rule.from = parseRaw(fields[3]);
+        rule.to   = parseRaw(fields[4]);
+      } else {
+        logger->error("AlertEngine: {}:{}: unknown rule kind '{}'", _path, lineNum, fields[2]);
+        return ErrorCode::ERROR;
+      }
+    } catch (...) {
+      logger->error("AlertEngine: {}:{}: invalid number", _path, lineNum);
+      return ErrorCode::ERROR;
+    }
+
+    if (add(move(rule)) != ErrorCode::OK) { return ErrorCode::ERROR; }
+  }
+
+  SPDLOG_LOGGER_DEBUG(logger, "AlertEngine: loaded {} rules from '{}'", mRules.size(), _path);
+  return ErrorCode::OK;
+}
+
+//! Adds an event to the queue (mMutex must be locked).
+void AlertEngine::push(Event const &_event) {
+  if (mEvents.size() >= mMaxEvents) {
+    ++mDropped;
+    return;
+  }
+
+  mEvents.push_back(_event);
+}
+
+//! Evaluates one rule with the new value (mMutex must be locked).
+void AlertEngine::evaluate(size_t _rule, Watch const &_watch, double _value, uint64_t _raw, int64_t _time) {
+  Rule const &rule   = mRules[_rule];
+  bool        active = mActive[_rule];
+  Event       event  = {_rule, rule.reg, _time, _value, _watch.value, false};
+
+  switch (rule.kind) {
+    case Kind::THRESHOLD: active = _value < rule.low || _value > rule.high; break;
+
+    case Kind::HYSTERESIS:
+      if (rule.set > rule.clear) {
+        active = active ? _value > rule.clear : _value >= rule.set;
+      } else {
+        active = active ? _value < rule.clear : _value <= rule.set;
+      }
+      break;
+
+    case Kind::RATE: {
+      if (!_watch.hasLast || _time <= _watch.time) { return; }
+      double rate = (_value - _watch.value) * 1000.0 / (double)(_time - _watch.time);
+      active      = rate < rule.low || rate > rule.high;
+      event.value = rate;
+      break;
+    }
+
+    case Kind::TRANSITION:
+      if (!_watch.hasLast || _raw == _watch.raw) { return; }
+      if (rule.from != ANY && (uint64_t)rule.from != _watch.raw) { return; }
+      if (rule.to != ANY && (uint64_t)rule.to != _raw) { return; }
+      event.value    = (double)_raw;
+      event.previous = (double)_watch.raw;
+      event.active   = true;
+      push(event);
+      return;
+  }
+
+  if (active == mActive[_rule]) { return; }
+  mActive[_rule] = active;
+  event.active   = active;
+  push(event);
+}
+
+/*!
+ * \brief Evaluates the rules of the registers in _regList
+ *
+ * Matches the signature of ModbusAPI::UpdateListener.
+ *
+ * \param _container The registers
+ * \param _regList   The updated registers
+ * \param _time      UNIX timestamp of the update in ms
+ */
+void AlertEngine::update(RegisterContainer const &_container, vector<uint16_t> const &_regList, int64_t _time) {
+  trace::Span       span("AlertEngine::update", "alerts");
+  lock_guard<mutex> lock(mMutex);
+
+  for (uint16_t i : _regList) {
+    auto iter = mWatches.find(i);
+    if (iter == end(mWatches)) { continue; }
+
+    Register const *reg = _container.get(i);
+    if (!reg || reg->type() == DataType::STR32 || reg->isNaN()) { continue; }
+
+    Watch &  watch = iter->second;
+    uint64_t raw   = reg->valueUInt();
+    if (watch.hasLast && raw == watch.raw && !watch.hasRate) { continue; } // Nothing changed
+
+    double value = reg->valueDouble();
+    for (size_t j : watch.rules) { evaluate(j, watch, value, raw, _time); }
+    mEvaluated += watch.rules.size();
+
+    watch.hasLast = true;
+    watch.value   = value;
+    watch.raw     = raw;
+    watch.time    = _time;
+  }
+}
+
+//! Moves all queued events to _out and returns their number.
+size_t AlertEngine::drain(vector<Event> &_out) {
+  lock_guard<mutex> lock(mMutex);
+  size_t            num = mEvents.size();
+  _out.insert(end(_out), begin(mEvents), end(mEvents));
+  mEvents.clear();
+  return num;
+}
+
+//! Returns the indexes of the currently active THRESHOLD, HYSTERESIS and RATE rules.
+vector<size_t> AlertEngine::active() const {
+  lock_guard<mutex> lock(mMutex);
+  vector<size_t>    out;
+  for (size_t i = 0; i < mActive.size(); ++i) {
+    if (mActive[i]) { out.push_back(i); }
+  }
+  return out;
+}
+
+//! Returns the number of events dropped because the queue was full.
+size_t AlertEngine::dropped() const {
+  lock_guard<mutex> lock(mMutex);
+  return mDropped;
+}
+
+//! Returns the number of rule evaluations so far.
+size_t AlertEngine::evaluated() const {
+  lock_guard<mutex> lock(mMutex);
+  return mEvaluated;
+}
+
+//! Converts a rule kind to a string.
+string AlertEngine::toStr(Kind _kind) {
+  switch (_kind) {
+    case Kind::THRESHOLD: return "threshold";
+    case Kind::HYSTERESIS: return "hysteresis";
+    case Kind::RATE: return "rate";
+    case Kind::TRANSITION: return "transition";
+  }
+
+  return "unknown";
+}
@@ -0,0 +1,137 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <cmath>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "RegisterContainer.hpp"
+
+namespace modbusSMA {
+
+/*!
+ * \brief Evaluates alert rules on the registers updated in a poll cycle
+ *
+ * Rule kinds:
+ *
+ *   - THRESHOLD:  active while the value is outside of [low, high]
+ *   - HYSTERESIS: raised when the value reaches `set`, cleared when it reaches `clear` (`set` > `clear`: alarm on high
+ *     values, `set` < `clear`: alarm on low values, e.g. the insulation resistance)
+ *   - RATE:       active while the change per second is outside of [low, high]
+ *   - TRANSITION: fires when the raw value changes from `from` to `to` (ANY matches every value), e.g. status enums
+ *
+ * The rules are indexed by register, so update() only looks at the rules of the updated registers. The rules of a
+ * register are skipped entirely if its raw value did not change (unless it has RATE rules). NaN values are ignored.
+ *
+ * Every raised and cleared alert is stored in a bounded event queue (see drain()). When the queue is full, new events
+ * are dropped and counted (see dropped()).
+ *
+ * \code{.cpp}
+ * AlertEngine alerts;
+ * alerts.add({"grid overvoltage", 30783, AlertEngine::Kind::HYSTERESIS, 0, 0, 253.0, 250.0});
+ * mapi.addUpdateListener([&](auto const &_cont, auto const &_regs, int64_t _ts) { alerts.update(_cont, _regs, _ts); });
+ * \endcode
+ *
+ * \note Rules must be added before the first update(). update(), drain() and active() are thread safe.
+ */
+class AlertEngine {
+ public:
+  //! The rule types.
+  enum class Kind {
+    THRESHOLD,  //!< Value outside of [low, high].
+    HYSTERESIS, //!< Raised at `set`, cleared at `clear`.
+    RATE,       //!< Change per second outside of [low, high].
+    TRANSITION, //!< Raw value changes from `from` to `to`.
+  };
+
+  static constexpr int64_t ANY = -1; //!< Wildcard for Rule::from and Rule::to.
+
+  //! One alert rule.
+  struct Rule {
+    std::string name  = "";              //!< The name of the rule (used in the events).
+    uint16_t    reg   = 0;               //!< The watched register.
+    Kind        kind  = Kind::THRESHOLD; //!< The rule type.
+    double      low   = -HUGE_VAL;       //!< THRESHOLD and RATE: the lower limit.
+    double      high  = HUGE_VAL;        //!< THRESHOLD and RATE: the upper limit.
+    double      set   = 0;               //!< HYSTERESIS: the value that raises the alert.
+    double      clear = 0;               //!< HYSTERESIS: the value that clears the alert.
+    int64_t     from  = ANY;             //!< TRANSITION: the old raw value.
+    int64_t     to    = ANY;             //!< TRANSITION: the new raw value.
+  };
+
+  //! A raised or cleared alert.
+  struct Event {
+    size_t   rule     = 0;     //!< Index of the rule (see rules()).
+    uint16_t reg      = 0;     //!< The register.
+    int64_t  time     = 0;     //!< UNIX timestamp in ms.
+    double   value    = 0;     //!< The value (RATE: the change per second, TRANSITION: the new raw value).
+    double   previous = 0;     //!< The previous value (TRANSITION: the old raw value).
+    bool     active   = false; //!< Raised (true) or cleared (false). TRANSITION events are always raised.
+  };
+
+ private:
+  //! The rules and the last value of one register.
+  struct Watch {
+    std::vector<size_t> rules;
+    bool                hasRate = false;
+    bool                hasLast = false;
+    double              value   = 0;
+    uint64_t            raw     = 0;
+    int64_t             time    = 0;
+  };
+
+  std::vector<Rule>                   mRules;
+  std::unordered_map<uint16_t, Watch> mWatches;
+  size_t                              mMaxEvents;
+
+  mutable std::mutex mMutex;
+  std::vector<bool>  mActive;
+  std::deque<Event>  mEvents;
+  size_t             mDropped   = 0;
+  size_t             mEvaluated = 0;
+
+  void evaluate(size_t _rule, Watch const &_watch, double _value, uint64_t _raw, int64_t _time);
+  void push(Event const &_event);
+
+ public:
+  AlertEngine(size_t _maxEvents = 1024);
+
+  AlertEngine(AlertEngine const &) = delete;
+  void operator=(AlertEngine const &) = delete;
+
+  ErrorCode add(Rule _rule);
+  ErrorCode loadFile(std::string const &_path);
+
+  void                update(RegisterContainer const &_container, std::vector<uint16_t> const &_regList, int64_t _time);
+  size_t              drain(std::vector<Event> &_out);
+  std::vector<size_t> active() const;
+  size_t              dropped() const;
+  size_t              evaluated() const;
+
+  inline std::vector<Rule> const &rules() const { return mRules; } //!< All rules.
+
+  static std::string toStr(Kind _kind);
+};
+
+} // namespace modbusSMA
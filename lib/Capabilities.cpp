@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Capabilities.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+
+#include "DataBase.hpp"
+#include "Logging.hpp"
+#include "ModbusAPI.hpp"
+#include "Trace.hpp"
+
+using namespace std;
+using namespace modbusSMA;
+using namespace modbusSMA::internal;
+
+const uint16_t FIRMWARE_REGISTER = 30059;
+
+CapabilityMap::CapabilityMap(uint32_t _serial, uint32_t _firmware, uint32_t _typeID)
+    : mSerial(_serial), mFirmware(_firmware), mTypeID(_typeID) {}
+
+//! Creates a map from the packed data (see first() and data()).
+CapabilityMap::CapabilityMap(uint32_t        _serial,
+                             uint32_t        _firmware,
+                             uint32_t        _typeID,
+                             uint16_t        _first,
+                             vector<uint8_t> _data)
+    : mSerial(_serial), mFirmware(_firmware), mTypeID(_typeID), mFirst(_first), mData(move(_data)) {}
+
+//! Returns the state of a register address.
+CapabilityMap::State CapabilityMap::get(uint16_t _reg) const {
+  if (_reg < mFirst) { return State::UNKNOWN; }
+
+  size_t offset = _reg - mFirst;
+  if (offset / 4 >= mData.size()) { return State::UNKNOWN; }
+
+  return (State)((mData[offset / 4] >> ((offset % 4) * 2)) & 0x3);
+}
+
+//! Sets the state of a register address (the map grows as needed).
+void CapabilityMap::set(uint16_t _reg, State _state) {
+  uint16_t aligned = _reg & ~(uint16_t)0x3; // mFirst is always a multiple of 4, so the data can be prepended
+  if (mData.empty()) {
+    mFirst = aligned;
+  } else if (aligned < mFirst) {
+    mData.insert(begin(mData), (mFirst - aligned) / 4, 0);
+    mFirst = aligned;
+  }
+
+  size_t offset = _reg - mFirst;
+  if (offset / 4 >= mData.size()) { mData.resize(offset / 4 + 1, 0); }
+
+  uint8_t &byte  = mData[offset / 4];
+  int      shift = (offset % 4) * 2;
+  byte           = (uint8_t)((byte & ~(0x3 << shift)) | ((uint8_t)_state << shift));
+}
+
+//! Returns the number of addresses with the state _state (UNKNOWN is only counted inside the map).
+size_t CapabilityMap::count(State _state) const {
+  size_t num = 0;
+  for (uint8_t i : mData) {
+    for (int j = 0; j < 8; j += 2) { num += (State)((i >> j) & 0x3) == _state ? 1 : 0; }
+  }
+
+  return num;
+}
+
+
+
+CapabilityProbe::CapabilityProbe(ModbusAPI &_api) : mAPI(_api) {}
+
+/*!
+ * \brief Reads the serial number and the firmware version (register 30059) of the device
+ *
+ * The firmware is 0 if the device does not support register 30059.
+ */
+ErrorCode CapabilityProbe::identify(uint32_t &_serial, uint32_t &_firmware) {
+  if (mAPI.getState() != State::INITIALIZED) {
+    log::get()->error("CapabilityProbe: identify() -- invalid object state '{}'", enum2Str::toStr(mAPI.getState()));
+    return ErrorCode::INVALID_STATE;
+  }
+
+  vector<uint16_t> raw = mAPI.readRaw(FIRMWARE_REGISTER, 2);
+  _serial              = mAPI.serialNumber();
+  _firmware            = raw.size() == 2 ? ((uint32_t)raw[0] << 16) + raw[1] : 0;
+  return ErrorCode::OK;
+}
+
+/*!
+ * \brief Probes all readable registers of the catalog
+ *
+ * \param[out] _out The result (for the serial number and firmware of the device)
+ *
+ * \returns MODBUS_CONNECTION_FAILED if the connection was lost
+ */
+ErrorCode CapabilityProbe::run(CapabilityMap &_out) {
+  trace::Span span("CapabilityProbe::run", "api");
+  auto        logger = log::get();
+  auto        start  = chrono::steady_clock::now();
+
+  uint32_t  serial   = 0;
+  uint32_t  firmware = 0;
+  ErrorCode res      = identify(serial, firmware);
+  if (res != ErrorCode::OK) { return res; }
+
+  _out = CapabilityMap(serial, firmware, mAPI.inverterTypeID());
+
+  auto             registers = mAPI.getRegisters();
+  vector<Register> regList   = registers->getRegisters(registers->getAddresses(0, UINT16_MAX, true));
+
+  // Classifies the registers of a successfully read batch
+  auto classify = [&](ReadPlan::Batch const &_batch, vector<uint16_t> const &_data) {
+    for (auto const &i : _batch.regs) {
+      auto     reg   = lower_bound(begin(regList), end(regList), i.reg);
+      WordView value = {_data.data() + i.offset, i.size};
+      _out.set(i.reg, value == reg->nanValue() ? CapabilityMap::State::NAN_ONLY : CapabilityMap::State::SUPPORTED);
+    }
+  };
+
+  // 1st: read all batches and split the failed batches until single registers are left
+  ReadPlan                 plan(regList);
+  vector<vector<uint16_t>> data;
+  vector<ReadPlan::Reg>    singles;
+  size_t                   rounds   = 0;
+  size_t                   requests = 0;
+
+  while (!plan.empty()) {
+    res = mAPI.readBatches(plan, data);
+    if (res != ErrorCode::OK) { return res; }
+
+    ++rounds;
+    requests += plan.size();
+
+    vector<ReadPlan::Batch> next;
+    size_t                  numOK = 0;
+    for (size_t i = 0; i < plan.size(); ++i) {
+      ReadPlan::Batch const &batch = plan.batches()[i];
+      if (data[i].size() == batch.size) {
+        classify(batch, data[i]);
+        ++numOK;
+        continue;
+      }
+
+      if (batch.regs.size() == 1) {
+        singles.push_back(batch.regs[0]);
+        continue;
+      }
+
+      // Split the batch in half
+      size_t half = batch.regs.size() / 2;
+      for (auto const &j : {make_pair(size_t(0), half), make_pair(half, batch.regs.size())}) {
+        ReadPlan::Batch part = {batch.regs[j.first].reg, 0, {}};
+        for (size_t k = j.first; k < j.second; ++k) {
+          part.regs.push_back({batch.regs[k].reg, part.size, batch.regs[k].size});
+          part.size += batch.regs[k].size;
+        }
+        next.push_back(move(part));
+      }
+    }
+
+    if (numOK == 0 && Statistics::classifyError(mAPI.lastError()) == Statistics::ErrorClass::CONNECTION) {
+      logger->error("CapabilityProbe: connection lost");
+      return ErrorCode::MODBUS_CONNECTION_FAILED;
+    }
+
+    SPDLOG_LOGGER_DEBUG(
+        logger, "CapabilityProbe: round {}: {} of {} batches failed", rounds, plan.size() - numOK, plan.size());
+    plan = ReadPlan(move(next));
+  }
+
+  // 2nd: check why the single registers failed
+  size_t numUnknown = 0;
+  for (auto const &i : singles) {
+    vector<uint16_t> raw = mAPI.readRaw(i.reg, i.size);
+    ++requests;
+
+    if (raw.size() == i.size) {
+      classify({i.reg, i.size, {{i.reg, 0, i.size}}}, raw);
+    } else if (Statistics::classifyError(mAPI.lastError()) == Statistics::ErrorClass::EXCEPTION) {
+      _out.set(i.reg, CapabilityMap::State::REJECTED);
+    } else {
+      ++numUnknown;
+    }
+  }
+
+  auto duration = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+  SPDLOG_LOGGER_INFO(logger,
+                     "CapabilityProbe: {} registers in {} requests ({} rounds, {}ms): {} supported, {} NaN, "
+                     "{} rejected, {} unknown",
+                     regList.size(),
+                     requests,
+                     rounds,
+                     duration.count(),
+                     _out.count(CapabilityMap::State::SUPPORTED),
+                     _out.count(CapabilityMap::State::NAN_ONLY),
+                     _out.count(CapabilityMap::State::REJECTED),
+                     numUnknown);
+  return ErrorCode::OK;
+}
+
+
+
+CapabilityStore::CapabilityStore(string _path) : mPath(_path) {} //!< Constructor. Only sets the DB path.
+CapabilityStore::~CapabilityStore() { disconnect(); }
+
+//! Opens (or creates) the database.
+ErrorCode CapabilityStore::connect() {
+  if (mDB) { return ErrorCode::OK; }
+
+  int errorCode = sqlite3_open(mPath.c_str(), &mDB);
+  if (errorCode != SQLITE_OK) {
+    log::get()->error("CapabilityStore [{}]: unable to open the database: '{}'", mPath, sqlite3_errstr(errorCode));
+    disconnect();
+    return ErrorCode::DATA_BASE_ERROR;
+  }
+
+  char *errMsg = nullptr;
+  errorCode    = sqlite3_exec(mDB,
+                           "CREATE TABLE IF NOT EXISTS `capabilities` (`serial` INTEGER, `firmware` INTEGER, "
+                           "`type` INTEGER, `probed` INTEGER, `first` INTEGER, `data` BLOB, "
+                           "PRIMARY KEY (`serial`, `firmware`));",
+                           nullptr,
+                           nullptr,
+                           &errMsg);
+  if (errorCode != SQLITE_OK) {
+    log::get()->error("CapabilityStore [{}]: unable to create the table: '{}'", mPath, errMsg ? errMsg : "");
+    sqlite3_free(errMsg);
+    disconnect();
+    return ErrorCode::DATA_BASE_ERROR;
+  }
+
+  return ErrorCode::OK;
+}
+
+//! Closes the database.
+void CapabilityStore::disconnect() {
+  if (!mDB) { return; }
+
+  sqlite3_close(mDB);
+  mDB = nullptr;
+}
+
+//! Stores (or replaces) the map of a device.
+ErrorCode CapabilityStore::save(CapabilityMap const &_map) {
+  if (!isConnected()) { return ErrorCode::INVALID_STATE; }
+
+  SQL_Query query(mDB, "INSERT OR REPLACE INTO `capabilities` VALUES (?, ?, ?, ?, ?, ?);");
+  if (!query.isValid()) { return ErrorCode::DATA_BASE_ERROR; }
+
+  sqlite3_bind_int64(query(), 1, _map.serial());
+  sqlite3_bind_int64(query(), 2, _map.firmware());
+  sqlite3_bind_int64(query(), 3, _map.typeID());
+  sqlite3_bind_int64(query(), 4, (int64_t)time(nullptr));
+  sqlite3_bind_int(query(), 5, _map.first());
+  sqlite3_bind_blob(query(), 6, _map.data().data(), (int)_map.data().size(), SQLITE_TRANSIENT);
+
+  int errorCode = sqlite3_step(query());
+  if (errorCode != SQLITE_DONE) {
+    log::get()->error("CapabilityStore [{}]: save() failed: '{}'", mPath, sqlite3_errmsg(mDB));
+    return ErrorCode::DATA_BASE_ERROR;
+  }
+
+  return ErrorCode::OK;
+}
+
+//! Loads the map of a device. Returns FILE_NOT_FOUND if the device was not probed yet.
+ErrorCode CapabilityStore::load(uint32_t _serial, uint32_t _firmware, CapabilityMap &_out) {
+  if (!isConnected()) { return ErrorCode::INVALID_STATE; }
+
+  SQL_Query query(mDB, "SELECT `type`, `first`, `data` FROM `capabilities` WHERE `serial` = ? AND `firmware` = ?;");
+  if (!query.isValid()) { return ErrorCode::DATA_BASE_ERROR; }
+
+  sqlite3_bind_int64(query(), 1, _serial);
+  sqlite3_bind_int64(query(), 2, _firmware);
+
+  int errorCode = sqlite3_step(query());
+  if (errorCode == SQLITE_DONE) { return ErrorCode::FILE_NOT_FOUND; }
+  if (errorCode != SQLITE_ROW) {
+    log::get()->error("CapabilityStore [{}]: load() failed: '{}'", mPath, sqlite3_errmsg(mDB));
+    return ErrorCode::DATA_BASE_ERROR;
+  }
+
+  auto const *blob = (uint8_t const *)sqlite3_column_blob(query(), 2);
+  int         size = sqlite3_column_bytes(query(), 2);
+
+  _out = CapabilityMap(_serial,
+                       _firmware,
+                       (uint32_t)sqlite3_column_int64(query(), 0),
+                       (uint16_t)sqlite3_column_int(query(), 1),
+                       vector<uint8_t>(blob, blob + size));
+  return ErrorCode::OK;
+}
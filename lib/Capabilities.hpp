@@ -0,0 +1,123 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <sqlite3.h>
+#include <string>
+#include <vector>
+
+#include "Enums.hpp"
+
+namespace modbusSMA {
+
+class ModbusAPI;
+
+/*!
+ * \brief The registers supported by one device (serial number and firmware)
+ *
+ * The state of every register address is stored with 2 bits, starting at the lowest known address. A full SMA
+ * catalog (30001 -- 4xxxx) fits into a few KiB.
+ */
+class CapabilityMap {
+ public:
+  //! The state of one register address.
+  enum class State : uint8_t {
+    UNKNOWN   = 0, //!< Not probed (or the probe failed for another reason than a Modbus exception).
+    SUPPORTED = 1, //!< The register returned a valid value.
+    NAN_ONLY  = 2, //!< The register can be read, but only returned NaN.
+    REJECTED  = 3, //!< The device rejected the register with a Modbus exception.
+  };
+
+ private:
+  uint32_t mSerial   = 0;
+  uint32_t mFirmware = 0;
+  uint32_t mTypeID   = 0;
+
+  uint16_t             mFirst = 0;  //!< The address of the first entry in mData.
+  std::vector<uint8_t> mData  = {}; //!< 4 addresses per byte.
+
+ public:
+  CapabilityMap() = default;
+  CapabilityMap(uint32_t _serial, uint32_t _firmware, uint32_t _typeID);
+  CapabilityMap(uint32_t _serial, uint32_t _firmware, uint32_t _typeID, uint16_t _first, std::vector<uint8_t> _data);
+
+  State  get(uint16_t _reg) const;
+  void   set(uint16_t _reg, State _state);
+  size_t count(State _state) const;
+
+  inline bool isRejected(uint16_t _reg) const { return get(_reg) == State::REJECTED; } //!< Never request _reg?
+
+  inline uint32_t                    serial() const { return mSerial; }     //!< The serial number of the device.
+  inline uint32_t                    firmware() const { return mFirmware; } //!< The firmware (register 30059).
+  inline uint32_t                    typeID() const { return mTypeID; }     //!< The device type (register 30053).
+  inline uint16_t                    first() const { return mFirst; }       //!< The first address of data().
+  inline std::vector<uint8_t> const &data() const { return mData; }         //!< The packed states.
+};
+
+/*!
+ * \brief Determines the supported registers of the connected device
+ *
+ * All readable registers of the catalog are read with the largest possible batches. Failed batches are split in
+ * half and read again until single registers are left. The batches of every round are read with
+ * ModbusAPI::readBatches(), so they are striped over all connections (ModbusAPI::setConnectionCount()).
+ *
+ * Failed single registers are read once more to check the error: a Modbus exception marks the register as REJECTED,
+ * all other errors (timeouts, etc.) leave it UNKNOWN.
+ */
+class CapabilityProbe {
+ private:
+  ModbusAPI &mAPI;
+
+ public:
+  CapabilityProbe() = delete;
+  CapabilityProbe(ModbusAPI &_api);
+
+  ErrorCode identify(uint32_t &_serial, uint32_t &_firmware);
+  ErrorCode run(CapabilityMap &_out);
+};
+
+/*!
+ * \brief Persists CapabilityMap objects in a sqlite3 database
+ *
+ * The database (and the table) is created if it does not exist.
+ */
+class CapabilityStore {
+ private:
+  std::string mPath;
+  sqlite3 *   mDB = nullptr;
+
+ public:
+  CapabilityStore() = delete;
+  CapabilityStore(std::string _path);
+  ~CapabilityStore();
+
+  CapabilityStore(CapabilityStore const &) = delete;
+  void operator=(CapabilityStore const &) = delete;
+
+  ErrorCode connect();
+  void      disconnect();
+
+  ErrorCode save(CapabilityMap const &_map);
+  ErrorCode load(uint32_t _serial, uint32_t _firmware, CapabilityMap &_out);
+
+  bool isConnected() const { return mDB != nullptr; } //!< Returns whether the DB is open.
+};
+
+} // namespace modbusSMA
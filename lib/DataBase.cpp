@@ -21,6 +21,7 @@
 #include <set>
 
 #include "Logging.hpp"
+#include "Trace.hpp"
 
 using namespace std;
 using namespace modbusSMA;
@@ -51,9 +52,10 @@ DataBase::~DataBase() { disconnect(); }
 
 //! Connect to the databes.
 ErrorCode DataBase::connect() {
-  auto     logger    = log::get();
-  int      errorCode = SQLITE_OK;
-  fs::path filePath(mPath);
+  trace::Span span("DataBase::connect", "db");
+  auto        logger    = log::get();
+  int         errorCode = SQLITE_OK;
+  fs::path    filePath(mPath);
 
   if (!fs::exists(filePath)) {
     logger->error("DataBase::connect() [{}]: DB does not exist", mPath);
@@ -65,7 +67,7 @@ ErrorCode DataBase::connect() {
     return ErrorCode::FILE_NOT_FOUND;
   }
 
-  logger->debug("DataBase::connect() [{}]: Loading register DB", mPath);
+  SPDLOG_LOGGER_DEBUG(logger, "DataBase::connect() [{}]: Loading register DB", mPath);
   errorCode = sqlite3_open(mPath.c_str(), &mDB);
   if (errorCode != SQLITE_OK) {
     logger->error("DataBase::connect() [{}]: unable to open the database", mPath);
@@ -93,10 +95,12 @@ void DataBase::disconnect() {
 
 //! Validates the register database.
 bool DataBase::validate() {
+  trace::Span span("DataBase::validate", "db");
+
   if (!isConnected()) { return false; }
 
   auto logger = log::get();
-  logger->debug("Validating '{}':", mPath);
+  SPDLOG_LOGGER_DEBUG(logger, "Validating '{}':", mPath);
 
   vector<string> tables         = getTableList();
   vector<string> missingTables  = {};
@@ -104,9 +108,9 @@ bool DataBase::validate() {
   auto           itTableALL     = find(begin(tables), end(tables), "ALL");
   auto           itTableDevEnum = find(begin(tables), end(tables), "DeviceENUM");
 
-  logger->debug("  -- Total number of tables:      {}", tables.size());
-  logger->debug("    - Has table 'ALL':            {}", itTableALL != end(tables));
-  logger->debug("    - Has table 'DeviceENUM':     {}", itTableDevEnum != end(tables));
+  SPDLOG_LOGGER_DEBUG(logger, "  -- Total number of tables:      {}", tables.size());
+  SPDLOG_LOGGER_DEBUG(logger, "    - Has table 'ALL':            {}", itTableALL != end(tables));
+  SPDLOG_LOGGER_DEBUG(logger, "    - Has table 'DeviceENUM':     {}", itTableDevEnum != end(tables));
 
 
   if (tables.empty() || itTableALL == end(tables) || itTableDevEnum == end(tables)) {
@@ -115,7 +119,7 @@ bool DataBase::validate() {
   }
 
   vector<DevEnum> enums = getDeviceEnums();
-  logger->debug("  -- Number of supported devices: {}", enums.size());
+  SPDLOG_LOGGER_DEBUG(logger, "  -- Number of supported devices: {}", enums.size());
 
   if (enums.empty()) {
     logger->error("No entries in table 'DeviceENUM'");
@@ -153,7 +157,7 @@ bool DataBase::validate() {
     return false;
   }
 
-  logger->debug("  -- Found {} register descriptions in {} tables", count, requiredTables.size());
+  SPDLOG_LOGGER_DEBUG(logger, "  -- Found {} register descriptions in {} tables", count, requiredTables.size());
   return true;
 }
 
@@ -244,7 +248,7 @@ vector<DataBase::DevEnum> DataBase::getDeviceEnums() {
  *
  * \param _table The device table from the DevEnum
  */
-vector<Register> DataBase::getRegisters(std::string _table) {
+vector<Register> DataBase::getRegisters(std::string _table, shared_ptr<MetadataCache> _lazy) {
   if (!isConnected()) { return {}; }
   vector<Register> regList;
   int              errorCode;
@@ -310,8 +314,47 @@ vector<Register> DataBase::getRegisters(std::string _table) {
       return {};
     }
 
-    regList.emplace_back(id, desc, unit, type, format, access);
+    if (_lazy) {
+      regList.emplace_back(id, _lazy, type, format, access);
+    } else {
+      regList.emplace_back(id, desc, unit, type, format, access);
+    }
   }
 
   return regList;
 }
+
+/*!
+ * \brief Reads the description and the unit of a single register
+ *
+ * \param _table The table to search
+ * \param _reg   The register address
+ * \param _desc  Set to the description
+ * \param _unit  Set to the unit
+ *
+ * \returns ErrorCode::ERROR if the register is not in _table
+ */
+ErrorCode DataBase::getMetadata(string const &_table, uint16_t _reg, string &_desc, string &_unit) {
+  if (!isConnected()) { return ErrorCode::INVALID_STATE; }
+
+  SQL_Query query(mDB, fmt::format("SELECT `desc`, `unit` FROM `{}` WHERE `register` = ?;", _table));
+  if (!query.isValid()) { return ErrorCode::DATA_BASE_ERROR; }
+
+  sqlite3_bind_int(query(), 1, _reg);
+  int errorCode = sqlite3_step(query());
+  if (errorCode == SQLITE_DONE) { return ErrorCode::ERROR; }
+  if (errorCode != SQLITE_ROW) {
+    auto logger = log::get();
+    logger->error("DataBase: getMetadata(_table = '{}', _reg = {}): error in sqlite3_step:", _table, _reg);
+    logger->error("  -- Path:    '{}'", mPath);
+    logger->error("  -- Error:   '{}'", sqlite3_errstr(errorCode));
+    logger->error("  -- Message: '{}'", sqlite3_errmsg(mDB));
+    return ErrorCode::DATA_BASE_ERROR;
+  }
+
+  auto *rawDesc = sqlite3_column_text(query(), 0);
+  auto *rawUnit = sqlite3_column_text(query(), 1);
+  _desc         = rawDesc ? (const char *)rawDesc : "";
+  _unit         = rawUnit ? (const char *)rawUnit : "";
+  return ErrorCode::OK;
+}
@@ -76,7 +76,11 @@ class DataBase {
 
   std::vector<std::string> getTableList();
   std::vector<DevEnum>     getDeviceEnums();
-  std::vector<Register>    getRegisters(std::string _table);
+  std::vector<Register>    getRegisters(std::string _table, std::shared_ptr<MetadataCache> _lazy = nullptr);
+  ErrorCode                getMetadata(std::string const &_table,
+                                       uint16_t           _reg,
+                                       std::string &      _desc,
+                                       std::string &      _unit);
 
   bool isConnected() const { return mDB != nullptr; } //!< Returns whether the DB is loaded.
 };
@@ -0,0 +1,531 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DerivedRegisters.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <fstream>
+
+#include "Logging.hpp"
+#include "Trace.hpp"
+
+using namespace std;
+using namespace modbusSMA;
+
+namespace {
+
+//! Returns the number of decimal places of the supported formats (-1 if not supported).
+int decimals(DataFormat _format) {
+  switch (_format) {
+    case DataFormat::FIX0: return 0;
+    case DataFormat::FIX1: return 1;
+    case DataFormat::FIX2: return 2;
+    case DataFormat::FIX3: return 3;
+    case DataFormat::FIX4: return 4;
+    default: return -1;
+  }
+}
+
+string trim(string const &_str) {
+  auto first = _str.find_first_not_of(" \t\r");
+  auto last  = _str.find_last_not_of(" \t\r");
+  return first == string::npos ? "" : _str.substr(first, last - first + 1);
+}
+
+bool sameValue(double _a, double _b) { return _a == _b || (isnan(_a) && isnan(_b)); }
+
+} // namespace
+
+/*!
+ * \brief Compiles _expr into an RPN program (shunting-yard)
+ *
+ * \param[in]  _expr   The expression
+ * \param[out] _out    The program
+ * \param[out] _inputs The (sorted, unique) registers used by the expression
+ */
+ErrorCode DerivedRegisters::compile(string const &_expr, vector<Op> &_out, vector<uint16_t> &_inputs) {
+  auto const &logger = log::get();
+
+  // Operators on the stack: '(' is stored as CONST, functions as MIN / MAX / ABS
+  vector<Op::Type> ops;
+  bool             expectOperand = true;
+
+  _out.clear();
+  _inputs.clear();
+
+  auto precedence = [](Op::Type t) -> int {
+    switch (t) {
+      case Op::ADD:
+      case Op::SUB: return 1;
+      case Op::MUL:
+      case Op::DIV: return 2;
+      case Op::NEG: return 3;
+      default: return 0;
+    }
+  };
+
+  auto error = [&](string const &_msg) {
+    logger->error("DerivedRegisters: {} in '{}'", _msg, _expr);
+    return ErrorCode::ERROR;
+  };
+
+  for (size_t i = 0; i < _expr.size();) {
+    char c = _expr[i];
+
+    if (isspace((unsigned char)c)) {
+      ++i;
+      continue;
+    }
+
+    if (isdigit((unsigned char)c) || c == '.') {
+      if (!expectOperand) { return error("unexpected number"); }
+      size_t len = 0;
+      double val = 0;
+      try {
+        val = stod(_expr.substr(i), &len);
+      } catch (...) { return error("invalid number"); }
+      _out.push_back({Op::CONST, val, 0});
+      i += len;
+      expectOperand = false;
+      continue;
+    }
+
+    if (isalpha((unsigned char)c)) {
+      size_t start = i;
+      while (i < _expr.size() && isalnum((unsigned char)_expr[i])) { ++i; }
+      string name = _expr.substr(start, i - start);
+      if (!expectOperand) { return error(fmt::format("unexpected '{}'", name)); }
+
+      if (name == "min" || name == "max" || name == "abs") {
+        while (i < _expr.size() && isspace((unsigned char)_expr[i])) { ++i; }
+        if (i >= _expr.size() || _expr[i] != '(') { return error(fmt::format("missing '(' after '{}'", name)); }
+        ops.push_back(name == "min" ? Op::MIN : name == "max" ? Op::MAX : Op::ABS);
+        continue;
+      }
+
+      auto isDigit = [](char d) { return isdigit((unsigned char)d) != 0; };
+      if (name.size() < 2 || name.size() > 6 || name[0] != 'r' || !all_of(begin(name) + 1, end(name), isDigit)) {
+        return error(fmt::format("unknown identifier '{}'", name));
+      }
+
+      unsigned long reg = stoul(name.substr(1));
+      if (reg > UINT16_MAX) { return error(fmt::format("invalid register '{}'", name)); }
+      _out.push_back({Op::REG, 0, (uint16_t)reg});
+      _inputs.push_back((uint16_t)reg);
+      expectOperand = false;
+      continue;
+    }
+
+    ++i;
+    switch (c) {
+      case '(':
+        if (!expectOperand) { return error("unexpected '('"); }
+        ops.push_back(Op::CONST);
+        break;
+
+      case ',':
+      case ')':
+        if (expectOperand) { return error(fmt::format("unexpected '{}'", c)); }
+        while (!ops.empty() && ops.back() != Op::CONST) {
+          _out.push_back({ops.back(), 0, 0});
+          ops.pop_back();
+        }
+        if (ops.empty()) { return error(fmt::format("unbalanced '{}'", c)); }
+        if (c == ',') {
+          expectOperand = true;
+          break;
+        }
+
+        ops.pop_back(); // '('
+        if (!ops.empty() && (ops.back() == Op::MIN || ops.back() == Op::MAX || ops.back() == Op::ABS)) {
+          _out.push_back({ops.back(), 0, 0});
+          ops.pop_back();
+        }
+        break;
+
+      case '+':
+      case '-':
+      case '*':
+      case '/': {
+        Op::Type type = c == '+' ? Op::ADD : c == '-' ? Op::SUB : c == '*' ? Op::MUL : Op::DIV;
+        if (expectOperand) {
+          if (c != '-') { return error(fmt::format("unexpected '{}'", c)); }
+          ops.push_back(Op::NEG); // Unary minus (right associative)
+          break;
+        }
+
+        while (!ops.empty() && precedence(ops.back()) >= precedence(type)) {
+          _out.push_back({ops.back(), 0, 0});
+          ops.pop_back();
+        }
+        ops.push_back(type);
+        expectOperand = true;
+        break;
+      }
+
+      default: return error(fmt::format("unexpected character '{}'", c));
+    }
+  }
+
+  if (expectOperand) { return error("unexpected end of expression"); }
+  while (!ops.empty()) {
+    if (ops.back() == Op::CONST || ops.back() == Op::MIN || ops.back() == Op::MAX || ops.back() == Op::ABS) {
+      return error("unbalanced '('");
+    }
+    _out.push_back({ops.back(), 0, 0});
+    ops.pop_back();
+  }
+
+  // Check the arity (the program must leave exactly one value on the stack)
+  int depth = 0;
+  for (Op const &i : _out) {
+    switch (i.type) {
+      case Op::CONST:
+      case Op::REG: ++depth; break;
+      case Op::NEG:
+      case Op::ABS: depth = depth < 1 ? -1 : depth; break;
+      default: depth = depth < 2 ? -1 : depth - 1; break;
+    }
+    if (depth < 0) { return error("invalid number of arguments"); }
+  }
+  if (depth != 1) { return error("invalid number of arguments"); }
+
+  sort(begin(_inputs), end(_inputs));
+  _inputs.erase(unique(begin(_inputs), end(_inputs)), end(_inputs));
+  return ErrorCode::OK;
+}
+
+//! Adds a derived register (checks the format and the syntax of the expression).
+ErrorCode DerivedRegisters::add(Definition _def) {
+  if (decimals(_def.format) < 0) {
+    log::get()->error("DerivedRegisters: {}: unsupported format {} (only FIX0 - FIX4)",
+                      _def.reg,
+                      enum2Str::toStr(_def.format));
+    return ErrorCode::ERROR;
+  }
+
+  vector<Op>       program;
+  vector<uint16_t> inputs;
+  ErrorCode        res = compile(_def.expression, program, inputs);
+  if (res != ErrorCode::OK) { return res; }
+
+  mDefinitions.push_back(move(_def));
+  return ErrorCode::OK;
+}
+
+/*!
+ * \brief Loads the definitions from a file
+ *
+ * Format: one `address;format;unit;description;expression` per line, `#` starts a comment.
+ */
+ErrorCode DerivedRegisters::loadFile(string const &_path) {
+  auto const &logger = log::get();
+  ifstream    in(_path);
+  if (!in.is_open()) {
+    logger->error("DerivedRegisters: failed to open '{}'", _path);
+    return ErrorCode::FILE_NOT_FOUND;
+  }
+
+  string line;
+  size_t lineNum = 0;
+  while (getline(in, line)) {
+    ++lineNum;
+    line = trim(line.substr(0, line.find('#')));
+    if (line.empty()) { continue; }
+
+    vector<string> fields;
+    size_t         pos = 0;
+    for (size_t i = 0; i < 4 && pos != string::npos; ++i) {
+      size_t next = line.find(';', pos);
+      fields.push_back(trim(line.substr(pos, next == string::npos ? string::npos : next - pos)));
+      pos = next == string::npos ? next : next + 1;
+    }
+
+    if (fields.size() != 4 || pos == string::npos) {
+      logger->error("DerivedRegisters: {}:{}: expected 5 fields separated by ';'", _path, lineNum);
+      return ErrorCode::ERROR;
+    }
+
+    Definition def;
+    try {
+      unsigned long reg = stoul(fields[0]);
+      if (reg > UINT16_MAX) { throw out_of_range(fields[0]); }
+      def.reg = (uint16_t)reg;
+    } catch (...) {
+      logger->error("DerivedRegisters: {}:{}: invalid address '{}'", _path, lineNum, fields[0]);
+      return ErrorCode::ERROR;
+    }
+
+    def.format     = enum2Str::formatFromStr(fields[1]);
+    def.unit       = fields[2];
+    def.desc       = fields[3];
+    def.expression = trim(line.substr(pos));
+
+    ErrorCode res = add(move(def));
+    if (res != ErrorCode::OK) {
+      logger->error("DerivedRegisters: {}:{}: invalid definition", _path, lineNum);
+      return res;
+    }
+  }
+
+  SPDLOG_LOGGER_DEBUG(logger, "DerivedRegisters: loaded {} definitions from '{}'", mDefinitions.size(), _path);
+  return ErrorCode::OK;
+}
+
+/*!
+ * \brief Compiles the dependency graph and adds the derived registers to _container
+ *
+ * Fails if a derived register uses an address that is already used, an expression uses an unknown (or not readable)
+ * register or if the derived registers depend on each other in a cycle.
+ */
+ErrorCode DerivedRegisters::attach(RegisterContainer &_container) {
+  trace::Span span("DerivedRegisters::attach", "db");
+  auto const &logger = log::get();
+
+  mNodes.clear();
+  mNodeIndex.clear();
+  mConsumers.clear();
+  mLastRaw.clear();
+
+  // 1st: compile all expressions
+  vector<Node>                    nodes;
+  unordered_map<uint16_t, size_t> index;
+  nodes.reserve(mDefinitions.size());
+  for (auto const &i : mDefinitions) {
+    Register const *existing = _container.get(i.reg);
+    if (index.count(i.reg) > 0 || (existing && !existing->isVirtual())) {
+      logger->error("DerivedRegisters: address {} is already used", i.reg);
+      return ErrorCode::ERROR;
+    }
+
+    Node node;
+    node.def = i;
+    if (compile(i.expression, node.program, node.inputs) != ErrorCode::OK) { return ErrorCode::ERROR; }
+    index[i.reg] = nodes.size();
+    nodes.push_back(move(node));
+  }
+
+  // 2nd: resolve the inputs and build the edges
+  vector<size_t> inDegree(nodes.size(), 0);
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    for (uint16_t j : nodes[i].inputs) {
+      auto derived = index.find(j);
+      if (derived != end(index)) {
+        nodes[derived->second].dependents.push_back(i);
+        ++inDegree[i];
+        continue;
+      }
+
+      Register const *reg = _container.get(j);
+      if (!reg || !reg->canRead() || reg->type() == DataType::STR32) {
+        logger->error("DerivedRegisters: {}: register {} does not exist or is not a readable number",
+                      nodes[i].def.reg,
+                      j);
+        return ErrorCode::ERROR;
+      }
+    }
+  }
+
+  // 3rd: sort topologically (Kahn)
+  vector<size_t> order;
+  order.reserve(nodes.size());
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    if (inDegree[i] == 0) { order.push_back(i); }
+  }
+
+  for (size_t i = 0; i < order.size(); ++i) {
+    for (size_t j : nodes[order[i]].dependents) {
+      if (--inDegree[j] == 0) { order.push_back(j); }
+    }
+  }
+
+  if (order.size() != nodes.size()) {
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      if (inDegree[i] > 0) { logger->error("DerivedRegisters: {} is part of a dependency cycle", nodes[i].def.reg); }
+    }
+    return ErrorCode::ERROR;
+  }
+
+  // 4th: store the nodes in topological order (a node only depends on nodes with a lower index)
+  vector<size_t> position(nodes.size());
+  for (size_t i = 0; i < order.size(); ++i) { position[order[i]] = i; }
+
+  vector<Register> registers;
+  size_t           maxDepth = 0;
+  for (size_t i : order) {
+    Node node = move(nodes[i]);
+    for (size_t &j : node.dependents) { j = position[j]; }
+    for (uint16_t j : node.inputs) {
+      if (index.count(j) == 0) { mConsumers[j].push_back(mNodes.size()); }
+    }
+
+    Register reg(node.def.reg, node.def.desc, node.def.unit, DataType::S64, node.def.format, DataAccess::RO);
+    reg.setVirtual(true);
+    registers.push_back(reg);
+
+    mNodeIndex[node.def.reg] = mNodes.size();
+    maxDepth                 = max(maxDepth, node.program.size());
+    mNodes.push_back(move(node));
+  }
+
+  mStack.reserve(maxDepth);
+  _container.addRegisters(move(registers));
+  SPDLOG_LOGGER_DEBUG(logger, "DerivedRegisters: attached {} derived registers", mNodes.size());
+  return ErrorCode::OK;
+}
+
+/*!
+ * \brief Appends the registers that the derived registers in _regList depend on
+ *
+ * Derived registers of derived registers are resolved recursively. The result may contain duplicates.
+ */
+void DerivedRegisters::addInputs(vector<uint16_t> &_regList) const {
+  vector<uint16_t> pending;
+  for (uint16_t i : _regList) {
+    if (mNodeIndex.count(i) > 0) { pending.push_back(i); }
+  }
+
+  vector<bool> visited(mNodes.size(), false);
+  while (!pending.empty()) {
+    size_t idx = mNodeIndex.at(pending.back());
+    pending.pop_back();
+    if (visited[idx]) { continue; }
+    visited[idx] = true;
+
+    for (uint16_t j : mNodes[idx].inputs) {
+      if (mNodeIndex.count(j) > 0) {
+        pending.push_back(j);
+      } else {
+        _regList.push_back(j);
+      }
+    }
+  }
+}
+
+//! Evaluates the program of _node (NaN if an input is NaN).
+double DerivedRegisters::evaluate(Node const &_node, RegisterContainer const &_container) {
+  mStack.clear();
+  for (Op const &i : _node.program) {
+    double rhs = 0;
+    switch (i.type) {
+      case Op::CONST: mStack.push_back(i.value); continue;
+      case Op::REG: {
+        auto derived = mNodeIndex.find(i.reg);
+        if (derived != end(mNodeIndex)) {
+          mStack.push_back(mNodes[derived->second].value);
+          continue;
+        }
+
+        Register const *reg = _container.get(i.reg);
+        mStack.push_back(!reg || reg->isNaN() ? NAN : reg->valueDouble());
+        continue;
+      }
+
+      case Op::NEG: mStack.back() = -mStack.back(); continue;
+      case Op::ABS: mStack.back() = fabs(mStack.back()); continue;
+      default: break;
+    }
+
+    rhs = mStack.back();
+    mStack.pop_back();
+    double &lhs = mStack.back();
+    switch (i.type) {
+      case Op::ADD: lhs += rhs; break;
+      case Op::SUB: lhs -= rhs; break;
+      case Op::MUL: lhs *= rhs; break;
+      case Op::DIV: lhs = rhs == 0 ? NAN : lhs / rhs; break;
+      case Op::MIN: lhs = isnan(lhs) || isnan(rhs) ? NAN : min(lhs, rhs); break;
+      case Op::MAX: lhs = isnan(lhs) || isnan(rhs) ? NAN : max(lhs, rhs); break;
+      default: break;
+    }
+  }
+
+  ++mEvaluations;
+  return mStack.back();
+}
+
+//! Writes the value of _node into its (S64) register.
+void DerivedRegisters::store(Node const &_node, RegisterContainer &_container) const {
+  double scaled = _node.value * pow(10.0, decimals(_node.def.format));
+  if (!isfinite(scaled) || fabs(scaled) >= 9.2e18) {
+    uint16_t const nan[4] = {0x8000, 0x0000, 0x0000, 0x0000};
+    _container.updateRegister(_node.def.reg, {nan, 4});
+    return;
+  }
+
+  uint64_t       val     = (uint64_t)llround(scaled);
+  uint16_t const data[4] = {(uint16_t)(val >> 48), (uint16_t)(val >> 32), (uint16_t)(val >> 16), (uint16_t)val};
+  _container.updateRegister(_node.def.reg, {data, 4});
+}
+
+/*!
+ * \brief Re-evaluates the derived registers whose inputs changed
+ *
+ * Only the derived registers that use one of the _updated registers whose raw value differs from the last call are
+ * evaluated. Their dependents are only evaluated if the result changed. All derived registers are evaluated on the
+ * first call.
+ *
+ * \param _container The registers (the derived registers are updated here)
+ * \param _updated   The registers updated since the last call
+ * \param _changed   The derived registers with a new value are appended (sorted), may be nullptr
+ */
+void DerivedRegisters::update(RegisterContainer &      _container,
+                              vector<uint16_t> const &_updated,
+                              vector<uint16_t> *      _changed) {
+  if (mNodes.empty()) { return; }
+
+  size_t first = mNodes.size(); // The nodes are sorted topologically ==> start with the first dirty one
+  for (size_t i = 0; i < mNodes.size() && first == mNodes.size(); ++i) {
+    if (mNodes[i].dirty) { first = i; }
+  }
+
+  for (uint16_t i : _updated) {
+    auto consumers = mConsumers.find(i);
+    if (consumers == end(mConsumers)) { continue; }
+
+    Register const *reg = _container.get(i);
+    if (!reg) { continue; }
+
+    vector<uint16_t> &last = mLastRaw[i];
+    if (reg->raw() == WordView(last)) { continue; }
+    last.assign(reg->raw().begin(), reg->raw().end());
+
+    for (size_t j : consumers->second) {
+      mNodes[j].dirty = true;
+      first           = min(first, j);
+    }
+  }
+
+  size_t numChanged = _changed ? _changed->size() : 0;
+  for (size_t i = first; i < mNodes.size(); ++i) {
+    Node &node = mNodes[i];
+    if (!node.dirty) { continue; }
+    node.dirty = false;
+
+    double value = evaluate(node, _container);
+    if (node.valid && sameValue(value, node.value)) { continue; }
+
+    node.value = value;
+    node.valid = true;
+    store(node, _container);
+    if (_changed) { _changed->push_back(node.def.reg); }
+    for (size_t j : node.dependents) { mNodes[j].dirty = true; }
+  }
+
+  if (_changed) { sort(begin(*_changed) + numChanged, end(*_changed)); }
+}
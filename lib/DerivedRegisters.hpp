@@ -0,0 +1,115 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "RegisterContainer.hpp"
+
+namespace modbusSMA {
+
+/*!
+ * \brief Virtual registers computed from expressions over other registers
+ *
+ * A derived register has an address (outside of the SMA catalog), a description, a unit, a fixed point format (FIX0 -
+ * FIX4) and an expression. Expressions support numbers, registers (`r30775`, the scaled value of the register),
+ * `+ - * /`, parentheses and the functions `min(a, b)`, `max(a, b)` and `abs(a)`. Derived registers can use other
+ * derived registers as long as there are no cycles. If any input is NaN (or on a division by 0) the result is NaN.
+ *
+ * attach() compiles the expressions to RPN programs, sorts them topologically and adds the derived registers to the
+ * container as virtual S64 registers (see Register::isVirtual()). They then behave like normal registers (value(),
+ * export, metrics, ...). update() only re-evaluates the registers whose inputs changed, and their dependents only if
+ * the result changed.
+ *
+ * Definition files contain one register per line (`#` starts a comment):
+ *
+ * \code
+ * # address;format;unit;description;expression
+ * 40900;FIX2;%;DC/AC efficiency;100 * r30775 / (r30773 + r30961)
+ * 40904;FIX0;W;Phase imbalance;max(max(r30777, r30779), r30781) - min(min(r30777, r30779), r30781)
+ * \endcode
+ *
+ * \sa ModbusAPI::setDerivedRegisters()
+ */
+class DerivedRegisters {
+ public:
+  //! Definition of one derived register.
+  struct Definition {
+    uint16_t    reg        = 0;                //!< The address of the virtual register.
+    std::string desc       = "";               //!< The description.
+    std::string unit       = "";               //!< The unit.
+    DataFormat  format     = DataFormat::FIX0; //!< FIX0 - FIX4.
+    std::string expression = "";               //!< The expression.
+  };
+
+ private:
+  //! One RPN instruction.
+  struct Op {
+    enum Type { CONST, REG, ADD, SUB, MUL, DIV, NEG, MIN, MAX, ABS } type;
+
+    double   value = 0; //!< CONST only.
+    uint16_t reg   = 0; //!< REG only.
+  };
+
+  //! A compiled derived register.
+  struct Node {
+    Definition            def;
+    std::vector<Op>       program;
+    std::vector<uint16_t> inputs;         //!< Registers used by the expression (catalog and derived).
+    std::vector<size_t>   dependents;     //!< Nodes using this node.
+    double                value = 0;      //!< The last result.
+    bool                  valid = false;  //!< Was the node evaluated at least once?
+    bool                  dirty = true;   //!< Must be evaluated in the next update().
+  };
+
+  std::vector<Definition> mDefinitions;
+
+  std::vector<Node>                                   mNodes;     //!< Topologically sorted.
+  std::unordered_map<uint16_t, size_t>                mNodeIndex; //!< Address -> node.
+  std::unordered_map<uint16_t, std::vector<size_t>>   mConsumers; //!< Catalog register -> nodes using it.
+  std::unordered_map<uint16_t, std::vector<uint16_t>> mLastRaw;   //!< Last seen raw value of the catalog inputs.
+
+  std::vector<double> mStack; //!< Evaluation stack (reused).
+  size_t              mEvaluations = 0;
+
+  static ErrorCode compile(std::string const &_expr, std::vector<Op> &_out, std::vector<uint16_t> &_inputs);
+
+  double evaluate(Node const &_node, RegisterContainer const &_container);
+  void   store(Node const &_node, RegisterContainer &_container) const;
+
+ public:
+  DerivedRegisters() = default;
+
+  ErrorCode add(Definition _def);
+  ErrorCode loadFile(std::string const &_path);
+
+  ErrorCode attach(RegisterContainer &_container);
+  void      addInputs(std::vector<uint16_t> &_regList) const;
+  void      update(RegisterContainer &          _container,
+                   std::vector<uint16_t> const &_updated,
+                   std::vector<uint16_t> *      _changed = nullptr);
+
+  inline std::vector<Definition> const &definitions() const { return mDefinitions; } //!< All definitions.
+  inline size_t                         evaluations() const { return mEvaluations; } //!< Number of evaluations.
+};
+
+} // namespace modbusSMA
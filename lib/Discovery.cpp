@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Discovery.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include "Logging.hpp"
+#include "MBConnectionIP.hpp"
+#include "Trace.hpp"
+
+using namespace std;
+using namespace std::chrono;
+using namespace modbusSMA;
+
+const uint16_t DEFAULT_PORT = 502;
+
+//! Parses an IPv4 address (host byte order).
+inline bool parseIPv4(string const &_str, uint32_t &_out) {
+  in_addr addr = {};
+  if (inet_pton(AF_INET, _str.c_str(), &addr) != 1) { return false; }
+  _out = ntohl(addr.s_addr);
+  return true;
+}
+
+Discovery::Discovery(shared_ptr<DataBase> _db) : Discovery(_db, Settings()) {}
+
+Discovery::Discovery(shared_ptr<DataBase> _db, Settings _settings) : mDB(_db), mSettings(_settings) {
+  mSettings.maxConnects  = max<size_t>(mSettings.maxConnects, 1);
+  mSettings.probeThreads = max<size_t>(mSettings.probeThreads, 1);
+}
+
+/*!
+ * \brief Adds an address range to scan
+ *
+ * Supported formats:
+ *  - `192.168.1.10` (a single address)
+ *  - `192.168.1.0/24` (a subnet; the network and broadcast addresses are skipped for prefixes below 31)
+ *  - `192.168.1.10-192.168.1.20` or `192.168.1.10-20` (an inclusive range)
+ */
+ErrorCode Discovery::addRange(string const &_range) {
+  uint32_t first = 0;
+  uint32_t last  = 0;
+  size_t   slash = _range.find('/');
+  size_t   dash  = _range.find('-');
+
+  if (slash != string::npos) {
+    char *   end    = nullptr;
+    long int prefix = strtol(_range.c_str() + slash + 1, &end, 10);
+    if (!parseIPv4(_range.substr(0, slash), first) || *end != '\0' || end == _range.c_str() + slash + 1 ||
+        prefix < 0 || prefix > 32) {
+      log::get()->error("Discovery: invalid subnet '{}'", _range);
+      return ErrorCode::ERROR;
+    }
+
+    uint32_t mask = prefix == 0 ? 0 : ~(uint32_t)0 << (32 - prefix);
+    first         = first & mask;
+    last          = first | ~mask;
+    if (prefix < 31) {
+      ++first;
+      --last;
+    }
+  } else if (dash != string::npos) {
+    string lastStr = _range.substr(dash + 1);
+    if (lastStr.find('.') == string::npos) { lastStr = _range.substr(0, _range.rfind('.', dash) + 1) + lastStr; }
+
+    if (!parseIPv4(_range.substr(0, dash), first) || !parseIPv4(lastStr, last) || last < first) {
+      log::get()->error("Discovery: invalid address range '{}'", _range);
+      return ErrorCode::ERROR;
+    }
+  } else if (parseIPv4(_range, first)) {
+    last = first;
+  } else {
+    log::get()->error("Discovery: invalid address '{}'", _range);
+    return ErrorCode::ERROR;
+  }
+
+  mRanges.emplace_back(first, last);
+  return ErrorCode::OK;
+}
+
+//! Adds a port to scan (default: 502 if no port is added).
+void Discovery::addPort(uint16_t _port) {
+  if (find(begin(mPorts), end(mPorts), _port) == end(mPorts)) { mPorts.push_back(_port); }
+}
+
+//! Converts an IPv4 address (host byte order) to a string.
+string Discovery::toStr(uint32_t _address) {
+  in_addr addr = {};
+  char    buffer[INET_ADDRSTRLEN];
+  addr.s_addr = htonl(_address);
+  return inet_ntop(AF_INET, &addr, buffer, sizeof(buffer)) ? buffer : "";
+}
+
+/*!
+ * \brief Scans all added ranges and ports
+ * \returns The found devices sorted by address and port
+ */
+vector<Discovery::Device> Discovery::run() {
+  trace::Span span("Discovery::run", "discovery");
+  auto        logger = log::get();
+  auto        start  = steady_clock::now();
+
+  if (mPorts.empty()) { mPorts.push_back(DEFAULT_PORT); }
+
+  vector<Endpoint> open = sweep();
+  SPDLOG_LOGGER_DEBUG(logger,
+                      "Discovery: {} open ports found in {}ms",
+                      open.size(),
+                      duration_cast<milliseconds>(steady_clock::now() - start).count());
+
+  // Probe the open ports in parallel
+  vector<Device> devices(open.size());
+  vector<char>   found(open.size(), false);
+  atomic<size_t> next   = {0};
+  auto           worker = [&]() {
+    for (size_t i = next.fetch_add(1); i < open.size(); i = next.fetch_add(1)) {
+      found[i] = probe(open[i], devices[i]);
+    }
+  };
+
+  vector<thread> threads;
+  for (size_t i = 1; i < min(mSettings.probeThreads, open.size()); ++i) { threads.emplace_back(worker); }
+  worker();
+  for (auto &i : threads) { i.join(); }
+
+  // Resolve the device types
+  vector<DataBase::DevEnum> enums;
+  if (mDB && (mDB->isConnected() || mDB->connect() == ErrorCode::OK)) { enums = mDB->getDeviceEnums(); }
+
+  vector<Device> result;
+  for (size_t i = 0; i < devices.size(); ++i) {
+    if (!found[i]) { continue; }
+
+    Device &dev  = devices[i];
+    auto    iter = find_if(begin(enums), end(enums), [&](auto const &e) { return e.id == dev.typeID; });
+    if (iter != end(enums)) {
+      dev.type  = iter->name;
+      dev.known = true;
+    }
+
+    result.push_back(move(dev));
+  }
+
+  SPDLOG_LOGGER_INFO(logger,
+                     "Discovery: found {} devices ({} open ports) in {}ms",
+                     result.size(),
+                     open.size(),
+                     duration_cast<milliseconds>(steady_clock::now() - start).count());
+  return result;
+}
+
+/*!
+ * \brief Connects to all addresses and ports with non-blocking sockets
+ * \returns The endpoints that accepted the connection (sorted by address and port)
+ */
+vector<Discovery::Endpoint> Discovery::sweep() {
+  trace::Span span("sweep", "discovery");
+
+  // A pending connect
+  struct Pending {
+    Endpoint                 endpoint;
+    steady_clock::time_point deadline;
+  };
+
+  vector<Endpoint> result;
+  vector<Pending>  pending;
+  vector<pollfd>   fds;
+
+  size_t   rangeIdx = 0;
+  uint64_t address  = mRanges.empty() ? 0 : mRanges[0].first;
+  size_t   portIdx  = 0;
+
+  // Returns the next endpoint to scan
+  auto nextEndpoint = [&](Endpoint &_out) -> bool {
+    while (rangeIdx < mRanges.size()) {
+      if (address > mRanges[rangeIdx].second) {
+        if (++rangeIdx < mRanges.size()) { address = mRanges[rangeIdx].first; }
+        continue;
+      }
+
+      _out = {(uint32_t)address, mPorts[portIdx]};
+      if (++portIdx >= mPorts.size()) {
+        portIdx = 0;
+        ++address;
+      }
+      return true;
+    }
+    return false;
+  };
+
+  size_t   maxConnects = mSettings.maxConnects;
+  bool     done        = false;
+  bool     retry       = false; // ep was not started yet
+  Endpoint ep          = {};
+  while (!done || !fds.empty()) {
+    // Start new connects
+    while (!done && fds.size() < maxConnects) {
+      if (!retry && !nextEndpoint(ep)) {
+        done = true;
+        break;
+      }
+
+      retry  = false;
+      int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (fd < 0 && fds.empty()) {
+        log::get()->error("Discovery: failed to create a socket: '{}' (the sweep is incomplete)", strerror(errno));
+        done = true;
+        break;
+      }
+
+      if (fd < 0) {
+        // Probably out of file descriptors (EMFILE): continue with the current number of parallel connects
+        log::get()->warn("Discovery: failed to create a socket: '{}' (limiting the sweep to {} parallel connects)",
+                         strerror(errno),
+                         fds.size());
+        maxConnects = fds.size();
+        retry       = true;
+        break;
+      }
+
+      sockaddr_in addr     = {};
+      addr.sin_family      = AF_INET;
+      addr.sin_port        = htons(ep.port);
+      addr.sin_addr.s_addr = htonl(ep.address);
+      int res              = connect(fd, (sockaddr *)&addr, sizeof(addr));
+
+      if (res == 0) {
+        result.push_back(ep);
+        close(fd);
+      } else if (errno == EINPROGRESS) {
+        pending.push_back({ep, steady_clock::now() + mSettings.connectTimeout});
+        fds.push_back({fd, POLLOUT, 0});
+      } else {
+        close(fd);
+      }
+    }
+
+    if (fds.empty()) { continue; }
+
+    // Wait for the next connect to finish
+    auto now     = steady_clock::now();
+    auto timeout = min_element(begin(pending), end(pending), [](auto const &a, auto const &b) {
+                     return a.deadline < b.deadline;
+                   })->deadline - now;
+
+    int num = poll(fds.data(), fds.size(), max<int>((int)duration_cast<milliseconds>(timeout).count() + 1, 0));
+    if (num < 0 && errno != EINTR) {
+      log::get()->error("Discovery: poll failed: '{}'", strerror(errno));
+      break;
+    }
+
+    now = steady_clock::now();
+    for (size_t i = 0; i < fds.size();) {
+      bool finished = fds[i].revents != 0 || pending[i].deadline <= now;
+      if (!finished) {
+        ++i;
+        continue;
+      }
+
+      int       error = ETIMEDOUT;
+      socklen_t len   = sizeof(error);
+      if (fds[i].revents != 0) { getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &error, &len); }
+      if (error == 0) { result.push_back(pending[i].endpoint); }
+
+      close(fds[i].fd);
+      fds[i]     = fds.back();
+      pending[i] = pending.back();
+      fds.pop_back();
+      pending.pop_back();
+    }
+  }
+
+  for (auto const &i : fds) { close(i.fd); }
+
+  sort(begin(result), end(result), [](Endpoint const &a, Endpoint const &b) {
+    return a.address != b.address ? a.address < b.address : a.port < b.port;
+  });
+  return result;
+}
+
+//! Reads the identification registers of a device.
+bool Discovery::probe(Endpoint const &_endpoint, Device &_dev) {
+  trace::Span    span("probe", "discovery");
+  MBConnectionIP conn(toStr(_endpoint.address), _endpoint.port);
+
+  _dev.ip   = toStr(_endpoint.address);
+  _dev.port = _endpoint.port;
+
+  if (conn.connect() != ErrorCode::OK) { return false; }
+  conn.setTimeouts(mSettings.probeTimeout, mSettings.probeTimeout);
+
+  // Same sequence as ModbusAPI::initialize()
+  if (conn.setSlaveID(1) != ErrorCode::OK) { return false; }
+  vector<uint16_t> rawData = conn.readRegisters(42109, 4);
+  if (rawData.size() != 4) { return false; }
+
+  _dev.serial = ((uint32_t)rawData[0] << 16) + rawData[1];
+  _dev.susyID = rawData[2];
+  _dev.unitID = rawData[3];
+
+  if (conn.setSlaveID(_dev.unitID) != ErrorCode::OK) { return false; }
+  rawData = conn.readRegisters(30053, 2);
+  if (rawData.size() != 2) { return false; }
+
+  _dev.typeID = ((uint32_t)rawData[0] << 16) + rawData[1];
+  SPDLOG_LOGGER_DEBUG(log::get(),
+                      "Discovery: {}:{} -- serial: {}; unit ID: {}; type: {}",
+                      _dev.ip,
+                      _dev.port,
+                      _dev.serial,
+                      _dev.unitID,
+                      _dev.typeID);
+  return true;
+}
@@ -0,0 +1,98 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "DataBase.hpp"
+
+namespace modbusSMA {
+
+/*!
+ * \brief Finds SMA inverters in a network
+ *
+ * The discovery runs in two phases:
+ *  1. All addresses and ports are swept with non-blocking TCP connects (Settings::maxConnects in flight)
+ *  2. Every open port is probed by Settings::probeThreads threads: register 42109 (serial number, SusyID and unit
+ *     ID) is read with unit ID 1 and register 30053 (device type) with the reported unit ID
+ *
+ * \code{.cpp}
+ * Discovery disc(db);
+ * disc.addRange("192.168.1.0/24");
+ * for (auto const &i : disc.run()) { std::cout << i.ip << " " << i.type << std::endl; }
+ * \endcode
+ *
+ * \note IPv4 only
+ */
+class Discovery {
+ public:
+  //! Discovery parameters.
+  struct Settings {
+    std::chrono::milliseconds connectTimeout = std::chrono::milliseconds(500);  //!< Timeout of the TCP connect.
+    std::chrono::milliseconds probeTimeout   = std::chrono::milliseconds(1000); //!< Response timeout of the probe.
+    size_t                    maxConnects    = 256;                             //!< Parallel connects.
+    size_t                    probeThreads   = 16;                              //!< Parallel probes.
+  };
+
+  //! A found device.
+  struct Device {
+    std::string ip;             //!< The IP address.
+    uint16_t    port   = 0;     //!< The Modbus TCP port.
+    uint32_t    serial = 0;     //!< The serial number.
+    uint16_t    susyID = 0;     //!< The SusyID.
+    uint16_t    unitID = 0;     //!< The unit / slave ID.
+    uint32_t    typeID = 0;     //!< The device type (register 30053).
+    std::string type   = "";    //!< The name of the device type (empty if not in the DataBase).
+    bool        known  = false; //!< Whether the device type is in the DataBase.
+  };
+
+ private:
+  //! An open TCP port.
+  struct Endpoint {
+    uint32_t address; //!< IPv4 address (host byte order).
+    uint16_t port;    //!< The TCP port.
+  };
+
+  std::shared_ptr<DataBase> mDB;
+  Settings                  mSettings;
+
+  std::vector<std::pair<uint32_t, uint32_t>> mRanges; //!< [first, last] addresses (host byte order).
+  std::vector<uint16_t>                      mPorts;
+
+  std::vector<Endpoint> sweep();
+  bool                  probe(Endpoint const &_endpoint, Device &_dev);
+
+ public:
+  Discovery() = delete;
+  Discovery(std::shared_ptr<DataBase> _db);
+  Discovery(std::shared_ptr<DataBase> _db, Settings _settings);
+
+  ErrorCode addRange(std::string const &_range);
+  void      addPort(uint16_t _port);
+
+  std::vector<Device> run();
+
+  static std::string toStr(uint32_t _address);
+};
+
+} // namespace modbusSMA
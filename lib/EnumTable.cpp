@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "EnumTable.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string_view>
+#include <unordered_map>
+
+using namespace std;
+using namespace modbusSMA;
+
+namespace {
+
+const char *WHITESPACE = " \n\t\r";
+
+//! Returns [_first, _last) without leading and trailing whitespace.
+string trim(string const &_str, size_t _first, size_t _last) {
+  _first = _str.find_first_not_of(WHITESPACE, _first);
+  if (_first >= _last) { return ""; }
+  _last = _str.find_last_not_of(WHITESPACE, _last - 1);
+  return _str.substr(_first, _last - _first + 1);
+}
+
+//! The tables of all descriptions (see EnumTable::get()).
+struct Cache {
+  mutex                                                 guard;
+  unordered_map<string_view, weak_ptr<EnumTable const>> tables; //!< Keys point to EnumTable::mDesc.
+};
+
+//! Returns the cache. Never destroyed, since tables can be released by static objects after main().
+Cache &enumCache() {
+  static Cache *cache = new Cache;
+  return *cache;
+}
+
+} // namespace
+
+EnumTable::EnumTable(string _desc) : mDesc(move(_desc)) {}
+
+/*!
+ * \brief Returns the shared table of the description _desc
+ *
+ * Only creates the table, the values are parsed on the first access. The cache only holds weak references and its
+ * keys point into the description of the tables, so a description is stored once and a table is freed as soon as no
+ * register uses it.
+ */
+shared_ptr<EnumTable const> EnumTable::get(string const &_desc) {
+  Cache &           cache = enumCache();
+  lock_guard<mutex> lock(cache.guard);
+
+  auto iter = cache.tables.find(_desc);
+  if (iter != end(cache.tables)) {
+    if (auto table = iter->second.lock()) { return table; }
+    cache.tables.erase(iter); // The key points into the expiring table
+  }
+
+  shared_ptr<EnumTable const> table(new EnumTable(_desc), [](EnumTable const *_table) {
+    {
+      Cache &           c = enumCache();
+      lock_guard<mutex> l(c.guard);
+      auto              i = c.tables.find(_table->mDesc);
+      if (i != end(c.tables) && i->second.expired()) { c.tables.erase(i); } // Otherwise already replaced by get()
+    }
+
+    delete _table;
+  });
+
+  cache.tables.emplace(table->mDesc, table);
+  return table;
+}
+
+//! Returns a table without values.
+shared_ptr<EnumTable const> const &EnumTable::empty() {
+  static shared_ptr<EnumTable const> const emptyTable = make_shared<EnumTable const>("");
+  return emptyTable;
+}
+
+//! Parses all `<value> = <name>` lines (except the first one) of the description.
+void EnumTable::parse() const {
+  vector<pair<uint32_t, string>> entries;
+
+  for (size_t pos = mDesc.find('\n'); pos != string::npos;) {
+    size_t start = pos + 1;
+    pos          = mDesc.find('\n', start);
+    size_t end   = pos == string::npos ? mDesc.size() : pos;
+    size_t eq    = mDesc.find('=', start);
+    if (eq >= end) { continue; }
+
+    string num = trim(mDesc, start, eq);
+    char * numEnd;
+    long   number = strtol(num.c_str(), &numEnd, 10);
+    if (numEnd == num.c_str()) { continue; } // Not a number
+
+    entries.emplace_back((uint32_t)number, trim(mDesc, eq + 1, end));
+  }
+
+  // Sort by value; for duplicate values the last line wins
+  stable_sort(begin(entries), end(entries), [](auto const &a, auto const &b) { return a.first < b.first; });
+
+  mValues.reserve(entries.size());
+  mNames.reserve(entries.size());
+  for (auto &i : entries) {
+    if (!mValues.empty() && mValues.back() == i.first) {
+      mNames.back() = move(i.second);
+      continue;
+    }
+
+    mValues.push_back(i.first);
+    mNames.push_back(move(i.second));
+  }
+}
+
+//! Returns the name of _value (nullptr if _value is not in the table).
+string const *EnumTable::find(uint32_t _value) const {
+  auto const &vals = values();
+  auto        pos  = lower_bound(begin(vals), end(vals), _value);
+  if (pos == end(vals) || *pos != _value) { return nullptr; }
+  return &mNames[(size_t)(pos - begin(vals))];
+}
+
+//! All enum values (sorted).
+vector<uint32_t> const &EnumTable::values() const {
+  call_once(mParsed, [this]() { parse(); });
+  return mValues;
+}
+
+//! The names of the values (same order as values()).
+vector<string> const &EnumTable::names() const {
+  call_once(mParsed, [this]() { parse(); });
+  return mNames;
+}
@@ -0,0 +1,68 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace modbusSMA {
+
+/*!
+ * \brief The enum values of a register description
+ *
+ * The SMA register descriptions list the enum values after the first line (`<value> = <name>`, one per line). The
+ * table is parsed on the first access into two flat arrays sorted by value.
+ *
+ * Registers with the same description share one table (see get()), so each description is parsed at most once, no
+ * matter how many devices / containers / copies of the register exist.
+ *
+ * \note Thread safe.
+ */
+class EnumTable {
+ private:
+  std::string const mDesc;
+
+  mutable std::once_flag           mParsed;
+  mutable std::vector<uint32_t>    mValues;
+  mutable std::vector<std::string> mNames;
+
+  void parse() const;
+
+ public:
+  EnumTable() = delete;
+  explicit EnumTable(std::string _desc);
+
+  EnumTable(EnumTable const &) = delete;
+  void operator=(EnumTable const &) = delete;
+
+  static std::shared_ptr<EnumTable const>        get(std::string const &_desc);
+  static std::shared_ptr<EnumTable const> const &empty();
+
+  std::string const *find(uint32_t _value) const;
+
+  std::vector<uint32_t> const &   values() const;
+  std::vector<std::string> const &names() const;
+
+  inline size_t size() const { return values().size(); } //!< Number of enum values.
+};
+
+} // namespace modbusSMA
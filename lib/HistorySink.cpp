@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "HistorySink.hpp"
+
+#include <algorithm>
+
+#include "Logging.hpp"
+#include "Trace.hpp"
+
+using namespace std;
+using namespace modbusSMA;
+using namespace modbusSMA::internal;
+
+namespace {
+
+const char *SCHEMA = "CREATE TABLE IF NOT EXISTS `devices` (`id` INTEGER PRIMARY KEY, `serial` INTEGER UNIQUE, "
+                     "`type` INTEGER);"
+                     "CREATE TABLE IF NOT EXISTS `registers` (`id` INTEGER PRIMARY KEY, `device` INTEGER, "
+                     "`register` INTEGER, `description` TEXT, `unit` TEXT, `type` TEXT, `format` TEXT, "
+                     "UNIQUE (`device`, `register`));"
+                     "CREATE TABLE IF NOT EXISTS `cycles` (`id` INTEGER PRIMARY KEY, `device` INTEGER, "
+                     "`cycle` INTEGER, `timestamp` INTEGER);"
+                     "CREATE TABLE IF NOT EXISTS `samples` (`cycle` INTEGER, `register` INTEGER, `value` INTEGER, "
+                     "PRIMARY KEY (`cycle`, `register`)) WITHOUT ROWID;";
+
+//! Returns the raw value of _reg as an integer.
+int64_t sampleValue(Register const &_reg) {
+  switch (_reg.type()) {
+    case DataType::S16:
+    case DataType::S32:
+    case DataType::S64: return _reg.valueInt();
+    default: return (int64_t)_reg.valueUInt();
+  }
+}
+
+//! Resets a prepared statement for the next execution.
+void reset(sqlite3_stmt *_stmt) {
+  sqlite3_reset(_stmt);
+  sqlite3_clear_bindings(_stmt);
+}
+
+} // namespace
+
+HistorySink::HistorySink(string _path) : HistorySink(_path, Settings()) {} //!< Constructor with default settings.
+
+/*!
+ * \brief Constructor. Only sets the path, call open() to create the database
+ * \param _path     The sqlite database file (created if it does not exist)
+ * \param _settings The configuration
+ */
+HistorySink::HistorySink(string _path, Settings _settings) : mPath(_path), mSettings(_settings) {
+  mSettings.cyclesPerCommit = max<size_t>(mSettings.cyclesPerCommit, 1);
+  mSettings.maxQueue        = max<size_t>(mSettings.maxQueue, 1);
+}
+
+HistorySink::~HistorySink() { close(); }
+
+//! Executes _sql without results.
+bool HistorySink::exec(char const *_sql) {
+  char *errMsg    = nullptr;
+  int   errorCode = sqlite3_exec(mDB, _sql, nullptr, nullptr, &errMsg);
+  if (errorCode != SQLITE_OK) {
+    log::get()->error("HistorySink [{}]: '{}' failed: '{}'", mPath, _sql, errMsg ? errMsg : sqlite3_errstr(errorCode));
+    sqlite3_free(errMsg);
+    return false;
+  }
+
+  return true;
+}
+
+//! Creates the schema, fills the catalog tables and prepares the insert statements.
+bool HistorySink::prepare(RegisterContainer const &_container, uint32_t _serial, uint32_t _typeID) {
+  if (!exec("PRAGMA journal_mode=WAL;") || !exec("PRAGMA synchronous=NORMAL;") || !exec(SCHEMA)) { return false; }
+  if (!exec("BEGIN;")) { return false; }
+
+  // Device
+  SQL_Query insDevice(mDB, "INSERT OR IGNORE INTO `devices` (`serial`, `type`) VALUES (?, ?);");
+  SQL_Query selDevice(mDB, "SELECT `id` FROM `devices` WHERE `serial` = ?;");
+  if (!insDevice.isValid() || !selDevice.isValid()) { return false; }
+
+  sqlite3_bind_int64(insDevice(), 1, _serial);
+  sqlite3_bind_int64(insDevice(), 2, _typeID);
+  sqlite3_bind_int64(selDevice(), 1, _serial);
+  if (sqlite3_step(insDevice()) != SQLITE_DONE || sqlite3_step(selDevice()) != SQLITE_ROW) { return false; }
+  mDeviceID = sqlite3_column_int64(selDevice(), 0);
+
+  // Registers
+  SQL_Query insReg(mDB, "INSERT OR IGNORE INTO `registers` VALUES (NULL, ?, ?, ?, ?, ?, ?);");
+  SQL_Query selReg(mDB, "SELECT `id` FROM `registers` WHERE `device` = ? AND `register` = ?;");
+  if (!insReg.isValid() || !selReg.isValid()) { return false; }
+
+  vector<uint16_t> regList;
+  mRegIDs.clear();
+  for (uint16_t i : mRegList) {
+    Register const *reg = _container.get(i);
+    if (!reg || reg->type() == DataType::STR32) { continue; }
+
+    auto meta = reg->metadata(); // One lookup in the low memory mode
+    sqlite3_bind_int64(insReg(), 1, mDeviceID);
+    sqlite3_bind_int(insReg(), 2, reg->reg());
+    sqlite3_bind_text(insReg(), 3, meta->desc.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(insReg(), 4, meta->unit.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(insReg(), 5, enum2Str::toStr(reg->type()).c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(insReg(), 6, enum2Str::toStr(reg->format()).c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(selReg(), 1, mDeviceID);
+    sqlite3_bind_int(selReg(), 2, reg->reg());
+    if (sqlite3_step(insReg()) != SQLITE_DONE || sqlite3_step(selReg()) != SQLITE_ROW) { return false; }
+
+    regList.push_back(i);
+    mRegIDs.push_back(sqlite3_column_int64(selReg(), 0));
+    reset(insReg());
+    reset(selReg());
+  }
+
+  mRegList = regList;
+  if (!exec("COMMIT;")) { return false; }
+
+  // Insert statements (the statements for less than ROWS_PER_INSERT rows are prepared on demand)
+  mInsertCycle = make_unique<SQL_Query>(mDB, "INSERT INTO `cycles` VALUES (NULL, ?, ?, ?);");
+  return mInsertCycle->isValid() && insertStatement(ROWS_PER_INSERT) != nullptr;
+}
+
+//! Returns the multi-row INSERT statement for _rows (1 - ROWS_PER_INSERT) samples or nullptr.
+sqlite3_stmt *HistorySink::insertStatement(size_t _rows) {
+  Statement &stmt = mInsertSamples[_rows - 1];
+  if (!stmt) {
+    string sql = "INSERT OR REPLACE INTO `samples` VALUES (?, ?, ?)";
+    for (size_t i = 1; i < _rows; ++i) { sql += ", (?, ?, ?)"; }
+    stmt = make_unique<SQL_Query>(mDB, sql + ";");
+  }
+
+  return stmt->isValid() ? (*stmt)() : nullptr;
+}
+
+/*!
+ * \brief Opens (or creates) the database and starts the writer thread
+ *
+ * \param _container The registers (for the catalog tables)
+ * \param _regList   The registers to record (strings are skipped)
+ * \param _serial    The serial number of the device
+ * \param _typeID    The device type
+ */
+ErrorCode HistorySink::open(RegisterContainer const &_container,
+                            vector<uint16_t> const & _regList,
+                            uint32_t                 _serial,
+                            uint32_t                 _typeID) {
+  close();
+
+  int errorCode = sqlite3_open(mPath.c_str(), &mDB);
+  if (errorCode != SQLITE_OK) {
+    log::get()->error("HistorySink [{}]: unable to open the database: '{}'", mPath, sqlite3_errstr(errorCode));
+    close();
+    return ErrorCode::DATA_BASE_ERROR;
+  }
+
+  mRegList = _regList;
+  if (!prepare(_container, _serial, _typeID)) {
+    log::get()->error("HistorySink [{}]: failed to prepare the database: '{}'", mPath, sqlite3_errmsg(mDB));
+    close();
+    return ErrorCode::DATA_BASE_ERROR;
+  }
+
+  mStop   = false;
+  mThread = thread(&HistorySink::writerLoop, this);
+
+  SPDLOG_LOGGER_INFO(log::get(), "HistorySink: recording {} registers in '{}'", mRegList.size(), mPath);
+  return ErrorCode::OK;
+}
+
+//! Writes all queued cycles, stops the writer thread and closes the database.
+void HistorySink::close() {
+  {
+    lock_guard<mutex> lock(mMutex);
+    mStop = true;
+  }
+
+  mCond.notify_all();
+  if (mThread.joinable()) { mThread.join(); }
+
+  mInsertCycle = nullptr;
+  for (auto &i : mInsertSamples) { i = nullptr; }
+  mInTransaction = 0;
+  mQueue.clear();
+
+  if (mDB) {
+    sqlite3_close(mDB);
+    mDB = nullptr;
+  }
+}
+
+/*!
+ * \brief Queues the current values of the registers (never blocks on the database)
+ *
+ * \param _container The registers
+ * \param _cycle     The number of the poll cycle
+ * \param _timestamp UNIX timestamp in ms
+ */
+void HistorySink::push(RegisterContainer const &_container, uint64_t _cycle, int64_t _timestamp) {
+  if (!mThread.joinable()) { return; }
+
+  Cycle  cycle = {_cycle, _timestamp, {}};
+  size_t idx   = 0;
+  cycle.values.reserve(mRegList.size());
+  _container.forEach(mRegList, [&](Register const &_reg) {
+    while (idx < mRegList.size() && mRegList[idx] != _reg.reg()) { ++idx; }
+    if (idx >= mRegList.size()) { return; }
+    if (!_reg.isNaN()) { cycle.values.emplace_back(mRegIDs[idx], sampleValue(_reg)); }
+  });
+
+  {
+    lock_guard<mutex> lock(mMutex);
+    if (mQueue.size() >= mSettings.maxQueue) {
+      mQueue.pop_front();
+      if (mDropped++ == 0) { log::get()->warn("HistorySink [{}]: the writer is too slow, dropping cycles", mPath); }
+    }
+
+    mQueue.push_back(move(cycle));
+  }
+
+  mCond.notify_one();
+}
+
+//! Inserts one cycle (a transaction must be active).
+bool HistorySink::write(Cycle const &_cycle) {
+  sqlite3_stmt *stmt = (*mInsertCycle)();
+  sqlite3_bind_int64(stmt, 1, mDeviceID);
+  sqlite3_bind_int64(stmt, 2, (int64_t)_cycle.cycle);
+  sqlite3_bind_int64(stmt, 3, _cycle.timestamp);
+  bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+  reset(stmt);
+  if (!ok) { return false; }
+
+  int64_t cycleID = sqlite3_last_insert_rowid(mDB);
+  auto    values  = _cycle.values.data();
+  size_t  left    = _cycle.values.size();
+
+  while (left > 0) {
+    size_t rows = min(left, ROWS_PER_INSERT);
+    stmt        = insertStatement(rows);
+    if (!stmt) { return false; }
+
+    for (size_t i = 0; i < rows; ++i) {
+      sqlite3_bind_int64(stmt, (int)(i * 3 + 1), cycleID);
+      sqlite3_bind_int64(stmt, (int)(i * 3 + 2), values[i].first);
+      sqlite3_bind_int64(stmt, (int)(i * 3 + 3), values[i].second);
+    }
+
+    ok = sqlite3_step(stmt) == SQLITE_DONE;
+    reset(stmt);
+    if (!ok) { return false; }
+
+    values += rows;
+    left -= rows;
+  }
+
+  return true;
+}
+
+//! Commits the open transaction (rolls it back if the commit fails).
+void HistorySink::commit() {
+  if (!exec("COMMIT;")) {
+    rollback();
+    return;
+  }
+
+  mInTransaction = 0;
+}
+
+/*!
+ * \brief Rolls back the open transaction
+ *
+ * All cycles of the transaction are lost, but the next cycle can start a new transaction (BEGIN fails while a
+ * transaction is open).
+ */
+void HistorySink::rollback() {
+  if (!sqlite3_get_autocommit(mDB)) { exec("ROLLBACK;"); }
+  mWritten -= mInTransaction;
+  mInTransaction = 0;
+}
+
+//! Writes the queued cycles and commits every Settings::cyclesPerCommit cycles.
+void HistorySink::writerLoop() {
+  auto         logger = log::get();
+  deque<Cycle> batch;
+  bool         failed = false;
+
+  while (true) {
+    {
+      unique_lock<mutex> lock(mMutex);
+      mCond.wait(lock, [this]() { return mStop || !mQueue.empty(); });
+      if (mQueue.empty()) { break; } // mStop is set
+      swap(batch, mQueue);
+    }
+
+    trace::Span span("history write", "history");
+    span.arg("cycles", (int64_t)batch.size());
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+      if (mInTransaction == 0 && !exec("BEGIN;")) {
+        logger->warn("HistorySink [{}]: dropping {} cycles", mPath, batch.size() - i); // exec() logged the reason
+        mDropped += batch.size() - i;
+        break;
+      }
+
+      if (!write(batch[i])) {
+        if (!failed) { logger->error("HistorySink [{}]: insert failed: '{}'", mPath, sqlite3_errmsg(mDB)); }
+        failed = true;
+        rollback(); // The cycle may be partially inserted
+        continue;
+      }
+
+      ++mWritten;
+      if (++mInTransaction >= mSettings.cyclesPerCommit) { commit(); }
+    }
+
+    batch.clear();
+  }
+
+  if (mInTransaction > 0) { commit(); }
+}
@@ -0,0 +1,125 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sqlite3.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "DataBase.hpp"
+#include "RegisterContainer.hpp"
+
+namespace modbusSMA {
+
+/*!
+ * \brief Writes the values of every poll cycle into a local sqlite database
+ *
+ * push() only copies the values into a queue, a background thread writes them. The writer uses WAL mode, prepared
+ * statements and multi-row inserts and commits one transaction every `cyclesPerCommit` cycles, so the database is
+ * written in a few large chunks (friendly to SD cards). If the writer can not keep up, the oldest queued cycles are
+ * dropped instead of stalling the poll loop.
+ *
+ * Schema (all references are integer keys):
+ *
+ *   - `devices   (id, serial, type)`
+ *   - `registers (id, device, register, description, unit, type, format)`
+ *   - `cycles    (id, device, cycle, timestamp)` -- timestamp in ms
+ *   - `samples   (cycle, register, value)`       -- raw integer value (scale: see registers.format)
+ *
+ * NaN values and strings are not written.
+ */
+class HistorySink {
+ public:
+  //! Configuration of the sink.
+  struct Settings {
+    size_t cyclesPerCommit = 10;   //!< Number of cycles per transaction.
+    size_t maxQueue        = 1000; //!< Maximum number of queued cycles (the oldest are dropped).
+  };
+
+  static constexpr size_t ROWS_PER_INSERT = 64; //!< Rows per multi-row INSERT of the samples.
+
+ private:
+  //! The values of one cycle.
+  struct Cycle {
+    uint64_t                                 cycle     = 0; //!< Number of the poll cycle.
+    int64_t                                  timestamp = 0; //!< UNIX timestamp in ms.
+    std::vector<std::pair<int64_t, int64_t>> values;        //!< (register ID, value)
+  };
+
+  typedef std::unique_ptr<internal::SQL_Query> Statement;
+
+  std::string mPath;
+  Settings    mSettings;
+  sqlite3 *   mDB       = nullptr;
+  int64_t     mDeviceID = 0;
+
+  std::vector<uint16_t> mRegList;
+  std::vector<int64_t>  mRegIDs; //!< Same order as mRegList.
+
+  Statement                              mInsertCycle;
+  std::array<Statement, ROWS_PER_INSERT> mInsertSamples; //!< [n - 1] inserts n rows (prepared on the first use).
+  size_t                                 mInTransaction = 0;
+
+  std::mutex              mMutex;
+  std::condition_variable mCond;
+  std::deque<Cycle>       mQueue;
+  bool                    mStop = false;
+  std::thread             mThread;
+
+  std::atomic<uint64_t> mWritten = 0;
+  std::atomic<uint64_t> mDropped = 0;
+
+  bool exec(char const *_sql);
+  bool prepare(RegisterContainer const &_container, uint32_t _serial, uint32_t _typeID);
+  bool write(Cycle const &_cycle);
+  void commit();
+  void rollback();
+  void writerLoop();
+
+  sqlite3_stmt *insertStatement(size_t _rows);
+
+ public:
+  HistorySink() = delete;
+  HistorySink(std::string _path);
+  HistorySink(std::string _path, Settings _settings);
+  virtual ~HistorySink();
+
+  HistorySink(HistorySink const &) = delete;
+  void operator=(HistorySink const &) = delete;
+
+  ErrorCode open(RegisterContainer const &    _container,
+                 std::vector<uint16_t> const &_regList,
+                 uint32_t                     _serial,
+                 uint32_t                     _typeID);
+  void      close();
+  void      push(RegisterContainer const &_container, uint64_t _cycle, int64_t _timestamp);
+
+  inline uint64_t written() const { return mWritten; } //!< Number of cycles written (committed or pending).
+  inline uint64_t dropped() const { return mDropped; } //!< Cycles dropped (queue full or no transaction).
+};
+
+} // namespace modbusSMA
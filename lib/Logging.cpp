@@ -18,47 +18,78 @@
 
 #include "Logging.hpp"
 
+#include <atomic>
+#include <mutex>
+#include <spdlog/async.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
 
 using namespace std;
 using namespace modbusSMA;
 
+namespace {
+
+log::LOGGER  gLogger;                // Only written once (before gInitialized is set)
+atomic<bool> gInitialized = {false}; // Fast path of log::get()
+mutex        gInitMutex;
+
+} // namespace
+
 /*!
  * \brief Initializes the logger for the ModbusSMA library
  *
- * If no sinks are specified, the default stdout_color_mt logger is used.
- * Does nothing if the logger already exists.
+ * If no sinks are specified, a colored stdout sink is used. Does nothing if the logger already exists.
+ *
+ * In the ASYNC mode the messages are formatted by the calling thread and written by the spdlog thread pool, so slow
+ * sinks (files, syslog, a terminal over SSH) do not block the poll loop. The caller blocks if the queue is full.
+ *
+ * \note The background thread does not survive fork(), so the ASYNC mode must be initialized after daemonizing.
  *
- * \param _sinks Sinks to add to the logger
+ * \param _sinks     Sinks to add to the logger
+ * \param _mode      Synchronous or asynchronous logging
+ * \param _queueSize Number of queued messages in the ASYNC mode
  * \returns the created logger
  */
-log::LOGGER log::initialize(std::vector<spdlog::sink_ptr> _sinks) {
-  auto logger = spdlog::get(SMA_MODBUS_SMA_LOGGER_NAME);
-  if (logger) {
-    logger->info("Logger '{}' was already initialized", SMA_MODBUS_SMA_LOGGER_NAME);
-    return logger;
+log::LOGGER log::initialize(std::vector<spdlog::sink_ptr> _sinks, Mode _mode, size_t _queueSize) {
+  lock_guard<mutex> lock(gInitMutex);
+  if (gInitialized.load()) {
+    SPDLOG_LOGGER_INFO(gLogger, "Logger '{}' was already initialized", SMA_MODBUS_SMA_LOGGER_NAME);
+    return gLogger;
   }
 
-  if (!_sinks.empty()) {
-    logger = make_shared<spdlog::logger>(SMA_MODBUS_SMA_LOGGER_NAME, begin(_sinks), end(_sinks));
-    register_logger(logger);
-  } else {
-    logger = spdlog::stdout_color_mt(SMA_MODBUS_SMA_LOGGER_NAME);
+  auto logger = spdlog::get(SMA_MODBUS_SMA_LOGGER_NAME); // Registered by the application
+  if (!logger) {
+    if (_sinks.empty()) {
+      _sinks.push_back(make_shared<spdlog::sinks::stdout_color_sink_mt>());
+      _sinks.back()->set_pattern("[%Y-%m-%d %H:%M:%S.%e] [%n] [%^%l%$] %v"); // Without the source location
+    }
+
+    if (_mode == Mode::ASYNC) {
+      if (!spdlog::thread_pool()) { spdlog::init_thread_pool(_queueSize, 1); }
+      logger = make_shared<spdlog::async_logger>(SMA_MODBUS_SMA_LOGGER_NAME,
+                                                 begin(_sinks),
+                                                 end(_sinks),
+                                                 spdlog::thread_pool(),
+                                                 spdlog::async_overflow_policy::block);
+    } else {
+      logger = make_shared<spdlog::logger>(SMA_MODBUS_SMA_LOGGER_NAME, begin(_sinks), end(_sinks));
+    }
+
+    spdlog::register_logger(logger);
   }
 
-  return logger;
+  gLogger = logger;
+  gInitialized.store(true);
+  return gLogger;
 }
 
 /*!
  * \brief Returns the logger used in the modbusSMA library
  *
- * Default initializes the logger if it is not already initialized.
+ * Default initializes the logger if it is not already initialized. The handle is cached, so this function does not
+ * touch the spdlog registry (mutex and map lookup) after the first call.
  */
-log::LOGGER log::get() {
-  auto logger = spdlog::get(SMA_MODBUS_SMA_LOGGER_NAME);
-
-  if (!logger) { logger = initialize(); }
-
-  return logger;
+log::LOGGER const &log::get() {
+  if (!gInitialized.load(memory_order_acquire)) { initialize(); }
+  return gLogger;
 }
@@ -21,12 +21,23 @@
 
 #include <spdlog/spdlog.h>
 
-//! Namespace for logging related functions.
+/*!
+ * \brief Namespace for logging related functions.
+ *
+ * Messages below the build time log level (meson option `log_level`, mapped to SPDLOG_ACTIVE_LEVEL) are removed by
+ * the SPDLOG_LOGGER_* macros, which are used for the debug and info messages of the library.
+ */
 namespace modbusSMA::log {
 
 typedef std::shared_ptr<spdlog::logger> LOGGER; //!< Typedef for the spdlog logger
 
-LOGGER initialize(std::vector<spdlog::sink_ptr> _sinks = {});
-LOGGER get();
+//! How the log messages are written.
+enum class Mode {
+  SYNC,  //!< Messages are written by the logging thread.
+  ASYNC, //!< Messages are queued and written by a background thread.
+};
+
+LOGGER        initialize(std::vector<spdlog::sink_ptr> _sinks = {}, Mode _mode = Mode::SYNC, size_t _queueSize = 8192);
+LOGGER const &get();
 
 } // namespace modbusSMA::log
@@ -0,0 +1,374 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MBBus.hpp"
+
+#include <algorithm>
+
+#include "Logging.hpp"
+#include "MBConnectionRTU.hpp"
+#include "Trace.hpp"
+
+using namespace std;
+using namespace std::chrono;
+using namespace modbusSMA;
+
+namespace {
+
+const uint32_t     REQUEST_SIZE     = 8;                 //!< Read request: unit, function, address, count, CRC.
+const uint32_t     RESPONSE_SIZE    = 5;                 //!< Read response without data: unit, function, size, CRC.
+const microseconds MIN_BYTE_TIMEOUT = milliseconds(20);  //!< Serial adapters (USB) deliver the data in chunks.
+const microseconds TURNAROUND       = milliseconds(200); //!< Default maximum processing time of a device.
+
+} // namespace
+
+/*!
+ * \brief Line time of one read request of _numRegisters registers
+ *
+ * Request and response frame, including the silent intervals. The processing time of the device is not included.
+ */
+microseconds MBBus::LineTiming::requestTime(uint32_t _numRegisters) const {
+  return charTime * (REQUEST_SIZE + RESPONSE_SIZE + 2 * _numRegisters) + 2 * frameGap;
+}
+
+//! Line time of an additional request (without data).
+microseconds MBBus::LineTiming::overhead() const { return requestTime(0); }
+
+//! The maximum number of unrequested registers worth reading to save a request.
+uint32_t MBBus::LineTiming::maxFill() const {
+  if (charTime.count() <= 0) { return 0; }
+  return (uint32_t)(overhead() / (2 * charTime));
+}
+
+/*!
+ * \brief Computes the timing of a serial line
+ *
+ * A character consists of a start bit, the data bits, an optional parity bit and the stop bits. The silent interval
+ * between two frames is 3.5 characters, but fixed to 1.75 ms above 19200 baud (Modbus over serial line specification).
+ */
+MBBus::LineTiming MBBus::lineTiming(uint32_t _baud, char _parity, int _dataBit, int _stopBit) {
+  LineTiming timing;
+  if (_baud == 0) { return timing; }
+
+  uint32_t bits     = 1 + (uint32_t)_dataBit + (_parity == 'N' || _parity == 'n' ? 0 : 1) + (uint32_t)_stopBit;
+  timing.charTime   = microseconds((bits * 1000000 + _baud - 1) / _baud);
+  timing.frameGap   = _baud > 19200 ? microseconds(1750) : timing.charTime * 7 / 2;
+  timing.turnaround = TURNAROUND;
+  return timing;
+}
+
+/*!
+ * \brief Creates a bus on a serial line
+ *
+ * \param _device  Name of the serial port handled by the OS
+ * \param _baud    Baud rate of the communication
+ * \param _parity  Parity type: (N)one (E)ven (O)dd
+ * \param _dataBit The number of bits of data, the allowed values: 5-8
+ * \param _stopBit The bits of stop, the allowed values are 1 and 2
+ * \param _db      The register DataBase (nullptr ==> default DataBase)
+ */
+MBBus::MBBus(string _device, uint32_t _baud, char _parity, int _dataBit, int _stopBit, shared_ptr<DataBase> _db)
+    : MBBus(make_unique<MBConnectionRTU>(_device, _baud, _parity, _dataBit, _stopBit), _db) {}
+
+/*!
+ * \brief Creates a bus on an existing (not yet connected) connection
+ *
+ * The line timing is only known for RTU connections. Other connections (for instance a TCP gateway with many unit
+ * IDs) keep the default timeouts and the registers are not merged across gaps.
+ */
+MBBus::MBBus(unique_ptr<MBConnectionBase> _conn, shared_ptr<DataBase> _db) : mConn(move(_conn)), mDB(_db) {
+  if (!mDB) { mDB = make_shared<DataBase>(SMA_MODBUS_DEFAULT_DB); }
+
+  auto rtu = dynamic_cast<MBConnectionRTU *>(mConn.get());
+  if (rtu) { mTiming = lineTiming(rtu->getBaud(), rtu->getParity(), rtu->getDataBit(), rtu->getStopBit()); }
+}
+
+MBBus::~MBBus() { disconnect(); }
+
+/*!
+ * \brief Adds a device to the bus
+ *
+ * \param _unitID  The modbus unit ID of the device
+ * \param _regList The registers to update (empty ==> all readable registers)
+ * \returns OK or ERROR if the unit ID is invalid or already used
+ */
+ErrorCode MBBus::addDevice(uint8_t _unitID, vector<uint16_t> _regList) {
+  if (_unitID == 0 || _unitID > 247 || findDevice(_unitID)) {
+    log::get()->error("MBBus: invalid or duplicate unit ID {}", _unitID);
+    return ErrorCode::ERROR;
+  }
+
+  sort(begin(_regList), end(_regList));
+  _regList.erase(unique(begin(_regList), end(_regList)), end(_regList));
+
+  Device dev;
+  dev.unitID  = _unitID;
+  dev.regList = move(_regList);
+  mDevices.push_back(move(dev));
+  return ErrorCode::OK;
+}
+
+//! Opens the line and connects the DataBase (if neccessary).
+ErrorCode MBBus::connect() {
+  auto logger = log::get();
+  if (!mDB->isConnected()) {
+    ErrorCode res = mDB->connect();
+    if (res != ErrorCode::OK) {
+      logger->error("MBBus: DataBase initialization failed with {}", enum2Str::toStr(res));
+      return res;
+    }
+  }
+
+  ErrorCode res = mConn->connect();
+  if (res != ErrorCode::OK) { return res; }
+
+  applyTimeouts();
+  SPDLOG_LOGGER_INFO(logger, "MBBus: connected to {} ({} devices)", mConn->description(), mDevices.size());
+  return ErrorCode::OK;
+}
+
+//! Closes the line. The identified devices are kept.
+void MBBus::disconnect() { mConn->disconnect(); }
+
+/*!
+ * \brief Sets the maximum processing time of the devices
+ *
+ * The response timeout is the transmission time of the request plus this time.
+ */
+void MBBus::setTurnaround(microseconds _turnaround) {
+  mTiming.turnaround = _turnaround;
+  applyTimeouts();
+}
+
+//! Derives the libmodbus timeouts from the line timing (only if the timing is known).
+void MBBus::applyTimeouts() {
+  if (!isConnected() || mTiming.charTime.count() <= 0) { return; }
+
+  microseconds response = mTiming.charTime * REQUEST_SIZE + mTiming.frameGap + mTiming.turnaround;
+  microseconds byte     = max(mTiming.frameGap, MIN_BYTE_TIMEOUT);
+  mConn->setTimeouts(response, byte);
+
+  SPDLOG_LOGGER_DEBUG(log::get(),
+                      "MBBus: character time: {}us; response timeout: {}us; byte timeout: {}us; max. fill: {}",
+                      mTiming.charTime.count(),
+                      response.count(),
+                      byte.count(),
+                      mTiming.maxFill());
+}
+
+MBBus::Device *MBBus::findDevice(uint8_t _unitID) {
+  auto iter = find_if(begin(mDevices), end(mDevices), [_unitID](Device const &i) { return i.unitID == _unitID; });
+  return iter == end(mDevices) ? nullptr : &*iter;
+}
+
+//! Returns the registers of the device _unitID (nullptr if the device is unknown or not identified yet).
+shared_ptr<RegisterContainer> MBBus::getRegisters(uint8_t _unitID) {
+  Device *dev = findDevice(_unitID);
+  return dev ? dev->registers : nullptr;
+}
+
+/*!
+ * \brief Determines the inverter type of the device and loads its registers
+ *
+ * Same as ModbusAPI::initialize(), except that the unit ID is already known.
+ */
+ErrorCode MBBus::identify(Device &_dev) {
+  trace::Span span("MBBus::identify", "bus");
+  span.arg("unit", _dev.unitID);
+
+  auto logger = log::get();
+  mConn->setSlaveID(_dev.unitID);
+  ++_dev.requests;
+  vector<uint16_t> rawData = mConn->readRegisters(30053, 2);
+  if (rawData.size() != 2) {
+    ++_dev.failedBatches;
+    return ErrorCode::INITIALIZATION_FAILED;
+  }
+
+  uint32_t inverterID = (rawData[0] << 16) + rawData[1];
+  for (auto const &i : mDB->getDeviceEnums()) {
+    if (i.id != inverterID) { continue; }
+
+    _dev.inverterType   = i.name;
+    _dev.inverterTypeID = inverterID;
+    _dev.registers      = make_shared<RegisterContainer>();
+    _dev.registers->addRegisters(mDB->getRegisters("ALL"));
+    _dev.registers->addRegisters(mDB->getRegisters(i.table));
+    buildPlan(_dev);
+
+    SPDLOG_LOGGER_INFO(logger,
+                       "MBBus: unit {} is a {} ({} batches for {} registers)",
+                       _dev.unitID,
+                       _dev.inverterType,
+                       _dev.plan.size(),
+                       _dev.plan.numRegisters());
+    return ErrorCode::OK;
+  }
+
+  logger->error("MBBus: unit {}: unknown inverter type {}", _dev.unitID, inverterID);
+  return ErrorCode::INITIALIZATION_FAILED;
+}
+
+/*!
+ * \brief Creates the read plan of a device
+ *
+ * Gaps between the requested registers are filled with the known readable registers of the device if the gap is at
+ * most LineTiming::maxFill() registers. Reading them costs less line time than the overhead of an additional request.
+ * The fill registers are updated as well.
+ */
+void MBBus::buildPlan(Device &_dev) {
+  vector<Register> const &all = _dev.registers->registers();
+
+  vector<uint16_t> addresses = _dev.regList;
+  if (addresses.empty()) { addresses = _dev.registers->getAddresses(0, UINT16_MAX, true); }
+
+  vector<Register> requested = _dev.registers->getRegisters(addresses);
+  vector<Register> regList;
+  uint32_t         maxFill = mTiming.maxFill();
+  regList.reserve(requested.size());
+
+  for (Register const &i : requested) {
+    if (!regList.empty() && maxFill > 0) {
+      uint32_t gapStart = (uint32_t)regList.back().reg() + regList.back().size();
+      uint32_t gapEnd   = i.reg();
+
+      if (gapEnd > gapStart && gapEnd - gapStart <= maxFill) {
+        auto     first = lower_bound(begin(all), end(all), (uint16_t)gapStart);
+        auto     last  = first;
+        uint32_t pos   = gapStart;
+        while (last != end(all) && last->reg() == pos && last->canRead() && pos < gapEnd) { pos += (last++)->size(); }
+        if (pos == gapEnd) { regList.insert(end(regList), first, last); } // Only fill if the gap is fully covered
+      }
+    }
+
+    regList.push_back(i);
+  }
+
+  _dev.plan = ReadPlan(regList);
+}
+
+/*!
+ * \brief Marks the device as offline and skips it for the next cycles
+ *
+ * The number of skipped cycles doubles with every failed cycle (up to setMaxBackoff()).
+ */
+void MBBus::deviceFailed(Device &_dev) {
+  if (_dev.online || _dev.failures == 0) { log::get()->warn("MBBus: unit {} is not responding", _dev.unitID); }
+
+  _dev.online = false;
+  _dev.skip   = min<uint32_t>(1u << min<uint32_t>(_dev.failures, 31), mMaxBackoff);
+  ++_dev.failures;
+}
+
+/*!
+ * \brief Updates the registers of all devices (one cycle)
+ *
+ * The batches of all devices are interleaved. Devices that are not identified yet are identified first. A device
+ * that does not answer is skipped for the rest of the cycle.
+ *
+ * \param[out] _numUpdated Number of updated registers (of all devices)
+ * \returns OK, MODBUS_CONNECTION_FAILED if the line is broken (reconnected in the next call) or the connect() error
+ */
+ErrorCode MBBus::updateRegisters(size_t *_numUpdated) {
+  trace::Span span("MBBus::updateRegisters", "bus");
+  auto const &logger = log::get();
+  if (_numUpdated) { *_numUpdated = 0; }
+
+  if (!isConnected()) {
+    ErrorCode res = connect();
+    if (res != ErrorCode::OK) { return res; }
+  }
+
+  auto start = steady_clock::now();
+
+  // 1st: select the devices of this cycle
+  vector<Device *> active;
+  for (Device &i : mDevices) {
+    if (i.skip > 0) {
+      --i.skip;
+      continue;
+    }
+
+    if (!i.registers && identify(i) != ErrorCode::OK) {
+      deviceFailed(i);
+      continue;
+    }
+
+    active.push_back(&i);
+  }
+
+  span.arg("devices", (int64_t)active.size());
+
+  // 2nd: interleave the batches
+  size_t numBatches = 0;
+  size_t numFailed  = 0;
+  size_t numUpdated = 0;
+  bool   broken     = false;
+  for (size_t round = 0; !broken; ++round) {
+    bool more = false;
+    for (Device *&i : active) {
+      if (!i || round >= i->plan.size()) { continue; }
+
+      ReadPlan::Batch const &batch = i->plan.batches()[round];
+      more                         = true;
+      ++numBatches;
+      ++i->requests;
+
+      mConn->setSlaveID(i->unitID);
+      vector<uint16_t> rawData = mConn->readRegisters(batch.start, batch.size);
+
+      if (rawData.size() != batch.size) {
+        ++numFailed;
+        ++i->failedBatches;
+
+        auto errClass = Statistics::classifyError(mConn->lastError());
+        if (errClass == Statistics::ErrorClass::CONNECTION) {
+          logger->error("MBBus: connection lost");
+          mConn->disconnect();
+          broken = true;
+          break;
+        }
+
+        if (errClass != Statistics::ErrorClass::EXCEPTION) {
+          deviceFailed(*i);
+          i = nullptr; // Skip the rest of the cycle
+        }
+        continue;
+      }
+
+      for (auto const &j : batch.regs) {
+        i->registers->updateRegister(j.reg, {rawData.data() + j.offset, j.size});
+        ++numUpdated;
+      }
+    }
+
+    if (!more) { break; }
+  }
+
+  if (!broken) {
+    for (Device *i : active) {
+      if (!i) { continue; }
+      i->online   = true;
+      i->failures = 0;
+    }
+  }
+
+  if (_numUpdated) { *_numUpdated = numUpdated; }
+  auto duration = duration_cast<microseconds>(steady_clock::now() - start);
+  mConn->statistics().recordCycle(numBatches, numFailed, numUpdated, duration);
+
+  return broken ? ErrorCode::MODBUS_CONNECTION_FAILED : ErrorCode::OK;
+}
@@ -0,0 +1,134 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "DataBase.hpp"
+#include "MBConnectionBase.hpp"
+#include "ReadPlan.hpp"
+#include "RegisterContainer.hpp"
+
+namespace modbusSMA {
+
+/*!
+ * \brief Scheduler for many devices (unit IDs) on one modbus line
+ *
+ * A ModbusAPI object owns its connection and always talks to the single unit ID it discovered in initialize(). On a
+ * multi-drop RS-485 line (or a TCP gateway with many unit IDs) all devices share one connection, so the bus owns the
+ * connection and schedules the requests of all devices:
+ *
+ *  - The batches of the devices are interleaved (round robin), so every device is updated at an even rate.
+ *  - The read plans are computed from the line timing: gaps between requested registers are bridged with known
+ *    registers of the device as long as transmitting them is cheaper than an additional request.
+ *  - The response and byte timeouts are derived from the line timing and the expected frame size, so a silent device
+ *    costs as little line time as possible.
+ *  - A device that does not answer is skipped for the rest of the cycle and then for an increasing number of cycles
+ *    (up to setMaxBackoff()).
+ *
+ * Devices are identified (inverter type, registers) with the first successful request, so they can be added before
+ * they are reachable.
+ *
+ * \code{.cpp}
+ * MBBus bus("/dev/ttyUSB0", 19200, 'N', 8, 1);
+ * for (uint8_t i = 3; i < 19; ++i) { bus.addDevice(i, {30529, 30775}); }
+ * bus.connect();
+ * bus.updateRegisters();          // One cycle for all devices
+ * auto reg = bus.getRegisters(3); // The RegisterContainer of unit 3
+ * \endcode
+ */
+class MBBus {
+ public:
+  //! Timing of the modbus line.
+  struct LineTiming {
+    std::chrono::microseconds charTime   = {}; //!< Time of one character (start, data, parity and stop bits).
+    std::chrono::microseconds frameGap   = {}; //!< Silent interval between two frames (3.5 characters, >= 1.75 ms).
+    std::chrono::microseconds turnaround = {}; //!< Maximum processing time of a device.
+
+    std::chrono::microseconds requestTime(uint32_t _numRegisters) const;
+    std::chrono::microseconds overhead() const;
+    uint32_t                  maxFill() const;
+  };
+
+  //! One device on the bus.
+  struct Device {
+    uint8_t                            unitID;                   //!< The modbus unit ID.
+    std::vector<uint16_t>              regList;                  //!< The requested registers (empty ==> all readable).
+    std::string                        inverterType   = "";      //!< The inverter type (empty if not identified).
+    uint32_t                           inverterTypeID = 0;       //!< The inverter type (ID).
+    std::shared_ptr<RegisterContainer> registers      = nullptr; //!< The registers (nullptr if not identified).
+    ReadPlan                           plan;                     //!< The batches of one cycle.
+    bool                               online        = false;    //!< The last request was answered.
+    uint32_t                           failures      = 0;        //!< Number of consecutive failed cycles.
+    uint32_t                           skip          = 0;        //!< Number of cycles to skip (backoff).
+    uint64_t                           requests      = 0;        //!< Number of requests.
+    uint64_t                           failedBatches = 0;        //!< Number of failed requests.
+  };
+
+ private:
+  std::unique_ptr<MBConnectionBase> mConn = nullptr;
+  std::shared_ptr<DataBase>         mDB   = nullptr;
+  std::vector<Device>               mDevices;
+  LineTiming                        mTiming;
+  uint32_t                          mMaxBackoff = 32;
+
+  ErrorCode identify(Device &_dev);
+  void      buildPlan(Device &_dev);
+  void      applyTimeouts();
+  void      deviceFailed(Device &_dev);
+  Device *  findDevice(uint8_t _unitID);
+
+ public:
+  MBBus() = delete;
+  MBBus(std::string               _device,
+        uint32_t                  _baud,
+        char                      _parity,
+        int                       _dataBit,
+        int                       _stopBit,
+        std::shared_ptr<DataBase> _db = nullptr);
+  MBBus(std::unique_ptr<MBConnectionBase> _conn, std::shared_ptr<DataBase> _db = nullptr);
+  virtual ~MBBus();
+
+  MBBus(MBBus const &) = delete;
+  void operator=(MBBus const &) = delete;
+
+  ErrorCode addDevice(uint8_t _unitID, std::vector<uint16_t> _regList = {});
+  ErrorCode connect();
+  void      disconnect();
+  ErrorCode updateRegisters(size_t *_numUpdated = nullptr);
+
+  std::shared_ptr<RegisterContainer> getRegisters(uint8_t _unitID);
+
+  void setTurnaround(std::chrono::microseconds _turnaround);
+  void setMaxBackoff(uint32_t _cycles) { mMaxBackoff = _cycles; } //!< Sets the max. number of skipped cycles.
+
+  inline std::vector<Device> const &devices() const { return mDevices; } //!< Returns all devices.
+  inline LineTiming                 timing() const { return mTiming; }   //!< Returns the line timing.
+  inline MBConnectionBase &         connection() { return *mConn; }      //!< Returns the connection.
+
+  inline bool isConnected() const { return mConn->isConnected(); } //!< Returns whether the line is connected.
+
+  static LineTiming lineTiming(uint32_t _baud, char _parity, int _dataBit, int _stopBit);
+};
+
+} // namespace modbusSMA
@@ -16,11 +16,14 @@
 
 #include "MBConnectionBase.hpp"
 
+#include <chrono>
 #include <modbus/modbus.h>
 
 #include "Logging.hpp"
+#include "Trace.hpp"
 
 using namespace std;
+using namespace std::chrono;
 using namespace modbusSMA;
 
 //! Disconnects the modbus connection if neccessary.
@@ -31,14 +34,19 @@ MBConnectionBase::~MBConnectionBase() { disconnect(); }
  * \note A previously established connection is disconnected when calling this function.
  */
 ErrorCode MBConnectionBase::connect() {
-  auto logger = log::get();
+  trace::Span span("connect", "modbus");
+  auto        logger = log::get();
   if (mConnection) { disconnect(); }
 
   mConnection = createModbusContext();
   if (!mConnection) { return ErrorCode::INVALID_MODBUS_CONTEXT; }
 
-  logger->debug("MBConnectionBase: Establishing the modbus connection");
-  if (modbus_connect(mConnection) == -1) {
+  SPDLOG_LOGGER_DEBUG(logger, "MBConnectionBase: Establishing the modbus connection");
+  auto start  = steady_clock::now();
+  int  result = modbus_connect(mConnection);
+  mStats->recordConnect(result != -1, duration_cast<microseconds>(steady_clock::now() - start));
+
+  if (result == -1) {
     logger->error("MBConnectionBase: Failed to establish the modbus connection: '{}'", modbus_strerror(errno));
     modbus_close(mConnection);
     modbus_free(mConnection);
@@ -46,14 +54,44 @@ ErrorCode MBConnectionBase::connect() {
     return ErrorCode::MODBUS_CONNECTION_FAILED;
   }
 
+  if (mTuning.isEnabled()) {
+    uint32_t sec  = 0;
+    uint32_t usec = 0;
+    modbus_get_response_timeout(mConnection, &sec, &usec);
+    mTuning.initialize(seconds(sec) + microseconds(usec)); // Keeps the learned timeout on a reconnect
+    applyTuning();
+  }
+
   return ErrorCode::OK;
 }
 
+//! Applies the response timeout of the adaptive tuning to the modbus context.
+void MBConnectionBase::applyTuning() {
+  auto timeout = mTuning.timeout().count();
+  if (!mConnection || timeout <= 0) { return; }
+
+  SPDLOG_LOGGER_DEBUG(log::get(), "MBConnectionBase: response timeout: {}us", timeout);
+  modbus_set_response_timeout(mConnection, (uint32_t)(timeout / 1000000), (uint32_t)(timeout % 1000000));
+}
+
+/*!
+ * \brief Creates a new (not connected) connection to the same device
+ *
+ * The new connection records its requests in the Statistics of this connection. The adaptive tuning is not shared.
+ *
+ * \returns The new connection or nullptr if the connection type can not be cloned (RTU)
+ */
+unique_ptr<MBConnectionBase> MBConnectionBase::clone() const {
+  auto conn = createClone();
+  if (conn) { conn->mStats = mStats; }
+  return conn;
+}
+
 //! Disconnects an active modbus connnection (if present, else does nothing).
 void MBConnectionBase::disconnect() {
   if (!mConnection) { return; }
 
-  log::get()->debug("MBConnectionBase: Closing the current modbus connection");
+  SPDLOG_LOGGER_DEBUG(log::get(), "MBConnectionBase: Closing the current modbus connection");
   modbus_close(mConnection);
   modbus_free(mConnection);
   mConnection = nullptr;
@@ -77,19 +115,68 @@ vector<uint16_t> MBConnectionBase::readRegisters(uint32_t _reg, uint32_t _num) {
     return {};
   }
 
+  if (!mConnection) { return {}; }
+
+  trace::Span span("readRegisters", "modbus");
+  span.arg("reg", _reg).arg("num", _num);
+
   vector<uint16_t> vecOut;
   vecOut.resize(_num);
 
-  if (modbus_read_registers(mConnection, _reg, _num, vecOut.data()) < 0) {
+  auto start    = steady_clock::now();
+  int  result   = modbus_read_registers(mConnection, _reg, _num, vecOut.data());
+  int  error    = result < 0 ? errno : 0;
+  auto duration = duration_cast<microseconds>(steady_clock::now() - start);
+  mStats->recordRequest(_num, duration, error);
+  if (mTuning.record(_num, duration, error)) { applyTuning(); }
+
+  if (result < 0) {
+    mLastError  = error;
     auto logger = log::get();
     logger->error("MBConnectionBase: readRegisters(_reg = {}, _num = {}): ", _reg, _num);
-    logger->error("  -- Request failed with '{}'", modbus_strerror(errno));
+    logger->error("  -- Request failed with '{}'", modbus_strerror(error));
     return {};
   }
 
+  mLastError = 0;
   return vecOut;
 }
 
+/*!
+ * \brief Writes _data to the registers starting at _reg
+ *
+ * The maximum number of registers is limited by SMA_MODBUS_MAX_REGISTER_COUNT
+ *
+ * \param _reg  The starting register
+ * \param _data The values to write
+ *
+ * \returns ErrorCode::OK on success
+ *          ErrorCode::INVALID_STATE if not connected
+ *          ErrorCode::ERROR when the request failed (see lastError())
+ */
+ErrorCode MBConnectionBase::writeRegisters(uint32_t _reg, vector<uint16_t> const &_data) {
+  if (_data.empty() || _data.size() > SMA_MODBUS_MAX_REGISTER_COUNT) {
+    log::get()->error("MBConnectionBase: writeRegisters(_reg = {}): invalid size {}", _reg, _data.size());
+    return ErrorCode::ERROR;
+  }
+
+  if (!mConnection) { return ErrorCode::INVALID_STATE; }
+
+  trace::Span span("writeRegisters", "modbus");
+  span.arg("reg", _reg).arg("num", (int64_t)_data.size());
+
+  if (modbus_write_registers(mConnection, (int)_reg, (int)_data.size(), _data.data()) < 0) {
+    mLastError  = errno;
+    auto logger = log::get();
+    logger->error("MBConnectionBase: writeRegisters(_reg = {}, _num = {}): ", _reg, _data.size());
+    logger->error("  -- Request failed with '{}'", modbus_strerror(mLastError));
+    return ErrorCode::ERROR;
+  }
+
+  mLastError = 0;
+  return ErrorCode::OK;
+}
+
 /*!
  * \brief Sets the slave/uinit ID of the modbus connection
  *
@@ -107,3 +194,31 @@ ErrorCode MBConnectionBase::setSlaveID(int _id) {
 
   return ErrorCode::OK;
 }
+
+/*!
+ * \brief Sets the response and byte timeouts of the modbus connection
+ *
+ * Disables the adaptive tuning (see tuning()), since the timeouts are fixed now.
+ *
+ * \param _response Maximum time to wait for the first byte of a response
+ * \param _byte     Maximum time between two bytes of a response
+ *
+ * \returns ErrorCode::OK on success
+ *          ErrorCode::INVALID_STATE if not connected
+ *          ErrorCode::ERROR when setting the timeouts failed
+ */
+ErrorCode MBConnectionBase::setTimeouts(microseconds _response, microseconds _byte) {
+  if (!isConnected()) { return ErrorCode::INVALID_STATE; }
+
+  mTuning.setEnabled(false);
+  auto toSec  = [](microseconds _t) { return (uint32_t)(_t.count() / 1000000); };
+  auto toUSec = [](microseconds _t) { return (uint32_t)(_t.count() % 1000000); };
+
+  if (modbus_set_response_timeout(mConnection, toSec(_response), toUSec(_response)) != 0 ||
+      modbus_set_byte_timeout(mConnection, toSec(_byte), toUSec(_byte)) != 0) {
+    log::get()->error("Failed to set the timeouts. Error: '{}'", modbus_strerror(errno));
+    return ErrorCode::ERROR;
+  }
+
+  return ErrorCode::OK;
+}
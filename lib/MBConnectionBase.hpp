@@ -19,11 +19,15 @@
 
 #include "mSMAConfig.hpp"
 
+#include <chrono>
+#include <memory>
 #include <modbus/modbus.h>
 #include <string>
 #include <vector>
 
+#include "AdaptiveTuning.hpp"
 #include "Enums.hpp"
+#include "Statistics.hpp"
 
 namespace modbusSMA {
 
@@ -40,11 +44,19 @@ namespace modbusSMA {
  */
 class MBConnectionBase {
  private:
-  modbus_t *mConnection = nullptr;
+  modbus_t *                  mConnection = nullptr;
+  std::shared_ptr<Statistics> mStats      = std::make_shared<Statistics>();
+  AdaptiveTuning              mTuning;
+  int                         mLastError = 0;
+
+  void applyTuning();
 
  protected:
   virtual modbus_t *createModbusContext() = 0; //!< Create and return the modbus context.
 
+  //! Creates a new (not connected) connection with the same configuration. Returns nullptr if not supported.
+  virtual std::unique_ptr<MBConnectionBase> createClone() const { return nullptr; }
+
  public:
   MBConnectionBase() = default;
   virtual ~MBConnectionBase();
@@ -54,12 +66,19 @@ class MBConnectionBase {
 
   ErrorCode connect();
   ErrorCode setSlaveID(int _id);
+  ErrorCode setTimeouts(std::chrono::microseconds _response, std::chrono::microseconds _byte);
   void      disconnect();
   bool      isConnected() const { return mConnection != nullptr; } //!< Returns whether a valid conection exists.
 
   std::vector<uint16_t> readRegisters(uint32_t _reg, uint32_t _num);
+  ErrorCode             writeRegisters(uint32_t _reg, std::vector<uint16_t> const &_data);
+
+  std::unique_ptr<MBConnectionBase> clone() const;
 
-  inline modbus_t *getConnection() { return mConnection; } //!< Returns the raw connection. DO NOT close OR free it.
+  inline modbus_t *      getConnection() { return mConnection; }  //!< The raw connection. DO NOT close OR free it.
+  inline Statistics &    statistics() { return *mStats; }         //!< Returns the request statistics.
+  inline AdaptiveTuning &tuning() { return mTuning; }             //!< Returns the adaptive timeout and batch size.
+  inline int             lastError() const { return mLastError; } //!< errno of the last failed request (0 = none).
 
   virtual ConnectionType type()        = 0; //!< Returns the modbus connection type.
   virtual std::string    description() = 0; //!< Textual description of the connection.
@@ -33,7 +33,7 @@ MBConnectionIP::MBConnectionIP(std::string _ip, uint32_t _port) : mIP(_ip), mPor
  */
 modbus_t *MBConnectionIP::createModbusContext() {
   auto logger = log::get();
-  logger->debug("MBConnectionIP: Creating modbus context for {} port: {}", mIP, mPort);
+  SPDLOG_LOGGER_DEBUG(logger, "MBConnectionIP: Creating modbus context for {} port: {}", mIP, mPort);
   modbus_t *ctx = modbus_new_tcp(mIP.c_str(), (int)mPort);
 
   if (!ctx) {
@@ -45,3 +45,6 @@ modbus_t *MBConnectionIP::createModbusContext() {
 }
 
 string MBConnectionIP::description() { return fmt::format("TCP-IP: {}:{}", mIP, mPort); }
+
+//! Creates a new connection to the same server.
+unique_ptr<MBConnectionBase> MBConnectionIP::createClone() const { return make_unique<MBConnectionIP>(mIP, mPort); }
@@ -32,7 +32,8 @@ class MBConnectionIP : public MBConnectionBase {
   uint32_t    mPort;
 
  protected:
-  modbus_t *createModbusContext() override;
+  modbus_t *                        createModbusContext() override;
+  std::unique_ptr<MBConnectionBase> createClone() const override;
 
  public:
   MBConnectionIP() = delete;
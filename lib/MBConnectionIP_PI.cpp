@@ -33,7 +33,7 @@ MBConnectionIP_PI::MBConnectionIP_PI(std::string _node, std::string _service) :
  */
 modbus_t *MBConnectionIP_PI::createModbusContext() {
   auto logger = log::get();
-  logger->debug("MBConnectionIP_PI: Creating modbus context for Node: {} Service: {}", mNode, mService);
+  SPDLOG_LOGGER_DEBUG(logger, "MBConnectionIP_PI: Creating modbus context for Node: {} Service: {}", mNode, mService);
   modbus_t *ctx = modbus_new_tcp_pi(mNode.c_str(), mService.c_str());
 
   if (!ctx) {
@@ -45,3 +45,8 @@ modbus_t *MBConnectionIP_PI::createModbusContext() {
 }
 
 string MBConnectionIP_PI::description() { return fmt::format("TCP Node: '{}'; Service: '{}'", mNode, mService); }
+
+//! Creates a new connection to the same server.
+unique_ptr<MBConnectionBase> MBConnectionIP_PI::createClone() const {
+  return make_unique<MBConnectionIP_PI>(mNode, mService);
+}
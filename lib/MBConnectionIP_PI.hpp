@@ -32,7 +32,8 @@ class MBConnectionIP_PI : public MBConnectionBase {
   std::string mService;
 
  protected:
-  modbus_t *createModbusContext() override;
+  modbus_t *                        createModbusContext() override;
+  std::unique_ptr<MBConnectionBase> createClone() const override;
 
  public:
   MBConnectionIP_PI() = delete;
@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MBConnectionPool.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+
+#include "Logging.hpp"
+#include "Trace.hpp"
+
+using namespace std;
+using namespace modbusSMA;
+
+namespace {
+
+const auto RECONNECT_MIN = chrono::seconds(1);
+const auto RECONNECT_MAX = chrono::seconds(60);
+
+} // namespace
+
+/*!
+ * \brief Opens up to _count additional connections to the device of _main
+ *
+ * Connections that can not be established are dropped (see size()).
+ */
+MBConnectionPool::MBConnectionPool(MBConnectionBase &_main, size_t _count) {
+  auto logger = log::get();
+  for (size_t i = 0; i < _count; ++i) {
+    auto conn = _main.clone();
+    if (!conn) {
+      logger->warn("MBConnectionPool: {} does not support multiple connections", _main.description());
+      break;
+    }
+
+    if (conn->connect() != ErrorCode::OK) {
+      logger->warn("MBConnectionPool: only {} of {} additional connections could be established", i, _count);
+      break;
+    }
+
+    mWorkers.push_back({move(conn), thread(), true});
+  }
+
+  for (size_t i = 0; i < mWorkers.size(); ++i) { mWorkers[i].thread = thread(&MBConnectionPool::run, this, i); }
+  SPDLOG_LOGGER_DEBUG(logger, "MBConnectionPool: {} additional connections", mWorkers.size());
+}
+
+//! Stops the worker threads and closes the connections.
+MBConnectionPool::~MBConnectionPool() {
+  {
+    lock_guard<mutex> lock(mLock);
+    mStop = true;
+  }
+
+  mStart.notify_all();
+  for (auto &i : mWorkers) { i.thread.join(); }
+}
+
+//! Sets the slave / unit ID of all connections (also used for reconnects).
+ErrorCode MBConnectionPool::setSlaveID(int _id) {
+  mSlaveID = _id;
+  for (auto &i : mWorkers) {
+    ErrorCode res = i.conn->setSlaveID(_id);
+    if (res != ErrorCode::OK) { return res; }
+  }
+
+  return ErrorCode::OK;
+}
+
+/*!
+ * \brief Reads all batches of _plan with the main and the additional connections
+ *
+ * \param _plan   The batches to read
+ * \param _main   The main connection (used by the calling thread)
+ * \param _out    The raw data per batch (an empty vector if the batch failed)
+ * \param _errors The errno of the connection that read the batch per batch (0 if the batch was read)
+ */
+void MBConnectionPool::read(ReadPlan const &          _plan,
+                            MBConnectionBase &        _main,
+                            vector<vector<uint16_t>> &_out,
+                            vector<int> &             _errors) {
+  trace::Span span("MBConnectionPool::read", "modbus");
+  span.arg("batches", (int64_t)_plan.size());
+
+  _out.assign(_plan.size(), {});
+  _errors.assign(_plan.size(), ENOTCONN); // Batches are not read if all connections are lost
+  {
+    lock_guard<mutex> lock(mLock);
+    mPlan   = &_plan;
+    mOut    = &_out;
+    mErrors = &_errors;
+    mNext.store(0);
+    mBusy = (size_t)count_if(begin(mWorkers), end(mWorkers), [](Worker const &_w) { return _w.ready; });
+    ++mGeneration;
+  }
+
+  mStart.notify_all();
+  work(_main);
+
+  unique_lock<mutex> lock(mLock);
+  mDone.wait(lock, [this]() { return mBusy == 0; });
+  mPlan   = nullptr;
+  mOut    = nullptr;
+  mErrors = nullptr;
+}
+
+//! Reads batches until all batches of the current read() are assigned.
+void MBConnectionPool::work(MBConnectionBase &_conn) {
+  if (!_conn.isConnected()) { return; }
+
+  for (size_t i = mNext.fetch_add(1); i < mPlan->size(); i = mNext.fetch_add(1)) {
+    ReadPlan::Batch const &batch = mPlan->batches()[i];
+    (*mOut)[i]                   = _conn.readRegisters(batch.start, batch.size);
+    (*mErrors)[i]                = (*mOut)[i].empty() ? _conn.lastError() : 0;
+
+    if ((*mOut)[i].empty() && Statistics::classifyError(_conn.lastError()) == Statistics::ErrorClass::CONNECTION) {
+      _conn.disconnect(); // Reconnected by the worker outside of read()
+      return;
+    }
+  }
+}
+
+/*!
+ * \brief Worker thread main loop
+ *
+ * A worker that lost its connection is not ready and does not take part in read(). It reconnects without holding the
+ * lock, so read() never waits for a connect timeout.
+ */
+void MBConnectionPool::run(size_t _index) {
+  if (trace::isEnabled()) { trace::setThreadName("connection " + to_string(_index + 2)); }
+
+  Worker &           worker  = mWorkers[_index];
+  MBConnectionBase & conn    = *worker.conn;
+  uint64_t           seen    = 0;
+  auto               backoff = chrono::duration_cast<chrono::milliseconds>(RECONNECT_MIN);
+  unique_lock<mutex> lock(mLock);
+
+  while (!mStop) {
+    if (!worker.ready) {
+      lock.unlock();
+      bool connected = conn.connect() == ErrorCode::OK;
+      if (connected && mSlaveID >= 0) { conn.setSlaveID(mSlaveID); }
+      lock.lock();
+
+      if (connected) {
+        SPDLOG_LOGGER_DEBUG(log::get(), "MBConnectionPool: connection {} reestablished", _index + 2);
+        worker.ready = true;
+        seen         = mGeneration; // A read() that is already running does not wait for this worker
+        backoff      = RECONNECT_MIN;
+      } else {
+        mStart.wait_for(lock, backoff, [this]() { return mStop; });
+        backoff = min<chrono::milliseconds>(backoff * 2, RECONNECT_MAX);
+      }
+      continue;
+    }
+
+    mStart.wait(lock, [&]() { return mStop || mGeneration != seen; });
+    if (mStop) { return; }
+
+    seen = mGeneration;
+    lock.unlock();
+    work(conn);
+    lock.lock();
+
+    worker.ready = conn.isConnected();
+    if (--mBusy == 0) { mDone.notify_one(); }
+  }
+}
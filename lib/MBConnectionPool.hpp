@@ -0,0 +1,91 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "MBConnectionBase.hpp"
+#include "ReadPlan.hpp"
+
+namespace modbusSMA {
+
+/*!
+ * \brief Additional connections to the same device for striped reads
+ *
+ * Every connection of the pool is a clone (MBConnectionBase::clone()) of the main connection and has its own worker
+ * thread. read() distributes the batches of a ReadPlan over the main connection (calling thread) and the pool. The
+ * batches are assigned dynamically, so a slow connection gets fewer batches.
+ *
+ * A pool connection that lost its connection is excluded from read() and reconnected by its worker thread in the
+ * background (exponential backoff between the attempts). Its batches are taken by the other connections in the
+ * meantime.
+ *
+ * \note Used by ModbusAPI::setConnectionCount()
+ */
+class MBConnectionPool {
+ private:
+  //! One additional connection.
+  struct Worker {
+    std::unique_ptr<MBConnectionBase> conn;
+    std::thread                       thread;
+    bool                              ready = true; //!< Connected and taking part in read() (mLock).
+  };
+
+  std::vector<Worker> mWorkers;
+  int                 mSlaveID = -1;
+
+  std::mutex              mLock;
+  std::condition_variable mStart;
+  std::condition_variable mDone;
+  uint64_t                mGeneration = 0; //!< Incremented for every read().
+  size_t                  mBusy       = 0; //!< Number of ready workers working on the current read().
+  bool                    mStop       = false;
+
+  ReadPlan const *                    mPlan   = nullptr;
+  std::vector<std::vector<uint16_t>> *mOut    = nullptr;
+  std::vector<int> *                  mErrors = nullptr;
+  std::atomic<size_t>                 mNext   = {0};
+
+  void run(size_t _index);
+  void work(MBConnectionBase &_conn);
+
+ public:
+  MBConnectionPool() = delete;
+  MBConnectionPool(MBConnectionBase &_main, size_t _count);
+  ~MBConnectionPool();
+
+  MBConnectionPool(MBConnectionPool const &) = delete;
+  void operator=(MBConnectionPool const &) = delete;
+
+  ErrorCode setSlaveID(int _id);
+  void      read(ReadPlan const &                    _plan,
+                 MBConnectionBase &                  _main,
+                 std::vector<std::vector<uint16_t>> &_out,
+                 std::vector<int> &                  _errors);
+
+  inline size_t size() const { return mWorkers.size(); } //!< Number of additional connections.
+};
+
+} // namespace modbusSMA
@@ -0,0 +1,282 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MBGateway.hpp"
+
+#include <algorithm>
+#include <modbus/modbus.h>
+
+#include "Logging.hpp"
+#include "ReadPlan.hpp"
+#include "Trace.hpp"
+
+using namespace std;
+using namespace std::chrono;
+using namespace modbusSMA;
+
+/*!
+ * \brief Creates the gateway
+ *
+ * \param _api        The upstream connection (reconnected by the gateway if neccessary)
+ * \param _defaultTTL The time to live of all registers without an explicit TTL (setTTL())
+ */
+MBGateway::MBGateway(ModbusAPI &_api, milliseconds _defaultTTL)
+    : mAPI(_api), mDefaultTTL(_defaultTTL), mWordToEntry(UINT16_MAX + 1, -1), mImage(UINT16_MAX + 1, 0) {
+  if (mAPI.getState() == State::INITIALIZED) { buildLayout(); }
+}
+
+//! Sets the time to live of a single register.
+void MBGateway::setTTL(uint16_t _reg, milliseconds _ttl) {
+  mTTL[_reg] = _ttl;
+
+  int32_t idx = mWordToEntry[_reg];
+  if (idx >= 0 && mEntries[idx].reg == _reg) { mEntries[idx].ttl = _ttl; }
+}
+
+//! Returns the request counters. Can be called from any thread.
+MBGateway::Counters MBGateway::counters() const {
+  Counters c;
+  c.reads          = mReads.load(memory_order_relaxed);
+  c.hits           = mHits.load(memory_order_relaxed);
+  c.misses         = mMisses.load(memory_order_relaxed);
+  c.writes         = mWrites.load(memory_order_relaxed);
+  c.upstreamReads  = mUpstreamReads.load(memory_order_relaxed);
+  c.upstreamErrors = mUpstreamErrors.load(memory_order_relaxed);
+  return c;
+}
+
+//! Maps the errno of a failed libmodbus request to the exception for the downstream client.
+MBException MBGateway::toException(int _errno) {
+  switch (_errno) {
+    case EMBXILFUN: return MBException::ILLEGAL_FUNCTION;
+    case EMBXILADD: return MBException::ILLEGAL_DATA_ADDRESS;
+    case EMBXILVAL: return MBException::ILLEGAL_DATA_VALUE;
+    case EMBXSFAIL: return MBException::SERVER_FAILURE;
+    case EMBXSBUSY: return MBException::SERVER_BUSY;
+    case EMBXGPATH: return MBException::GATEWAY_PATH;
+    default: return MBException::GATEWAY_TARGET;
+  }
+}
+
+//! Creates the cache entries for all readable registers. Invalidates the cache.
+void MBGateway::buildLayout() {
+  auto container = mAPI.getRegisters();
+  mEntries.clear();
+  fill(begin(mWordToEntry), end(mWordToEntry), -1);
+
+  for (Register const &i : container->registers()) {
+    if (!i.canRead() || i.isVirtual() || (uint32_t)i.reg() + i.size() > UINT16_MAX + 1u) { continue; }
+
+    auto ttl = mTTL.find(i.reg());
+    mEntries.push_back({i.reg(), (uint16_t)i.size(), ttl == end(mTTL) ? mDefaultTTL : ttl->second, {}});
+
+    for (uint32_t j = i.reg(); j < (uint32_t)i.reg() + i.size(); ++j) {
+      if (mWordToEntry[j] < 0) { mWordToEntry[j] = (int32_t)mEntries.size() - 1; }
+    }
+  }
+
+  SPDLOG_LOGGER_DEBUG(log::get(), "MBGateway: caching {} registers", mEntries.size());
+}
+
+/*!
+ * \brief Checks the upstream connection and reconnects if neccessary
+ *
+ * Reconnects are rate limited, so a missing inverter is not hammered by every downstream request.
+ */
+bool MBGateway::upstreamReady() {
+  if (mAPI.getState() == State::INITIALIZED) {
+    if (mEntries.empty()) { buildLayout(); }
+    return true;
+  }
+
+  auto now = steady_clock::now();
+  if (mLastConnect != TimePoint() && now - mLastConnect < mReconnectDelay) { return false; }
+  mLastConnect = now;
+
+  mAPI.reset();
+  ErrorCode res = mAPI.setup();
+  if (res != ErrorCode::OK) {
+    log::get()->warn("MBGateway: upstream reconnect failed with '{}'", enum2Str::toStr(res));
+    return false;
+  }
+
+  buildLayout();
+  return true;
+}
+
+//! Marks all cached registers in [_reg, _reg + _count) as stale.
+void MBGateway::invalidate(uint16_t _reg, uint16_t _count) {
+  for (uint32_t i = _reg; i < (uint32_t)_reg + _count && i <= UINT16_MAX; ++i) {
+    if (mWordToEntry[i] >= 0) { mEntries[mWordToEntry[i]].valid = false; }
+  }
+}
+
+/*!
+ * \brief Fetches the registers of the entries in _entries from the inverter
+ *
+ * The registers are merged into as few requests as possible (ReadPlan). The RegisterContainer of the ModbusAPI is
+ * updated as well.
+ */
+void MBGateway::fetch(vector<uint32_t> &_entries) {
+  trace::Span span("MBGateway::fetch", "gateway");
+  span.arg("registers", (int64_t)_entries.size());
+
+  sort(begin(_entries), end(_entries)); // mEntries is sorted by address
+
+  vector<uint16_t> addresses;
+  addresses.reserve(_entries.size());
+  for (uint32_t i : _entries) { addresses.push_back(mEntries[i].reg); }
+
+  auto     container = mAPI.getRegisters();
+  ReadPlan plan(container->getRegisters(addresses));
+
+  for (auto const &i : plan) {
+    mUpstreamReads.fetch_add(1, memory_order_relaxed);
+    vector<uint16_t> raw = mAPI.readRaw(i.start, i.size);
+    TimePoint        now = steady_clock::now();
+
+    if (raw.size() != i.size) {
+      mUpstreamErrors.fetch_add(1, memory_order_relaxed);
+      int error = mAPI.lastError();
+      if (Statistics::classifyError(error) != Statistics::ErrorClass::EXCEPTION) {
+        log::get()->warn("MBGateway: upstream connection lost");
+        mAPI.reset(); // Reconnect with the next request
+        return;
+      }
+
+      for (auto const &j : i.regs) { // Cache the exception of the inverter
+        Entry &e    = mEntries[mWordToEntry[j.reg]];
+        e.fetched   = now;
+        e.valid     = true;
+        e.exception = toException(error);
+      }
+      continue;
+    }
+
+    copy(begin(raw), end(raw), begin(mImage) + i.start);
+    for (auto const &j : i.regs) {
+      Entry &e    = mEntries[mWordToEntry[j.reg]];
+      e.fetched   = now;
+      e.valid     = true;
+      e.exception = MBException::NONE;
+      container->updateRegister(j.reg, {raw.data() + j.offset, j.size});
+    }
+  }
+}
+
+/*!
+ * \brief Answers the requests of one event loop iteration
+ *
+ * 1. Writes are forwarded (and invalidate the cache), so reads of the same iteration see the new values
+ * 2. The stale registers of all reads are fetched together
+ * 3. The reads are answered from the cache
+ */
+void MBGateway::handleRequests(vector<MBRequest> const &_requests, vector<MBResponse> &_responses) {
+  trace::Span span("MBGateway::handleRequests", "gateway");
+  span.arg("requests", (int64_t)_requests.size());
+
+  auto             now   = steady_clock::now();
+  bool             ready = upstreamReady();
+  vector<uint32_t> toFetch;
+  vector<bool>     done(_requests.size(), false);
+  ++mRound;
+
+  auto setException = [&](size_t _idx, MBException _exception) {
+    _responses[_idx].action    = MBResponse::Action::EXCEPTION;
+    _responses[_idx].exception = _exception;
+    done[_idx]                 = true;
+  };
+
+  // 1st: forward the writes
+  for (size_t i = 0; i < _requests.size(); ++i) {
+    MBRequest const &req = _requests[i];
+    if (req.function != (uint8_t)MBFunction::WRITE_SINGLE_REGISTER &&
+        req.function != (uint8_t)MBFunction::WRITE_MULTIPLE_REGISTERS) {
+      continue;
+    }
+
+    mWrites.fetch_add(1, memory_order_relaxed);
+    done[i] = true;
+    if (!ready) {
+      setException(i, MBException::GATEWAY_PATH);
+      continue;
+    }
+
+    invalidate(req.address, req.count);
+    if (mAPI.writeRaw(req.address, req.data) != ErrorCode::OK) {
+      int error = mAPI.lastError();
+      mUpstreamErrors.fetch_add(1, memory_order_relaxed);
+      setException(i, toException(error));
+
+      if (Statistics::classifyError(error) != Statistics::ErrorClass::EXCEPTION) {
+        log::get()->warn("MBGateway: upstream connection lost");
+        mAPI.reset();
+        ready = false;
+      }
+    }
+  }
+
+  // 2nd: collect the stale registers of all reads
+  for (size_t i = 0; i < _requests.size(); ++i) {
+    MBRequest const &req = _requests[i];
+    if (done[i]) { continue; }
+
+    mReads.fetch_add(1, memory_order_relaxed);
+    uint32_t last = (uint32_t)req.address + req.count;
+    bool     hit  = true;
+    for (uint32_t j = req.address; j < last;) {
+      int32_t idx = j <= UINT16_MAX ? mWordToEntry[j] : -1;
+      if (idx < 0) {
+        setException(i, MBException::ILLEGAL_DATA_ADDRESS);
+        break;
+      }
+
+      Entry &e = mEntries[idx];
+      if (isStale(e, now)) {
+        hit = false;
+        if (e.round != mRound) { toFetch.push_back((uint32_t)idx); }
+        e.round = mRound;
+      }
+
+      j = (uint32_t)e.reg + e.size;
+    }
+
+    if (!done[i]) { (hit ? mHits : mMisses).fetch_add(1, memory_order_relaxed); }
+  }
+
+  // 3rd: fetch them
+  if (ready && !toFetch.empty()) { fetch(toFetch); }
+
+  // 4th: answer the reads
+  for (size_t i = 0; i < _requests.size(); ++i) {
+    MBRequest const &req = _requests[i];
+    if (done[i]) { continue; }
+
+    uint32_t last = (uint32_t)req.address + req.count;
+    for (uint32_t j = req.address; j < last && !done[i];) {
+      Entry const &e = mEntries[mWordToEntry[j]];
+      if (isStale(e, now)) {
+        setException(i, ready ? MBException::GATEWAY_TARGET : MBException::GATEWAY_PATH);
+      } else if (e.exception != MBException::NONE) {
+        setException(i, e.exception);
+      }
+
+      j = (uint32_t)e.reg + e.size;
+    }
+
+    if (!done[i]) { _responses[i].data.assign(begin(mImage) + req.address, begin(mImage) + last); }
+  }
+}
@@ -0,0 +1,114 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+
+#include "MBServer.hpp"
+#include "ModbusAPI.hpp"
+
+namespace modbusSMA {
+
+/*!
+ * \brief Caching Modbus TCP gateway for one inverter
+ *
+ * Many downstream clients share the single upstream connection of a ModbusAPI object. Reads are answered from a cache
+ * of all readable registers of the RegisterContainer. A register is only fetched from the inverter if its time to
+ * live (TTL) has expired. All registers that are missing for the requests of one event loop iteration are fetched
+ * together with a ReadPlan, so the upstream load depends on the TTLs and not on the number of clients. Writes are
+ * forwarded immediately and invalidate the cached registers.
+ *
+ * Modbus exceptions of the inverter are cached as well. Reads of addresses that are not part of a readable register
+ * are answered with MBException::ILLEGAL_DATA_ADDRESS without an upstream request.
+ *
+ * \note The upstream requests are executed in the event loop, so requests of other clients are queued (and merged)
+ *       while the inverter is busy.
+ * \note The unit ID of the requests is ignored, since there is only one upstream device.
+ */
+class MBGateway : public MBServer {
+ public:
+  //! Request counters.
+  struct Counters {
+    uint64_t reads          = 0; //!< Number of downstream read requests.
+    uint64_t hits           = 0; //!< Read requests that were answered without an upstream request.
+    uint64_t misses         = 0; //!< Read requests that required an upstream request.
+    uint64_t writes         = 0; //!< Number of forwarded write requests.
+    uint64_t upstreamReads  = 0; //!< Number of upstream read requests.
+    uint64_t upstreamErrors = 0; //!< Number of failed upstream requests.
+  };
+
+ private:
+  typedef std::chrono::steady_clock::duration   Duration;
+  typedef std::chrono::steady_clock::time_point TimePoint;
+
+  //! One cached register.
+  struct Entry {
+    uint16_t    reg;                           //!< The register address.
+    uint16_t    size;                          //!< Number of modbus registers.
+    Duration    ttl;                           //!< Time to live of the cached value.
+    TimePoint   fetched;                       //!< When the value (or exception) was received.
+    bool        valid     = false;             //!< fetched is valid.
+    MBException exception = MBException::NONE; //!< The cached exception of the inverter.
+    uint64_t    round     = 0;                 //!< Last handleRequests() call that requested the entry.
+  };
+
+  ModbusAPI &mAPI;
+  Duration   mDefaultTTL;
+  Duration   mReconnectDelay = std::chrono::seconds(5);
+  TimePoint  mLastConnect    = {};
+  uint64_t   mRound          = 0;
+
+  std::unordered_map<uint16_t, Duration> mTTL; //!< Register --> TTL overrides.
+
+  std::vector<Entry>    mEntries;     //!< Sorted by register address.
+  std::vector<int32_t>  mWordToEntry; //!< Modbus register address --> index in mEntries (or -1).
+  std::vector<uint16_t> mImage;       //!< Cached data by modbus register address.
+
+  std::atomic<uint64_t> mReads          = {0};
+  std::atomic<uint64_t> mHits           = {0};
+  std::atomic<uint64_t> mMisses         = {0};
+  std::atomic<uint64_t> mWrites         = {0};
+  std::atomic<uint64_t> mUpstreamReads  = {0};
+  std::atomic<uint64_t> mUpstreamErrors = {0};
+
+  bool upstreamReady();
+  void buildLayout();
+  void fetch(std::vector<uint32_t> &_entries);
+  void invalidate(uint16_t _reg, uint16_t _count);
+
+  inline bool isStale(Entry const &_e, TimePoint _now) const { return !_e.valid || _now - _e.fetched > _e.ttl; }
+
+ protected:
+  void handleRequests(std::vector<MBRequest> const &_requests, std::vector<MBResponse> &_responses) override;
+
+ public:
+  MBGateway() = delete;
+  MBGateway(ModbusAPI &_api, std::chrono::milliseconds _defaultTTL = std::chrono::milliseconds(1000));
+
+  void     setTTL(uint16_t _reg, std::chrono::milliseconds _ttl);
+  Counters counters() const;
+
+  static MBException toException(int _errno);
+};
+
+} // namespace modbusSMA
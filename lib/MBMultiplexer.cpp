@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MBMultiplexer.hpp"
+
+#include <algorithm>
+
+#include "Logging.hpp"
+#include "Trace.hpp"
+
+using namespace std;
+using namespace std::chrono;
+using namespace modbusSMA;
+
+/*!
+ * \brief Creates the multiplexer and starts the worker thread
+ * \param _api The shared connection (reconnected by the multiplexer if neccessary)
+ */
+MBMultiplexer::MBMultiplexer(ModbusAPI &_api) : mAPI(_api) { mWorker = thread(&MBMultiplexer::run, this); }
+
+MBMultiplexer::~MBMultiplexer() { stop(); }
+
+/*!
+ * \brief Stops the worker thread
+ *
+ * Already queued requests are still executed. New requests fail with ErrorCode::INVALID_STATE.
+ */
+void MBMultiplexer::stop() {
+  {
+    lock_guard<mutex> lock(mLock);
+    mStop = true;
+  }
+
+  mCond.notify_all();
+  if (mWorker.joinable()) { mWorker.join(); }
+}
+
+//! Returns the request counters. Can be called from any thread.
+MBMultiplexer::Counters MBMultiplexer::counters() const {
+  Counters c;
+  c.reads  = mReads.load(memory_order_relaxed);
+  c.joined = mJoined.load(memory_order_relaxed);
+  c.merged = mMerged.load(memory_order_relaxed);
+  c.cycles = mCycles.load(memory_order_relaxed);
+  c.writes = mWrites.load(memory_order_relaxed);
+  c.tasks  = mTasks.load(memory_order_relaxed);
+  return c;
+}
+
+/*!
+ * \brief Reads the registers in _regList
+ *
+ * Can be called from any thread. Unsupported registers are not part of the result (ErrorCode::ERROR).
+ *
+ * \param _regList The registers to fetch
+ * \returns The future result
+ */
+future<MBMultiplexer::Result> MBMultiplexer::readAsync(vector<uint16_t> _regList) {
+  auto job  = make_shared<Job>();
+  job->kind = Job::Kind::READ;
+  job->regs = move(_regList);
+  sort(begin(job->regs), end(job->regs));
+  job->regs.erase(unique(begin(job->regs), end(job->regs)), end(job->regs));
+
+  auto res = job->result.get_future();
+  mReads.fetch_add(1, memory_order_relaxed);
+  submit(job);
+  return res;
+}
+
+/*!
+ * \brief Writes raw data to the modbus registers starting at _reg (see ModbusAPI::writeRaw())
+ *
+ * Can be called from any thread.
+ */
+future<ErrorCode> MBMultiplexer::writeAsync(uint16_t _reg, vector<uint16_t> _data) {
+  auto job  = make_shared<Job>();
+  job->kind = Job::Kind::WRITE;
+  job->reg  = _reg;
+  job->data = move(_data);
+
+  auto res = job->status.get_future();
+  mWrites.fetch_add(1, memory_order_relaxed);
+  submit(job);
+  return res;
+}
+
+/*!
+ * \brief Executes _task with the ModbusAPI object in the worker thread
+ *
+ * Can be called from any thread. The task must not call functions of the multiplexer.
+ */
+future<ErrorCode> MBMultiplexer::executeAsync(Task _task) {
+  auto job  = make_shared<Job>();
+  job->kind = Job::Kind::TASK;
+  job->task = move(_task);
+
+  auto res = job->status.get_future();
+  mTasks.fetch_add(1, memory_order_relaxed);
+  submit(job);
+  return res;
+}
+
+//! Blocking version of readAsync().
+MBMultiplexer::Result MBMultiplexer::read(vector<uint16_t> _regList) { return readAsync(move(_regList)).get(); }
+
+//! Blocking version of writeAsync().
+ErrorCode MBMultiplexer::write(uint16_t _reg, vector<uint16_t> _data) { return writeAsync(_reg, move(_data)).get(); }
+
+//! Blocking version of executeAsync().
+ErrorCode MBMultiplexer::execute(Task _task) { return executeAsync(move(_task)).get(); }
+
+
+
+/*!
+ * \brief Queues a job or lets a read join the running read
+ *
+ * A read only joins the running read if no write or task is queued, so it can not miss the result of an earlier
+ * write.
+ */
+void MBMultiplexer::submit(JobPtr _job) {
+  unique_lock<mutex> lock(mLock);
+  if (mStop) {
+    lock.unlock();
+    log::get()->error("MBMultiplexer: request submitted after stop()");
+    if (_job->kind == Job::Kind::READ) {
+      _job->result.set_value({ErrorCode::INVALID_STATE, {}});
+    } else {
+      _job->status.set_value(ErrorCode::INVALID_STATE);
+    }
+    return;
+  }
+
+  if (_job->kind == Job::Kind::READ && mBusy &&
+      none_of(begin(mQueue), end(mQueue), [](JobPtr const &i) { return i->kind != Job::Kind::READ; }) &&
+      includes(begin(mRunningRegs), end(mRunningRegs), begin(_job->regs), end(_job->regs))) {
+    mJoined.fetch_add(1, memory_order_relaxed);
+    mRunning.push_back(_job);
+    return;
+  }
+
+  mQueue.push_back(_job);
+  lock.unlock();
+  mCond.notify_one();
+}
+
+/*!
+ * \brief Checks the connection and reconnects if neccessary
+ *
+ * Reconnects are rate limited, so a missing inverter is not hammered by every request.
+ */
+bool MBMultiplexer::upstreamReady() {
+  if (mAPI.getState() == State::INITIALIZED) { return true; }
+
+  auto now = steady_clock::now();
+  if (mLastConnect != steady_clock::time_point() && now - mLastConnect < mReconnectDelay) { return false; }
+  mLastConnect = now;
+
+  mAPI.reset();
+  ErrorCode res = mAPI.setup();
+  if (res != ErrorCode::OK) {
+    log::get()->warn("MBMultiplexer: reconnect failed with '{}'", enum2Str::toStr(res));
+    return false;
+  }
+
+  return true;
+}
+
+//! Worker thread main loop.
+void MBMultiplexer::run() {
+  trace::setThreadName("multiplexer");
+  unique_lock<mutex> lock(mLock);
+
+  while (true) {
+    mCond.wait(lock, [this]() { return mStop || !mQueue.empty(); });
+    if (mQueue.empty()) { return; } // Stopped and all requests are done
+
+    if (mQueue.front()->kind == Job::Kind::READ) {
+      runReads(lock);
+      continue;
+    }
+
+    JobPtr job = mQueue.front();
+    mQueue.pop_front();
+    lock.unlock();
+
+    ErrorCode res = ErrorCode::INVALID_STATE;
+    if (job->kind == Job::Kind::TASK) {
+      trace::Span span("MBMultiplexer::task", "multiplexer");
+      res = job->task(mAPI);
+    } else if (upstreamReady()) {
+      trace::Span span("MBMultiplexer::write", "multiplexer");
+      res = mAPI.writeRaw(job->reg, job->data);
+      if (res != ErrorCode::OK && Statistics::classifyError(mAPI.lastError()) != Statistics::ErrorClass::EXCEPTION) {
+        log::get()->warn("MBMultiplexer: connection lost");
+        mAPI.reset(); // Reconnect with the next request
+      }
+    }
+
+    job->status.set_value(res);
+    lock.lock();
+  }
+}
+
+/*!
+ * \brief Executes all reads at the front of the queue with a single updateRegisters() call
+ *
+ * Reads that are submitted while the registers are fetched can join (see submit()). All of them are served from the
+ * same response.
+ */
+void MBMultiplexer::runReads(unique_lock<mutex> &_lock) {
+  mRunningRegs.clear();
+  while (!mQueue.empty() && mQueue.front()->kind == Job::Kind::READ) {
+    JobPtr job = mQueue.front();
+    mQueue.pop_front();
+    mRunningRegs.insert(end(mRunningRegs), begin(job->regs), end(job->regs));
+    mRunning.push_back(job);
+  }
+
+  sort(begin(mRunningRegs), end(mRunningRegs));
+  mRunningRegs.erase(unique(begin(mRunningRegs), end(mRunningRegs)), end(mRunningRegs));
+  if (mRunning.size() > 1) { mMerged.fetch_add(mRunning.size(), memory_order_relaxed); }
+  mBusy = true;
+  _lock.unlock(); // mRunningRegs is only modified by the worker thread
+
+  ErrorCode                     res = ErrorCode::INVALID_STATE;
+  vector<uint16_t>              failed;
+  shared_ptr<RegisterContainer> container;
+  {
+    trace::Span span("MBMultiplexer::read", "multiplexer");
+    span.arg("registers", (int64_t)mRunningRegs.size());
+
+    if (upstreamReady()) {
+      mCycles.fetch_add(1, memory_order_relaxed);
+      container = mAPI.getRegisters(); // Keep the container if the connection is reset
+      res       = mAPI.updateRegisters(mRunningRegs, nullptr, &failed);
+
+      if (!failed.empty() && Statistics::classifyError(mAPI.lastError()) != Statistics::ErrorClass::EXCEPTION) {
+        log::get()->warn("MBMultiplexer: connection lost");
+        mAPI.reset(); // Reconnect with the next request
+      }
+    }
+  }
+
+  vector<JobPtr> jobs;
+  _lock.lock();
+  jobs.swap(mRunning);
+  mBusy = false;
+  _lock.unlock();
+
+  sort(begin(failed), end(failed));
+  for (JobPtr const &i : jobs) {
+    Result result;
+    result.error = res;
+
+    if (res == ErrorCode::OK) {
+      for (Register &j : container->getRegisters(i->regs)) {
+        if (!binary_search(begin(failed), end(failed), j.reg())) { result.registers.push_back(move(j)); }
+      }
+
+      if (result.registers.size() != i->regs.size()) { result.error = ErrorCode::ERROR; }
+    }
+
+    i->result.set_value(move(result));
+  }
+
+  _lock.lock();
+}
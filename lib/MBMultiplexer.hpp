@@ -0,0 +1,141 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ModbusAPI.hpp"
+
+namespace modbusSMA {
+
+/*!
+ * \brief Thread-safe front end for one ModbusAPI object
+ *
+ * A ModbusAPI object must not be used by more than one thread at once. The multiplexer owns a worker thread that
+ * executes all requests on the ModbusAPI object in the order they were submitted, so any number of threads can share
+ * one connection.
+ *
+ * Concurrent reads are deduplicated (single-flight):
+ *  - A read whose registers are all part of the currently running read joins it and is served from its response.
+ *  - All other reads that are queued while the worker is busy are merged into a single updateRegisters() call.
+ *
+ * Writes and tasks are never merged. They split the queue, so a read that was submitted after a write always sees
+ * the written value.
+ *
+ * \code{.cpp}
+ * MBMultiplexer mux(mapi);
+ * auto          res = mux.read({30529, 30775}); // Can be called from any thread
+ * \endcode
+ *
+ * \note The ModbusAPI object must not be accessed directly while the multiplexer exists. Use execute() instead.
+ */
+class MBMultiplexer {
+ public:
+  //! The result of a read request.
+  struct Result {
+    ErrorCode             error = ErrorCode::OK; //!< OK if all requested registers were fetched.
+    std::vector<Register> registers;             //!< Copies of the successfully fetched registers.
+  };
+
+  //! Request counters.
+  struct Counters {
+    uint64_t reads  = 0; //!< Number of read requests.
+    uint64_t joined = 0; //!< Read requests that joined an already running read.
+    uint64_t merged = 0; //!< Read requests that shared an updateRegisters() call with other queued reads.
+    uint64_t cycles = 0; //!< Number of updateRegisters() calls.
+    uint64_t writes = 0; //!< Number of write requests.
+    uint64_t tasks  = 0; //!< Number of execute() calls.
+  };
+
+  typedef std::function<ErrorCode(ModbusAPI &)> Task; //!< Function executed by the worker thread.
+
+ private:
+  //! One queued request.
+  struct Job {
+    enum class Kind { READ, WRITE, TASK };
+
+    Kind                    kind;
+    std::vector<uint16_t>   regs;    //!< READ: the requested registers (sorted, unique).
+    uint16_t                reg = 0; //!< WRITE: the first modbus register.
+    std::vector<uint16_t>   data;    //!< WRITE: the raw data.
+    Task                    task;    //!< TASK: the function to execute.
+    std::promise<Result>    result;  //!< READ: the result.
+    std::promise<ErrorCode> status;  //!< WRITE and TASK: the result.
+  };
+
+  typedef std::shared_ptr<Job> JobPtr;
+
+  ModbusAPI &mAPI;
+
+  std::mutex              mLock;
+  std::condition_variable mCond;
+  std::deque<JobPtr>      mQueue;
+  std::vector<JobPtr>     mRunning;      //!< Reads served by the running read (including joined reads).
+  std::vector<uint16_t>   mRunningRegs;  //!< Registers of the running read (sorted).
+  bool                    mBusy = false; //!< A read is running.
+  bool                    mStop = false;
+
+  std::chrono::steady_clock::duration   mReconnectDelay = std::chrono::seconds(5);
+  std::chrono::steady_clock::time_point mLastConnect    = {};
+
+  std::atomic<uint64_t> mReads  = {0};
+  std::atomic<uint64_t> mJoined = {0};
+  std::atomic<uint64_t> mMerged = {0};
+  std::atomic<uint64_t> mCycles = {0};
+  std::atomic<uint64_t> mWrites = {0};
+  std::atomic<uint64_t> mTasks  = {0};
+
+  std::thread mWorker;
+
+  void run();
+  void runReads(std::unique_lock<std::mutex> &_lock);
+  void submit(JobPtr _job);
+  bool upstreamReady();
+
+ public:
+  MBMultiplexer() = delete;
+  MBMultiplexer(ModbusAPI &_api);
+  ~MBMultiplexer();
+
+  MBMultiplexer(MBMultiplexer const &) = delete;
+  void operator=(MBMultiplexer const &) = delete;
+
+  std::future<Result>    readAsync(std::vector<uint16_t> _regList);
+  std::future<ErrorCode> writeAsync(uint16_t _reg, std::vector<uint16_t> _data);
+  std::future<ErrorCode> executeAsync(Task _task);
+
+  Result    read(std::vector<uint16_t> _regList);
+  ErrorCode write(uint16_t _reg, std::vector<uint16_t> _data);
+  ErrorCode execute(Task _task);
+
+  void     stop();
+  Counters counters() const;
+};
+
+} // namespace modbusSMA
@@ -0,0 +1,409 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MBServer.hpp"
+
+#include <arpa/inet.h>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "Logging.hpp"
+
+using namespace std;
+using namespace std::chrono;
+using namespace modbusSMA;
+
+const size_t   MBAP_HEADER_SIZE    = 7;
+const size_t   MAX_PDU_SIZE        = 253;
+const int      MAX_EPOLL_EVENTS    = 256;
+const size_t   MAX_OUTPUT_SIZE     = 1024 * 1024;
+const uint16_t MAX_READ_REGISTERS  = 125;
+const uint16_t MAX_WRITE_REGISTERS = 123;
+
+//! Reads a big endian 16-bit integer.
+inline uint16_t readBE16(char const *_data) {
+  return (uint16_t)(((uint8_t)_data[0] << 8) | (uint8_t)_data[1]);
+}
+
+//! Appends a big endian 16-bit integer.
+inline void appendBE16(uint16_t _val, string &_out) {
+  _out += (char)(_val >> 8);
+  _out += (char)(_val & 0xFF);
+}
+
+MBServer::~MBServer() {
+  for (auto &i : mConnections) { close(i.second.fd); }
+  for (auto &i : mListenFDs) { close(i.first); }
+  for (int i : {mEpollFD, mStopPipe[0], mStopPipe[1]}) {
+    if (i >= 0) { close(i); }
+  }
+}
+
+//! Creates the epoll instance and the stop pipe (if not already done).
+bool MBServer::init() {
+  if (mEpollFD >= 0) { return true; }
+
+  mEpollFD = epoll_create1(EPOLL_CLOEXEC);
+  if (mEpollFD < 0 || pipe2(mStopPipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+    log::get()->error("MBServer: failed to initialize epoll: '{}'", strerror(errno));
+    return false;
+  }
+
+  epoll_event event = {};
+  event.events      = EPOLLIN;
+  event.data.fd     = mStopPipe[0];
+  epoll_ctl(mEpollFD, EPOLL_CTL_ADD, mStopPipe[0], &event);
+  return true;
+}
+
+/*!
+ * \brief Listens for Modbus TCP clients on an additional port
+ *
+ * This function can be called multiple times (also while the server is running in another thread is NOT supported).
+ *
+ * \param _bindAddress The IPv4 address to listen on
+ * \param _port        The TCP port
+ */
+ErrorCode MBServer::listen(string _bindAddress, uint16_t _port) {
+  auto        logger = log::get();
+  sockaddr_in addr   = {};
+  int         one    = 1;
+
+  if (!init()) { return ErrorCode::ERROR; }
+
+  addr.sin_family = AF_INET;
+  addr.sin_port   = htons(_port);
+  if (inet_pton(AF_INET, _bindAddress.c_str(), &addr.sin_addr) != 1) {
+    logger->error("MBServer: invalid bind address '{}'", _bindAddress);
+    return ErrorCode::ERROR;
+  }
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    logger->error("MBServer: failed to create a socket: '{}'", strerror(errno));
+    return ErrorCode::ERROR;
+  }
+
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+    logger->error("MBServer: failed to listen on {}:{}: '{}'", _bindAddress, _port, strerror(errno));
+    close(fd);
+    return ErrorCode::ERROR;
+  }
+
+  epoll_event event = {};
+  event.events      = EPOLLIN;
+  event.data.fd     = fd;
+  epoll_ctl(mEpollFD, EPOLL_CTL_ADD, fd, &event);
+
+  mListenFDs[fd] = _port;
+  SPDLOG_LOGGER_DEBUG(logger, "MBServer: listening on {}:{}", _bindAddress, _port);
+  return ErrorCode::OK;
+}
+
+//! Stops run(). Thread and async signal safe.
+void MBServer::stop() {
+  if (mStopPipe[1] < 0) { return; }
+  char c = 1;
+  (void)!write(mStopPipe[1], &c, 1);
+}
+
+//! Accepts all pending connections on a listening socket.
+void MBServer::accept(int _listenFD) {
+  int one = 1;
+  while (true) {
+    int fd = accept4(_listenFD, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) { return; }
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    uint64_t    id    = mNextID++;
+    epoll_event event = {};
+    event.events      = EPOLLIN | EPOLLRDHUP;
+    event.data.fd     = fd;
+    epoll_ctl(mEpollFD, EPOLL_CTL_ADD, fd, &event);
+
+    mConnections[id] = {fd, id, mListenFDs[_listenFD], "", "", false};
+    mFDtoID[fd]      = id;
+  }
+}
+
+/*!
+ * \brief Reads all available data and decodes complete frames
+ *
+ * Malformed requests that can still be answered (invalid function code or register count) are answered directly
+ * with an exception.
+ *
+ * \returns false if the connection should be closed
+ */
+bool MBServer::receive(Connection &_conn, vector<MBRequest> &_requests) {
+  if (_conn.dead) { return false; }
+
+  char buffer[4096];
+  while (true) {
+    ssize_t len = recv(_conn.fd, buffer, sizeof(buffer), 0);
+    if (len == 0) { return false; }
+    if (len < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) { break; }
+      if (errno == EINTR) { continue; }
+      return false;
+    }
+
+    _conn.input.append(buffer, (size_t)len);
+  }
+
+  size_t pos = 0;
+  while (_conn.input.size() - pos >= MBAP_HEADER_SIZE) {
+    char const *frame    = _conn.input.data() + pos;
+    uint16_t    protocol = readBE16(frame + 2);
+    uint16_t    length   = readBE16(frame + 4);
+
+    if (protocol != 0 || length < 2 || length > MAX_PDU_SIZE + 1) { return false; }
+    if (_conn.input.size() - pos < 6u + length) { break; }
+
+    char const *pdu    = frame + MBAP_HEADER_SIZE;
+    size_t      pduLen = length - 1u;
+    MBRequest   req    = {_conn.id, _conn.port, readBE16(frame), (uint8_t)frame[6], (uint8_t)pdu[0], 0, 0, {}};
+    MBResponse  exc    = {MBResponse::Action::EXCEPTION, MBException::NONE, {}, microseconds(0)};
+
+    pos += 6u + length;
+
+    switch ((MBFunction)req.function) {
+      case MBFunction::READ_HOLDING_REGISTERS:
+      case MBFunction::READ_INPUT_REGISTERS:
+        if (pduLen != 5) { return false; }
+        req.address = readBE16(pdu + 1);
+        req.count   = readBE16(pdu + 3);
+        if (req.count == 0 || req.count > MAX_READ_REGISTERS) { exc.exception = MBException::ILLEGAL_DATA_VALUE; }
+        break;
+
+      case MBFunction::WRITE_SINGLE_REGISTER:
+        if (pduLen != 5) { return false; }
+        req.address = readBE16(pdu + 1);
+        req.count   = 1;
+        req.data    = {readBE16(pdu + 3)};
+        break;
+
+      case MBFunction::WRITE_MULTIPLE_REGISTERS:
+        if (pduLen < 6) { return false; }
+        req.address = readBE16(pdu + 1);
+        req.count   = readBE16(pdu + 3);
+        if (req.count == 0 || req.count > MAX_WRITE_REGISTERS || (uint8_t)pdu[5] != req.count * 2 ||
+            pduLen != 6u + req.count * 2u) {
+          exc.exception = MBException::ILLEGAL_DATA_VALUE;
+          break;
+        }
+
+        for (uint16_t i = 0; i < req.count; ++i) { req.data.push_back(readBE16(pdu + 6 + 2 * i)); }
+        break;
+
+      default: exc.exception = MBException::ILLEGAL_FUNCTION; break;
+    }
+
+    if (exc.exception != MBException::NONE) {
+      send(_conn.id, encodeResponse(req, exc));
+      continue;
+    }
+
+    _requests.push_back(move(req));
+  }
+
+  _conn.input.erase(0, pos);
+  return true;
+}
+
+//! Encodes the MBAP frame of the response to _req.
+string MBServer::encodeResponse(MBRequest const &_req, MBResponse const &_resp) {
+  string pdu;
+
+  if (_resp.action == MBResponse::Action::EXCEPTION) {
+    pdu += (char)(_req.function | 0x80);
+    pdu += (char)_resp.exception;
+  } else {
+    pdu += (char)_req.function;
+    switch ((MBFunction)_req.function) {
+      case MBFunction::READ_HOLDING_REGISTERS:
+      case MBFunction::READ_INPUT_REGISTERS:
+        pdu += (char)(_req.count * 2);
+        for (uint16_t i = 0; i < _req.count; ++i) { appendBE16(i < _resp.data.size() ? _resp.data[i] : 0, pdu); }
+        break;
+      case MBFunction::WRITE_SINGLE_REGISTER:
+        appendBE16(_req.address, pdu);
+        appendBE16(_req.data.empty() ? 0 : _req.data[0], pdu);
+        break;
+      case MBFunction::WRITE_MULTIPLE_REGISTERS:
+        appendBE16(_req.address, pdu);
+        appendBE16(_req.count, pdu);
+        break;
+    }
+  }
+
+  string frame;
+  frame.reserve(MBAP_HEADER_SIZE + pdu.size());
+  appendBE16(_req.transaction, frame);
+  appendBE16(0, frame);
+  appendBE16((uint16_t)(pdu.size() + 1), frame);
+  frame += (char)_req.unit;
+  frame += pdu;
+  return frame;
+}
+
+//! Sends (or queues) a frame.
+void MBServer::send(uint64_t _client, string const &_frame) {
+  auto iter = mConnections.find(_client);
+  if (iter == end(mConnections) || iter->second.dead) { return; } // Connection already closed
+
+  Connection &conn = iter->second;
+  conn.output += _frame;
+  flush(conn);
+}
+
+//! Sends as much of the output buffer as possible and updates the epoll events.
+void MBServer::flush(Connection &_conn) {
+  bool wasBlocked = !_conn.output.empty();
+  while (!_conn.output.empty()) {
+    ssize_t len = ::send(_conn.fd, _conn.output.data(), _conn.output.size(), MSG_NOSIGNAL);
+    if (len < 0) {
+      if (errno == EINTR) { continue; }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) { _conn.output.clear(); } // Closed on the next EPOLLRDHUP / read
+      break;
+    }
+
+    _conn.output.erase(0, (size_t)len);
+  }
+
+  if (_conn.output.size() > MAX_OUTPUT_SIZE && !_conn.dead) {
+    _conn.dead = true; // The client does not read its responses
+    mDead.push_back(_conn.id);
+    return;
+  }
+
+  if (wasBlocked || !_conn.output.empty()) {
+    epoll_event event = {};
+    event.events      = EPOLLIN | EPOLLRDHUP | (_conn.output.empty() ? 0u : (uint32_t)EPOLLOUT);
+    event.data.fd     = _conn.fd;
+    epoll_ctl(mEpollFD, EPOLL_CTL_MOD, _conn.fd, &event);
+  }
+}
+
+//! Closes a client connection.
+void MBServer::closeConnection(uint64_t _client) {
+  auto iter = mConnections.find(_client);
+  if (iter == end(mConnections)) { return; }
+
+  int fd = iter->second.fd;
+  epoll_ctl(mEpollFD, EPOLL_CTL_DEL, fd, nullptr);
+  close(fd);
+  mFDtoID.erase(fd);
+  mConnections.erase(iter);
+}
+
+//! Passes the requests to the implementation and sends / schedules the responses.
+void MBServer::dispatch(vector<MBRequest> &_requests) {
+  vector<MBResponse> responses(_requests.size());
+  handleRequests(_requests, responses);
+
+  auto now = steady_clock::now();
+  for (size_t i = 0; i < _requests.size(); ++i) {
+    MBRequest const & req  = _requests[i];
+    MBResponse const &resp = responses[i];
+
+    if (resp.action == MBResponse::Action::DROP) { continue; }
+
+    bool   disconnect = resp.action == MBResponse::Action::DISCONNECT;
+    string frame      = disconnect ? "" : encodeResponse(req, resp);
+
+    if (resp.delay.count() > 0) {
+      mPending.push({now + resp.delay, req.client, move(frame), disconnect});
+    } else if (disconnect) {
+      closeConnection(req.client);
+    } else {
+      send(req.client, frame);
+    }
+  }
+}
+
+//! Sends all delayed responses that are due.
+void MBServer::sendPending() {
+  auto now = steady_clock::now();
+  while (!mPending.empty() && mPending.top().due <= now) {
+    Pending const &next = mPending.top();
+    if (next.disconnect) {
+      closeConnection(next.client);
+    } else {
+      send(next.client, next.frame);
+    }
+    mPending.pop();
+  }
+}
+
+/*!
+ * \brief Runs the event loop until stop() is called
+ * \returns OK after stop() or ERROR if epoll fails
+ */
+ErrorCode MBServer::run() {
+  if (!init()) { return ErrorCode::ERROR; }
+
+  epoll_event       events[MAX_EPOLL_EVENTS];
+  vector<MBRequest> requests;
+
+  while (true) {
+    int timeout = -1;
+    if (!mPending.empty()) {
+      auto wait = duration_cast<milliseconds>(mPending.top().due - steady_clock::now()).count();
+      timeout   = wait < 0 ? 0 : (int)wait + 1;
+    }
+
+    int num = epoll_wait(mEpollFD, events, MAX_EPOLL_EVENTS, timeout);
+    if (num < 0) {
+      if (errno == EINTR) { continue; }
+      log::get()->error("MBServer: epoll_wait failed: '{}'", strerror(errno));
+      return ErrorCode::ERROR;
+    }
+
+    requests.clear();
+    for (int i = 0; i < num; ++i) {
+      int fd = events[i].data.fd;
+      if (fd == mStopPipe[0]) { return ErrorCode::OK; }
+
+      if (mListenFDs.count(fd) > 0) {
+        accept(fd);
+        continue;
+      }
+
+      auto idIter = mFDtoID.find(fd);
+      if (idIter == end(mFDtoID)) { continue; }
+
+      Connection &conn = mConnections[idIter->second];
+      if (events[i].events & EPOLLOUT) { flush(conn); }
+      if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && !receive(conn, requests)) {
+        conn.dead = true;
+        mDead.push_back(conn.id);
+      }
+    }
+
+    if (!requests.empty()) { dispatch(requests); }
+    sendPending();
+
+    for (uint64_t i : mDead) { closeConnection(i); }
+    mDead.clear();
+  }
+}
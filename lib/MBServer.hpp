@@ -0,0 +1,157 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <chrono>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Enums.hpp"
+
+namespace modbusSMA {
+
+//! Modbus function codes supported by the MBServer.
+enum class MBFunction : uint8_t {
+  READ_HOLDING_REGISTERS   = 0x03, //!< Read holding registers.
+  READ_INPUT_REGISTERS     = 0x04, //!< Read input registers.
+  WRITE_SINGLE_REGISTER    = 0x06, //!< Write a single register.
+  WRITE_MULTIPLE_REGISTERS = 0x10, //!< Write multiple registers.
+};
+
+//! Modbus exception codes.
+enum class MBException : uint8_t {
+  NONE                 = 0x00, //!< No exception.
+  ILLEGAL_FUNCTION     = 0x01, //!< The function code is not supported.
+  ILLEGAL_DATA_ADDRESS = 0x02, //!< The address range is not valid.
+  ILLEGAL_DATA_VALUE   = 0x03, //!< A value in the request is not valid.
+  SERVER_FAILURE       = 0x04, //!< Unrecoverable error while processing the request.
+  SERVER_BUSY          = 0x06, //!< The server is busy.
+  GATEWAY_PATH         = 0x0A, //!< Gateway path unavailable.
+  GATEWAY_TARGET       = 0x0B, //!< Gateway target device failed to respond.
+};
+
+//! One decoded Modbus TCP request.
+struct MBRequest {
+  uint64_t              client;      //!< Unique ID of the client connection.
+  uint16_t              port;        //!< The local port the request was received on.
+  uint16_t              transaction; //!< The MBAP transaction ID.
+  uint8_t               unit;        //!< The unit (slave) ID.
+  uint8_t               function;    //!< The function code (see MBFunction).
+  uint16_t              address;     //!< The first register address.
+  uint16_t              count;       //!< The number of registers.
+  std::vector<uint16_t> data;        //!< The values to write (write requests only).
+};
+
+//! The reply to one MBRequest.
+struct MBResponse {
+  //! What to do with the request.
+  enum class Action {
+    REPLY,      //!< Send the data (read) or the acknowledgement (write).
+    EXCEPTION,  //!< Send an exception response.
+    DROP,       //!< Do not respond at all (the client runs into its timeout).
+    DISCONNECT, //!< Close the client connection.
+  };
+
+  Action                    action    = Action::REPLY;                //!< What to do.
+  MBException               exception = MBException::NONE;            //!< The exception for Action::EXCEPTION.
+  std::vector<uint16_t>     data      = {};                           //!< The values of a read request.
+  std::chrono::microseconds delay     = std::chrono::microseconds(0); //!< Delay before the action is executed.
+};
+
+/*!
+ * \brief Minimal epoll based Modbus TCP server
+ *
+ * The server can listen on many ports and handles all connections in a single thread. All requests that are
+ * received in one event loop iteration are passed to handleRequests() together, so the implementation can merge
+ * them. Responses can be delayed without blocking the event loop.
+ *
+ * \note Only the function codes in MBFunction are passed to the implementation. Other function codes are answered
+ *       with MBException::ILLEGAL_FUNCTION.
+ */
+class MBServer {
+ private:
+  //! One client connection.
+  struct Connection {
+    int         fd;     //!< The socket.
+    uint64_t    id;     //!< Unique connection ID.
+    uint16_t    port;   //!< The local port.
+    std::string input;  //!< Received but not yet parsed data.
+    std::string output; //!< Data that could not be sent yet.
+    bool        dead;   //!< The connection will be closed at the end of the event loop iteration.
+  };
+
+  //! A delayed response.
+  struct Pending {
+    std::chrono::steady_clock::time_point due;        //!< When to send the data.
+    uint64_t                              client;     //!< The client connection ID.
+    std::string                           frame;      //!< The frame to send.
+    bool                                  disconnect; //!< Close the connection instead of sending the frame.
+
+    bool operator>(Pending const &_other) const { return due > _other.due; } //!< Orders the queue.
+  };
+
+  int mEpollFD     = -1;
+  int mStopPipe[2] = {-1, -1};
+
+  std::unordered_map<int, uint16_t>        mListenFDs;   //!< Listening socket --> port.
+  std::unordered_map<uint64_t, Connection> mConnections; //!< Connection ID --> connection.
+  std::unordered_map<int, uint64_t>        mFDtoID;      //!< Client socket --> connection ID.
+  std::vector<uint64_t>                    mDead;        //!< Connections to close.
+  uint64_t                                 mNextID = 1;
+
+  std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending>> mPending;
+
+  bool init();
+  void accept(int _listenFD);
+  bool receive(Connection &_conn, std::vector<MBRequest> &_requests);
+  void send(uint64_t _client, std::string const &_frame);
+  void flush(Connection &_conn);
+  void closeConnection(uint64_t _client);
+  void dispatch(std::vector<MBRequest> &_requests);
+  void sendPending();
+
+ protected:
+  /*!
+   * \brief Processes a list of requests
+   *
+   * _responses has the same size as _requests and is default initialized (REPLY without data). The implementation
+   * must fill the data of all read requests that are answered with REPLY.
+   */
+  virtual void handleRequests(std::vector<MBRequest> const &_requests, std::vector<MBResponse> &_responses) = 0;
+
+ public:
+  MBServer() = default;
+  virtual ~MBServer();
+
+  MBServer(MBServer const &) = delete;
+  void operator=(MBServer const &) = delete;
+
+  ErrorCode listen(std::string _bindAddress, uint16_t _port);
+  ErrorCode run();
+  void      stop();
+
+  inline size_t numConnections() const { return mConnections.size(); } //!< Number of open client connections.
+
+  static std::string encodeResponse(MBRequest const &_req, MBResponse const &_resp);
+};
+
+} // namespace modbusSMA
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MetadataCache.hpp"
+
+#include "DataBase.hpp"
+
+using namespace std;
+using namespace modbusSMA;
+
+/*!
+ * \brief Initializes the cache
+ *
+ * \param _db       The (connected) database with the register tables
+ * \param _capacity The maximum number of entries kept in memory (at least 1)
+ */
+MetadataCache::MetadataCache(shared_ptr<DataBase> _db, size_t _capacity)
+    : mDB(_db), mCapacity(max<size_t>(_capacity, 1)) {}
+
+//! Adds a table to search for the metadata.
+void MetadataCache::addTable(string _table) {
+  lock_guard<mutex> lock(mMutex);
+  mTables.push_back(move(_table));
+}
+
+//! Reads the metadata of _reg from the database (mMutex must be locked).
+MetadataCache::EntryPtr MetadataCache::load(uint16_t _reg) {
+  auto entry = make_shared<Entry>();
+  for (auto const &i : mTables) {
+    if (mDB->getMetadata(i, _reg, entry->desc, entry->unit) == ErrorCode::OK) { break; }
+  }
+
+  // Not shared with EnumTable::get(), so the table is freed together with the entry
+  if (entry->desc.find('\n') != string::npos) { entry->enums = make_shared<EnumTable const>(entry->desc); }
+  return entry;
+}
+
+/*!
+ * \brief Returns the metadata of _reg
+ *
+ * The entry stays valid as long as the returned pointer exists, even if it is evicted from the cache.
+ */
+MetadataCache::EntryPtr MetadataCache::get(uint16_t _reg) {
+  lock_guard<mutex> lock(mMutex);
+
+  auto iter = mLookup.find(_reg);
+  if (iter != end(mLookup)) {
+    ++mHits;
+    mLRU.splice(begin(mLRU), mLRU, iter->second);
+    return iter->second->second;
+  }
+
+  ++mMisses;
+  EntryPtr entry = load(_reg);
+  mLRU.emplace_front(_reg, entry);
+  mLookup[_reg] = begin(mLRU);
+
+  if (mLRU.size() > mCapacity) {
+    mLookup.erase(mLRU.back().first);
+    mLRU.pop_back();
+  }
+
+  return entry;
+}
+
+size_t MetadataCache::size() {
+  lock_guard<mutex> lock(mMutex);
+  return mLRU.size();
+}
+
+size_t MetadataCache::hits() {
+  lock_guard<mutex> lock(mMutex);
+  return mHits;
+}
+
+size_t MetadataCache::misses() {
+  lock_guard<mutex> lock(mMutex);
+  return mMisses;
+}
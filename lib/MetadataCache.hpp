@@ -0,0 +1,91 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "EnumTable.hpp"
+
+namespace modbusSMA {
+
+class DataBase;
+
+/*!
+ * \brief Loads the descriptions, units and enum tables of registers on demand
+ *
+ * Used for the low memory mode of ModbusAPI (see ModbusAPI::setMetadataCache()). The registers only keep the address,
+ * type, format and access resident; Register::metadata() and Register::enums() query this cache, which reads
+ * the metadata from the DataBase and keeps the last `capacity` entries in a LRU list.
+ *
+ * The tables are searched in the order they were added (the first match wins, like RegisterContainer::addRegisters()).
+ *
+ * \note Thread safe.
+ */
+class MetadataCache {
+ public:
+  //! The metadata of one register.
+  struct Entry {
+    std::string                      desc;  //!< The description.
+    std::string                      unit;  //!< The unit.
+    std::shared_ptr<EnumTable const> enums; //!< Only set for multi-line descriptions.
+  };
+
+  typedef std::shared_ptr<Entry const> EntryPtr; //!< Shared entry (stays valid after it was evicted).
+
+ private:
+  typedef std::list<std::pair<uint16_t, EntryPtr>> LRU;
+
+  std::shared_ptr<DataBase> mDB;
+  std::vector<std::string>  mTables;
+  size_t                    mCapacity;
+
+  std::mutex                                  mMutex;
+  LRU                                         mLRU; //!< Most recently used entry first.
+  std::unordered_map<uint16_t, LRU::iterator> mLookup;
+
+  size_t mHits   = 0;
+  size_t mMisses = 0;
+
+  EntryPtr load(uint16_t _reg);
+
+ public:
+  MetadataCache() = delete;
+  MetadataCache(std::shared_ptr<DataBase> _db, size_t _capacity);
+
+  MetadataCache(MetadataCache const &) = delete;
+  void operator=(MetadataCache const &) = delete;
+
+  void addTable(std::string _table);
+
+  EntryPtr get(uint16_t _reg);
+
+  size_t size();   //!< Number of cached entries.
+  size_t hits();   //!< Number of get() calls served from the cache.
+  size_t misses(); //!< Number of get() calls that queried the database.
+
+  inline size_t capacity() const { return mCapacity; } //!< The maximum number of cached entries.
+};
+
+} // namespace modbusSMA
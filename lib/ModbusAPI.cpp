@@ -19,11 +19,14 @@
 #include "ModbusAPI.hpp"
 
 #include <algorithm>
+#include <chrono>
 
 #include "Logging.hpp"
 #include "MBConnectionIP.hpp"
 #include "MBConnectionIP_PI.hpp"
 #include "MBConnectionRTU.hpp"
+#include "ReadPlan.hpp"
+#include "Trace.hpp"
 
 using namespace std;
 using namespace modbusSMA;
@@ -92,11 +95,9 @@ ModbusAPI::~ModbusAPI() { reset(); }
  * State change: * --> CONFIGURE
  */
 void ModbusAPI::reset() {
-  if (mConn) {
-    mConn->disconnect();
-    mConn = nullptr;
-  }
+  if (mConn) { mConn->disconnect(); } // Keep the connection object, it holds the configuration
 
+  mPool      = nullptr;
   mRegisters = nullptr;
   mState     = State::CONFIGURE;
 }
@@ -121,7 +122,9 @@ ErrorCode ModbusAPI::connect() {
     return res;
   }
 
-  logger->info("ModbusAPI: connected to {}", mConn->description());
+  SPDLOG_LOGGER_INFO(logger, "ModbusAPI: connected to {}", mConn->description());
+  if (mNumConnections > 1) { mPool = make_unique<MBConnectionPool>(*mConn, mNumConnections - 1); }
+
   mState = State::CONNECTED;
   return ErrorCode::OK;
 }
@@ -135,8 +138,10 @@ ErrorCode ModbusAPI::connect() {
  * State change: CONNECTED --> INITIALIZED | ERROR
  */
 ErrorCode ModbusAPI::initialize() {
-  auto      logger = log::get();
-  ErrorCode result;
+  trace::Span span("initialize", "api");
+  auto        logger    = log::get();
+  auto        initStart = chrono::steady_clock::now();
+  ErrorCode   result;
 
   if (mState != State::CONNECTED) {
     logger->error("ModbusAPI: can not initialize() -- invalid object state '{}'", enum2Str::toStr(mState));
@@ -145,6 +150,7 @@ ErrorCode ModbusAPI::initialize() {
   }
 
   // 1st: check database
+  auto dbStart = chrono::steady_clock::now();
   if (!mDB->isConnected()) {
     result = mDB->connect();
     if (result != ErrorCode::OK) {
@@ -154,8 +160,14 @@ ErrorCode ModbusAPI::initialize() {
     }
   }
 
+  mMetadata = nullptr;
+  if (mMetadataSize > 0) {
+    mMetadata = make_shared<MetadataCache>(mDB, mMetadataSize);
+    mMetadata->addTable("ALL");
+  }
+
   mRegisters = make_shared<RegisterContainer>();
-  mRegisters->addRegisters(mDB->getRegisters("ALL"));
+  mRegisters->addRegisters(mDB->getRegisters("ALL", mMetadata));
   if (mRegisters->empty()) {
     // This code should never be executed because of the DataBase validation
     logger->error("ModbusAPI: No Registers in table 'ALL'");
@@ -163,6 +175,8 @@ ErrorCode ModbusAPI::initialize() {
     return ErrorCode::DATA_BASE_ERROR;
   }
 
+  auto dbDuration = chrono::steady_clock::now() - dbStart;
+
   // 2nd: set slave ID to 1
   result = mConn->setSlaveID(1);
 
@@ -174,7 +188,7 @@ ErrorCode ModbusAPI::initialize() {
   // 3rd: request data
   vector<uint16_t> rawData = mConn->readRegisters(42109, 4);
 
-  logger->debug("Requesting basic inverter information:");
+  SPDLOG_LOGGER_DEBUG(logger, "Requesting basic inverter information:");
 
   if (rawData.size() != 4) {
     logger->error("ModbusAPI: Failed to initialize -- requesting slave/unit ID failed");
@@ -182,16 +196,16 @@ ErrorCode ModbusAPI::initialize() {
     return ErrorCode::INITIALIZATION_FAILED;
   }
 
-  uint32_t serialNumber = (rawData[0] << 16) + rawData[1];
-  uint16_t susyID       = rawData[2];
-  uint16_t unitID       = rawData[3];
+  mSerialNumber   = ((uint32_t)rawData[0] << 16) + rawData[1];
+  uint16_t unitID = rawData[3];
 
-  logger->debug("  -- Physical serial number: {}", serialNumber);
-  logger->debug("  -- Physical SusyID:        {}", susyID);
-  logger->debug("  -- Unit / Slave ID:        {}", unitID);
+  SPDLOG_LOGGER_DEBUG(logger, "  -- Physical serial number: {}", mSerialNumber);
+  SPDLOG_LOGGER_DEBUG(logger, "  -- Physical SusyID:        {}", rawData[2]);
+  SPDLOG_LOGGER_DEBUG(logger, "  -- Unit / Slave ID:        {}", unitID);
 
   // 4th: set slave ID to unitID
   result = mConn->setSlaveID(unitID);
+  if (result == ErrorCode::OK && mPool) { result = mPool->setSlaveID(unitID); }
 
   if (result != ErrorCode::OK) {
     mState = State::ERROR;
@@ -199,10 +213,17 @@ ErrorCode ModbusAPI::initialize() {
   }
 
   // 5th: determine the inverter type
-  rawData             = mConn->readRegisters(30053, 2);
+  rawData = mConn->readRegisters(30053, 2);
+  if (rawData.size() != 2) {
+    logger->error("ModbusAPI: Failed to initialize -- requesting the device type failed");
+    mState = State::ERROR;
+    return ErrorCode::INITIALIZATION_FAILED;
+  }
+
   uint32_t inverterID = (rawData[0] << 16) + rawData[1];
-  logger->debug("  -- Inverter type ID:       {}", inverterID);
+  SPDLOG_LOGGER_DEBUG(logger, "  -- Inverter type ID:       {}", inverterID);
 
+  dbStart      = chrono::steady_clock::now();
   auto devices = mDB->getDeviceEnums();
   bool found   = false;
   for (auto i : devices) {
@@ -210,7 +231,8 @@ ErrorCode ModbusAPI::initialize() {
       found           = true;
       mInverterType   = i.name;
       mInverterTypeID = inverterID;
-      mRegisters->addRegisters(mDB->getRegisters(i.table));
+      if (mMetadata) { mMetadata->addTable(i.table); }
+      mRegisters->addRegisters(mDB->getRegisters(i.table, mMetadata));
       break;
     }
   }
@@ -221,9 +243,21 @@ ErrorCode ModbusAPI::initialize() {
     return ErrorCode::INITIALIZATION_FAILED;
   }
 
-  logger->debug("  -- Inverter type:          '{}'", mInverterType);
-  logger->debug("  -- Number of registers:    {}", mRegisters->size());
-  logger->info("ModbusAPI: initialization for {} complete", mInverterType);
+  if (mDerived && mDerived->attach(*mRegisters) != ErrorCode::OK) {
+    logger->error("ModbusAPI: Failed to initialize -- invalid derived registers");
+    mState = State::ERROR;
+    return ErrorCode::INITIALIZATION_FAILED;
+  }
+
+  auto now    = chrono::steady_clock::now();
+  dbDuration += now - dbStart;
+  mConn->statistics().recordPhase(Statistics::Phase::DB_LOAD, chrono::duration_cast<chrono::microseconds>(dbDuration));
+  mConn->statistics().recordPhase(Statistics::Phase::INITIALIZE,
+                                  chrono::duration_cast<chrono::microseconds>(now - initStart));
+
+  SPDLOG_LOGGER_DEBUG(logger, "  -- Inverter type:          '{}'", mInverterType);
+  SPDLOG_LOGGER_DEBUG(logger, "  -- Number of registers:    {}", mRegisters->size());
+  SPDLOG_LOGGER_INFO(logger, "ModbusAPI: initialization for {} complete", mInverterType);
   mState = State::INITIALIZED;
   return ErrorCode::OK;
 }
@@ -242,22 +276,6 @@ ErrorCode ModbusAPI::setup() {
 
 
 
-//! Internal Request helper
-//! \internal
-struct RegBatch {
-  //! Internal Request helper
-  //! \internal
-  struct Reg {
-    uint16_t reg;    //!< 16-bit register address.
-    uint16_t offset; //!< offset in the rawData vector.
-    uint16_t size;   //!< number of modbus registers used in the Register class.
-  };
-
-  uint16_t         size;    //!< Size of the batch in number of registers.
-  vector<Reg>      regs;    //!< Registers in the batch.
-  vector<uint16_t> rawData; //!< Raw data vector.
-};
-
 /*!
  * \brief Updates all registers stored in _regList
  *
@@ -272,10 +290,13 @@ struct RegBatch {
  *
  * \param[in]  _regList    List of registers to update
  * \param[out] _numUpdated Number of updated registers
+ * \param[out] _failed     Registers that could not be fetched (failed batches)
  */
-ErrorCode ModbusAPI::updateRegisters(vector<Register> _regList, size_t *_numUpdated) {
-  auto logger = log::get();
+ErrorCode ModbusAPI::updateRegisters(vector<Register> _regList, size_t *_numUpdated, vector<uint16_t> *_failed) {
+  trace::Span span("updateRegisters", "api");
+  auto const &logger = log::get(); // No reference count update in the poll loop
   if (_numUpdated) { *_numUpdated = 0; }
+  if (_failed) { _failed->clear(); }
   if (mState != State::INITIALIZED) {
     logger->error("ModbusAPI: updateRegisters() -- invalid object state '{}'", enum2Str::toStr(mState));
     return ErrorCode::INVALID_STATE;
@@ -285,61 +306,207 @@ ErrorCode ModbusAPI::updateRegisters(vector<Register> _regList, size_t *_numUpda
     return ErrorCode::OK;
   }
 
-  sort(begin(_regList), end(_regList)); // Ensure that the list is sorted.
+  auto start = chrono::steady_clock::now();
+  span.arg("registers", (int64_t)_regList.size());
 
   // 1st: Create batches of registers.
-  std::vector<RegBatch> batches;
-  batches.reserve(_regList.size()); // Worst case: every register has its own batch
-  batches.push_back({0, {}, {}});
-
-  for (Register i : _regList) {
-    RegBatch *curr = &batches.back();
-
-    if (!curr->regs.empty()) {
-      if (((curr->size + i.size()) >= SMA_MODBUS_MAX_REGISTER_COUNT) || // Check if maximum request size is reached
-          ((curr->regs[0].reg + curr->size) != i.reg())) {              // Check if continous
-        batches.push_back({0, {}, {}});
-        curr = &batches.back();
+  ReadPlan plan;
+  mLastError = 0;
+  {
+    trace::Span planSpan("plan", "api");
+    if (mCapabilities) {
+      auto isRejected = [&](Register const &r) -> bool {
+        if (!mCapabilities->isRejected(r.reg())) { return false; }
+        if (_failed) { _failed->push_back(r.reg()); }
+        return true;
+      };
+
+      _regList.erase(remove_if(begin(_regList), end(_regList), isRejected), end(_regList));
+    }
+
+    if (mDerived) {
+      // Also read the inputs of the requested derived registers
+      vector<uint16_t> addresses;
+      addresses.reserve(_regList.size());
+      for (auto const &i : _regList) { addresses.push_back(i.reg()); }
+      size_t numRequested = addresses.size();
+      mDerived->addInputs(addresses);
+      if (addresses.size() > numRequested) {
+        sort(begin(addresses), end(addresses));
+        addresses.erase(unique(begin(addresses), end(addresses)), end(addresses));
+        _regList = mRegisters->getRegisters(addresses);
       }
     }
 
-    curr->regs.push_back({i.reg(), curr->size, (uint16_t)i.size()});
-    curr->size += i.size();
+    sort(begin(_regList), end(_regList)); // Ensure that the list is sorted.
+    plan = ReadPlan(_regList, mConn->tuning().batchLimit());
+    planSpan.arg("batches", (int64_t)plan.size());
   }
 
-  vector<uint16_t> singleRegData = {};
-  uint32_t         counter       = 1;
-  for (auto &i : batches) {
-    logger->debug("Fetching batch {} of {} -- Start: {}; Size: {}", counter++, batches.size(), i.regs[0].reg, i.size);
-    i.rawData = mConn->readRegisters(i.regs[0].reg, i.size);
-
-    if (i.rawData.size() != i.size) {
-      logger->warn(
-          "ModbusAPI: updateRegisters() -- failed to fetch registers: Start = {}; Size = {}", i.regs[0].reg, i.size);
+  // 2nd: Read all batches in parallel if there are additional connections
+  vector<vector<uint16_t>> striped;
+  vector<int>              errors;
+  if (mPool && mPool->size() > 0 && plan.size() > 1) { mPool->read(plan, *mConn, striped, errors); }
+
+  size_t           numFailed  = 0;
+  size_t           numUpdated = 0;
+  bool             track      = !mListeners.empty() || mDerived;
+  vector<uint16_t> updated; // Only filled for the update listeners and the derived registers
+  for (auto const &i : plan) {
+    SPDLOG_LOGGER_DEBUG(logger,
+                        "Fetching batch {} of {} -- Start: {}; Size: {}",
+                        &i - plan.batches().data() + 1,
+                        plan.size(),
+                        i.start,
+                        i.size);
+    size_t           idx     = &i - plan.batches().data();
+    vector<uint16_t> rawData = striped.empty() ? mConn->readRegisters(i.start, i.size) : move(striped[idx]);
+
+    if (rawData.size() != i.size) {
+      logger->warn("ModbusAPI: updateRegisters() -- failed to fetch registers: Start = {}; Size = {}", i.start, i.size);
+      mergeError(striped.empty() ? mConn->lastError() : errors[idx]);
+      ++numFailed;
+      if (_failed) {
+        for (auto const &j : i.regs) { _failed->push_back(j.reg); }
+      }
       continue;
     }
 
-    for (auto j : i.regs) {
-      singleRegData.resize(j.size);
-      for (uint16_t k = 0; k < j.size; ++k) { singleRegData[k] = i.rawData[j.offset + k]; }
-      mRegisters->updateRegister(j.reg, singleRegData);
-      if (_numUpdated) { *_numUpdated += 1; }
+    trace::Span decodeSpan("decode", "api");
+    decodeSpan.arg("registers", (int64_t)i.regs.size());
+    for (auto const &j : i.regs) {
+      mRegisters->updateRegister(j.reg, {rawData.data() + j.offset, j.size});
+      if (track) { updated.push_back(j.reg); }
+      ++numUpdated;
     }
   }
 
+  if (_numUpdated) { *_numUpdated = numUpdated; }
+  auto duration = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+  mConn->statistics().recordCycle(plan.size(), numFailed, numUpdated, duration);
+
+  if (mDerived) {
+    trace::Span derivedSpan("derived registers", "api");
+    size_t      numRead = updated.size();
+    mDerived->update(*mRegisters, updated, &updated);
+    inplace_merge(begin(updated), begin(updated) + numRead, end(updated));
+  }
+
+  if (!mListeners.empty() && !updated.empty()) {
+    trace::Span listenerSpan("update listeners", "api");
+    auto        now = chrono::system_clock::now().time_since_epoch();
+    int64_t     ts  = chrono::duration_cast<chrono::milliseconds>(now).count();
+    for (auto const &i : mListeners) { i.second(*mRegisters, updated, ts); }
+  }
+
   return ErrorCode::OK;
 }
 
 //! Convinience wrapper for the other version of this function.
-ErrorCode ModbusAPI::updateRegisters(vector<uint16_t> _regList, size_t *_numUpdated) {
+ErrorCode ModbusAPI::updateRegisters(vector<uint16_t> _regList, size_t *_numUpdated, vector<uint16_t> *_failed) {
   if (mState != State::INITIALIZED) {
     log::get()->error("ModbusAPI: updateRegisters() -- invalid object state '{}'", enum2Str::toStr(mState));
     return ErrorCode::INVALID_STATE;
   }
 
-  return updateRegisters(mRegisters->getRegisters(_regList), _numUpdated);
+  return updateRegisters(mRegisters->getRegisters(_regList), _numUpdated, _failed);
+}
+
+/*!
+ * \brief Reads _num raw modbus registers starting at _reg
+ *
+ * The RegisterContainer is NOT updated.
+ *
+ * \note This function can only be called in the INITIALIZED state
+ *
+ * State change: NONE
+ *
+ * \returns The raw data OR an empty vector on error (see lastError())
+ */
+vector<uint16_t> ModbusAPI::readRaw(uint16_t _reg, uint16_t _num) {
+  if (mState != State::INITIALIZED) {
+    log::get()->error("ModbusAPI: readRaw() -- invalid object state '{}'", enum2Str::toStr(mState));
+    return {};
+  }
+
+  vector<uint16_t> data = mConn->readRegisters(_reg, _num);
+  mLastError            = data.empty() ? mConn->lastError() : 0;
+  return data;
+}
+
+/*!
+ * \brief Writes raw data to the modbus registers starting at _reg
+ *
+ * The RegisterContainer is NOT updated.
+ *
+ * \note This function can only be called in the INITIALIZED state
+ *
+ * State change: NONE
+ *
+ * \returns OK, INVALID_STATE or ERROR (see lastError())
+ */
+ErrorCode ModbusAPI::writeRaw(uint16_t _reg, vector<uint16_t> const &_data) {
+  if (mState != State::INITIALIZED) {
+    log::get()->error("ModbusAPI: writeRaw() -- invalid object state '{}'", enum2Str::toStr(mState));
+    return ErrorCode::INVALID_STATE;
+  }
+
+  ErrorCode res = mConn->writeRegisters(_reg, _data);
+  mLastError    = mConn->lastError();
+  return res;
 }
 
+/*!
+ * \brief Reads all batches of _plan (striped over all connections, see setConnectionCount())
+ *
+ * The RegisterContainer is NOT updated.
+ *
+ * \param[in]  _plan The batches to read
+ * \param[out] _out  The raw data per batch (an empty vector if the batch failed)
+ */
+ErrorCode ModbusAPI::readBatches(ReadPlan const &_plan, vector<vector<uint16_t>> &_out) {
+  if (mState != State::INITIALIZED) {
+    log::get()->error("ModbusAPI: readBatches() -- invalid object state '{}'", enum2Str::toStr(mState));
+    return ErrorCode::INVALID_STATE;
+  }
+
+  mLastError = 0;
+  if (mPool && mPool->size() > 0 && _plan.size() > 1) {
+    vector<int> errors;
+    mPool->read(_plan, *mConn, _out, errors);
+    for (int i : errors) { mergeError(i); }
+    return ErrorCode::OK;
+  }
+
+  _out.clear();
+  _out.reserve(_plan.size());
+  for (auto const &i : _plan) {
+    _out.push_back(mConn->readRegisters(i.start, i.size));
+    if (_out.back().empty()) { mergeError(mConn->lastError()); }
+  }
+  return ErrorCode::OK;
+}
+
+/*!
+ * \brief Combines the errno of one failed batch with the error of the current request
+ *
+ * A batch can fail on any connection of the pool. Connection and timeout errors take precedence over modbus
+ * exceptions, so that the error of a lost connection is not hidden by an unsupported register.
+ */
+void ModbusAPI::mergeError(int _errno) {
+  if (_errno == 0) { return; }
+  if (mLastError == 0 || Statistics::classifyError(mLastError) == Statistics::ErrorClass::EXCEPTION) {
+    mLastError = _errno;
+  }
+}
+
+/*!
+ * \brief Returns the errno (modbus exception) of the last modbus request or 0
+ *
+ * For updateRegisters() and readBatches() this is the error of a failed batch on any connection (see mergeError()).
+ */
+int ModbusAPI::lastError() const { return mLastError; }
+
 
 
 
@@ -456,3 +623,130 @@ ErrorCode ModbusAPI::setConnectionRTU(string _device, uint32_t _baud, char _pari
   mConn = make_unique<MBConnectionRTU>(_device, _baud, _parity, _dataBit, _stopBit);
   return ErrorCode::OK;
 }
+
+/*!
+ * \brief Sets the number of parallel connections to the inverter (default: 1)
+ *
+ * With more than one connection, the batches of updateRegisters() are distributed over all connections. This reduces
+ * the cycle time when the inverter handles requests of different connections in parallel (Modbus TCP only, RTU has a
+ * single line). Connections that can not be established are skipped.
+ *
+ * All connections share the same Statistics.
+ *
+ * \param _count The number of connections (including the main connection)
+ *
+ * \sa MBConnectionPool
+ */
+ErrorCode ModbusAPI::setConnectionCount(size_t _count) {
+  if (mState != State::CONFIGURE) {
+    log::get()->error("ModbusAPI: setConnectionCount() -- invalid object state '{}'", enum2Str::toStr(mState));
+    return ErrorCode::INVALID_STATE;
+  }
+
+  mNumConnections = max<size_t>(_count, 1);
+  return ErrorCode::OK;
+}
+
+/*!
+ * \brief Registers a function that is called after every updateRegisters() call with the updated registers
+ *
+ * The listener is called from the thread calling updateRegisters(). Listeners must not be added or removed while
+ * updateRegisters() is running.
+ *
+ * \returns The ID of the listener (see removeUpdateListener())
+ */
+size_t ModbusAPI::addUpdateListener(UpdateListener _fn) {
+  mListeners.emplace_back(mNextListener, move(_fn));
+  return mNextListener++;
+}
+
+//! Removes the update listener with the ID _id.
+void ModbusAPI::removeUpdateListener(size_t _id) {
+  auto isID = [_id](auto const &i) { return i.first == _id; };
+  mListeners.erase(remove_if(begin(mListeners), end(mListeners), isID), end(mListeners));
+}
+
+/*!
+ * \brief Enables the low memory mode
+ *
+ * The registers then only keep the address, type, format and access in memory. Descriptions, units and enum tables
+ * are read from the DataBase on demand and the last _capacity of them are cached (see MetadataCache). Useful on small
+ * gateways that only poll a few registers.
+ *
+ * \param _capacity The number of cached registers (0 disables the low memory mode)
+ * \note Must be called before initialize()
+ */
+ErrorCode ModbusAPI::setMetadataCache(size_t _capacity) {
+  if (mState != State::CONFIGURE) {
+    log::get()->error("ModbusAPI: setMetadataCache() -- invalid object state '{}'", enum2Str::toStr(mState));
+    return ErrorCode::INVALID_STATE;
+  }
+
+  mMetadataSize = _capacity;
+  return ErrorCode::OK;
+}
+
+/*!
+ * \brief Sets the derived (virtual) registers (nullptr to disable)
+ *
+ * The derived registers are added to the RegisterContainer by initialize(). updateRegisters() reads the inputs of the
+ * requested derived registers and re-evaluates the derived registers whose inputs changed. The update listeners also
+ * receive the changed derived registers.
+ *
+ * \note Must be called before initialize()
+ * \sa DerivedRegisters
+ */
+ErrorCode ModbusAPI::setDerivedRegisters(shared_ptr<DerivedRegisters> _derived) {
+  if (mState != State::CONFIGURE) {
+    log::get()->error("ModbusAPI: setDerivedRegisters() -- invalid object state '{}'", enum2Str::toStr(mState));
+    return ErrorCode::INVALID_STATE;
+  }
+
+  mDerived = _derived;
+  return ErrorCode::OK;
+}
+
+
+
+/*!
+ * \brief Returns a copy of the request statistics of the current connection
+ *
+ * The statistics are collected lock-free, so this function can be called from any thread (for instance by an exporter)
+ * while updateRegisters() is running.
+ *
+ * \note The statistics belong to the connection object, so they are reset by the setConnection*() functions.
+ */
+Statistics::Snapshot ModbusAPI::getStatistics() const {
+  if (!mConn) { return {}; }
+  Statistics::Snapshot snap = mConn->statistics().snapshot();
+  snap.tuning               = mConn->tuning().snapshot();
+  return snap;
+}
+
+//! Resets the request statistics of the current connection.
+void ModbusAPI::resetStatistics() {
+  if (mConn) { mConn->statistics().reset(); }
+}
+
+/*!
+ * \brief Enables or disables the adaptive response timeout and batch size of the current connection
+ *
+ * The adaptive tuning is enabled by default. When disabled, the libmodbus timeouts are kept and the batches are only
+ * limited by SMA_MODBUS_MAX_REGISTER_COUNT.
+ *
+ * \note The tuning belongs to the connection object, so it is reset by the setConnection*() functions.
+ *
+ * \sa AdaptiveTuning
+ */
+void ModbusAPI::setAdaptiveTuning(bool _enabled) {
+  if (mConn) { mConn->tuning().setEnabled(_enabled); }
+}
+
+/*!
+ * \brief Sets the supported registers of the device (nullptr to disable)
+ *
+ * updateRegisters() never requests registers that are REJECTED in the map. They are reported as failed.
+ *
+ * \sa CapabilityProbe, CapabilityStore
+ */
+void ModbusAPI::setCapabilities(shared_ptr<CapabilityMap const> _caps) { mCapabilities = _caps; }
@@ -19,13 +19,20 @@
 
 #include "mSMAConfig.hpp"
 
+#include <functional>
 #include <memory>
 #include <string>
 
+#include "Capabilities.hpp"
 #include "DataBase.hpp"
+#include "DerivedRegisters.hpp"
 #include "Enums.hpp"
 #include "MBConnectionBase.hpp"
+#include "MBConnectionPool.hpp"
+#include "MetadataCache.hpp"
+#include "ReadPlan.hpp"
 #include "RegisterContainer.hpp"
+#include "Statistics.hpp"
 
 //! The main namespace of this library.
 namespace modbusSMA {
@@ -98,16 +105,38 @@ namespace modbusSMA {
  * \enddot
  */
 class ModbusAPI {
+ public:
+  /*!
+   * \brief Called at the end of updateRegisters()
+   *
+   * Arguments: the registers, the (sorted) addresses of the updated registers and the UNIX timestamp in ms.
+   */
+  typedef std::function<void(RegisterContainer const &, std::vector<uint16_t> const &, int64_t)> UpdateListener;
+
  private:
   std::unique_ptr<MBConnectionBase>  mConn      = nullptr;
+  std::unique_ptr<MBConnectionPool>  mPool      = nullptr; //!< Additional connections (see setConnectionCount()).
   std::shared_ptr<DataBase>          mDB        = nullptr;
   std::shared_ptr<RegisterContainer> mRegisters = nullptr;
 
+  std::shared_ptr<CapabilityMap const> mCapabilities = nullptr; //!< Registers to skip (see setCapabilities()).
+  std::shared_ptr<MetadataCache>       mMetadata     = nullptr; //!< Low memory mode (see setMetadataCache()).
+  std::shared_ptr<DerivedRegisters>    mDerived      = nullptr; //!< Virtual registers (see setDerivedRegisters()).
+
   std::string mInverterType   = "";
   uint32_t    mInverterTypeID = 0;
+  uint32_t    mSerialNumber   = 0;
+  size_t      mNumConnections = 1;
+  size_t      mMetadataSize   = 0;
+  int         mLastError      = 0; //!< errno of the last request (all connections, see lastError()).
+
+  std::vector<std::pair<size_t, UpdateListener>> mListeners;
+  size_t                                         mNextListener = 1;
 
   State mState = State::CONFIGURE;
 
+  void mergeError(int _errno);
+
  public:
   ModbusAPI() = delete;
   ModbusAPI(std::string _ip, uint32_t _port, std::shared_ptr<DataBase> _db = nullptr);
@@ -132,8 +161,17 @@ class ModbusAPI {
   ErrorCode setup();
   void      reset();
 
-  ErrorCode updateRegisters(std::vector<uint16_t> _regList, size_t *_numUpdated = nullptr);
-  ErrorCode updateRegisters(std::vector<Register> _regList, size_t *_numUpdated = nullptr);
+  ErrorCode updateRegisters(std::vector<uint16_t>  _regList,
+                            size_t *               _numUpdated = nullptr,
+                            std::vector<uint16_t> *_failed     = nullptr);
+  ErrorCode updateRegisters(std::vector<Register>  _regList,
+                            size_t *               _numUpdated = nullptr,
+                            std::vector<uint16_t> *_failed     = nullptr);
+
+  std::vector<uint16_t> readRaw(uint16_t _reg, uint16_t _num);
+  ErrorCode             writeRaw(uint16_t _reg, std::vector<uint16_t> const &_data);
+  ErrorCode             readBatches(ReadPlan const &_plan, std::vector<std::vector<uint16_t>> &_out);
+  int                   lastError() const;
 
   ErrorCode setDataBase(std::shared_ptr<DataBase> _db);
   ErrorCode setDataBase(std::string _dbPath);
@@ -141,13 +179,29 @@ class ModbusAPI {
   ErrorCode setConnectionTCP_IP(std::string _ip, uint32_t _port);
   ErrorCode setConnectionTCP_IP_PI(std::string _node, std::string _service);
   ErrorCode setConnectionRTU(std::string _device, uint32_t _baud, char _parity, int _dataBit, int _stopBit);
+  ErrorCode setConnectionCount(size_t _count);
+  ErrorCode setMetadataCache(size_t _capacity);
+  ErrorCode setDerivedRegisters(std::shared_ptr<DerivedRegisters> _derived);
 
-  inline State                              getState() const { return mState; }         //!< Returns the current state.
-  inline std::shared_ptr<DataBase>          getDataBase() { return mDB; }               //!< Returns the used DataBase.
-  inline std::shared_ptr<RegisterContainer> getRegisters() const { return mRegisters; } //!< Returns the registers.
+  inline State                              getState() const { return mState; } //!< Returns the current state.
+  inline std::shared_ptr<DataBase>          getDataBase() { return mDB; } //!< Returns the used DataBase.
+  inline std::shared_ptr<RegisterContainer> getRegisters() const { return mRegisters; }   //!< Returns the registers.
+  inline std::shared_ptr<MetadataCache>     metadataCache() const { return mMetadata; }   //!< nullptr if disabled.
+  inline std::shared_ptr<DerivedRegisters>  derivedRegisters() const { return mDerived; } //!< nullptr if not set.
 
   inline std::string inverterType() const { return mInverterType; }     //!< Returns the inverter type.
   inline uint32_t    inverterTypeID() const { return mInverterTypeID; } //!< Returns the inverter type (ID).
+  inline uint32_t    serialNumber() const { return mSerialNumber; }     //!< Returns the serial number.
+
+  void                                        setCapabilities(std::shared_ptr<CapabilityMap const> _caps);
+  inline std::shared_ptr<CapabilityMap const> capabilities() const { return mCapabilities; } //!< The used map.
+
+  size_t addUpdateListener(UpdateListener _fn);
+  void   removeUpdateListener(size_t _id);
+
+  Statistics::Snapshot getStatistics() const;
+  void                 resetStatistics();
+  void                 setAdaptiveTuning(bool _enabled);
 };
 
 } // namespace modbusSMA
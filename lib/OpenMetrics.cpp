@@ -0,0 +1,411 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "OpenMetrics.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "Logging.hpp"
+
+using namespace std;
+using namespace modbusSMA;
+
+const char   OPEN_METRICS_CONTENT_TYPE[] = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+const size_t MAX_HTTP_REQUEST_SIZE       = 8 * 1024;
+
+//! Converts _str to a valid metric name part ([a-z0-9_], no repeated '_').
+string sanitizeMetricName(string const &_str) {
+  string out;
+  for (char i : _str) {
+    if (isalnum((unsigned char)i)) {
+      out += (char)tolower((unsigned char)i);
+    } else if (i == '%') {
+      out += out.empty() || out.back() == '_' ? "percent" : "_percent";
+    } else if (!out.empty() && out.back() != '_') {
+      out += '_';
+    }
+  }
+
+  while (!out.empty() && out.back() == '_') { out.pop_back(); }
+  return out;
+}
+
+//! Escapes a label value (backslash, double quote and newline).
+string escapeLabel(string const &_str) {
+  string out;
+  for (char i : _str) {
+    switch (i) {
+      case '\\': out += "\\\\"; break;
+      case '"': out += "\\\""; break;
+      case '\n': out += "\\n"; break;
+      default: out += i; break;
+    }
+  }
+  return out;
+}
+
+//! Returns the first line of a register description (the other lines contain the ENUM values).
+string firstLine(string const &_str) {
+  string line = _str.substr(0, _str.find('\n'));
+  while (!line.empty() && isspace((unsigned char)line.back())) { line.pop_back(); }
+  return line;
+}
+
+
+
+//! Returns whether the register has a numeric value that can be exported.
+bool MetricTable::isExported(Register const &_reg) {
+  if (!_reg.canRead()) { return false; }
+  switch (_reg.type()) {
+    case DataType::S16:
+    case DataType::S32:
+    case DataType::S64:
+    case DataType::U16:
+    case DataType::U32:
+    case DataType::U64: break;
+    default: return false;
+  }
+
+  switch (_reg.format()) {
+    case DataFormat::FW:
+    case DataFormat::IP4:
+    case DataFormat::REV:
+    case DataFormat::UTF8:
+    case DataFormat::__UNKNOWN__: return false;
+    default: return true;
+  }
+}
+
+//! Generates the metric name of a register.
+string MetricTable::metricName(Register const &_reg) {
+  auto   meta    = _reg.metadata();
+  string name    = "sma_" + sanitizeMetricName(firstLine(meta->desc));
+  string unit    = sanitizeMetricName(meta->unit);
+  bool   hasUnit = name.size() > unit.size() && name.compare(name.size() - unit.size(), unit.size(), unit) == 0;
+  if (!unit.empty() && !hasUnit) { name += "_" + unit; }
+
+  if (_reg.format() == DataFormat::ENUM) { name += "_code"; }
+  return name;
+}
+
+/*!
+ * \brief Precomputes the metric names and labels for all exportable registers in _regList
+ *
+ * \param _container The registers
+ * \param _regList   The registers to export (registers with non numeric values are skipped)
+ */
+MetricTable::MetricTable(RegisterContainer &_container, vector<uint16_t> const &_regList) {
+  vector<pair<string, Register>> named;
+  _container.forEach(_regList, [&](Register const &_reg) {
+    if (isExported(_reg)) { named.emplace_back(metricName(_reg), _reg); }
+  });
+
+  // All samples of one family must be grouped together
+  stable_sort(begin(named), end(named), [](auto const &a, auto const &b) { return a.first < b.first; });
+
+  string lastName;
+  for (auto &i : named) {
+    Register const &reg  = i.second;
+    auto            meta = reg.metadata();
+    string          desc = escapeLabel(firstLine(meta->desc));
+
+    if (mFamilies.empty() || i.first != lastName) {
+      mFamilies.push_back({fmt::format("# HELP {0} {1}\n# TYPE {0} gauge\n", i.first, desc), mEntries.size(), 0});
+      lastName = i.first;
+    }
+
+    mEntries.push_back({reg.reg(),
+                        fmt::format("{}{{register=\"{}\",unit=\"{}\",description=\"{}\"}} ",
+                                    i.first,
+                                    reg.reg(),
+                                    escapeLabel(meta->unit),
+                                    desc)});
+    mFamilies.back().end = mEntries.size();
+    mRegList.push_back(reg.reg());
+  }
+}
+
+//! Copies the current register values (in table order) into the snapshot. Missing registers are stored as NaN.
+void MetricTable::fill(RegisterContainer &_container, MetricSnapshot &_snapshot) const {
+  _snapshot.values.clear();
+  _snapshot.values.reserve(mRegList.size());
+
+  // One value per table entry, render() matches them by position
+  for (uint16_t i : mRegList) {
+    Register const *reg = _container.get(i);
+    _snapshot.values.push_back(!reg || reg->isNaN() ? NAN : reg->valueDouble());
+  }
+}
+
+//! Renders the snapshot in the OpenMetrics text format. Invalid (NaN) values and empty families are omitted.
+void MetricTable::render(MetricSnapshot const &_snapshot, string &_out) const {
+  _out.reserve(_out.size() + mEntries.size() * 128);
+
+  for (auto const &family : mFamilies) {
+    size_t headerPos  = _out.size();
+    size_t numSamples = 0;
+
+    _out += family.header;
+    for (size_t i = family.begin; i < family.end && i < _snapshot.values.size(); ++i) {
+      double value = _snapshot.values[i];
+      if (isnan(value)) { continue; }
+
+      _out += mEntries[i].prefix;
+      _out += fmt::format("{}\n", value);
+      ++numSamples;
+    }
+
+    if (numSamples == 0) { _out.resize(headerPos); } // Skip families without valid values
+  }
+
+  if (_snapshot.hasStats) { renderStatistics(_snapshot.stats, _out); }
+  _out += "# EOF\n";
+}
+
+//! Renders a latency histogram as the samples of an OpenMetrics summary (in seconds).
+void renderSummary(string const &_name, string const &_labels, LatencyHistogram::Snapshot const &_hist, string &_out) {
+  string sep = _labels.empty() ? "" : ",";
+  for (double i : {50.0, 90.0, 99.0}) {
+    _out += fmt::format("{}{{{}{}quantile=\"{}\"}} {}\n", _name, _labels, sep, i / 100.0, _hist.percentile(i) / 1e6);
+  }
+
+  string labels = _labels.empty() ? "" : "{" + _labels + "}";
+  _out += fmt::format("{}_count{} {}\n{}_sum{} {}\n", _name, labels, _hist.count, _name, labels, _hist.sum / 1e6);
+}
+
+//! Renders the modbus request statistics (counters and latency summaries).
+void MetricTable::renderStatistics(Statistics::Snapshot const &_stats, string &_out) {
+  auto counter = [&_out](string const &_name, string const &_help, uint64_t _value) {
+    _out += fmt::format("# HELP {0} {1}\n# TYPE {0} counter\n{0}_total {2}\n", _name, _help, _value);
+  };
+
+  counter("sma_modbus_requests", "Modbus read requests", _stats.requests);
+  counter("sma_modbus_request_failures", "Failed modbus read requests", _stats.failedRequests);
+  counter("sma_modbus_registers_read", "Successfully read modbus registers", _stats.registersRead);
+  counter("sma_modbus_pdu_sent_bytes", "Modbus PDU bytes sent", _stats.bytesSent);
+  counter("sma_modbus_pdu_received_bytes", "Modbus PDU bytes received", _stats.bytesReceived);
+  counter("sma_modbus_connects", "Connection attempts", _stats.connects);
+  counter("sma_modbus_connect_failures", "Failed connection attempts", _stats.failedConnects);
+  counter("sma_modbus_update_cycles", "updateRegisters() calls", _stats.cycles);
+  counter("sma_modbus_batches", "Batches requested by updateRegisters()", _stats.batches);
+  counter("sma_modbus_batch_failures", "Failed batches", _stats.failedBatches);
+
+  _out += "# HELP sma_modbus_request_errors Failed requests by error class\n# TYPE sma_modbus_request_errors counter\n";
+  for (size_t i = 0; i < Statistics::NUM_ERROR_CLASSES; ++i) {
+    _out += fmt::format("sma_modbus_request_errors_total{{class=\"{}\"}} {}\n",
+                        Statistics::toStr((Statistics::ErrorClass)i),
+                        _stats.errors[i]);
+  }
+
+  _out += "# HELP sma_modbus_phase_duration_seconds Duration of the last setup phase\n";
+  _out += "# TYPE sma_modbus_phase_duration_seconds gauge\n";
+  for (size_t i = 0; i < Statistics::NUM_PHASES; ++i) {
+    if (_stats.phases[i].count == 0) { continue; }
+    _out += fmt::format("sma_modbus_phase_duration_seconds{{phase=\"{}\"}} {}\n",
+                        Statistics::toStr((Statistics::Phase)i),
+                        _stats.phases[i].last / 1e6);
+  }
+
+  _out += "# HELP sma_modbus_request_latency_seconds Latency of modbus read requests\n";
+  _out += "# TYPE sma_modbus_request_latency_seconds summary\n";
+  renderSummary("sma_modbus_request_latency_seconds", "", _stats.latency, _out);
+
+  _out += "# HELP sma_modbus_batch_latency_seconds Latency of modbus read requests by batch size\n";
+  _out += "# TYPE sma_modbus_batch_latency_seconds summary\n";
+  for (size_t i = 0; i < Statistics::NUM_SIZE_CLASSES; ++i) {
+    if (_stats.latencyBySize[i].count == 0) { continue; }
+    string labels = fmt::format("batch_size=\"{}\"", Statistics::sizeClassLabel(i));
+    renderSummary("sma_modbus_batch_latency_seconds", labels, _stats.latencyBySize[i], _out);
+  }
+
+  _out += "# HELP sma_modbus_update_duration_seconds Duration of updateRegisters()\n";
+  _out += "# TYPE sma_modbus_update_duration_seconds summary\n";
+  renderSummary("sma_modbus_update_duration_seconds", "", _stats.cycleLatency, _out);
+
+  if (!_stats.tuning.enabled) { return; }
+
+  auto gauge = [&_out](string const &_name, string const &_help, double _value) {
+    _out += fmt::format("# HELP {0} {1}\n# TYPE {0} gauge\n{0} {2}\n", _name, _help, _value);
+  };
+
+  gauge("sma_modbus_response_timeout_seconds", "Adaptive response timeout", _stats.tuning.timeout.count() / 1e6);
+  gauge("sma_modbus_batch_limit", "Adaptive maximum batch size", _stats.tuning.batchLimit);
+  gauge("sma_modbus_rtt_seconds", "Estimated round trip time", _stats.tuning.rtt / 1e6);
+  gauge("sma_modbus_register_cost_seconds", "Estimated transfer time per register", _stats.tuning.wordCost / 1e6);
+}
+
+
+
+//! Creates the metric table for the registers in _regList.
+MetricsExporter::MetricsExporter(RegisterContainer &_container, vector<uint16_t> const &_regList)
+    : mTable(_container, _regList) {}
+
+MetricsExporter::~MetricsExporter() { stop(); }
+
+/*!
+ * \brief Starts the HTTP server thread
+ *
+ * \param _bindAddress The IPv4 address to listen on
+ * \param _port        The TCP port to listen on
+ */
+ErrorCode MetricsExporter::start(string _bindAddress, uint16_t _port) {
+  auto        logger = log::get();
+  sockaddr_in addr   = {};
+  int         one    = 1;
+
+  if (mServerFD >= 0) { return ErrorCode::INVALID_STATE; }
+
+  addr.sin_family = AF_INET;
+  addr.sin_port   = htons(_port);
+  if (inet_pton(AF_INET, _bindAddress.c_str(), &addr.sin_addr) != 1) {
+    logger->error("MetricsExporter: invalid bind address '{}'", _bindAddress);
+    return ErrorCode::ERROR;
+  }
+
+  mServerFD = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (mServerFD < 0 || pipe2(mStopPipe, O_CLOEXEC) != 0) {
+    logger->error("MetricsExporter: failed to create the server socket: '{}'", strerror(errno));
+    stop();
+    return ErrorCode::ERROR;
+  }
+
+  setsockopt(mServerFD, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(mServerFD, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(mServerFD, 16) != 0) {
+    logger->error("MetricsExporter: failed to listen on {}:{}: '{}'", _bindAddress, _port, strerror(errno));
+    stop();
+    return ErrorCode::ERROR;
+  }
+
+  SPDLOG_LOGGER_INFO(logger,
+                     "MetricsExporter: serving {} metrics on http://{}:{}/metrics",
+                     mTable.size(),
+                     _bindAddress,
+                     _port);
+  mThread = thread(&MetricsExporter::serve, this);
+  return ErrorCode::OK;
+}
+
+//! Stops the HTTP server thread.
+void MetricsExporter::stop() {
+  if (mStopPipe[1] >= 0) {
+    char c = 1;
+    (void)!write(mStopPipe[1], &c, 1);
+  }
+
+  if (mThread.joinable()) { mThread.join(); }
+
+  for (int *i : {&mServerFD, &mStopPipe[0], &mStopPipe[1]}) {
+    if (*i >= 0) { close(*i); }
+    *i = -1;
+  }
+}
+
+//! Publishes the current values of the exported registers (and the statistics). Called after each poll cycle.
+void MetricsExporter::update(RegisterContainer &_container, uint64_t _cycle, Statistics::Snapshot const *_stats) {
+  int64_t now = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+  mBuffer.publish([&](MetricSnapshot &_snapshot) {
+    _snapshot.cycle     = _cycle;
+    _snapshot.timestamp = now;
+    _snapshot.hasStats  = _stats != nullptr;
+    mTable.fill(_container, _snapshot);
+    if (_stats) { _snapshot.stats = *_stats; }
+  });
+}
+
+//! Renders the latest snapshot (only the EOF marker if no snapshot was published yet).
+void MetricsExporter::render(string &_out) const {
+  auto snapshot = mBuffer.acquire();
+  if (snapshot) {
+    mTable.render(*snapshot, _out);
+  } else {
+    _out += "# EOF\n";
+  }
+}
+
+//! The HTTP server loop.
+void MetricsExporter::serve() {
+  pollfd fds[2] = {{mStopPipe[0], POLLIN, 0}, {mServerFD, POLLIN, 0}};
+
+  while (true) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) { continue; }
+      log::get()->error("MetricsExporter: poll() failed: '{}'", strerror(errno));
+      return;
+    }
+
+    if (fds[0].revents != 0) { return; }
+    if ((fds[1].revents & POLLIN) == 0) { continue; }
+
+    int clientFD = accept4(mServerFD, nullptr, nullptr, SOCK_CLOEXEC);
+    if (clientFD < 0) { continue; }
+
+    handleClient(clientFD);
+    close(clientFD);
+  }
+}
+
+//! Reads one HTTP request and sends the response (HTTP/1.0 style, the connection is closed afterwards).
+void MetricsExporter::handleClient(int _fd) {
+  timeval timeout = {1, 0};
+  setsockopt(_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  string request;
+  char   buffer[1024];
+  while (request.find("\r\n\r\n") == string::npos && request.find("\n\n") == string::npos) {
+    ssize_t len = recv(_fd, buffer, sizeof(buffer), 0);
+    if (len <= 0 || request.size() > MAX_HTTP_REQUEST_SIZE) { return; }
+    request.append(buffer, (size_t)len);
+  }
+
+  string status      = "200 OK";
+  string contentType = OPEN_METRICS_CONTENT_TYPE;
+  string body;
+
+  if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0) {
+    render(body);
+  } else if (request.compare(0, 4, "GET ") == 0) {
+    status      = "404 Not Found";
+    contentType = "text/plain";
+    body        = "Not found\n";
+  } else {
+    status      = "405 Method Not Allowed";
+    contentType = "text/plain";
+    body        = "Method not allowed\n";
+  }
+
+  string response = fmt::format("HTTP/1.0 {}\r\nContent-Type: {}\r\nContent-Length: {}\r\nConnection: close\r\n\r\n",
+                                status,
+                                contentType,
+                                body.size());
+  response += body;
+
+  size_t sent = 0;
+  while (sent < response.size()) {
+    ssize_t len = send(_fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+    if (len <= 0) { return; }
+    sent += (size_t)len;
+  }
+}
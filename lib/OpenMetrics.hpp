@@ -0,0 +1,120 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Enums.hpp"
+#include "RegisterContainer.hpp"
+#include "SnapshotBuffer.hpp"
+#include "Statistics.hpp"
+
+namespace modbusSMA {
+
+//! The values of one poll cycle in the order of the MetricTable entries (NaN for invalid values).
+struct MetricSnapshot {
+  uint64_t             cycle     = 0;     //!< Number of the poll cycle.
+  int64_t              timestamp = 0;     //!< UNIX timestamp in ms.
+  std::vector<double>  values;            //!< The values.
+  bool                 hasStats  = false; //!< Whether stats is valid.
+  Statistics::Snapshot stats;             //!< The modbus request statistics.
+};
+
+/*!
+ * \brief Precomputed OpenMetrics names and labels for a list of registers
+ *
+ * The metric name is generated from the first line of the register description and the unit (for instance
+ * `sma_grid_voltage_phase_l1_v`). Each sample has the labels `register`, `unit` and `description`. Only registers
+ * with a numeric value (including ENUM codes) are exported.
+ */
+class MetricTable {
+ private:
+  //! One sample line.
+  struct Entry {
+    uint16_t    reg;    //!< The register address.
+    std::string prefix; //!< Metric name and labels, including the trailing space.
+  };
+
+  //! Metric family (all entries with the same name).
+  struct Family {
+    std::string header; //!< The HELP and TYPE lines.
+    size_t      begin;  //!< The first entry.
+    size_t      end;    //!< One past the last entry.
+  };
+
+  std::vector<Entry>    mEntries;
+  std::vector<Family>   mFamilies;
+  std::vector<uint16_t> mRegList;
+
+ public:
+  MetricTable() = default;
+  MetricTable(RegisterContainer &_container, std::vector<uint16_t> const &_regList);
+
+  static bool        isExported(Register const &_reg);
+  static std::string metricName(Register const &_reg);
+
+  void fill(RegisterContainer &_container, MetricSnapshot &_snapshot) const;
+  void render(MetricSnapshot const &_snapshot, std::string &_out) const;
+
+  static void renderStatistics(Statistics::Snapshot const &_stats, std::string &_out);
+
+  inline size_t                       size() const { return mEntries.size(); } //!< Number of exported registers.
+  inline std::vector<uint16_t> const &registers() const { return mRegList; }   //!< The exported registers.
+};
+
+/*!
+ * \brief Tiny HTTP server for OpenMetrics / Prometheus scrapes
+ *
+ * The poll loop calls update() after each cycle; this copies the register values into a SnapshotBuffer. Scrapes
+ * (`GET /metrics`) are rendered from the latest snapshot in a background thread, so they never block the poll loop
+ * and never cause Modbus traffic. If the request statistics are passed to update(), they are exported as well
+ * (`sma_modbus_*`).
+ */
+class MetricsExporter {
+ private:
+  MetricTable                    mTable;
+  SnapshotBuffer<MetricSnapshot> mBuffer;
+
+  int         mServerFD    = -1;
+  int         mStopPipe[2] = {-1, -1};
+  std::thread mThread;
+
+  void serve();
+  void handleClient(int _fd);
+
+ public:
+  MetricsExporter() = delete;
+  MetricsExporter(RegisterContainer &_container, std::vector<uint16_t> const &_regList);
+  virtual ~MetricsExporter();
+
+  MetricsExporter(MetricsExporter const &) = delete;
+  void operator=(MetricsExporter const &) = delete;
+
+  ErrorCode start(std::string _bindAddress, uint16_t _port);
+  void      stop();
+  void      update(RegisterContainer &_container, uint64_t _cycle, Statistics::Snapshot const *_stats = nullptr);
+  void      render(std::string &_out) const;
+
+  inline MetricTable const &table() const { return mTable; } //!< Returns the metric table.
+};
+
+} // namespace modbusSMA
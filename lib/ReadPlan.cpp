@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ReadPlan.hpp"
+
+using namespace std;
+using namespace modbusSMA;
+
+/*!
+ * \brief Creates the batches for _regList
+ *
+ * Virtual registers (see Register::isVirtual()) are skipped.
+ *
+ * \param _regList The registers to read (must be sorted)
+ * \param _maxSize The maximum number of modbus registers per batch
+ */
+ReadPlan::ReadPlan(vector<Register> const &_regList, uint32_t _maxSize) {
+  mBatches.reserve(_regList.size()); // Worst case: every register has its own batch
+
+  for (Register const &i : _regList) {
+    if (i.isVirtual()) { continue; }
+
+    Batch *curr = mBatches.empty() ? nullptr : &mBatches.back();
+
+    if (!curr || ((curr->size + i.size()) >= _maxSize) || // Check if maximum request size is reached
+        ((curr->start + curr->size) != i.reg())) {        // Check if continous
+      mBatches.push_back({i.reg(), 0, {}});
+      curr = &mBatches.back();
+    }
+
+    curr->regs.push_back({i.reg(), curr->size, (uint16_t)i.size()});
+    curr->size += i.size();
+    ++mNumRegisters;
+  }
+}
+
+//! Creates a plan from already split batches (the batches are not merged).
+ReadPlan::ReadPlan(vector<Batch> _batches) : mBatches(move(_batches)) {
+  for (auto const &i : mBatches) { mNumRegisters += i.regs.size(); }
+}
@@ -0,0 +1,68 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <vector>
+
+#include "Register.hpp"
+
+namespace modbusSMA {
+
+/*!
+ * \brief Splits a list of registers into Modbus read requests (batches)
+ *
+ * Registers are merged into one batch as long as they are continuous and the batch stays below the maximum request
+ * size.
+ */
+class ReadPlan {
+ public:
+  //! One register inside a batch.
+  struct Reg {
+    uint16_t reg;    //!< 16-bit register address.
+    uint16_t offset; //!< Offset of the register in the data of the batch.
+    uint16_t size;   //!< Number of modbus registers used by the Register.
+  };
+
+  //! One Modbus read request.
+  struct Batch {
+    uint16_t         start; //!< The first register address.
+    uint16_t         size;  //!< Size of the batch in number of modbus registers.
+    std::vector<Reg> regs;  //!< Registers in the batch.
+  };
+
+ private:
+  std::vector<Batch> mBatches;
+  size_t             mNumRegisters = 0;
+
+ public:
+  ReadPlan() = default;
+  ReadPlan(std::vector<Register> const &_regList, uint32_t _maxSize = SMA_MODBUS_MAX_REGISTER_COUNT);
+  explicit ReadPlan(std::vector<Batch> _batches);
+
+  inline std::vector<Batch> const &batches() const { return mBatches; }           //!< Returns the batches.
+  inline size_t                    size() const { return mBatches.size(); }       //!< Number of batches.
+  inline bool                      empty() const { return mBatches.empty(); }     //!< Checks if empty.
+  inline size_t                    numRegisters() const { return mNumRegisters; } //!< Number of planned registers.
+
+  inline std::vector<Batch>::const_iterator begin() const { return mBatches.begin(); } //!< Batch iterator.
+  inline std::vector<Batch>::const_iterator end() const { return mBatches.end(); }     //!< Batch iterator.
+};
+
+} // namespace modbusSMA
@@ -16,33 +16,16 @@
 
 #include "Register.hpp"
 
-#include <regex>
-#include <sstream>
-
 #include "Logging.hpp"
 
 using namespace std;
 using namespace modbusSMA;
 
-template <typename Out>
-void split(const string &s, char delim, Out result) {
-  stringstream ss(s);
-  string       item;
-  while (getline(ss, item, delim)) { *(result++) = item; }
-}
+namespace {
 
-vector<string> split(const string &s, char delim) {
-  vector<string> elems;
-  split(s, delim, back_inserter(elems));
-  return elems;
-}
+const string EMPTY_STRING = "";
 
-string trim(const string &str) {
-  size_t first = str.find_first_not_of(" \n\t");
-  if (string::npos == first) { return str; }
-  size_t last = str.find_last_not_of(" \n\t");
-  return str.substr(first, (last - first + 1));
-}
+} // namespace
 
 //! Initializes the register.
 Register::Register(uint16_t    _reg,    //!< The starting register.
@@ -52,29 +35,49 @@ Register::Register(uint16_t    _reg,    //!< The starting register.
                    DataFormat  _format, //!< The data format.
                    DataAccess  _access  //!< How this register can be accessed.
                    )
-    : mReg(_reg), mDesc(_desc), mUnit(_unit), mType(_type), mFormat(_format), mAccess(_access) {
+    : mReg(_reg), mType(_type), mFormat(_format), mAccess(_access) {
   resetData();
 
-  vector<string> splitDesc = split(mDesc, '\n');
-  if (splitDesc.size() > 1) {
-    for (size_t i = 1; i < splitDesc.size(); ++i) {
-      vector<string> currSplit = split(splitDesc[i], '=');
-      if (currSplit.size() < 2) { continue; }
+  auto info = make_shared<MetadataCache::Entry>();
+  if (_desc.find('\n') != string::npos) { info->enums = EnumTable::get(_desc); }
+  info->desc = move(_desc);
+  info->unit = move(_unit);
+  mInfo      = move(info);
+}
 
-      string num  = trim(currSplit[0]);
-      string name = currSplit[1];
+/*!
+ * \brief Initializes a register without resident metadata (low memory mode)
+ *
+ * desc(), unit() and enums() are loaded from _meta on demand.
+ */
+Register::Register(uint16_t                  _reg,    //!< The starting register.
+                   shared_ptr<MetadataCache> _meta,   //!< Source of the description, unit and enums.
+                   DataType                  _type,   //!< The data type.
+                   DataFormat                _format, //!< The data format.
+                   DataAccess                _access  //!< How this register can be accessed.
+                   )
+    : mReg(_reg), mType(_type), mFormat(_format), mAccess(_access), mMeta(_meta) {
+  resetData();
+}
 
-      for (size_t j = 2; j < currSplit.size(); ++j) { name += "=" + currSplit[j]; }
-      name = trim(name);
+/*!
+ * \brief Returns the description, unit and enum table of the register
+ *
+ * In the low memory mode the entry is loaded from the MetadataCache and stays valid as long as the returned pointer
+ * exists. Use this instead of desc(), unit() and enums() if more than one of them is needed.
+ */
+MetadataCache::EntryPtr Register::metadata() const { return mMeta ? mMeta->get(mReg) : mInfo; }
 
-      uint32_t number;
-      try {
-        number = (uint32_t)stoi(num);
-      } catch (...) { continue; }
+//! Returns the register description (an empty string in the low memory mode, see metadata()).
+string const &Register::desc() const noexcept { return mInfo ? mInfo->desc : EMPTY_STRING; }
 
-      mEnumData[number] = name;
-    }
-  }
+//! Returns the unit of the register (an empty string in the low memory mode, see metadata()).
+string const &Register::unit() const noexcept { return mInfo ? mInfo->unit : EMPTY_STRING; }
+
+//! Returns the enum values (an empty table if the register has none).
+shared_ptr<EnumTable const> Register::enums() const {
+  auto const &table = metadata()->enums;
+  return table ? table : EnumTable::empty();
 }
 
 //! The size in 16-bit words of this register (returns 2 for an unknown type)
@@ -91,34 +94,37 @@ uint32_t Register::size() const noexcept {
   }
 }
 
-//! Generate NaN values for the current data type.
-vector<uint16_t> Register::getNaN() {
+//! Returns the NaN value of the current data type (the view points to static data).
+WordView Register::nanValue() const noexcept {
+  static const uint16_t S_NAN[4]  = {0x8000, 0x0000, 0x0000, 0x0000};
+  static const uint16_t U_NAN[4]  = {0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF};
+  static const uint16_t ZEROS[16] = {};
+
   switch (mType) {
-    case DataType::S16: return {0x8000}; break;
-    case DataType::S32: return {0x8000, 0x0000}; break;
-    case DataType::S64: return {0x8000, 0x0000, 0x0000, 0x0000}; break;
-    case DataType::U16: return {0xFFFF}; break;
-    case DataType::U32: return {0xFFFF, 0xFFFF}; break;
-    case DataType::U64: return {0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF}; break;
-    case DataType::STR32: return {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}; break;
-    default: return {0x0000, 0x0000};
+    case DataType::S16:
+    case DataType::S32:
+    case DataType::S64: return {S_NAN, size()};
+    case DataType::U16:
+    case DataType::U32:
+    case DataType::U64: return {U_NAN, size()};
+    default: return {ZEROS, size()};
   }
 }
 
-
+//! Generate NaN values for the current data type.
+vector<uint16_t> Register::getNaN() const { return nanValue().toVector(); }
 
 //! Sets the new raw data. Returns false if the size differs from the expected size.
-bool Register::setRaw(std::vector<uint16_t> _data) {
+bool Register::setRaw(WordView _data) noexcept {
   if (_data.size() != size()) { return false; }
-  mData = _data;
+  copy(_data.begin(), _data.end(), begin(mData));
   return true;
 }
 
 //! Returns the value of the register as a string.
-string Register::value() {
-  char *raw = reinterpret_cast<char *>(mData.data());
+string Register::value() const {
+  char const *raw = reinterpret_cast<char const *>(mData.data());
   if (mType == DataType::STR32) {
-    if (mData.size() != 16) { return "Conversion ERROR: Invalid Data size!"; }
     char data[33];
     for (uint32_t i = 0; i < 32; i += 2) {
       data[i + 0] = raw[i + 1];
@@ -128,13 +134,13 @@ string Register::value() {
     return data;
   }
 
-  if (mData == getNaN()) { return "NaN"; }
+  if (isNaN()) { return "NaN"; }
 
   uint32_t numDec = UINT32_MAX;
 
   switch (mFormat) {
     case DataFormat::FW: {
-      if (mData.size() < 2) { return "Conversion ERROR: Invalid Data size!"; }
+      if (size() < 2) { return "Conversion ERROR: Invalid Data size!"; }
       string suffix;
       switch ((uint)raw[2]) {
         case 0: suffix = "N"; break;
@@ -150,18 +156,23 @@ string Register::value() {
 
     case DataFormat::IP4:
     case DataFormat::REV:
-      if (mData.size() < 2) { return "Conversion ERROR: Invalid Data size!"; }
+      if (size() < 2) { return "Conversion ERROR: Invalid Data size!"; }
       return fmt::format("{}.{}.{}.{}", (uint)raw[0], (uint)raw[1], (uint)raw[2], (uint)raw[3]);
 
     case DataFormat::DT: {
       time_t time = (time_t)valueUInt();
-      return asctime(localtime(&time));
+      tm     timeData;
+      char   timeStr[32];
+      localtime_r(&time, &timeData); // Thread safe variants (formatting may run in parallel)
+      return asctime_r(&timeData, timeStr);
     }
 
     case DataFormat::ENUM: {
-      auto iter = mEnumData.find((uint32_t)valueUInt());
-      if (iter == end(mEnumData)) { return fmt::format("ENUM: {}", valueUInt()); }
-      return iter->second;
+      uint32_t           val   = (uint32_t)valueUInt();
+      auto               table = enums(); // Keeps name alive
+      std::string const *name  = table->find(val);
+      if (!name) { return fmt::format("ENUM: {}", val); }
+      return *name;
     }
 
     case DataFormat::FIX0:
@@ -218,28 +229,37 @@ string Register::value() {
 }
 
 //! Get the value as an signed integer. Fixed point number formats are ignored.
-int64_t Register::valueInt() {
+int64_t Register::valueInt() const noexcept {
+  switch (mType) {
+    case DataType::S16: return (int16_t)mData[0];
+    case DataType::S32: return (int32_t)(((uint32_t)mData[0] << 16) + mData[1]);
+    case DataType::S64: return (int64_t)valueUInt();
+    default: return (int64_t)valueUInt();
+  }
+}
+
+//! Get the value as an unsigned integer. Fixed point number formats are ignored.
+uint64_t Register::valueUInt() const noexcept {
   switch (mType) {
     case DataType::S16:
-    case DataType::U16: return (int16_t)mData[0];
+    case DataType::U16: return mData[0];
     case DataType::S32:
-    case DataType::U32: return (int32_t)(((uint32_t)mData[0] << 16) + mData[1]);
+    case DataType::U32: return ((uint32_t)mData[0] << 16) + mData[1];
     case DataType::S64:
     case DataType::U64:
-      return (int64_t)(((uint64_t)mData[0] << 48) + ((uint64_t)mData[0] << 32) + ((uint32_t)mData[0] << 16) + mData[0]);
+      return ((uint64_t)mData[0] << 48) + ((uint64_t)mData[1] << 32) + ((uint64_t)mData[2] << 16) + mData[3];
     default: return 0;
   }
 }
 
-//! Get the value as an unsigned integer. Fixed point number formats are ignored.
-uint64_t Register::valueUInt() { return (uint64_t)valueInt(); }
-
 //! Get the value as floating point variable.
-double Register::valueDouble() {
-  double value = (double)valueInt();
+double Register::valueDouble() const noexcept {
+  bool   isSigned = mType == DataType::S16 || mType == DataType::S32 || mType == DataType::S64;
+  double value    = isSigned ? (double)valueInt() : (double)valueUInt();
 
   switch (mFormat) {
-    case DataFormat::FIX1: value /= 10.0; break;
+    case DataFormat::FIX1:
+    case DataFormat::TEMP: value /= 10.0; break;
     case DataFormat::FIX2: value /= 100.0; break;
     case DataFormat::FIX3: value /= 1000.0; break;
     case DataFormat::FIX4: value /= 10000.0; break;
@@ -19,37 +19,91 @@
 
 #include "mSMAConfig.hpp"
 
-#include <map>
+#include <algorithm>
+#include <array>
+#include <initializer_list>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "EnumTable.hpp"
 #include "Enums.hpp"
+#include "MetadataCache.hpp"
 
 namespace modbusSMA {
 
+/*!
+ * \brief Read only view of 16-bit register words
+ *
+ * The view does not own the data. It is only valid as long as the viewed object (Register, vector, ...) is neither
+ * modified nor destroyed.
+ */
+class WordView {
+ private:
+  uint16_t const *mData = nullptr;
+  size_t          mSize = 0;
+
+ public:
+  WordView() = default;
+  WordView(uint16_t const *_data, size_t _size) noexcept : mData(_data), mSize(_size) {}
+  WordView(std::vector<uint16_t> const &_data) noexcept : mData(_data.data()), mSize(_data.size()) {}
+
+  inline uint16_t const *data() const noexcept { return mData; }                        //!< The first word.
+  inline size_t          size() const noexcept { return mSize; }                        //!< Number of words.
+  inline bool            empty() const noexcept { return mSize == 0; }                  //!< Checks if empty.
+  inline uint16_t const *begin() const noexcept { return mData; }                       //!< Iterator support.
+  inline uint16_t const *end() const noexcept { return mData + mSize; }                 //!< Iterator support.
+  inline uint16_t        operator[](size_t _idx) const noexcept { return mData[_idx]; } //!< Returns the word _idx.
+
+  inline std::vector<uint16_t> toVector() const { return {begin(), end()}; } //!< Returns a copy of the words.
+};
+
+//! Compares the words of two views.
+inline bool operator==(WordView a, WordView b) noexcept {
+  return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin());
+}
+
+//! Compares the words of two views.
+inline bool operator!=(WordView a, WordView b) noexcept { return !(a == b); }
+
 /*!
  * \brief Data and information of one SMA register
+ *
+ * The value is stored inline (at most MAX_WORDS words), so copying and updating a Register does not allocate. The
+ * description, unit and enum table are shared by all copies (see metadata()), use the container overloads
+ * (RegisterContainer::forEach(), ...) to avoid copying the Register objects themselves.
+ *
+ * desc() and unit() return references to the resident strings. Registers in the low memory mode (isLazy()) have no
+ * resident strings, use metadata() for them (or for code that handles both modes).
  */
 class Register {
+ public:
+  static const uint32_t MAX_WORDS = 16; //!< The size of the largest data type (STR32).
+
  private:
-  uint16_t    mReg;
-  std::string mDesc;
-  std::string mUnit;
-  DataType    mType;
-  DataFormat  mFormat;
-  DataAccess  mAccess;
+  uint16_t   mReg;
+  DataType   mType;
+  DataFormat mFormat;
+  DataAccess mAccess;
+  bool       mVirtual = false; //!< Computed by DerivedRegisters, never read from the device.
 
-  std::vector<uint16_t> mData;
+  std::array<uint16_t, MAX_WORDS> mData = {};
 
-  std::map<uint32_t, std::string> mEnumData;
+  MetadataCache::EntryPtr        mInfo; //!< Description, unit and enums (nullptr in the low memory mode).
+  std::shared_ptr<MetadataCache> mMeta; //!< Source of desc, unit and enums in the low memory mode.
 
  public:
   Register() = delete;
   Register(uint16_t _reg, std::string _desc, std::string _unit, DataType _type, DataFormat _format, DataAccess _access);
-
-  inline uint16_t    reg() const noexcept { return mReg; }       //!< Returns the register (integer).
-  inline std::string desc() const noexcept { return mDesc; }     //!< Returns the register description.
-  inline std::string unit() const noexcept { return mUnit; }     //!< Returns the unit of the register.
+  Register(uint16_t                       _reg,
+           std::shared_ptr<MetadataCache> _meta,
+           DataType                       _type,
+           DataFormat                     _format,
+           DataAccess                     _access);
+
+  inline uint16_t    reg() const noexcept { return mReg; } //!< Returns the register (integer).
+  std::string const &desc() const noexcept;
+  std::string const &unit() const noexcept;
   inline DataType    type() const noexcept { return mType; }     //!< Returns the data type.
   inline DataFormat  format() const noexcept { return mFormat; } //!< Returns the data format.
   inline DataAccess  access() const noexcept { return mAccess; } //!< Returns the access type.
@@ -57,18 +111,26 @@ class Register {
   inline bool canRead() const noexcept { return mAccess == DataAccess::RO || mAccess == DataAccess::RW; }  //!< Read?
   inline bool canWrite() const noexcept { return mAccess == DataAccess::RW || mAccess == DataAccess::WO; } //!< Write?
 
-  inline std::vector<uint16_t>           raw() const { return mData; }       //!< Returns the raw data.
-  inline std::map<uint32_t, std::string> enums() const { return mEnumData; } //!< Returns all parsed enums.
+  inline bool isLazy() const noexcept { return mMeta != nullptr; }        //!< Is the metadata loaded on demand?
+  inline bool isVirtual() const noexcept { return mVirtual; }             //!< Computed locally (see DerivedRegisters)?
+  inline void setVirtual(bool _virtual) noexcept { mVirtual = _virtual; } //!< Marks the register as computed.
+
+  inline WordView                  raw() const noexcept { return {mData.data(), size()}; } //!< Returns the raw data.
+  std::shared_ptr<EnumTable const> enums() const;
+  MetadataCache::EntryPtr          metadata() const;
 
-  std::string value();
-  uint64_t    valueUInt();
-  int64_t     valueInt();
-  double      valueDouble();
+  std::string value() const;
+  uint64_t    valueUInt() const noexcept;
+  int64_t     valueInt() const noexcept;
+  double      valueDouble() const noexcept;
 
-  bool        setRaw(std::vector<uint16_t> _data);
-  inline void resetData() { mData = getNaN(); } //!< Reset all data to NaN.
+  bool        setRaw(WordView _data) noexcept;
+  inline bool setRaw(std::initializer_list<uint16_t> _data) noexcept { return setRaw({_data.begin(), _data.size()}); }
+  inline void resetData() noexcept { setRaw(nanValue()); }           //!< Reset all data to NaN.
+  inline bool isNaN() const noexcept { return raw() == nanValue(); } //!< Checks if the value is NaN.
 
-  std::vector<uint16_t> getNaN();
+  WordView              nanValue() const noexcept;
+  std::vector<uint16_t> getNaN() const;
 
   uint32_t size() const noexcept;
 };
@@ -31,23 +31,71 @@ vector<Register> RegisterContainer::getRegisters(vector<uint16_t> _regList) {
 
   for (uint16_t i : _regList) {
     auto pos = lower_bound(begin(mRegisters), end(mRegisters), i); // the register vector is sorted
-    if (*pos == i) { outRegList.push_back(*pos); }
+    if (pos != end(mRegisters) && *pos == i) { outRegList.push_back(*pos); }
   }
 
   return outRegList;
 }
 
+/*!
+ * \brief Returns the addresses of all registers in the range [_min, _max]
+ *
+ * Only the (sorted) addresses are copied, not the Register objects themselves.
+ *
+ * \param _min      The first address to include
+ * \param _max      The last address to include
+ * \param _readable Only return registers that can be read
+ */
+vector<uint16_t> RegisterContainer::getAddresses(uint16_t _min, uint16_t _max, bool _readable) const {
+  vector<uint16_t> outList = {};
+  auto             startIt = lower_bound(begin(mRegisters), end(mRegisters), _min);
+  auto             endIt   = upper_bound(begin(mRegisters), end(mRegisters), _max);
+  outList.reserve(distance(startIt, endIt));
+
+  for (auto i = startIt; i != endIt; ++i) {
+    if (_readable && !i->canRead()) { continue; }
+    outList.push_back(i->reg());
+  }
+
+  return outList;
+}
+
+//! Returns the register with the address _address (nullptr if not found).
+Register const *RegisterContainer::get(uint16_t _address) const {
+  auto pos = lower_bound(begin(mRegisters), end(mRegisters), _address); // the register vector is sorted
+  return pos != end(mRegisters) && *pos == _address ? &*pos : nullptr;
+}
+
 //! Adds the registers to the register list.
 void RegisterContainer::addRegisters(vector<Register> _registers) {
   mRegisters.insert(end(mRegisters), begin(_registers), end(_registers));
   stable_sort(begin(mRegisters), end(mRegisters));
   mRegisters.erase(unique(mRegisters.begin(), mRegisters.end()), mRegisters.end());
+
+  lock_guard<mutex> lock(mIndexMutex);
+  mIndexValid = false;
+}
+
+/*!
+ * \brief Returns the secondary indexes (unit, format, ...)
+ *
+ * The indexes are built on the first call after addRegisters(), so the catalog load (and the low memory mode) does not
+ * pay for them if they are not used.
+ */
+RegisterIndex const &RegisterContainer::index() const {
+  lock_guard<mutex> lock(mIndexMutex);
+  if (!mIndexValid) {
+    mIndex.build(mRegisters);
+    mIndexValid = true;
+  }
+
+  return mIndex;
 }
 
 //! Updates already existing registers
-bool RegisterContainer::updateRegister(uint16_t _address, vector<uint16_t> _data) {
+bool RegisterContainer::updateRegister(uint16_t _address, WordView _data) {
   auto pos = lower_bound(begin(mRegisters), end(mRegisters), _address); // the register vector is always sorted
-  if (not(*pos == _address)) { return false; }
+  if (pos == end(mRegisters) || not(*pos == _address)) { return false; }
 
   return pos->setRaw(_data);
 }
@@ -19,10 +19,13 @@
 
 #include "mSMAConfig.hpp"
 
+#include <algorithm>
 #include <functional>
+#include <mutex>
 #include <vector>
 
 #include "Register.hpp"
+#include "RegisterIndex.hpp"
 
 namespace modbusSMA {
 
@@ -31,19 +34,45 @@ class RegisterContainer {
  private:
   std::vector<Register> mRegisters;
 
+  mutable std::mutex    mIndexMutex;
+  mutable RegisterIndex mIndex;
+  mutable bool          mIndexValid = false;
+
  public:
   RegisterContainer() = default;
 
-  inline size_t   size() const { return mRegisters.size(); }                   //!< The number of registers stored.
-  inline bool     empty() const { return mRegisters.empty(); }                 //!< Checks if empty.
-  inline Register at(uint16_t _idx) const { return mRegisters.at(_idx); }      //!< Returns the register at index _idx.
-  inline Register operator[](uint16_t _idx) const { return mRegisters[_idx]; } //!< Returns the register at index _idx.
+  inline size_t          size() const { return mRegisters.size(); }                   //!< The number of registers.
+  inline bool            empty() const { return mRegisters.empty(); }                 //!< Checks if empty.
+  inline Register const &at(uint16_t _idx) const { return mRegisters.at(_idx); }      //!< The register at index _idx.
+  inline Register const &operator[](uint16_t _idx) const { return mRegisters[_idx]; } //!< The register at index _idx.
 
   void addRegisters(std::vector<Register> _registers);
-  bool updateRegister(uint16_t _address, std::vector<uint16_t> _data);
+  bool updateRegister(uint16_t _address, WordView _data);
 
   std::vector<Register> getRegisters(std::vector<uint16_t> _regList);
+  std::vector<uint16_t> getAddresses(uint16_t _min = 0, uint16_t _max = UINT16_MAX, bool _readable = false) const;
   std::vector<Register> getRegisters() const { return mRegisters; } //!< Returns a COPY of ALL registers.
+
+  Register const *                    get(uint16_t _address) const;
+  inline std::vector<Register> const &registers() const { return mRegisters; } //!< ALL registers (sorted, no copy).
+
+  /*!
+   * \brief Calls _fn for every register in _regList (without copying the registers)
+   *
+   * \param _regList The addresses of the registers (addresses without register are skipped)
+   * \param _fn      Called with `Register const &`
+   */
+  template <typename F>
+  void forEach(std::vector<uint16_t> const &_regList, F &&_fn) const {
+    auto pos = begin(mRegisters);
+    for (uint16_t i : _regList) {
+      if (pos == end(mRegisters) || pos->reg() > i) { pos = begin(mRegisters); } // Only restart for unsorted lists
+      pos = std::lower_bound(pos, end(mRegisters), i);
+      if (pos != end(mRegisters) && pos->reg() == i) { _fn(static_cast<Register const &>(*pos)); }
+    }
+  }
+
+  RegisterIndex const &index() const;
 };
 
 } // namespace modbusSMA
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "RegisterIndex.hpp"
+
+#include <algorithm>
+#include <cctype>
+
+#include "Trace.hpp"
+
+using namespace std;
+using namespace modbusSMA;
+
+namespace {
+
+const RegisterIndex::List EMPTY_LIST = {};
+
+} // namespace
+
+/*!
+ * \brief Splits the first line of _str into lower case words
+ *
+ * Everything except letters and digits separates words.
+ */
+vector<string> RegisterIndex::tokenize(string const &_str) {
+  vector<string> words;
+  string         curr;
+
+  for (char i : _str.substr(0, _str.find('\n'))) {
+    if (isalnum((unsigned char)i)) {
+      curr += (char)tolower((unsigned char)i);
+    } else if (!curr.empty()) {
+      words.push_back(move(curr));
+      curr.clear();
+    }
+  }
+
+  if (!curr.empty()) { words.push_back(move(curr)); }
+  return words;
+}
+
+//! Builds the indexes for _registers (must be sorted, see RegisterContainer).
+void RegisterIndex::build(vector<Register> const &_registers) {
+  trace::Span span("RegisterIndex::build", "db");
+  clear();
+
+  for (Register const &i : _registers) {
+    uint16_t reg  = i.reg();
+    auto     meta = i.metadata(); // Also loads the metadata in the low memory mode
+    mAll.push_back(reg);
+    mUnits[meta->unit].push_back(reg);
+    mFormats[i.format()].push_back(reg);
+    mTypes[i.type()].push_back(reg);
+    mAccess[i.access()].push_back(reg);
+    if (i.canRead()) { mReadable.push_back(reg); }
+    if (i.canWrite()) { mWritable.push_back(reg); }
+
+    for (auto &j : tokenize(meta->desc)) {
+      List &list = mWords[j];
+      if (list.empty() || list.back() != reg) { list.push_back(reg); } // A word can occur more than once
+    }
+  }
+}
+
+//! Removes all entries.
+void RegisterIndex::clear() {
+  mUnits.clear();
+  mWords.clear();
+  mFormats.clear();
+  mTypes.clear();
+  mAccess.clear();
+  mReadable.clear();
+  mWritable.clear();
+  mAll.clear();
+}
+
+RegisterIndex::List const &RegisterIndex::lookup(unordered_map<string, List> const &_map, string const &_key) {
+  auto iter = _map.find(_key);
+  return iter == end(_map) ? EMPTY_LIST : iter->second;
+}
+
+template <typename T>
+RegisterIndex::List const &RegisterIndex::lookup(map<T, List> const &_map, T _key) {
+  auto iter = _map.find(_key);
+  return iter == end(_map) ? EMPTY_LIST : iter->second;
+}
+
+RegisterIndex::List const &RegisterIndex::byUnit(string const &_unit) const { return lookup(mUnits, _unit); }
+RegisterIndex::List const &RegisterIndex::byFormat(DataFormat _format) const { return lookup(mFormats, _format); }
+RegisterIndex::List const &RegisterIndex::byType(DataType _type) const { return lookup(mTypes, _type); }
+RegisterIndex::List const &RegisterIndex::byAccess(DataAccess _access) const { return lookup(mAccess, _access); }
+
+//! Returns the registers with the (lower case) word _word in the first line of the description.
+RegisterIndex::List const &RegisterIndex::byWord(string const &_word) const {
+  string word = _word;
+  transform(begin(word), end(word), begin(word), [](unsigned char c) { return (char)tolower(c); });
+  return lookup(mWords, word);
+}
+
+//! Returns the sorted addresses of all registers matching all conditions of _query.
+RegisterIndex::List RegisterIndex::find(Query const &_query) const {
+  if (_query.min > _query.max) { return {}; }
+
+  vector<List const *> lists;
+
+  if (!_query.unit.empty()) { lists.push_back(&byUnit(_query.unit)); }
+  if (_query.format != DataFormat::__UNKNOWN__) { lists.push_back(&byFormat(_query.format)); }
+  if (_query.type != DataType::__UNKNOWN__) { lists.push_back(&byType(_query.type)); }
+  if (_query.access != DataAccess::__UNKNOWN__) { lists.push_back(&byAccess(_query.access)); }
+  if (_query.readable) { lists.push_back(&mReadable); }
+  if (_query.writable) { lists.push_back(&mWritable); }
+  for (auto const &i : _query.words) {
+    for (auto const &j : tokenize(i)) { lists.push_back(&byWord(j)); }
+  }
+
+  if (lists.empty()) { lists.push_back(&mAll); }
+
+  // Start with the shortest list and only keep the addresses that are in all other lists
+  sort(begin(lists), end(lists), [](List const *a, List const *b) { return a->size() < b->size(); });
+
+  List result;
+  auto first = lower_bound(begin(*lists[0]), end(*lists[0]), _query.min);
+  auto last  = upper_bound(begin(*lists[0]), end(*lists[0]), _query.max);
+
+  for (auto i = first; i != last; ++i) {
+    auto contains = [&](List const *l) { return binary_search(begin(*l), end(*l), *i); };
+    if (all_of(begin(lists) + 1, end(lists), contains)) { result.push_back(*i); }
+  }
+
+  return result;
+}
@@ -0,0 +1,100 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Register.hpp"
+
+namespace modbusSMA {
+
+/*!
+ * \brief Secondary indexes of a register catalog
+ *
+ * Maps the unit, data format, data type, access and the words of the description (first line, lower case) to the
+ * sorted addresses of the matching registers. The single key lookups return references to the index, find()
+ * intersects the lists of all conditions of a Query, starting with the shortest one.
+ *
+ * \code{.cpp}
+ * RegisterIndex::Query query;
+ * query.unit     = "W";
+ * query.readable = true;
+ * query.words    = {"power"};
+ * auto regs = container->index().find(query);
+ * \endcode
+ *
+ * \note Built by RegisterContainer::index()
+ */
+class RegisterIndex {
+ public:
+  typedef std::vector<uint16_t> List; //!< Sorted register addresses.
+
+  //! The conditions of find(). Empty / __UNKNOWN__ conditions are ignored.
+  struct Query {
+    std::string              unit     = "";                      //!< The unit (exact match).
+    DataFormat               format   = DataFormat::__UNKNOWN__; //!< The data format.
+    DataType                 type     = DataType::__UNKNOWN__;   //!< The data type.
+    DataAccess               access   = DataAccess::__UNKNOWN__; //!< The access type.
+    bool                     readable = false;                   //!< Only registers that can be read (RO, RW).
+    bool                     writable = false;                   //!< Only registers that can be written (RW, WO).
+    std::vector<std::string> words    = {};                      //!< Words of the description (all must match).
+    uint16_t                 min      = 0;                       //!< The lowest address.
+    uint16_t                 max      = UINT16_MAX;              //!< The highest address.
+  };
+
+ private:
+  std::unordered_map<std::string, List> mUnits;
+  std::unordered_map<std::string, List> mWords;
+  std::map<DataFormat, List>            mFormats;
+  std::map<DataType, List>              mTypes;
+  std::map<DataAccess, List>            mAccess;
+  List                                  mReadable;
+  List                                  mWritable;
+  List                                  mAll;
+
+  static List const &lookup(std::unordered_map<std::string, List> const &_map, std::string const &_key);
+  template <typename T>
+  static List const &lookup(std::map<T, List> const &_map, T _key);
+
+ public:
+  RegisterIndex() = default;
+
+  void build(std::vector<Register> const &_registers);
+  void clear();
+
+  List find(Query const &_query) const;
+
+  List const &byUnit(std::string const &_unit) const;
+  List const &byWord(std::string const &_word) const;
+  List const &byFormat(DataFormat _format) const;
+  List const &byType(DataType _type) const;
+  List const &byAccess(DataAccess _access) const;
+
+  inline List const &readable() const { return mReadable; } //!< All readable registers (RO, RW).
+  inline List const &writable() const { return mWritable; } //!< All writable registers (RW, WO).
+  inline List const &all() const { return mAll; }           //!< All registers.
+
+  static std::vector<std::string> tokenize(std::string const &_str);
+};
+
+} // namespace modbusSMA
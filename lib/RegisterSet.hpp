@@ -0,0 +1,329 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Enums.hpp"
+#include "ModbusAPI.hpp"
+#include "ReadPlan.hpp"
+
+namespace modbusSMA {
+
+/*!
+ * \brief Compile-time description of one register
+ *
+ * `value_type` is a double (scaled) for the fixed point formats (FIX1 - FIX4, TEMP) and the integer type matching
+ * DataType for everything else (FIX0, ENUM, RAW, DT, ...). Strings are not supported.
+ *
+ * \sa RegisterSet, modbusSMA::regs
+ */
+template <uint16_t Addr, DataType Type, DataFormat Format>
+struct RegisterDef {
+  static_assert(Type != DataType::STR32 && Type != DataType::__UNKNOWN__, "Only numeric registers are supported");
+
+  static constexpr uint16_t   reg    = Addr;   //!< The register address.
+  static constexpr DataType   type   = Type;   //!< The data type.
+  static constexpr DataFormat format = Format; //!< The data format.
+
+  //! Number of 16-bit words.
+  static constexpr uint16_t size = Type == DataType::S16 || Type == DataType::U16   ? 1
+                                   : Type == DataType::S32 || Type == DataType::U32 ? 2
+                                                                                    : 4;
+
+  //! Number of decimal places (0 for all integer formats).
+  static constexpr int decimals = Format == DataFormat::FIX1 || Format == DataFormat::TEMP ? 1
+                                  : Format == DataFormat::FIX2                             ? 2
+                                  : Format == DataFormat::FIX3                             ? 3
+                                  : Format == DataFormat::FIX4                             ? 4
+                                                                                           : 0;
+
+  static constexpr bool isSigned = Type == DataType::S16 || Type == DataType::S32 || Type == DataType::S64;
+
+  //! The raw integer type.
+  using raw_type = std::conditional_t<
+      Type == DataType::S16,
+      int16_t,
+      std::conditional_t<
+          Type == DataType::U16,
+          uint16_t,
+          std::conditional_t<Type == DataType::S32,
+                             int32_t,
+                             std::conditional_t<Type == DataType::U32,
+                                                uint32_t,
+                                                std::conditional_t<Type == DataType::S64, int64_t, uint64_t>>>>>;
+
+  using value_type = std::conditional_t<(decimals > 0), double, raw_type>; //!< The decoded type.
+
+  //! Combines the (big endian) words of _data.
+  static constexpr uint64_t combine(uint16_t const *_data) noexcept {
+    uint64_t val = 0;
+    for (uint16_t i = 0; i < size; ++i) { val = (val << 16) | _data[i]; }
+    return val;
+  }
+
+  //! Checks if _data is the NaN value of the data type (see Register::nanValue()).
+  static constexpr bool isNaN(uint16_t const *_data) noexcept {
+    uint64_t val = combine(_data);
+    return isSigned ? val == (uint64_t)1 << (16 * size - 1) : val == UINT64_MAX >> (64 - 16 * size);
+  }
+
+  //! Decodes and scales _data (same result as Register::valueDouble() / valueInt() / valueUInt()).
+  static constexpr value_type decode(uint16_t const *_data) noexcept {
+    raw_type raw = (raw_type)combine(_data);
+    if constexpr (decimals > 0) {
+      constexpr double DIVISOR[] = {1.0, 10.0, 100.0, 1000.0, 10000.0};
+      return (double)raw / DIVISOR[decimals];
+    } else {
+      return raw;
+    }
+  }
+};
+
+//! Definitions of commonly used registers (Sunny Tripower / Sunny Boy, see the register database).
+namespace regs {
+
+using DeviceClass      = RegisterDef<30051, DataType::U32, DataFormat::ENUM>;     //!< Device class.
+using DeviceType       = RegisterDef<30053, DataType::U32, DataFormat::ENUM>;     //!< Device type.
+using SerialNumber     = RegisterDef<30057, DataType::U32, DataFormat::RAW>;      //!< Serial number.
+using Condition        = RegisterDef<30201, DataType::U32, DataFormat::ENUM>;     //!< Condition (Ok, Warning, ...).
+using InsulationRes    = RegisterDef<30225, DataType::U32, DataFormat::FIX0>;     //!< Insulation resistance [Ohms].
+using TotalYield       = RegisterDef<30529, DataType::U32, DataFormat::FIX0>;     //!< Total yield [Wh].
+using DailyYield       = RegisterDef<30535, DataType::U32, DataFormat::FIX0>;     //!< Daily yield [Wh].
+using TotalYield64     = RegisterDef<30513, DataType::U64, DataFormat::FIX0>;     //!< Total yield [Wh].
+using DailyYield64     = RegisterDef<30517, DataType::U64, DataFormat::FIX0>;     //!< Daily yield [Wh].
+using OperatingTime    = RegisterDef<30521, DataType::U64, DataFormat::Duration>; //!< Operating time [s].
+using FeedInTime       = RegisterDef<30525, DataType::U64, DataFormat::Duration>; //!< Feed-in time [s].
+using GridPower        = RegisterDef<30775, DataType::S32, DataFormat::FIX0>;     //!< Power [W].
+using GridPowerL1      = RegisterDef<30777, DataType::S32, DataFormat::FIX0>;     //!< Power L1 [W].
+using GridPowerL2      = RegisterDef<30779, DataType::S32, DataFormat::FIX0>;     //!< Power L2 [W].
+using GridPowerL3      = RegisterDef<30781, DataType::S32, DataFormat::FIX0>;     //!< Power L3 [W].
+using GridVoltageL1    = RegisterDef<30783, DataType::U32, DataFormat::FIX2>;     //!< Grid voltage phase L1 [V].
+using GridVoltageL2    = RegisterDef<30785, DataType::U32, DataFormat::FIX2>;     //!< Grid voltage phase L2 [V].
+using GridVoltageL3    = RegisterDef<30787, DataType::U32, DataFormat::FIX2>;     //!< Grid voltage phase L3 [V].
+using GridFrequency    = RegisterDef<30803, DataType::U32, DataFormat::FIX2>;     //!< Grid frequency [Hz].
+using IntermediateVolt = RegisterDef<30975, DataType::S32, DataFormat::FIX2>;     //!< Intermediate circuit voltage [V].
+using GridCurrentL1    = RegisterDef<30977, DataType::S32, DataFormat::FIX3>;     //!< Grid current phase L1 [A].
+
+} // namespace regs
+
+/*!
+ * \brief A fixed set of registers with a read plan computed at compile time
+ *
+ * The batches and the offsets of all registers are computed by the compiler (same rules as ReadPlan, with the maximum
+ * batch size SMA_MODBUS_MAX_REGISTER_COUNT). read() fetches the batches with ModbusAPI::readBatches() and decodes
+ * them straight into a tuple of typed and scaled values, without the RegisterContainer, runtime planning or switches
+ * on the DataType / DataFormat.
+ *
+ * \code{.cpp}
+ * using Set = RegisterSet<regs::TotalYield, regs::GridPower, regs::GridVoltageL1>;
+ *
+ * Set         set;
+ * Set::Values values;
+ * if (set.read(mapi, values) == ErrorCode::OK) {
+ *   auto [yield, power, voltage] = values.fields; // uint32_t, int32_t, double
+ *   if (values.isValid<regs::GridPower>()) { fmt::print("{} W\n", values.get<regs::GridPower>()); }
+ * }
+ * \endcode
+ *
+ * \note The registers are not checked against the register database of the inverter.
+ */
+template <typename... Regs>
+class RegisterSet {
+ public:
+  static constexpr size_t NUM_REGISTERS = sizeof...(Regs); //!< Number of registers.
+
+  static_assert(NUM_REGISTERS > 0, "A RegisterSet needs at least one register");
+
+ private:
+  //! Position of a register in the read plan.
+  struct Slot {
+    uint16_t reg    = 0;
+    uint16_t size   = 0;
+    uint16_t batch  = 0;
+    uint16_t offset = 0;
+  };
+
+  //! Address range of one batch.
+  struct Range {
+    uint16_t start = 0;
+    uint16_t size  = 0;
+  };
+
+  //! The compile-time read plan.
+  struct Layout {
+    std::array<Slot, NUM_REGISTERS>  slots      = {};   //!< In template parameter order.
+    std::array<Range, NUM_REGISTERS> batches    = {};   //!< The first numBatches are used.
+    size_t                           numBatches = 0;    //!< Number of batches.
+    bool                             unique     = true; //!< No register is used twice.
+  };
+
+  static constexpr Layout computeLayout() {
+    Layout                              out;
+    std::array<size_t, NUM_REGISTERS>   order = {};
+    std::array<uint16_t, NUM_REGISTERS> addrs = {Regs::reg...};
+    std::array<uint16_t, NUM_REGISTERS> sizes = {Regs::size...};
+
+    // Sort the register indexes by address (insertion sort, the sets are small)
+    for (size_t i = 0; i < NUM_REGISTERS; ++i) {
+      size_t j = i;
+      for (; j > 0 && addrs[order[j - 1]] > addrs[i]; --j) { order[j] = order[j - 1]; }
+      order[j] = i;
+    }
+
+    for (size_t i = 0; i < NUM_REGISTERS; ++i) {
+      size_t   idx  = order[i];
+      uint16_t reg  = addrs[idx];
+      uint16_t size = sizes[idx];
+      auto *   curr = out.numBatches > 0 ? &out.batches[out.numBatches - 1] : nullptr;
+
+      if (i > 0 && addrs[order[i - 1]] == reg) { out.unique = false; }
+
+      if (!curr || curr->size + size >= SMA_MODBUS_MAX_REGISTER_COUNT || curr->start + curr->size != reg) {
+        curr        = &out.batches[out.numBatches++];
+        curr->start = reg;
+      }
+
+      out.slots[idx].reg    = reg;
+      out.slots[idx].size   = size;
+      out.slots[idx].batch  = (uint16_t)(out.numBatches - 1);
+      out.slots[idx].offset = curr->size;
+      curr->size += size;
+    }
+
+    return out;
+  }
+
+  static constexpr Layout LAYOUT = computeLayout();
+
+  static_assert(LAYOUT.unique, "The registers of a RegisterSet must be unique");
+
+  template <typename R>
+  static constexpr size_t indexOf() {
+    constexpr bool matches[] = {std::is_same_v<R, Regs>...};
+    for (size_t i = 0; i < NUM_REGISTERS; ++i) {
+      if (matches[i]) { return i; }
+    }
+    return NUM_REGISTERS;
+  }
+
+ public:
+  static constexpr size_t NUM_BATCHES = LAYOUT.numBatches; //!< Number of modbus requests per read().
+
+  //! The decoded values.
+  struct Values {
+    std::tuple<typename Regs::value_type...> fields = {}; //!< The values (in template parameter order).
+    std::array<bool, NUM_REGISTERS>          valid  = {}; //!< Was the value read and not NaN?
+
+    //! Returns the value of the register R.
+    template <typename R>
+    inline auto get() const noexcept {
+      static_assert(indexOf<R>() < NUM_REGISTERS, "The register is not part of this RegisterSet");
+      return std::get<indexOf<R>()>(fields);
+    }
+
+    //! Checks if the value of the register R is valid.
+    template <typename R>
+    inline bool isValid() const noexcept {
+      static_assert(indexOf<R>() < NUM_REGISTERS, "The register is not part of this RegisterSet");
+      return valid[indexOf<R>()];
+    }
+  };
+
+ private:
+  std::vector<std::vector<uint16_t>> mRaw;
+
+  template <size_t I>
+  static bool decodeOne(std::vector<std::vector<uint16_t>> const &_raw, Values &_out) noexcept {
+    using R                = std::tuple_element_t<I, std::tuple<Regs...>>;
+    constexpr Slot    slot = LAYOUT.slots[I];
+    constexpr int64_t size = LAYOUT.batches[slot.batch].size;
+
+    if (slot.batch >= _raw.size() || (int64_t)_raw[slot.batch].size() != size) {
+      _out.valid[I] = false;
+      return false;
+    }
+
+    uint16_t const *data   = _raw[slot.batch].data() + slot.offset;
+    _out.valid[I]          = !R::isNaN(data);
+    std::get<I>(_out.fields) = R::decode(data);
+    return true;
+  }
+
+  template <size_t... I>
+  static bool decode(std::vector<std::vector<uint16_t>> const &_raw, Values &_out, std::index_sequence<I...>) noexcept {
+    return (decodeOne<I>(_raw, _out) & ...);
+  }
+
+ public:
+  RegisterSet() = default;
+
+  //! Returns the compile-time plan as a ReadPlan (built once).
+  static ReadPlan const &plan() {
+    static const ReadPlan PLAN = [] {
+      std::vector<ReadPlan::Batch> batches(NUM_BATCHES);
+      for (size_t i = 0; i < NUM_BATCHES; ++i) { batches[i] = {LAYOUT.batches[i].start, LAYOUT.batches[i].size, {}}; }
+      for (Slot const &i : LAYOUT.slots) { batches[i.batch].regs.push_back({i.reg, i.offset, i.size}); }
+      for (auto &i : batches) {
+        std::sort(i.regs.begin(), i.regs.end(), [](auto const &a, auto const &b) { return a.offset < b.offset; });
+      }
+      return ReadPlan(std::move(batches));
+    }();
+    return PLAN;
+  }
+
+  /*!
+   * \brief Decodes the raw data of the batches of plan() into _out
+   * \returns false if a batch is missing or has the wrong size (the values of the batch are marked invalid)
+   */
+  static bool decode(std::vector<std::vector<uint16_t>> const &_raw, Values &_out) noexcept {
+    return decode(_raw, _out, std::index_sequence_for<Regs...>{});
+  }
+
+  /*!
+   * \brief Reads all registers from the inverter
+   *
+   * \returns ERROR if at least one batch failed (see Values::valid), the error of ModbusAPI::readBatches() or OK
+   */
+  ErrorCode read(ModbusAPI &_api, Values &_out) {
+    ErrorCode res = _api.readBatches(plan(), mRaw);
+    if (res != ErrorCode::OK) {
+      _out.valid.fill(false);
+      return res;
+    }
+
+    return decode(mRaw, _out) ? ErrorCode::OK : ErrorCode::ERROR;
+  }
+
+  //! Returns the address of the register R.
+  template <typename R>
+  static constexpr uint16_t address() noexcept {
+    static_assert(indexOf<R>() < NUM_REGISTERS, "The register is not part of this RegisterSet");
+    return R::reg;
+  }
+};
+
+} // namespace modbusSMA
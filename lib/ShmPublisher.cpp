@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ShmPublisher.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "Logging.hpp"
+
+using namespace std;
+using namespace modbusSMA;
+
+ShmPublisher::~ShmPublisher() { close(); }
+
+/*!
+ * \brief Creates the shared memory segment and writes the catalog
+ *
+ * An existing segment with the same name is replaced.
+ *
+ * \param _name      The name of the segment (a leading '/' is added if missing)
+ * \param _container The registers
+ * \param _regList   The registers to publish (in any order)
+ * \param _serial    The serial number of the device (stored in the header)
+ * \param _typeID    The device type (stored in the header)
+ */
+ErrorCode ShmPublisher::open(string                  _name,
+                             RegisterContainer &     _container,
+                             vector<uint16_t> const &_regList,
+                             uint32_t                _serial,
+                             uint32_t                _typeID) {
+  close();
+  if (_name.empty() || _name[0] != '/') { _name = "/" + _name; }
+
+  // The catalog must be sorted by register (see ShmReader::find())
+  vector<uint16_t> regList = _regList;
+  sort(begin(regList), end(regList));
+  regList.erase(unique(begin(regList), end(regList)), end(regList));
+
+  auto             logger    = log::get();
+  vector<Register> registers = _container.getRegisters(regList);
+  uint32_t         numWords  = 0;
+  for (auto &i : registers) { numWords += i.size(); }
+
+  shm_unlink(_name.c_str()); // Readers of an old segment keep their mapping
+  mFD = shm_open(_name.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644);
+  if (mFD < 0) {
+    logger->error("ShmPublisher: failed to create '{}': '{}'", _name, strerror(errno));
+    return ErrorCode::ERROR;
+  }
+
+  mName = _name;
+  mSize = shm::segmentSize((uint32_t)registers.size(), numWords);
+  if (ftruncate(mFD, (off_t)mSize) != 0) {
+    logger->error("ShmPublisher: failed to resize '{}': '{}'", _name, strerror(errno));
+    close();
+    return ErrorCode::ERROR;
+  }
+
+  mMem = mmap(nullptr, mSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFD, 0);
+  if (mMem == MAP_FAILED) {
+    logger->error("ShmPublisher: failed to map '{}': '{}'", _name, strerror(errno));
+    mMem = nullptr;
+    close();
+    return ErrorCode::ERROR;
+  }
+
+  // The segment is zero initialized by ftruncate(), so the atomics are 0
+  mHead             = static_cast<shm::Header *>(mMem);
+  mHead->version    = shm::VERSION;
+  mHead->numEntries = (uint32_t)registers.size();
+  mHead->numWords   = numWords;
+  mHead->serial     = _serial;
+  mHead->typeID     = _typeID;
+
+  auto *   entries = reinterpret_cast<shm::Entry *>(mHead + 1);
+  uint32_t offset  = 0;
+  mRegList.clear();
+  for (auto &i : registers) {
+    shm::Entry &e = entries[mRegList.size()];
+    e.reg         = i.reg();
+    e.size        = (uint16_t)i.size();
+    e.offset      = offset;
+    e.type        = (uint8_t)i.type();
+    e.format      = (uint8_t)i.format();
+    strncpy(e.unit, i.metadata()->unit.c_str(), sizeof(e.unit) - 1);
+
+    offset += i.size();
+    mRegList.push_back(i.reg());
+  }
+
+  atomic_thread_fence(memory_order_release);
+  memcpy(mHead->magic, shm::MAGIC, sizeof(shm::MAGIC)); // Written last, so readers never see a partial catalog
+
+  SPDLOG_LOGGER_INFO(logger, "ShmPublisher: publishing {} registers in '{}' ({} bytes)", mRegList.size(), mName, mSize);
+  return ErrorCode::OK;
+}
+
+//! Marks the segment as closed, unmaps and removes it.
+void ShmPublisher::close() {
+  if (mHead) { mHead->closed.store(1); }
+  if (mMem) { munmap(mMem, mSize); }
+  if (mFD >= 0) {
+    ::close(mFD);
+    shm_unlink(mName.c_str());
+  }
+
+  mFD   = -1;
+  mMem  = nullptr;
+  mHead = nullptr;
+  mSize = 0;
+}
+
+/*!
+ * \brief Publishes the current values of the registers
+ *
+ * The values are written to the slot that is not the latest one, so readers of the latest slot are not disturbed.
+ */
+void ShmPublisher::update(RegisterContainer &_container, uint64_t _cycle, int64_t _timestamp) {
+  if (!mHead) { return; }
+
+  uint32_t   slotIdx = 1 - (mHead->latest.load(memory_order_relaxed) & 1);
+  shm::Slot &slot    = mHead->slots[slotIdx];
+  auto *     values  = reinterpret_cast<uint16_t *>(reinterpret_cast<shm::Entry *>(mHead + 1) + mHead->numEntries);
+  auto *     entries = reinterpret_cast<shm::Entry const *>(mHead + 1);
+  uint16_t * data    = values + slotIdx * mHead->numWords;
+  uint64_t   seq     = slot.sequence.load(memory_order_relaxed);
+
+  slot.sequence.store(seq + 1, memory_order_relaxed); // Odd: writing
+  atomic_thread_fence(memory_order_release);
+
+  size_t idx = 0;
+  _container.forEach(mRegList, [&](Register const &_reg) {
+    while (idx < mRegList.size() && mRegList[idx] != _reg.reg()) { ++idx; } // Skip registers that were removed
+    if (idx >= mRegList.size()) { return; }
+
+    WordView raw = _reg.raw();
+    copy_n(raw.begin(), min<size_t>(raw.size(), entries[idx].size), data + entries[idx].offset);
+  });
+
+  slot.cycle     = _cycle;
+  slot.timestamp = _timestamp;
+  slot.sequence.store(seq + 2, memory_order_release);
+  mHead->latest.store(slotIdx, memory_order_release);
+}
@@ -0,0 +1,69 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <string>
+#include <vector>
+
+#include "RegisterContainer.hpp"
+#include "ShmReader.hpp"
+
+namespace modbusSMA {
+
+/*!
+ * \brief Publishes the register values in a POSIX shared memory segment
+ *
+ * The segment starts with a catalog (address, size, type, format and unit of every published register) followed by
+ * two value slots. The poll loop calls update() after each cycle; this copies the raw values into the slot that is
+ * not the latest, protected by the seqlock of the slot, and then makes it the latest slot.
+ *
+ * Any number of local processes can read the values with ShmReader without Modbus traffic or IPC copies.
+ *
+ * \note The segment is removed by the destructor.
+ */
+class ShmPublisher {
+ private:
+  std::string mName;
+  int         mFD   = -1;
+  void *      mMem  = nullptr;
+  size_t      mSize = 0;
+
+  shm::Header *         mHead = nullptr;
+  std::vector<uint16_t> mRegList;
+
+ public:
+  ShmPublisher() = default;
+  ~ShmPublisher();
+
+  ShmPublisher(ShmPublisher const &) = delete;
+  void operator=(ShmPublisher const &) = delete;
+
+  ErrorCode open(std::string                  _name,
+                 RegisterContainer &          _container,
+                 std::vector<uint16_t> const &_regList,
+                 uint32_t                     _serial,
+                 uint32_t                     _typeID);
+  void      close();
+  void      update(RegisterContainer &_container, uint64_t _cycle, int64_t _timestamp);
+
+  inline std::string name() const { return mName; } //!< The name of the segment.
+};
+
+} // namespace modbusSMA
@@ -0,0 +1,248 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Enums.hpp"
+
+namespace modbusSMA {
+
+//! Layout of the shared memory segment written by ShmPublisher.
+namespace shm {
+
+const char     MAGIC[8] = "mSMAshm"; //!< Identifies the segment.
+const uint32_t VERSION  = 1;         //!< Incremented for incompatible layout changes.
+
+//! One copy of the register values.
+struct Slot {
+  std::atomic<uint64_t> sequence;  //!< Seqlock: odd while the slot is written, 0 if never written.
+  uint64_t              cycle;     //!< The poll cycle of the values.
+  int64_t               timestamp; //!< UNIX timestamp in ms.
+};
+
+/*!
+ * \brief The header at the start of the segment
+ *
+ * The segment layout is: `Header | Entry[numEntries] | uint16_t values[2][numWords]`
+ */
+struct Header {
+  char                  magic[8];   //!< MAGIC (written last).
+  uint32_t              version;    //!< VERSION.
+  uint32_t              numEntries; //!< Number of catalog entries.
+  uint32_t              numWords;   //!< Number of 16-bit words per slot.
+  uint32_t              serial;     //!< Serial number of the device.
+  uint32_t              typeID;     //!< Device type (register 30053).
+  std::atomic<uint32_t> latest;     //!< Index of the slot with the latest values.
+  std::atomic<uint32_t> closed;     //!< Set to 1 when the publisher exits.
+  uint32_t              reserved;   //!< Padding.
+  Slot                  slots[2];   //!< The two value slots.
+};
+
+//! One register of the catalog (sorted by reg).
+struct Entry {
+  uint16_t reg;      //!< The register address.
+  uint16_t size;     //!< Number of 16-bit words.
+  uint32_t offset;   //!< Offset of the value in the slot (in words).
+  uint8_t  type;     //!< The DataType.
+  uint8_t  format;   //!< The DataFormat.
+  uint16_t reserved; //!< Padding.
+  char     unit[12]; //!< The unit (NUL terminated, may be truncated).
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the seqlock requires lock-free 64-bit atomics");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "the seqlock requires lock-free 32-bit atomics");
+
+//! Size of the segment in bytes.
+inline size_t segmentSize(uint32_t _numEntries, uint32_t _numWords) {
+  return sizeof(Header) + _numEntries * sizeof(Entry) + 2 * _numWords * sizeof(uint16_t);
+}
+
+} // namespace shm
+
+/*!
+ * \brief Zero-copy reader for the values published by ShmPublisher
+ *
+ * The publisher writes every cycle into the slot that readers do not use and then switches the latest slot. A reader
+ * only has to retry when the publisher finished a whole cycle while the reader was still accessing the values, so
+ * reading practically never waits.
+ *
+ * \code{.cpp}
+ * ShmReader reader;
+ * reader.open("/modbusSMA");
+ *
+ * shm::Entry const *entry = reader.find(30775);
+ * uint32_t          power = 0;
+ * reader.read([&](ShmReader::Frame const &_frame) {
+ *   uint16_t const *value = _frame.value(*entry); // Points into the shared memory
+ *   power                 = ((uint32_t)value[0] << 16) | value[1];
+ * });
+ * \endcode
+ *
+ * The reader does not depend on the rest of the library (header only).
+ */
+class ShmReader {
+ public:
+  //! The values of one cycle. The publisher may overwrite them at any time, check with validate().
+  struct Frame {
+    uint16_t const *data      = nullptr; //!< The values (see shm::Entry::offset).
+    uint64_t        cycle     = 0;       //!< The poll cycle.
+    int64_t         timestamp = 0;       //!< UNIX timestamp in ms.
+    uint32_t        slot      = 0;       //!< The slot index.
+    uint64_t        sequence  = 0;       //!< The sequence number of the slot when the frame was acquired.
+
+    inline uint16_t const *value(shm::Entry const &_e) const { return data + _e.offset; } //!< Value of _e.
+  };
+
+ private:
+  int          mFD   = -1;
+  void *       mMem  = nullptr;
+  size_t       mSize = 0;
+  shm::Header *mHead = nullptr;
+
+  shm::Entry const *mEntries = nullptr;
+  uint16_t const *  mValues  = nullptr;
+
+ public:
+  ShmReader() = default;
+  ~ShmReader() { close(); }
+
+  ShmReader(ShmReader const &) = delete;
+  void operator=(ShmReader const &) = delete;
+
+  //! Maps the segment _name (read only).
+  ErrorCode open(std::string _name) {
+    close();
+    if (_name.empty() || _name[0] != '/') { _name = "/" + _name; }
+
+    struct stat info = {};
+    mFD              = shm_open(_name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (mFD < 0) { return ErrorCode::FILE_NOT_FOUND; }
+    if (fstat(mFD, &info) != 0 || (size_t)info.st_size < sizeof(shm::Header)) {
+      close();
+      return ErrorCode::ERROR;
+    }
+
+    mSize = (size_t)info.st_size;
+    mMem  = mmap(nullptr, mSize, PROT_READ, MAP_SHARED, mFD, 0);
+    if (mMem == MAP_FAILED) {
+      mMem = nullptr;
+      close();
+      return ErrorCode::ERROR;
+    }
+
+    mHead = static_cast<shm::Header *>(mMem);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (memcmp(mHead->magic, shm::MAGIC, sizeof(shm::MAGIC)) != 0 || mHead->version != shm::VERSION ||
+        shm::segmentSize(mHead->numEntries, mHead->numWords) > mSize) {
+      close();
+      return ErrorCode::INVALID_STATE;
+    }
+
+    mEntries = reinterpret_cast<shm::Entry const *>(mHead + 1);
+    mValues  = reinterpret_cast<uint16_t const *>(mEntries + mHead->numEntries);
+    return ErrorCode::OK;
+  }
+
+  //! Unmaps the segment.
+  void close() {
+    if (mMem) { munmap(mMem, mSize); }
+    if (mFD >= 0) { ::close(mFD); }
+    mFD      = -1;
+    mMem     = nullptr;
+    mSize    = 0;
+    mHead    = nullptr;
+    mEntries = nullptr;
+    mValues  = nullptr;
+  }
+
+  /*!
+   * \brief Gets the latest values
+   * \returns false if no values were published yet
+   */
+  bool acquire(Frame &_frame) const {
+    if (!mHead) { return false; }
+
+    for (int i = 0; i < 2; ++i) {
+      uint32_t slot = mHead->latest.load(std::memory_order_acquire) & 1;
+      uint64_t seq  = mHead->slots[slot].sequence.load(std::memory_order_acquire);
+      if (seq == 0) { return false; }
+      if (seq & 1) { continue; } // The publisher wrapped around, check the new latest slot
+
+      _frame.data      = mValues + slot * mHead->numWords;
+      _frame.cycle     = mHead->slots[slot].cycle;
+      _frame.timestamp = mHead->slots[slot].timestamp;
+      _frame.slot      = slot;
+      _frame.sequence  = seq;
+      return true;
+    }
+
+    return false;
+  }
+
+  //! Checks that the values of _frame were not overwritten since acquire().
+  bool validate(Frame const &_frame) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return mHead && mHead->slots[_frame.slot].sequence.load(std::memory_order_relaxed) == _frame.sequence;
+  }
+
+  /*!
+   * \brief Calls _fn with the latest values until the values were consistent
+   *
+   * _fn must not act on the values before read() returned true (copy them instead).
+   *
+   * \returns false if no values were published or the publisher overwrote the values _retries times
+   */
+  template <typename F>
+  bool read(F &&_fn, int _retries = 8) const {
+    Frame frame;
+    for (int i = 0; i < _retries; ++i) {
+      if (!acquire(frame)) { continue; }
+      _fn(static_cast<Frame const &>(frame));
+      if (validate(frame)) { return true; }
+    }
+
+    return false;
+  }
+
+  //! Returns the catalog entry of _reg (nullptr if not published).
+  shm::Entry const *find(uint16_t _reg) const {
+    if (!mEntries) { return nullptr; }
+    auto end = mEntries + mHead->numEntries;
+    auto pos = std::lower_bound(mEntries, end, _reg, [](shm::Entry const &e, uint16_t r) { return e.reg < r; });
+    return pos != end && pos->reg == _reg ? pos : nullptr;
+  }
+
+  inline bool              isOpen() const { return mHead != nullptr; }                      //!< Is a segment mapped?
+  inline bool              isClosed() const { return !mHead || mHead->closed.load() != 0; } //!< Publisher exited?
+  inline uint32_t          size() const { return mHead ? mHead->numEntries : 0; }           //!< Number of registers.
+  inline shm::Entry const *entries() const { return mEntries; }                             //!< The catalog.
+  inline uint32_t          serial() const { return mHead ? mHead->serial : 0; }             //!< Serial number.
+  inline uint32_t          typeID() const { return mHead ? mHead->typeID : 0; }             //!< Device type.
+};
+
+} // namespace modbusSMA
@@ -0,0 +1,130 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+namespace modbusSMA {
+
+/*!
+ * \brief Single writer, multi reader buffer for the latest version of some data (e.g. the values of a poll cycle)
+ *
+ * The buffer has three slots. The writer fills a slot that is neither the current slot nor in use by a reader and
+ * then atomically makes it the current slot. Readers pin the current slot with a reference count, so they never
+ * take a lock and never see a partially written object. A reader only retries if a new version was published
+ * between loading and pinning the current slot.
+ *
+ * The slots are reused, so publishing does not allocate once the capacity of T has settled.
+ *
+ * \note The SnapshotBuffer must outlive all Reader objects.
+ */
+template <typename T>
+class SnapshotBuffer {
+ private:
+  static constexpr uint32_t NUM_SLOTS = 3;
+  static constexpr uint32_t NO_SLOT   = UINT32_MAX;
+
+  //! One version of the data.
+  struct Slot {
+    T                             data;        //!< The stored data.
+    mutable std::atomic<uint32_t> readers = {0}; //!< Number of active readers.
+  };
+
+  std::array<Slot, NUM_SLOTS> mSlots;
+  std::atomic<uint32_t>       mCurrent = {NO_SLOT};
+  std::mutex                  mWriteMutex;
+
+ public:
+  //! Pins one published version of the data. The data stays valid until the Reader is destroyed.
+  class Reader {
+   private:
+    Slot const *mSlot = nullptr;
+
+   public:
+    Reader() = default;
+    explicit Reader(Slot const *_slot) : mSlot(_slot) {} //!< Takes ownership of an already pinned slot.
+    ~Reader() { release(); }
+
+    Reader(Reader const &) = delete;
+    void operator=(Reader const &) = delete;
+    Reader(Reader &&_other) noexcept : mSlot(_other.mSlot) { _other.mSlot = nullptr; } //!< Move constructor.
+
+    //! Releases the pinned slot.
+    void release() {
+      if (mSlot) { mSlot->readers.fetch_sub(1); }
+      mSlot = nullptr;
+    }
+
+    inline T const *get() const { return mSlot ? &mSlot->data : nullptr; } //!< Returns the data (or nullptr).
+    inline T const *operator->() const { return get(); }                    //!< Access the data.
+    inline T const &operator*() const { return *get(); }                    //!< Access the data.
+    inline explicit operator bool() const { return mSlot != nullptr; }     //!< Checks if data was published.
+  };
+
+  SnapshotBuffer() = default;
+
+  SnapshotBuffer(SnapshotBuffer const &) = delete;
+  void operator=(SnapshotBuffer const &) = delete;
+
+  /*!
+   * \brief Publishes a new version of the data
+   *
+   * _fill is called with a reference to a free slot, which still contains an old version of the data (reuse its
+   * capacity). The new version is visible to readers as soon as this function returns.
+   */
+  template <typename F>
+  void publish(F &&_fill) {
+    std::lock_guard<std::mutex> lock(mWriteMutex);
+    uint32_t                    current = mCurrent.load();
+
+    while (true) {
+      for (uint32_t i = 0; i < NUM_SLOTS; ++i) {
+        if (i == current || mSlots[i].readers.load() != 0) { continue; }
+
+        _fill(mSlots[i].data);
+        mCurrent.store(i);
+        return;
+      }
+
+      // Both other slots are pinned by (slow) readers
+      std::this_thread::yield();
+    }
+  }
+
+  //! Returns a Reader for the latest published version (evaluates to false if nothing was published yet).
+  Reader acquire() const {
+    while (true) {
+      uint32_t current = mCurrent.load();
+      if (current == NO_SLOT) { return Reader(); }
+
+      Slot const &slot = mSlots[current];
+      slot.readers.fetch_add(1);
+      if (mCurrent.load() == current) { return Reader(&slot); }
+
+      // A new version was published in the meantime ==> try again
+      slot.readers.fetch_sub(1);
+    }
+  }
+};
+
+} // namespace modbusSMA
@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Statistics.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <modbus/modbus.h>
+
+using namespace std;
+using namespace std::chrono;
+using namespace modbusSMA;
+
+//! Stores the minimum of _value and the current value of _target.
+inline void atomicMin(atomic<uint64_t> &_target, uint64_t _value) {
+  uint64_t current = _target.load(memory_order_relaxed);
+  while (_value < current && !_target.compare_exchange_weak(current, _value, memory_order_relaxed)) {}
+}
+
+//! Stores the maximum of _value and the current value of _target.
+inline void atomicMax(atomic<uint64_t> &_target, uint64_t _value) {
+  uint64_t current = _target.load(memory_order_relaxed);
+  while (_value > current && !_target.compare_exchange_weak(current, _value, memory_order_relaxed)) {}
+}
+
+
+
+//! Returns the bucket of a value.
+uint32_t LatencyHistogram::bucketIndex(uint64_t _value) {
+  if (_value < SUB_BUCKET_COUNT) { return (uint32_t)_value; }
+  if (_value >= (1ull << MAX_VALUE_BITS)) { return NUM_BUCKETS - 1; }
+
+  uint32_t msb      = 63 - (uint32_t)__builtin_clzll(_value);
+  uint32_t exponent = msb - SUB_BUCKET_BITS + 1;
+  uint32_t mantissa = (uint32_t)(_value >> (msb - SUB_BUCKET_BITS)) & (SUB_BUCKET_COUNT - 1);
+  return exponent * SUB_BUCKET_COUNT + mantissa;
+}
+
+//! Returns the smallest value of a bucket.
+uint64_t LatencyHistogram::bucketLowerBound(uint32_t _index) {
+  uint32_t exponent = _index / SUB_BUCKET_COUNT;
+  uint64_t mantissa = _index % SUB_BUCKET_COUNT;
+  if (exponent == 0) { return mantissa; }
+  return (SUB_BUCKET_COUNT + mantissa) << (exponent - 1);
+}
+
+//! Returns the largest value of a bucket.
+uint64_t LatencyHistogram::bucketUpperBound(uint32_t _index) {
+  if (_index + 1 >= NUM_BUCKETS) { return UINT64_MAX; }
+  return bucketLowerBound(_index + 1) - 1;
+}
+
+//! Records one value (in µs).
+void LatencyHistogram::record(uint64_t _value) {
+  mBuckets[bucketIndex(_value)].fetch_add(1, memory_order_relaxed);
+  mCount.fetch_add(1, memory_order_relaxed);
+  mSum.fetch_add(_value, memory_order_relaxed);
+  atomicMin(mMin, _value);
+  atomicMax(mMax, _value);
+}
+
+//! Copies the current data. The copy is not atomic as a whole (concurrent records may be partially included).
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+  Snapshot snap;
+  snap.buckets.resize(NUM_BUCKETS);
+  for (uint32_t i = 0; i < NUM_BUCKETS; ++i) { snap.buckets[i] = mBuckets[i].load(memory_order_relaxed); }
+
+  snap.count = mCount.load(memory_order_relaxed);
+  snap.sum   = mSum.load(memory_order_relaxed);
+  snap.min   = snap.count > 0 ? mMin.load(memory_order_relaxed) : 0;
+  snap.max   = mMax.load(memory_order_relaxed);
+  return snap;
+}
+
+//! Removes all recorded values.
+void LatencyHistogram::reset() {
+  for (auto &i : mBuckets) { i.store(0, memory_order_relaxed); }
+  mCount.store(0, memory_order_relaxed);
+  mSum.store(0, memory_order_relaxed);
+  mMin.store(UINT64_MAX, memory_order_relaxed);
+  mMax.store(0, memory_order_relaxed);
+}
+
+/*!
+ * \brief Returns the value at the given percentile (0 - 100)
+ *
+ * The result is the upper bound of the bucket containing the percentile, limited to the recorded maximum.
+ */
+uint64_t LatencyHistogram::Snapshot::percentile(double _percentile) const {
+  if (count == 0 || buckets.empty()) { return 0; }
+
+  double   rank   = std::min(std::max(_percentile, 0.0), 100.0) / 100.0 * (double)count;
+  uint64_t target = std::max<uint64_t>((uint64_t)ceil(rank), 1);
+  uint64_t seen   = 0;
+
+  for (uint32_t i = 0; i < buckets.size(); ++i) {
+    seen += buckets[i];
+    if (seen >= target) { return std::min(bucketUpperBound(i), max); }
+  }
+
+  return max;
+}
+
+//! Returns the mean value (0 if empty).
+double LatencyHistogram::Snapshot::mean() const { return count > 0 ? (double)sum / (double)count : 0.0; }
+
+
+
+/*!
+ * \brief Records one read request
+ *
+ * \param _numRegisters The number of requested modbus registers
+ * \param _duration     The duration of the request
+ * \param _errno        The error (errno) of a failed request or 0 on success
+ */
+void Statistics::recordRequest(uint32_t _numRegisters, microseconds _duration, int _errno) {
+  uint64_t us = (uint64_t)max<int64_t>(_duration.count(), 0);
+
+  mRequests.fetch_add(1, memory_order_relaxed);
+  mBytesSent.fetch_add(5, memory_order_relaxed); // Function code, address and number of registers
+  mLatency.record(us);
+  mLatencyBySize[sizeClass(_numRegisters)].record(us);
+
+  if (_errno != 0) {
+    ErrorClass errClass = classifyError(_errno);
+    mFailedRequests.fetch_add(1, memory_order_relaxed);
+    mErrors[(size_t)errClass].fetch_add(1, memory_order_relaxed);
+    if (errClass == ErrorClass::EXCEPTION) { mBytesReceived.fetch_add(2, memory_order_relaxed); }
+    return;
+  }
+
+  mRegistersRead.fetch_add(_numRegisters, memory_order_relaxed);
+  mBytesReceived.fetch_add(2 + 2 * (uint64_t)_numRegisters, memory_order_relaxed); // Function code, byte count, data
+}
+
+//! Records a connection attempt.
+void Statistics::recordConnect(bool _success, microseconds _duration) {
+  mConnects.fetch_add(1, memory_order_relaxed);
+  if (!_success) { mFailedConnects.fetch_add(1, memory_order_relaxed); }
+  recordPhase(Phase::CONNECT, _duration);
+}
+
+/*!
+ * \brief Records one ModbusAPI::updateRegisters() call
+ *
+ * \param _batches       The number of batches (read requests)
+ * \param _failedBatches The number of failed batches
+ * \param _updated       The number of updated Register objects
+ * \param _duration      The duration of the call
+ */
+void Statistics::recordCycle(size_t _batches, size_t _failedBatches, size_t _updated, microseconds _duration) {
+  mCycles.fetch_add(1, memory_order_relaxed);
+  mBatches.fetch_add(_batches, memory_order_relaxed);
+  mFailedBatches.fetch_add(_failedBatches, memory_order_relaxed);
+  mRegistersUpdated.fetch_add(_updated, memory_order_relaxed);
+  mCycleLatency.record((uint64_t)max<int64_t>(_duration.count(), 0));
+}
+
+//! Records the duration of a setup phase.
+void Statistics::recordPhase(Phase _phase, microseconds _duration) {
+  uint64_t us = (uint64_t)max<int64_t>(_duration.count(), 0);
+  mPhaseCount[(size_t)_phase].fetch_add(1, memory_order_relaxed);
+  mPhaseLast[(size_t)_phase].store(us, memory_order_relaxed);
+  mPhaseTotal[(size_t)_phase].fetch_add(us, memory_order_relaxed);
+}
+
+//! Copies all statistics. Safe to call from any thread.
+Statistics::Snapshot Statistics::snapshot() const {
+  Snapshot snap;
+  snap.requests         = mRequests.load(memory_order_relaxed);
+  snap.failedRequests   = mFailedRequests.load(memory_order_relaxed);
+  snap.registersRead    = mRegistersRead.load(memory_order_relaxed);
+  snap.bytesSent        = mBytesSent.load(memory_order_relaxed);
+  snap.bytesReceived    = mBytesReceived.load(memory_order_relaxed);
+  snap.connects         = mConnects.load(memory_order_relaxed);
+  snap.failedConnects   = mFailedConnects.load(memory_order_relaxed);
+  snap.cycles           = mCycles.load(memory_order_relaxed);
+  snap.batches          = mBatches.load(memory_order_relaxed);
+  snap.failedBatches    = mFailedBatches.load(memory_order_relaxed);
+  snap.registersUpdated = mRegistersUpdated.load(memory_order_relaxed);
+
+  for (size_t i = 0; i < NUM_ERROR_CLASSES; ++i) { snap.errors[i] = mErrors[i].load(memory_order_relaxed); }
+  for (size_t i = 0; i < NUM_PHASES; ++i) {
+    snap.phases[i] = {mPhaseCount[i].load(memory_order_relaxed),
+                      mPhaseLast[i].load(memory_order_relaxed),
+                      mPhaseTotal[i].load(memory_order_relaxed)};
+  }
+
+  snap.latency = mLatency.snapshot();
+  for (size_t i = 0; i < NUM_SIZE_CLASSES; ++i) { snap.latencyBySize[i] = mLatencyBySize[i].snapshot(); }
+  snap.cycleLatency = mCycleLatency.snapshot();
+  return snap;
+}
+
+//! Resets all statistics.
+void Statistics::reset() {
+  for (auto *i : {&mRequests, &mFailedRequests, &mRegistersRead, &mBytesSent, &mBytesReceived, &mConnects}) {
+    i->store(0, memory_order_relaxed);
+  }
+
+  for (auto *i : {&mFailedConnects, &mCycles, &mBatches, &mFailedBatches, &mRegistersUpdated}) {
+    i->store(0, memory_order_relaxed);
+  }
+
+  for (auto &i : mErrors) { i.store(0, memory_order_relaxed); }
+  for (size_t i = 0; i < NUM_PHASES; ++i) {
+    mPhaseCount[i].store(0, memory_order_relaxed);
+    mPhaseLast[i].store(0, memory_order_relaxed);
+    mPhaseTotal[i].store(0, memory_order_relaxed);
+  }
+
+  mLatency.reset();
+  for (auto &i : mLatencyBySize) { i.reset(); }
+  mCycleLatency.reset();
+}
+
+//! Maps a (libmodbus) errno value to an error class.
+Statistics::ErrorClass Statistics::classifyError(int _errno) {
+  if (_errno >= EMBXILFUN && _errno <= EMBXGTAR) { return ErrorClass::EXCEPTION; }
+
+  switch (_errno) {
+    case ETIMEDOUT: return ErrorClass::TIMEOUT;
+    case ECONNRESET:
+    case ECONNREFUSED:
+    case ECONNABORTED:
+    case ENOTCONN:
+    case EPIPE:
+    case EBADF: return ErrorClass::CONNECTION;
+    default: return ErrorClass::OTHER;
+  }
+}
+
+//! Returns the batch size class of a request (log2 of the number of registers).
+size_t Statistics::sizeClass(uint32_t _numRegisters) {
+  size_t sizeClass = 0;
+  while (_numRegisters > 1 && sizeClass + 1 < NUM_SIZE_CLASSES) {
+    _numRegisters >>= 1;
+    ++sizeClass;
+  }
+  return sizeClass;
+}
+
+//! Returns a label for a batch size class (for instance `4-7`).
+string Statistics::sizeClassLabel(size_t _sizeClass) {
+  if (_sizeClass == 0) { return "1"; }
+  if (_sizeClass + 1 >= NUM_SIZE_CLASSES) { return to_string(1u << _sizeClass) + "+"; }
+  return to_string(1u << _sizeClass) + "-" + to_string((2u << _sizeClass) - 1);
+}
+
+//! Converts an error class to a string.
+string Statistics::toStr(ErrorClass _class) {
+  switch (_class) {
+    case ErrorClass::TIMEOUT: return "timeout";
+    case ErrorClass::EXCEPTION: return "exception";
+    case ErrorClass::CONNECTION: return "connection";
+    case ErrorClass::OTHER: return "other";
+  }
+
+  return "<UNKNOWN>";
+}
+
+//! Converts a phase to a string.
+string Statistics::toStr(Phase _phase) {
+  switch (_phase) {
+    case Phase::CONNECT: return "connect";
+    case Phase::DB_LOAD: return "db_load";
+    case Phase::INITIALIZE: return "initialize";
+  }
+
+  return "<UNKNOWN>";
+}
@@ -0,0 +1,186 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "AdaptiveTuning.hpp"
+
+namespace modbusSMA {
+
+/*!
+ * \brief Lock-free latency histogram with log-linear buckets (HDR histogram style)
+ *
+ * Values (in µs) below 16 have their own bucket. Larger values are stored in 16 linear sub-buckets per power of two,
+ * so the relative error of a percentile is at most 1/16. The histogram covers values up to 2^32 µs (~71 minutes);
+ * larger values are stored in the last bucket.
+ *
+ * record() only uses relaxed atomic operations and can be called from any thread.
+ */
+class LatencyHistogram {
+ public:
+  static constexpr uint32_t SUB_BUCKET_BITS  = 4;
+  static constexpr uint32_t SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+  static constexpr uint32_t MAX_VALUE_BITS   = 32;
+  static constexpr uint32_t NUM_BUCKETS      = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+  //! Copy of the histogram data.
+  struct Snapshot {
+    std::vector<uint64_t> buckets;   //!< Counts per bucket.
+    uint64_t              count = 0; //!< Number of recorded values.
+    uint64_t              sum   = 0; //!< Sum of all values in µs.
+    uint64_t              min   = 0; //!< The smallest value in µs.
+    uint64_t              max   = 0; //!< The largest value in µs.
+
+    uint64_t percentile(double _percentile) const;
+    double   mean() const;
+  };
+
+ private:
+  std::array<std::atomic<uint64_t>, NUM_BUCKETS> mBuckets = {};
+  std::atomic<uint64_t>                          mCount   = {0};
+  std::atomic<uint64_t>                          mSum     = {0};
+  std::atomic<uint64_t>                          mMin     = {UINT64_MAX};
+  std::atomic<uint64_t>                          mMax     = {0};
+
+ public:
+  LatencyHistogram() = default;
+
+  LatencyHistogram(LatencyHistogram const &) = delete;
+  void operator=(LatencyHistogram const &) = delete;
+
+  void     record(uint64_t _value);
+  Snapshot snapshot() const;
+  void     reset();
+
+  static uint32_t bucketIndex(uint64_t _value);
+  static uint64_t bucketLowerBound(uint32_t _index);
+  static uint64_t bucketUpperBound(uint32_t _index);
+};
+
+/*!
+ * \brief Request statistics of one modbus connection
+ *
+ * Collects the number of requests, registers and PDU bytes, failures by error class and latency histograms (total and
+ * by batch size) of the modbus read requests, the results of ModbusAPI::updateRegisters() and the durations of the
+ * setup phases. All record functions are lock-free, so exporters can take a snapshot() at any time.
+ *
+ * \note Byte counts are modbus PDU bytes (function code and data), so they do not depend on the transport.
+ */
+class Statistics {
+ public:
+  //! Error classes of failed requests.
+  enum class ErrorClass {
+    TIMEOUT,    //!< The device did not respond in time.
+    EXCEPTION,  //!< The device responded with a modbus exception.
+    CONNECTION, //!< The connection is broken.
+    OTHER,      //!< Protocol errors (invalid CRC, invalid data, ...).
+  };
+
+  //! Setup phases.
+  enum class Phase {
+    CONNECT,    //!< Establishing the modbus connection.
+    DB_LOAD,    //!< Loading the registers from the DataBase.
+    INITIALIZE, //!< ModbusAPI::initialize() (including DB_LOAD).
+  };
+
+  static constexpr size_t NUM_ERROR_CLASSES = 4;
+  static constexpr size_t NUM_PHASES        = 3;
+  static constexpr size_t NUM_SIZE_CLASSES  = 8; //!< Batch sizes 1, 2-3, 4-7, ..., 64-127, 128+.
+
+  //! Durations of one setup phase.
+  struct PhaseTiming {
+    uint64_t count = 0; //!< Number of times the phase was executed.
+    uint64_t last  = 0; //!< Duration of the last execution in µs.
+    uint64_t total = 0; //!< Total duration in µs.
+  };
+
+  //! Copy of all statistics.
+  struct Snapshot {
+    uint64_t requests       = 0; //!< Number of read requests.
+    uint64_t failedRequests = 0; //!< Number of failed read requests.
+    uint64_t registersRead  = 0; //!< Number of successfully read modbus registers (words).
+    uint64_t bytesSent      = 0; //!< PDU bytes sent.
+    uint64_t bytesReceived  = 0; //!< PDU bytes received.
+    uint64_t connects       = 0; //!< Number of connection attempts.
+    uint64_t failedConnects = 0; //!< Number of failed connection attempts.
+
+    uint64_t cycles           = 0; //!< Number of ModbusAPI::updateRegisters() calls.
+    uint64_t batches          = 0; //!< Number of batches requested by ModbusAPI::updateRegisters().
+    uint64_t failedBatches    = 0; //!< Number of failed batches.
+    uint64_t registersUpdated = 0; //!< Number of updated Register objects.
+
+    std::array<uint64_t, NUM_ERROR_CLASSES>                  errors = {};   //!< Failed requests by ErrorClass.
+    std::array<PhaseTiming, NUM_PHASES>                      phases = {};   //!< Setup phase durations by Phase.
+    LatencyHistogram::Snapshot                               latency;       //!< Latency of all read requests.
+    std::array<LatencyHistogram::Snapshot, NUM_SIZE_CLASSES> latencyBySize; //!< Latency by batch size class.
+    LatencyHistogram::Snapshot                               cycleLatency;  //!< Duration of updateRegisters().
+    AdaptiveTuning::Snapshot                                 tuning;        //!< State of the adaptive tuning.
+  };
+
+ private:
+  std::atomic<uint64_t> mRequests       = {0};
+  std::atomic<uint64_t> mFailedRequests = {0};
+  std::atomic<uint64_t> mRegistersRead  = {0};
+  std::atomic<uint64_t> mBytesSent      = {0};
+  std::atomic<uint64_t> mBytesReceived  = {0};
+  std::atomic<uint64_t> mConnects       = {0};
+  std::atomic<uint64_t> mFailedConnects = {0};
+
+  std::atomic<uint64_t> mCycles           = {0};
+  std::atomic<uint64_t> mBatches          = {0};
+  std::atomic<uint64_t> mFailedBatches    = {0};
+  std::atomic<uint64_t> mRegistersUpdated = {0};
+
+  std::array<std::atomic<uint64_t>, NUM_ERROR_CLASSES> mErrors     = {};
+  std::array<std::atomic<uint64_t>, NUM_PHASES>        mPhaseCount = {};
+  std::array<std::atomic<uint64_t>, NUM_PHASES>        mPhaseLast  = {};
+  std::array<std::atomic<uint64_t>, NUM_PHASES>        mPhaseTotal = {};
+
+  LatencyHistogram                               mLatency;
+  std::array<LatencyHistogram, NUM_SIZE_CLASSES> mLatencyBySize;
+  LatencyHistogram                               mCycleLatency;
+
+ public:
+  Statistics() = default;
+
+  Statistics(Statistics const &) = delete;
+  void operator=(Statistics const &) = delete;
+
+  void recordRequest(uint32_t _numRegisters, std::chrono::microseconds _duration, int _errno);
+  void recordConnect(bool _success, std::chrono::microseconds _duration);
+  void recordCycle(size_t _batches, size_t _failedBatches, size_t _updated, std::chrono::microseconds _duration);
+  void recordPhase(Phase _phase, std::chrono::microseconds _duration);
+
+  Snapshot snapshot() const;
+  void     reset();
+
+  static ErrorClass  classifyError(int _errno);
+  static size_t      sizeClass(uint32_t _numRegisters);
+  static std::string sizeClassLabel(size_t _sizeClass);
+  static std::string toStr(ErrorClass _class);
+  static std::string toStr(Phase _phase);
+};
+
+} // namespace modbusSMA
@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <unistd.h>
+#include <vector>
+
+#include "Logging.hpp"
+
+using namespace std;
+using namespace std::chrono;
+using namespace modbusSMA;
+using namespace modbusSMA::trace;
+
+namespace {
+
+//! The ring buffer of one thread.
+struct ThreadBuffer {
+  mutex         lock;     //!< Only contended while the trace is written.
+  vector<Event> events;   //!< The ring buffer.
+  uint64_t      next = 0; //!< Total number of recorded events.
+  uint32_t      tid  = 0; //!< Thread ID in the trace.
+  string        name;     //!< Thread name in the trace.
+};
+
+//! Global tracer state.
+struct TraceState {
+  atomic<bool>                     enabled  = {false};
+  atomic<int64_t>                  epoch    = {0}; //!< steady_clock time of enable() in ns.
+  mutex                            lock;
+  vector<shared_ptr<ThreadBuffer>> buffers;
+  size_t                           capacity = 65536;
+  uint32_t                         nextTID  = 1;
+};
+
+TraceState &state() {
+  static TraceState gState;
+  return gState;
+}
+
+thread_local shared_ptr<ThreadBuffer> tBuffer;
+
+inline int64_t nowNS() { return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count(); }
+
+//! Returns the buffer of the current thread (creates it if neccessary).
+ThreadBuffer &threadBuffer() {
+  if (tBuffer) { return *tBuffer; }
+
+  auto &            st  = state();
+  lock_guard<mutex> lock(st.lock);
+  tBuffer = make_shared<ThreadBuffer>();
+  tBuffer->events.resize(st.capacity);
+  tBuffer->tid  = st.nextTID++;
+  tBuffer->name = "thread " + to_string(tBuffer->tid);
+  st.buffers.push_back(tBuffer);
+  return *tBuffer;
+}
+
+//! Escapes a string for JSON.
+string escape(string const &_str) {
+  string out;
+  out.reserve(_str.size());
+  for (char i : _str) {
+    if (i == '"' || i == '\\') { out += '\\'; }
+    out += (unsigned char)i < 0x20 ? ' ' : i;
+  }
+  return out;
+}
+
+} // namespace
+
+/*!
+ * \brief Starts a span
+ * \param _name     The name of the span (must be a static string)
+ * \param _category The category of the span (must be a static string)
+ */
+Span::Span(char const *_name, char const *_category) {
+  if (!isEnabled()) { return; }
+
+  mActive         = true;
+  mEvent.name     = _name;
+  mEvent.category = _category;
+  mEvent.start    = nowNS() - state().epoch.load(memory_order_relaxed);
+}
+
+//! Ends the span and records it.
+Span::~Span() {
+  if (!mActive) { return; }
+
+  mEvent.duration = nowNS() - state().epoch.load(memory_order_relaxed) - mEvent.start;
+
+  ThreadBuffer &    buffer = threadBuffer();
+  lock_guard<mutex> lock(buffer.lock);
+  buffer.events[buffer.next % buffer.events.size()] = mEvent;
+  ++buffer.next;
+}
+
+/*!
+ * \brief Adds an argument to the span (only the first two arguments are stored)
+ * \param _name  The name of the argument (must be a static string)
+ * \param _value The value
+ */
+Span &Span::arg(char const *_name, int64_t _value) {
+  if (!mActive) { return *this; }
+
+  for (size_t i = 0; i < 2; ++i) {
+    if (mEvent.argNames[i]) { continue; }
+    mEvent.argNames[i]  = _name;
+    mEvent.argValues[i] = _value;
+    break;
+  }
+
+  return *this;
+}
+
+
+
+/*!
+ * \brief Enables tracing and writes the trace to _path when destroyed
+ * \param _path            The output file (tracing is not enabled if empty)
+ * \param _eventsPerThread Size of the ring buffer of each thread
+ */
+Session::Session(string _path, size_t _eventsPerThread) : mPath(_path) {
+  if (mPath.empty()) { return; }
+
+  enable(_eventsPerThread);
+  setThreadName("main");
+}
+
+//! Disables tracing and writes the trace file.
+Session::~Session() {
+  if (mPath.empty()) { return; }
+
+  disable();
+  writeFile(mPath);
+}
+
+
+
+/*!
+ * \brief Enables tracing
+ *
+ * All previously recorded events are discarded and the timestamps are reset.
+ *
+ * \param _eventsPerThread Size of the ring buffer of each thread (the oldest events are overwritten)
+ */
+void trace::enable(size_t _eventsPerThread) {
+  auto &            st = state();
+  lock_guard<mutex> lock(st.lock);
+  st.capacity = max<size_t>(_eventsPerThread, 1);
+
+  for (auto &i : st.buffers) {
+    lock_guard<mutex> bufferLock(i->lock);
+    i->events.assign(st.capacity, Event());
+    i->next = 0;
+  }
+
+  st.epoch.store(nowNS());
+  st.enabled.store(true);
+}
+
+//! Disables tracing. The recorded events are kept.
+void trace::disable() { state().enabled.store(false); }
+
+//! Checks if tracing is enabled.
+bool trace::isEnabled() { return state().enabled.load(memory_order_relaxed); }
+
+//! Discards all recorded events.
+void trace::clear() {
+  auto &            st = state();
+  lock_guard<mutex> lock(st.lock);
+  for (auto &i : st.buffers) {
+    lock_guard<mutex> bufferLock(i->lock);
+    i->next = 0;
+  }
+}
+
+//! Sets the name of the current thread in the trace.
+void trace::setThreadName(string const &_name) {
+  ThreadBuffer &    buffer = threadBuffer();
+  lock_guard<mutex> lock(state().lock); // The name is read while writing the trace
+  buffer.name = _name;
+}
+
+//! Returns the number of stored events (of all threads).
+size_t trace::numEvents() {
+  auto &            st  = state();
+  size_t            num = 0;
+  lock_guard<mutex> lock(st.lock);
+  for (auto &i : st.buffers) {
+    lock_guard<mutex> bufferLock(i->lock);
+    num += min<uint64_t>(i->next, i->events.size());
+  }
+  return num;
+}
+
+/*!
+ * \brief Writes the recorded events as Chrome trace event JSON
+ *
+ * The events of each thread are copied while holding the lock of its buffer, so tracing does not have to be
+ * disabled.
+ */
+void trace::writeJSON(ostream &_out) {
+  auto &            st   = state();
+  int               pid  = (int)getpid();
+  uint64_t          lost = 0;
+  vector<Event>     events;
+  lock_guard<mutex> lock(st.lock);
+
+  _out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  _out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"args\":{\"name\":\"modbusSMA\"}}";
+
+  for (auto &i : st.buffers) {
+    {
+      lock_guard<mutex> bufferLock(i->lock);
+      uint64_t          size  = i->events.size();
+      uint64_t          first = i->next > size ? i->next - size : 0;
+      events.clear();
+      for (uint64_t j = first; j < i->next; ++j) { events.push_back(i->events[j % size]); }
+      lost += first;
+    }
+
+    _out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << i->tid
+         << ",\"args\":{\"name\":\"" << escape(i->name) << "\"}}";
+
+    for (auto const &j : events) {
+      _out << fmt::format(",\n{{\"name\":\"{}\",\"cat\":\"{}\",\"ph\":\"X\","
+                          "\"pid\":{},\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}",
+                          j.name,
+                          j.category,
+                          pid,
+                          i->tid,
+                          j.start / 1e3,
+                          j.duration / 1e3);
+
+      if (j.argNames[0]) {
+        _out << ",\"args\":{\"" << j.argNames[0] << "\":" << j.argValues[0];
+        if (j.argNames[1]) { _out << ",\"" << j.argNames[1] << "\":" << j.argValues[1]; }
+        _out << "}";
+      }
+
+      _out << "}";
+    }
+  }
+
+  _out << "\n]}\n";
+
+  if (lost > 0) { log::get()->warn("trace: {} events were overwritten (increase the ring buffer size)", lost); }
+}
+
+/*!
+ * \brief Writes the recorded events to a Chrome trace event JSON file
+ * \param _path The output file
+ * \returns OK or ERROR if the file can not be written
+ */
+ErrorCode trace::writeFile(string const &_path) {
+  auto     logger = log::get();
+  ofstream out(_path);
+  if (!out.is_open()) {
+    logger->error("trace: failed to open '{}' for writing", _path);
+    return ErrorCode::ERROR;
+  }
+
+  writeJSON(out);
+  if (!out.good()) {
+    logger->error("trace: failed to write '{}'", _path);
+    return ErrorCode::ERROR;
+  }
+
+  SPDLOG_LOGGER_INFO(logger, "trace: wrote {} events to '{}'", numEvents(), _path);
+  return ErrorCode::OK;
+}
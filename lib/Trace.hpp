@@ -0,0 +1,98 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <ostream>
+#include <string>
+
+#include "Enums.hpp"
+
+/*!
+ * \brief Namespace for the (opt-in) tracer
+ *
+ * Spans are recorded into a fixed size ring buffer per thread, so the oldest events are overwritten when a buffer is
+ * full. The recorded events can be written as Chrome trace event JSON, which can be opened with chrome://tracing or
+ * https://ui.perfetto.dev.
+ *
+ * When tracing is disabled (the default) a Span only checks a single atomic flag.
+ */
+namespace modbusSMA::trace {
+
+//! One recorded span.
+struct Event {
+  char const *name         = nullptr;            //!< Name of the span (must be a static string).
+  char const *category     = nullptr;            //!< Category of the span (must be a static string).
+  int64_t     start        = 0;                  //!< Start time in ns (relative to enable()).
+  int64_t     duration     = 0;                  //!< Duration in ns.
+  char const *argNames[2]  = {nullptr, nullptr}; //!< Names of the arguments (must be static strings).
+  int64_t     argValues[2] = {0, 0};             //!< Values of the arguments.
+};
+
+/*!
+ * \brief Records the lifetime of the object as a span
+ *
+ * \code{.cpp}
+ * trace::Span span("readRegisters", "modbus");
+ * span.arg("reg", _reg);
+ * \endcode
+ */
+class Span {
+ private:
+  Event mEvent;
+  bool  mActive = false;
+
+ public:
+  Span(char const *_name, char const *_category = "modbusSMA");
+  ~Span();
+
+  Span(Span const &) = delete;
+  void operator=(Span const &) = delete;
+
+  Span &arg(char const *_name, int64_t _value);
+};
+
+/*!
+ * \brief Enables tracing and writes the trace to a file when destroyed
+ *
+ * Does nothing if the path is empty.
+ */
+class Session {
+ private:
+  std::string mPath;
+
+ public:
+  Session(std::string _path, size_t _eventsPerThread = 65536);
+  ~Session();
+
+  Session(Session const &) = delete;
+  void operator=(Session const &) = delete;
+};
+
+void enable(size_t _eventsPerThread = 65536);
+void disable();
+bool isEnabled();
+void clear();
+void setThreadName(std::string const &_name);
+
+size_t    numEvents();
+void      writeJSON(std::ostream &_out);
+ErrorCode writeFile(std::string const &_path);
+
+} // namespace modbusSMA::trace
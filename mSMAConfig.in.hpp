@@ -22,6 +22,13 @@
 #  define SPDLOG_FMT_EXTERNAL 1
 #endif
 
+// Log messages below this level are removed at compile time (SPDLOG_LOGGER_* macros)
+#mesondefine SMA_MODBUS_LOG_LEVEL
+
+#ifndef SPDLOG_ACTIVE_LEVEL
+#  define SPDLOG_ACTIVE_LEVEL SMA_MODBUS_LOG_LEVEL
+#endif
+
 #include <cstdint>
 
 #mesondefine SMA_MODBUS_SMA_VERSION
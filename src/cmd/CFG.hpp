@@ -18,8 +18,19 @@
 
 #include "mSMAConfig.hpp"
 
+#include <string>
+#include <vector>
+
 struct CFG {
-  std::string db = SMA_MODBUS_DEFAULT_DB;
+  std::string db           = SMA_MODBUS_DEFAULT_DB;
+  std::string trace        = "";
+  size_t      traceBuffer  = 65536;
+  bool        asyncLog     = false;
+  bool        fixedTiming  = false;
+  size_t      connections  = 1;
+  std::string capFile      = "";
+  size_t      metadataSize = 0;
+  std::string derived      = "";
 
   struct TcpIP {
     std::string ip   = "127.0.0.1";
@@ -40,8 +51,51 @@ struct CFG {
   } rtu;
 
   struct Print {
-    std::string csv = "registers.csv";
-    uint16_t    min = 0;
-    uint16_t    max = UINT16_MAX;
+    std::string              output     = "registers.csv";
+    std::string              format     = "csv";
+    uint16_t                 min        = 0;
+    uint16_t                 max        = UINT16_MAX;
+    size_t                   chunkSize  = 256;
+    size_t                   jobs       = 0;
+    std::string              unit       = "";
+    std::string              dataFormat = "";
+    std::vector<std::string> search     = {};
   } print;
+
+  struct Poll {
+    double                interval      = 1.0;
+    std::vector<uint16_t> registers     = {};
+    uint16_t              min           = 0;
+    uint16_t              max           = UINT16_MAX;
+    uint64_t              count         = 0;
+    bool                  daemon        = false;
+    bool                  noStdout      = false;
+    std::string           socket        = "";
+    uint16_t              metrics       = 0;
+    std::string           bind          = "0.0.0.0";
+    std::string           shm           = "";
+    std::string           history       = "";
+    size_t                historyCommit = 10;
+    bool                  aggregate     = false;
+    std::string           rules         = "";
+  } poll;
+
+  struct Gateway {
+    std::string              bind        = "0.0.0.0";
+    uint16_t                 port        = 1502;
+    double                   ttl         = 1.0;
+    std::vector<std::string> registerTTL = {};
+  } gateway;
+
+  struct Probe {
+    std::string output = "capabilities.db";
+  } probe;
+
+  struct Discover {
+    std::vector<std::string> ranges   = {};
+    std::vector<uint16_t>    ports    = {};
+    uint32_t                 timeout  = 500;
+    size_t                   parallel = 256;
+    bool                     jsonl    = false;
+  } discover;
 };
@@ -0,0 +1,357 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Export.hpp"
+
+#include <algorithm>
+#include <thread>
+
+#include "Logging.hpp"
+#include "Trace.hpp"
+
+using namespace std;
+using namespace modbusSMA;
+using namespace modbusSMA::cmd;
+
+const char BINARY_MAGIC[]  = "MSMADUMP";
+const char BINARY_VERSION  = 1;
+const char JSON_HEX_CHAR[] = "0123456789abcdef";
+
+//! Appends _str to _out with all JSON special characters escaped.
+void cmd::appendJSONString(string const &_str, string &_out) {
+  _out += '"';
+  for (char i : _str) {
+    switch (i) {
+      case '"': _out += "\\\""; break;
+      case '\\': _out += "\\\\"; break;
+      case '\n': _out += "\\n"; break;
+      case '\r': _out += "\\r"; break;
+      case '\t': _out += "\\t"; break;
+      default:
+        if ((unsigned char)i < 0x20) {
+          _out += "\\u00";
+          _out += JSON_HEX_CHAR[(i >> 4) & 0xF];
+          _out += JSON_HEX_CHAR[i & 0xF];
+        } else {
+          _out += i;
+        }
+    }
+  }
+  _out += '"';
+}
+
+//! Appends _str as a quoted CSV field (quotes are doubled).
+void appendCSVString(string const &_str, string &_out) {
+  _out += '"';
+  for (char i : _str) {
+    if (i == '"') { _out += '"'; }
+    _out += i;
+  }
+  _out += '"';
+}
+
+//! Appends a 16-bit little endian integer.
+void appendU16(uint16_t _val, string &_out) {
+  _out += (char)(_val & 0xFF);
+  _out += (char)(_val >> 8);
+}
+
+//! Returns whether the formatted value of the register is a plain number.
+bool isNumeric(Register const &_reg) {
+  if (_reg.type() == DataType::STR32) { return false; }
+  switch (_reg.format()) {
+    case DataFormat::FIX0:
+    case DataFormat::FIX1:
+    case DataFormat::FIX2:
+    case DataFormat::FIX3:
+    case DataFormat::FIX4:
+    case DataFormat::TEMP:
+    case DataFormat::Duration:
+    case DataFormat::HW:
+    case DataFormat::RAW:
+    case DataFormat::TM:
+    case DataFormat::FUNCTION_SEC: return true;
+    default: return false;
+  }
+}
+
+//! Parses the export format from a string (csv, jsonl, bin). Returns false for an unknown format.
+bool cmd::exportFormatFromStr(string _str, ExportFormat &_format) {
+  transform(begin(_str), end(_str), begin(_str), ::tolower);
+  if (_str == "csv") {
+    _format = ExportFormat::CSV;
+  } else if (_str == "jsonl" || _str == "json") {
+    _format = ExportFormat::JSONL;
+  } else if (_str == "bin" || _str == "binary") {
+    _format = ExportFormat::BINARY;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+//! The header line of the CSV format.
+string cmd::csvHeader() { return "register,description,value,unit,format,type,access\n"; }
+
+//! Formats one register as a CSV line and appends it to _out.
+void cmd::formatCSV(Register const &_reg, string &_out) {
+  auto meta = _reg.metadata();
+
+  _out += to_string(_reg.reg());
+  _out += ',';
+  appendCSVString(meta->desc, _out);
+  _out += ',';
+  appendCSVString(_reg.value(), _out); // DT values contain a newline, enum names may contain commas
+  _out += ',';
+  appendCSVString(meta->unit, _out);
+  _out += ',';
+  _out += enum2Str::toStr(_reg.format());
+  _out += ',';
+  _out += enum2Str::toStr(_reg.type());
+  _out += ',';
+  _out += enum2Str::toStr(_reg.access());
+  _out += '\n';
+}
+
+/*!
+ * \brief Formats one register as a JSON object and appends it (and a newline) to _out
+ *
+ * Numeric values are written as JSON numbers, NaN values as null and everything else as a string.
+ */
+void cmd::formatJSON(Register const &_reg, string &_out) {
+  auto   meta  = _reg.metadata();
+  string value = _reg.value();
+
+  _out += "{\"register\":";
+  _out += to_string(_reg.reg());
+  _out += ",\"description\":";
+  appendJSONString(meta->desc, _out);
+  _out += ",\"value\":";
+  if (value == "NaN") {
+    _out += "null";
+  } else if (isNumeric(_reg)) {
+    _out += value;
+  } else {
+    appendJSONString(value, _out);
+  }
+  _out += ",\"unit\":";
+  appendJSONString(meta->unit, _out);
+  _out += ",\"format\":\"";
+  _out += enum2Str::toStr(_reg.format());
+  _out += "\",\"type\":\"";
+  _out += enum2Str::toStr(_reg.type());
+  _out += "\",\"access\":\"";
+  _out += enum2Str::toStr(_reg.access());
+  _out += "\"}\n";
+}
+
+/*!
+ * \brief The header of the binary format
+ *
+ * The header consists of the 8 byte magic "MSMADUMP" followed by one version byte.
+ */
+string cmd::binaryHeader() {
+  string header(BINARY_MAGIC, sizeof(BINARY_MAGIC) - 1);
+  header += BINARY_VERSION;
+  return header;
+}
+
+/*!
+ * \brief Formats one register as a binary record and appends it to _out
+ *
+ * Record layout (all integers little endian):
+ *   - uint16_t register address
+ *   - uint8_t  DataType
+ *   - uint8_t  DataFormat
+ *   - uint8_t  DataAccess
+ *   - uint8_t  number of raw words (N)
+ *   - N * uint16_t raw register data
+ */
+void cmd::formatBinary(Register const &_reg, string &_out) {
+  WordView raw = _reg.raw();
+  appendU16(_reg.reg(), _out);
+  _out += (char)_reg.type();
+  _out += (char)_reg.format();
+  _out += (char)_reg.access();
+  _out += (char)raw.size();
+  for (uint16_t i : raw) { appendU16(i, _out); }
+}
+
+
+
+/*!
+ * \brief Initializes the export pipeline
+ *
+ * \param _api        The initialized ModbusAPI to fetch the registers with
+ * \param _out        The output stream
+ * \param _format     The output format
+ * \param _chunkSize  Number of registers per chunk
+ * \param _numWorkers Number of formatting threads (0 ==> number of CPU cores)
+ * \param _maxQueued  Maximum number of chunks that are fetched but not yet written
+ */
+ExportPipeline::ExportPipeline(
+    ModbusAPI &_api, ostream &_out, ExportFormat _format, size_t _chunkSize, size_t _numWorkers, size_t _maxQueued)
+    : mAPI(_api),
+      mOut(_out),
+      mFormat(_format),
+      mChunkSize(max<size_t>(_chunkSize, 1)),
+      mNumWorkers(_numWorkers),
+      mMaxQueued(max<size_t>(_maxQueued, 1)) {
+  if (mNumWorkers == 0) { mNumWorkers = max<size_t>(thread::hardware_concurrency(), 1); }
+}
+
+//! Formatting thread main loop.
+void ExportPipeline::worker() {
+  trace::setThreadName("export worker");
+  while (true) {
+    Chunk chunk;
+
+    {
+      unique_lock<mutex> lock(mMutex);
+      mCond.wait(lock, [this]() { return mDone || mAbort || !mToFormat.empty(); });
+      if (mAbort || mToFormat.empty()) { return; }
+      chunk = move(mToFormat.front());
+      mToFormat.pop_front();
+    }
+
+    trace::Span span("format chunk", "export");
+    span.arg("chunk", (int64_t)chunk.id).arg("registers", (int64_t)chunk.registers.size());
+
+    chunk.content.reserve(chunk.registers.size() * 96);
+
+    for (Register const &i : chunk.registers) {
+      switch (mFormat) {
+        case ExportFormat::CSV: formatCSV(i, chunk.content); break;
+        case ExportFormat::JSONL: formatJSON(i, chunk.content); break;
+        case ExportFormat::BINARY: formatBinary(i, chunk.content); break;
+      }
+    }
+
+    {
+      lock_guard<mutex> lock(mMutex);
+      mToWrite.emplace(chunk.id, move(chunk));
+    }
+    mCond.notify_all();
+  }
+}
+
+//! Writes the formatted chunks in order.
+void ExportPipeline::writer(size_t _numChunks) {
+  trace::setThreadName("export writer");
+  for (size_t next = 0; next < _numChunks; ++next) {
+    Chunk chunk;
+
+    {
+      unique_lock<mutex> lock(mMutex);
+      mCond.wait(lock, [this, next]() { return mAbort || mToWrite.count(next) > 0; });
+      if (mAbort) { return; }
+      auto iter = mToWrite.find(next);
+      chunk     = move(iter->second);
+      mToWrite.erase(iter);
+    }
+
+    {
+      trace::Span span("write chunk", "export");
+      span.arg("chunk", (int64_t)next).arg("bytes", (int64_t)chunk.content.size());
+      mOut.write(chunk.content.data(), (streamsize)chunk.content.size());
+    }
+
+    {
+      lock_guard<mutex> lock(mMutex);
+      --mInFlight;
+    }
+    mCond.notify_all();
+  }
+}
+
+/*!
+ * \brief Fetches, formats and writes all registers in _regList
+ *
+ * \note The ModbusAPI must be in the INITIALIZED state.
+ *
+ * \param _regList The (sorted) list of registers to export
+ * \returns The first error of ModbusAPI::updateRegisters or OK
+ */
+ErrorCode ExportPipeline::run(vector<uint16_t> const &_regList) {
+  auto      logger    = log::get();
+  size_t    numChunks = (_regList.size() + mChunkSize - 1) / mChunkSize;
+  ErrorCode result    = ErrorCode::OK;
+
+  mToFormat.clear();
+  mToWrite.clear();
+  mInFlight = 0;
+  mDone     = false;
+  mAbort    = false;
+
+  switch (mFormat) {
+    case ExportFormat::CSV: mOut << csvHeader(); break;
+    case ExportFormat::BINARY: mOut << binaryHeader(); break;
+    default: break;
+  }
+
+  SPDLOG_LOGGER_DEBUG(logger,
+                      "ExportPipeline: exporting {} registers in {} chunks with {} workers",
+                      _regList.size(),
+                      numChunks,
+                      mNumWorkers);
+
+  auto           container = mAPI.getRegisters();
+  vector<thread> workers;
+  for (size_t i = 0; i < mNumWorkers; ++i) { workers.emplace_back(&ExportPipeline::worker, this); }
+  thread writerThread(&ExportPipeline::writer, this, numChunks);
+
+  for (size_t i = 0; i < numChunks; ++i) {
+    auto  first = begin(_regList) + (ptrdiff_t)(i * mChunkSize);
+    auto  last  = (i + 1 == numChunks) ? end(_regList) : first + (ptrdiff_t)mChunkSize;
+    Chunk chunk = {i, vector<uint16_t>(first, last), {}, {}};
+
+    {
+      unique_lock<mutex> lock(mMutex);
+      mCond.wait(lock, [this]() { return mInFlight < mMaxQueued; });
+      ++mInFlight;
+    }
+
+    result = mAPI.updateRegisters(chunk.regs);
+    if (result != ErrorCode::OK) {
+      logger->error("ExportPipeline: failed to fetch chunk {} with '{}'", i, enum2Str::toStr(result));
+      lock_guard<mutex> lock(mMutex);
+      mAbort = true;
+      break;
+    }
+
+    chunk.registers.reserve(chunk.regs.size());
+    container->forEach(chunk.regs, [&](Register const &_reg) { chunk.registers.push_back(_reg); });
+
+    {
+      lock_guard<mutex> lock(mMutex);
+      mToFormat.push_back(move(chunk));
+    }
+    mCond.notify_all();
+  }
+
+  {
+    lock_guard<mutex> lock(mMutex);
+    mDone = true;
+  }
+  mCond.notify_all();
+
+  for (auto &i : workers) { i.join(); }
+  writerThread.join();
+  mOut.flush();
+
+  return result;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "ModbusAPI.hpp"
+
+namespace modbusSMA::cmd {
+
+//! Supported output formats of the register export.
+enum class ExportFormat {
+  CSV,    //!< Comma separated values with a header line.
+  JSONL,  //!< One JSON object per line.
+  BINARY, //!< Compact binary records (see formatBinary()).
+};
+
+bool        exportFormatFromStr(std::string _str, ExportFormat &_format);
+std::string csvHeader();
+void        formatCSV(Register const &_reg, std::string &_out);
+void        formatJSON(Register const &_reg, std::string &_out);
+void        formatBinary(Register const &_reg, std::string &_out);
+std::string binaryHeader();
+void        appendJSONString(std::string const &_str, std::string &_out);
+
+/*!
+ * \brief Streaming register export
+ *
+ * The register list is split into chunks. The calling thread fetches one chunk after another from the inverter while
+ * a pool of worker threads formats already fetched chunks. A dedicated writer thread writes the formatted chunks in
+ * order. The number of chunks between fetching and writing is bounded, so the memory usage does not depend on the
+ * number of exported registers.
+ *
+ * The calling thread copies the registers of a chunk right after fetching them. The workers only format these copies,
+ * since updating the registers (derived registers, see DerivedRegisters) can also modify registers outside the chunk.
+ */
+class ExportPipeline {
+ private:
+  //! One chunk of registers.
+  struct Chunk {
+    size_t                id;        //!< Sequential number of the chunk.
+    std::vector<uint16_t> regs;      //!< The registers in the chunk.
+    std::vector<Register> registers; //!< Copies of the fetched registers.
+    std::string           content;   //!< The formatted output.
+  };
+
+  ModbusAPI &   mAPI;
+  std::ostream &mOut;
+  ExportFormat  mFormat;
+  size_t        mChunkSize;
+  size_t        mNumWorkers;
+  size_t        mMaxQueued;
+
+  std::mutex              mMutex;
+  std::condition_variable mCond;
+  std::deque<Chunk>       mToFormat;
+  std::map<size_t, Chunk> mToWrite;
+  size_t                  mInFlight = 0;
+  bool                    mDone     = false;
+  bool                    mAbort    = false;
+
+  void worker();
+  void writer(size_t _numChunks);
+
+ public:
+  ExportPipeline() = delete;
+  ExportPipeline(ModbusAPI &   _api,
+                 std::ostream &_out,
+                 ExportFormat  _format,
+                 size_t        _chunkSize  = 256,
+                 size_t        _numWorkers = 0,
+                 size_t        _maxQueued  = 16);
+
+  ExportPipeline(ExportPipeline const &) = delete;
+  void operator=(ExportPipeline const &) = delete;
+
+  ErrorCode run(std::vector<uint16_t> const &_regList);
+};
+
+} // namespace modbusSMA::cmd
@@ -0,0 +1,488 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Poll.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Export.hpp"
+#include "Logging.hpp"
+#include "Trace.hpp"
+
+using namespace std;
+using namespace std::chrono;
+using namespace modbusSMA;
+using namespace modbusSMA::cmd;
+
+const size_t MAX_COMMAND_SIZE = 64 * 1024;
+
+//! Becomes readable (and stays readable) once the poller should stop. Shared by all threads.
+int gStopPipe[2] = {-1, -1};
+
+//! Signal handler for SIGINT and SIGTERM.
+void handleStopSignal(int) { Poller::stop(); }
+
+//! Initializes the poller. The ModbusAPI must be set up (INITIALIZED) before calling run().
+Poller::Poller(ModbusAPI &_api, CFG::Poll _cfg) : mAPI(_api), mCfg(_cfg) {}
+
+Poller::~Poller() {
+  removeListeners(); // The listeners capture this
+  stop();
+  if (mServerThread.joinable()) { mServerThread.join(); }
+  if (mServerFD >= 0) {
+    close(mServerFD);
+    unlink(mCfg.socket.c_str());
+  }
+}
+
+//! Stops the poll loop and the control socket thread. Async signal safe.
+void Poller::stop() {
+  if (gStopPipe[1] < 0) { return; }
+  char c = 1;
+  (void)!write(gStopPipe[1], &c, 1);
+}
+
+/*!
+ * \brief Detaches the process from the terminal
+ *
+ * Forks twice, starts a new session and redirects stdin, stdout and stderr to /dev/null. The working directory is not
+ * changed so that relative paths (database, control socket) stay valid.
+ *
+ * \returns false on error (only in the original process)
+ */
+bool Poller::daemonize() {
+  pid_t pid = fork();
+  if (pid < 0) { return false; }
+  if (pid > 0) { _exit(0); }
+
+  if (setsid() < 0) { return false; }
+
+  pid = fork();
+  if (pid < 0) { return false; }
+  if (pid > 0) { _exit(0); }
+
+  int nullFD = open("/dev/null", O_RDWR);
+  if (nullFD >= 0) {
+    dup2(nullFD, STDIN_FILENO);
+    dup2(nullFD, STDOUT_FILENO);
+    dup2(nullFD, STDERR_FILENO);
+    if (nullFD > STDERR_FILENO) { close(nullFD); }
+  }
+
+  return true;
+}
+
+//! Formats the snapshot as a single JSON line. Only registers in _filter are included (if set).
+string Poller::toJSON(Snapshot const &_snapshot, vector<uint16_t> const *_filter) {
+  string out = fmt::format("{{\"cycle\":{},\"timestamp\":{},\"registers\":[", _snapshot.cycle, _snapshot.timestamp);
+  bool   first = true;
+
+  auto append = [&](string const &_obj) {
+    if (!first) { out += ','; }
+    out += _obj;
+    first = false;
+  };
+
+  if (_filter) {
+    for (uint16_t i : *_filter) {
+      auto iter = lower_bound(begin(_snapshot.values), end(_snapshot.values), i, [](auto const &a, uint16_t b) {
+        return a.first < b;
+      });
+      if (iter != end(_snapshot.values) && iter->first == i) { append(iter->second); }
+    }
+  } else {
+    for (auto const &i : _snapshot.values) { append(i.second); }
+  }
+
+  out += "]}";
+  return out;
+}
+
+//! Returns the current aggregates of _regs as a JSON object.
+string Poller::aggregatesToJSON(vector<uint16_t> const &_regs) {
+  string out   = "{\"aggregates\":[";
+  bool   first = true;
+
+  for (uint16_t i : _regs) {
+    for (auto const &j : mAggregator->query(i)) {
+      if (!first) { out += ','; }
+      out += fmt::format("{{\"register\":{},\"window\":\"{}\",\"length\":{},\"start\":{},\"end\":{},\"count\":{},"
+                         "\"min\":{},\"max\":{},\"mean\":{},\"delta\":{}}}",
+                         j.reg,
+                         Aggregator::toStr(j.window.kind),
+                         j.window.length,
+                         j.start,
+                         j.end,
+                         j.count,
+                         j.min,
+                         j.max,
+                         j.mean,
+                         j.delta);
+      first = false;
+    }
+  }
+
+  out += "]}";
+  return out;
+}
+
+//! Returns the currently active alerts as a JSON object.
+string Poller::alertsToJSON() {
+  string out   = "{\"alerts\":[";
+  bool   first = true;
+
+  for (size_t i : mAlerts->active()) {
+    auto const &rule = mAlerts->rules()[i];
+    if (!first) { out += ','; }
+    out += "{\"rule\":";
+    appendJSONString(rule.name, out);
+    out += fmt::format(",\"register\":{},\"kind\":\"{}\"}}", rule.reg, AlertEngine::toStr(rule.kind));
+    first = false;
+  }
+
+  out += fmt::format("],\"dropped\":{}}}", mAlerts->dropped());
+  return out;
+}
+
+//! Logs the alerts raised and cleared since the last call.
+void Poller::logAlerts() {
+  auto const &logger = log::get();
+
+  mEvents.clear();
+  mAlerts->drain(mEvents);
+  for (auto const &i : mEvents) {
+    auto const &rule = mAlerts->rules()[i.rule];
+    if (i.active) {
+      auto kind = AlertEngine::toStr(rule.kind);
+      logger->warn("Alert '{}' ({}) raised: register {} = {}", rule.name, kind, i.reg, i.value);
+    } else {
+      SPDLOG_LOGGER_INFO(logger, "Alert '{}' cleared: register {} = {}", rule.name, i.reg, i.value);
+    }
+  }
+}
+
+//! Evaluates one control socket command and returns the response (without newline).
+string Poller::handleCommand(string const &_cmd) {
+  istringstream    stream(_cmd);
+  string           cmd;
+  vector<uint16_t> regs;
+
+  stream >> cmd;
+  if (cmd == "ping") { return "pong"; }
+  if (cmd == "alerts") { return mAlerts ? alertsToJSON() : "{\"error\":\"alerts are disabled\"}"; }
+  if (cmd != "get" && cmd != "all" && cmd != "agg") {
+    return fmt::format("{{\"error\":\"unknown command '{}'\"}}", cmd);
+  }
+
+  if (cmd == "get" || cmd == "agg") {
+    uint32_t reg;
+    while (stream >> reg) {
+      if (reg > UINT16_MAX) { return fmt::format("{{\"error\":\"invalid register {}\"}}", reg); }
+      regs.push_back((uint16_t)reg);
+    }
+
+    if (!stream.eof()) { return "{\"error\":\"invalid register list\"}"; }
+  }
+
+  if (cmd == "agg") { return mAggregator ? aggregatesToJSON(regs) : "{\"error\":\"aggregation is disabled\"}"; }
+
+  auto snapshot = mLatest.acquire();
+  if (!snapshot) { return "{\"error\":\"no data\"}"; }
+
+  return toJSON(*snapshot, cmd == "get" ? &regs : nullptr);
+}
+
+//! Creates, binds and listens on the Unix domain control socket.
+bool Poller::openControlSocket() {
+  auto        logger = log::get();
+  sockaddr_un addr   = {};
+
+  if (mCfg.socket.size() >= sizeof(addr.sun_path)) {
+    logger->error("Poller: control socket path '{}' is too long", mCfg.socket);
+    return false;
+  }
+
+  mServerFD = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (mServerFD < 0) {
+    logger->error("Poller: failed to create the control socket: '{}'", strerror(errno));
+    return false;
+  }
+
+  addr.sun_family = AF_UNIX;
+  mCfg.socket.copy(addr.sun_path, mCfg.socket.size());
+  unlink(mCfg.socket.c_str()); // Remove stale sockets
+
+  if (bind(mServerFD, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(mServerFD, 16) != 0) {
+    logger->error("Poller: failed to bind the control socket '{}': '{}'", mCfg.socket, strerror(errno));
+    close(mServerFD);
+    mServerFD = -1;
+    return false;
+  }
+
+  SPDLOG_LOGGER_INFO(logger, "Poller: control socket listening on '{}'", mCfg.socket);
+  return true;
+}
+
+//! Accepts clients and answers commands until stop() is called.
+void Poller::controlSocketLoop() {
+  struct Client {
+    int    fd;
+    string buffer;
+  };
+
+  vector<Client> clients;
+  vector<pollfd> fds;
+
+  while (true) {
+    fds.clear();
+    fds.push_back({gStopPipe[0], POLLIN, 0});
+    fds.push_back({mServerFD, POLLIN, 0});
+    for (auto &i : clients) { fds.push_back({i.fd, POLLIN, 0}); }
+
+    if (::poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) { continue; }
+      log::get()->error("Poller: poll() on the control socket failed: '{}'", strerror(errno));
+      break;
+    }
+
+    if (fds[0].revents != 0) { break; }
+
+    // Handle the clients first (the accept below invalidates the fds <==> clients mapping)
+    for (size_t i = 0; i < clients.size(); ++i) {
+      if (fds[i + 2].revents == 0) { continue; }
+
+      Client &client = clients[i];
+      char    buffer[4096];
+      ssize_t len = recv(client.fd, buffer, sizeof(buffer), 0);
+      if (len > 0) { client.buffer.append(buffer, (size_t)len); }
+
+      size_t pos;
+      while ((pos = client.buffer.find('\n')) != string::npos) {
+        string response = handleCommand(client.buffer.substr(0, pos)) + "\n";
+        client.buffer.erase(0, pos + 1);
+        if (send(client.fd, response.data(), response.size(), MSG_NOSIGNAL) < 0) {
+          len = 0;
+          break;
+        }
+      }
+
+      if (len <= 0 || client.buffer.size() > MAX_COMMAND_SIZE) {
+        close(client.fd);
+        client.fd = -1;
+      }
+    }
+
+    clients.erase(remove_if(begin(clients), end(clients), [](Client const &c) { return c.fd < 0; }), end(clients));
+
+    if (fds[1].revents & POLLIN) {
+      int clientFD = accept4(mServerFD, nullptr, nullptr, SOCK_CLOEXEC);
+      if (clientFD >= 0) { clients.push_back({clientFD, ""}); }
+    }
+  }
+
+  for (auto &i : clients) { close(i.fd); }
+}
+
+//! Tries to re-establish the connection to the inverter.
+bool Poller::reconnect() {
+  auto logger = log::get();
+  logger->warn("Poller: reconnecting to the inverter");
+  mAPI.reset();
+  ErrorCode result = mAPI.setup();
+  if (result != ErrorCode::OK) {
+    logger->error("Poller: reconnect failed with '{}'", enum2Str::toStr(result));
+    return false;
+  }
+
+  return true;
+}
+
+//! Removes the update listeners of the aggregator and the alert engine from the ModbusAPI.
+void Poller::removeListeners() {
+  if (mListenerID != 0) { mAPI.removeUpdateListener(mListenerID); }
+  if (mAlertsID != 0) { mAPI.removeUpdateListener(mAlertsID); }
+  mListenerID = 0;
+  mAlertsID   = 0;
+}
+
+/*!
+ * \brief Runs the poll loop until the configured number of cycles is reached or a stop signal is received
+ * \returns the exit code for main()
+ */
+int Poller::run() {
+  auto logger = log::get();
+
+  if (mCfg.registers.empty()) {
+    mRegList = mAPI.getRegisters()->getAddresses(mCfg.min, mCfg.max, true);
+  } else {
+    mRegList = mCfg.registers;
+    sort(begin(mRegList), end(mRegList));
+    mRegList.erase(unique(begin(mRegList), end(mRegList)), end(mRegList));
+  }
+
+  if (mRegList.empty()) {
+    logger->error("Poller: no registers to poll");
+    return 2;
+  }
+
+  if (pipe2(gStopPipe, O_CLOEXEC) != 0) {
+    logger->error("Poller: failed to create the stop pipe: '{}'", strerror(errno));
+    return 1;
+  }
+
+  signal(SIGINT, handleStopSignal);
+  signal(SIGTERM, handleStopSignal);
+  signal(SIGPIPE, SIG_IGN);
+
+  // The control socket thread serves the aggregations and alerts, so they must exist before it starts
+  if (mCfg.aggregate) { mAggregator = make_unique<Aggregator>(); }
+
+  if (!mCfg.rules.empty()) {
+    mAlerts = make_unique<AlertEngine>();
+    if (mAlerts->loadFile(mCfg.rules) != ErrorCode::OK) { return 2; }
+  }
+
+  if (!mCfg.socket.empty()) {
+    if (!openControlSocket()) { return 2; }
+    mServerThread = thread(&Poller::controlSocketLoop, this);
+  }
+
+  if (mCfg.metrics != 0) {
+    mMetrics = make_unique<MetricsExporter>(*mAPI.getRegisters(), mRegList);
+    if (mMetrics->start(mCfg.bind, mCfg.metrics) != ErrorCode::OK) { return 2; }
+  }
+
+  if (!mCfg.shm.empty()) {
+    auto res = mShm.open(mCfg.shm, *mAPI.getRegisters(), mRegList, mAPI.serialNumber(), mAPI.inverterTypeID());
+    if (res != ErrorCode::OK) { return 2; }
+  }
+
+  if (!mCfg.history.empty()) {
+    HistorySink::Settings settings;
+    settings.cyclesPerCommit = mCfg.historyCommit;
+    mHistory                 = make_unique<HistorySink>(mCfg.history, settings);
+    auto res = mHistory->open(*mAPI.getRegisters(), mRegList, mAPI.serialNumber(), mAPI.inverterTypeID());
+    if (res != ErrorCode::OK) { return 2; }
+  }
+
+  // Register the listeners after all steps that can fail (see removeListeners())
+  if (mAggregator) {
+    mListenerID = mAPI.addUpdateListener([this](RegisterContainer const &_container,
+                                                vector<uint16_t> const & _updated,
+                                                int64_t                  _timestamp) {
+      mAggregator->update(_container, _updated, _timestamp);
+    });
+  }
+
+  if (mAlerts) {
+    mAlertsID = mAPI.addUpdateListener([this](RegisterContainer const &_container,
+                                              vector<uint16_t> const & _updated,
+                                              int64_t                  _timestamp) {
+      mAlerts->update(_container, _updated, _timestamp);
+    });
+  }
+
+  SPDLOG_LOGGER_INFO(logger, "Poller: polling {} registers every {}s", mRegList.size(), mCfg.interval);
+
+  auto   interval  = duration_cast<steady_clock::duration>(duration<double>(mCfg.interval));
+  auto   next      = steady_clock::now();
+  bool   useStdout = !mCfg.noStdout && !mCfg.daemon;
+  string line;
+
+  for (uint64_t cycle = 1; mCfg.count == 0 || cycle <= mCfg.count; ++cycle) {
+    trace::Span cycleSpan("poll cycle", "poll");
+    size_t      numUpdated = 0;
+    ErrorCode   result     = ErrorCode::INVALID_STATE;
+    cycleSpan.arg("cycle", (int64_t)cycle);
+
+    if (mAPI.getState() == State::INITIALIZED || reconnect()) { result = mAPI.updateRegisters(mRegList, &numUpdated); }
+
+    // Modbus exceptions and NaN values do not mean that the connection is lost (the device answered)
+    auto errClass       = Statistics::classifyError(mAPI.lastError());
+    bool connectionLost = errClass == Statistics::ErrorClass::CONNECTION ||
+                          (errClass == Statistics::ErrorClass::TIMEOUT && numUpdated == 0);
+    if (result != ErrorCode::OK || connectionLost) {
+      logger->warn("Poller: cycle {} failed ({} registers updated)", cycle, numUpdated);
+      mAPI.reset(); // Reconnect in the next cycle
+    } else {
+      auto container = mAPI.getRegisters();
+      auto timestamp = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+
+      trace::Span publishSpan("publish", "poll");
+      mLatest.publish([&](Snapshot &_snapshot) {
+        _snapshot.cycle     = cycle;
+        _snapshot.timestamp = timestamp;
+        _snapshot.values.clear();
+        _snapshot.values.reserve(mRegList.size());
+
+        container->forEach(mRegList, [&](Register const &_reg) {
+          string obj;
+          formatJSON(_reg, obj);
+          obj.pop_back(); // Remove the newline
+          _snapshot.values.emplace_back(_reg.reg(), move(obj));
+        });
+
+        if (useStdout) { line = toJSON(_snapshot) + "\n"; }
+      });
+
+      mShm.update(*container, cycle, timestamp);
+      if (mHistory) { mHistory->push(*container, cycle, timestamp); }
+
+      if (mMetrics) {
+        auto stats = mAPI.getStatistics();
+        mMetrics->update(*container, cycle, &stats);
+      }
+
+      if (useStdout) {
+        fwrite(line.data(), 1, line.size(), stdout);
+        fflush(stdout);
+      }
+    }
+
+    if (mAlerts) { logAlerts(); }
+    cycleSpan.arg("updated", (int64_t)numUpdated);
+
+    // Wait for the next cycle (or the stop signal)
+    next += interval;
+    auto now = steady_clock::now();
+    if (next < now) { next = now; }
+
+    pollfd stopFD  = {gStopPipe[0], POLLIN, 0};
+    int    timeout = (int)duration_cast<milliseconds>(next - now).count();
+    if (::poll(&stopFD, 1, timeout) > 0) {
+      SPDLOG_LOGGER_INFO(logger, "Poller: stop requested");
+      break;
+    }
+  }
+
+  stop();
+  if (mServerThread.joinable()) { mServerThread.join(); }
+  if (mMetrics) { mMetrics->stop(); }
+  if (mHistory) { mHistory->close(); }
+  removeListeners();
+  return 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Aggregator.hpp"
+#include "AlertEngine.hpp"
+#include "CFG.hpp"
+#include "HistorySink.hpp"
+#include "ModbusAPI.hpp"
+#include "OpenMetrics.hpp"
+#include "ShmPublisher.hpp"
+#include "SnapshotBuffer.hpp"
+
+namespace modbusSMA::cmd {
+
+/*!
+ * \brief Continuously polls registers and serves the latest values
+ *
+ * Every cycle the configured registers are updated and written as JSON Lines to stdout. The latest values are also
+ * served over an (optional) Unix domain control socket. The socket protocol is line based:
+ *
+ *   - `get <reg> [<reg> ...]` returns the latest values of the requested registers
+ *   - `all`                   returns the latest values of all polled registers
+ *   - `agg <reg> [<reg> ...]` returns the current aggregates of the requested registers (requires --aggregate)
+ *   - `alerts`                returns the currently active alerts (requires --rules)
+ *   - `ping`                  returns `pong`
+ *
+ * Each command is answered with exactly one line. Values are returned as a JSON object of the form
+ * `{"cycle":N,"timestamp":T,"registers":[...]}`.
+ *
+ * Optionally, the values are also served as OpenMetrics text by a MetricsExporter and published in a shared memory
+ * segment (ShmPublisher) and recorded in a sqlite database (HistorySink). Neither the control socket nor the metrics
+ * endpoint ever wait for the poll loop. Raised and cleared alerts (AlertEngine) are logged at the end of each cycle.
+ */
+class Poller {
+ private:
+  //! The formatted values of one poll cycle.
+  struct Snapshot {
+    uint64_t                                       cycle     = 0; //!< Number of the poll cycle.
+    int64_t                                        timestamp = 0; //!< UNIX timestamp in ms.
+    std::vector<std::pair<uint16_t, std::string>> values;         //!< (register, JSON object) sorted by register.
+  };
+
+  ModbusAPI &mAPI;
+  CFG::Poll  mCfg;
+
+  std::vector<uint16_t>            mRegList;
+  SnapshotBuffer<Snapshot>         mLatest;
+  std::unique_ptr<MetricsExporter> mMetrics = nullptr;
+  ShmPublisher                     mShm;
+  std::unique_ptr<HistorySink>     mHistory    = nullptr;
+  std::unique_ptr<Aggregator>      mAggregator = nullptr;
+  size_t                           mListenerID = 0;
+  std::unique_ptr<AlertEngine>     mAlerts     = nullptr;
+  size_t                           mAlertsID   = 0;
+  std::vector<AlertEngine::Event>  mEvents;
+
+  int         mServerFD = -1;
+  std::thread mServerThread;
+
+  std::string handleCommand(std::string const &_cmd);
+  std::string toJSON(Snapshot const &_snapshot, std::vector<uint16_t> const *_filter = nullptr);
+  std::string aggregatesToJSON(std::vector<uint16_t> const &_regs);
+  std::string alertsToJSON();
+  void        logAlerts();
+
+  bool openControlSocket();
+  void controlSocketLoop();
+  bool reconnect();
+  void removeListeners();
+
+ public:
+  Poller() = delete;
+  Poller(ModbusAPI &_api, CFG::Poll _cfg);
+  ~Poller();
+
+  Poller(Poller const &) = delete;
+  void operator=(Poller const &) = delete;
+
+  int run();
+
+  static void stop();
+  static bool daemonize();
+};
+
+} // namespace modbusSMA::cmd
@@ -15,21 +15,159 @@
  */
 
 #include <algorithm>
+#include <csignal>
 #include <fstream>
 #include <iostream>
 
 #include "CFG.hpp"
 #include "CLI11.hpp"
+#include "Capabilities.hpp"
 #include "DataBase.hpp"
+#include "Discovery.hpp"
+#include "Export.hpp"
 #include "Logging.hpp"
+#include "MBGateway.hpp"
 #include "ModbusAPI.hpp"
+#include "Poll.hpp"
+#include "Trace.hpp"
 
 using namespace std;
 using namespace spdlog;
 using namespace modbusSMA;
+using namespace modbusSMA::cmd;
 
-int main(int argc, char *argv[]) {
+MBGateway *gGateway = nullptr;
+
+void stopGateway(int) {
+  if (gGateway) { gGateway->stop(); } // stop() only writes to a pipe
+}
+
+//! Runs the caching gateway until SIGINT or SIGTERM.
+int runGateway(ModbusAPI &_mapi, CFG::Gateway const &_cfg) {
   auto      logger = log::get();
+  MBGateway gateway(_mapi, chrono::milliseconds((int64_t)(_cfg.ttl * 1000)));
+
+  for (auto const &i : _cfg.registerTTL) {
+    auto pos = i.find('=');
+    try {
+      if (pos == string::npos) { throw invalid_argument(i); }
+      string regStr = i.substr(0, pos);
+      string ttlStr = i.substr(pos + 1);
+      size_t regLen = 0;
+      size_t ttlLen = 0;
+
+      unsigned long reg = stoul(regStr, &regLen);
+      double        ttl = stod(ttlStr, &ttlLen);
+      if (regStr[0] == '-' || regLen != regStr.size() || reg > UINT16_MAX) { throw out_of_range(regStr); }
+      if (ttlLen != ttlStr.size() || !(ttl >= 0.0 && ttl <= 1e9)) { throw out_of_range(ttlStr); }
+
+      gateway.setTTL((uint16_t)reg, chrono::milliseconds((int64_t)(ttl * 1000)));
+    } catch (exception &) {
+      logger->error("Invalid register TTL '{}' (expected <register>=<seconds>)", i);
+      return 2;
+    }
+  }
+
+  if (gateway.listen(_cfg.bind, _cfg.port) != ErrorCode::OK) { return 2; }
+
+  gGateway = &gateway;
+  signal(SIGINT, stopGateway);
+  signal(SIGTERM, stopGateway);
+  signal(SIGPIPE, SIG_IGN);
+
+  logger->info("Serving {} on {}:{} (TTL {}s)", _mapi.inverterType(), _cfg.bind, _cfg.port, _cfg.ttl);
+  ErrorCode result = gateway.run();
+  gGateway         = nullptr;
+
+  auto c = gateway.counters();
+  logger->info("Gateway stopped: {} reads ({} hits, {} misses), {} writes, {} upstream reads, {} upstream errors",
+               c.reads,
+               c.hits,
+               c.misses,
+               c.writes,
+               c.upstreamReads,
+               c.upstreamErrors);
+  return result == ErrorCode::OK ? 0 : 1;
+}
+
+//! Probes the supported registers and stores the result.
+int runProbe(ModbusAPI &_mapi, CFG::Probe const &_cfg) {
+  CapabilityProbe probe(_mapi);
+  CapabilityMap   caps;
+  CapabilityStore store(_cfg.output);
+
+  if (probe.run(caps) != ErrorCode::OK) { return 1; }
+  if (store.connect() != ErrorCode::OK || store.save(caps) != ErrorCode::OK) { return 2; }
+
+  fmt::print("{} (serial {}, firmware {:08X}): {} supported, {} NaN only, {} rejected -- saved to '{}'\n",
+             _mapi.inverterType(),
+             caps.serial(),
+             caps.firmware(),
+             caps.count(CapabilityMap::State::SUPPORTED),
+             caps.count(CapabilityMap::State::NAN_ONLY),
+             caps.count(CapabilityMap::State::REJECTED),
+             _cfg.output);
+  return 0;
+}
+
+//! Loads the capabilities of the connected device, so that rejected registers are never requested.
+void loadCapabilities(ModbusAPI &_mapi, string const &_path) {
+  auto            logger   = log::get();
+  uint32_t        serial   = 0;
+  uint32_t        firmware = 0;
+  auto            caps     = make_shared<CapabilityMap>();
+  CapabilityStore store(_path);
+
+  if (CapabilityProbe(_mapi).identify(serial, firmware) != ErrorCode::OK) { return; }
+  if (store.connect() != ErrorCode::OK) { return; }
+
+  ErrorCode res = store.load(serial, firmware, *caps);
+  if (res == ErrorCode::FILE_NOT_FOUND) {
+    logger->warn("No capabilities for serial {} / firmware {:08X} in '{}' (run 'probe')", serial, firmware, _path);
+    return;
+  }
+
+  if (res == ErrorCode::OK) {
+    SPDLOG_LOGGER_INFO(logger, "Skipping {} rejected registers", caps->count(CapabilityMap::State::REJECTED));
+    _mapi.setCapabilities(caps);
+  }
+}
+
+//! Scans the configured address ranges and prints the found devices.
+int runDiscovery(string const &_dbPath, CFG::Discover const &_cfg) {
+  Discovery::Settings settings;
+  settings.connectTimeout = chrono::milliseconds(_cfg.timeout);
+  settings.probeTimeout   = chrono::milliseconds(2 * _cfg.timeout);
+  settings.maxConnects    = _cfg.parallel;
+
+  Discovery disc(make_shared<DataBase>(_dbPath), settings);
+  for (auto const &i : _cfg.ranges) {
+    if (disc.addRange(i) != ErrorCode::OK) { return 2; }
+  }
+  for (auto i : _cfg.ports) { disc.addPort(i); }
+
+  for (auto const &i : disc.run()) {
+    if (_cfg.jsonl) {
+      fmt::print("{{\"ip\":\"{}\",\"port\":{},\"serial\":{},\"unitID\":{},\"typeID\":{},\"type\":\"{}\"}}\n",
+                 i.ip,
+                 i.port,
+                 i.serial,
+                 i.unitID,
+                 i.typeID,
+                 i.type);
+    } else {
+      fmt::print("{:<21} serial {:<10} unit {:<3} {}\n",
+                 i.ip + ":" + to_string(i.port),
+                 i.serial,
+                 i.unitID,
+                 i.known ? i.type : "unknown type " + to_string(i.typeID));
+    }
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
   CFG       cfg;
   ErrorCode result;
 
@@ -46,7 +184,7 @@ int main(int argc, char *argv[]) {
   CLI::App app{"modbusSMA CLI client"};
 
   app.add_flag("--version",
-               [logger](size_t) -> void {
+               [](size_t) -> void {
                  cout << "Version " << SMA_MODBUS_SMA_VERSION << endl;
                  exit(0);
                },
@@ -54,6 +192,17 @@ int main(int argc, char *argv[]) {
 
   app.add_option("-d,--database", cfg.db, "Path to the modbusSMA database", true)->check(CLI::ExistingFile);
 
+  app.add_option("--trace", cfg.trace, "Write a Chrome trace event JSON file (chrome://tracing, Perfetto)");
+  app.add_option("--trace-buffer", cfg.traceBuffer, "Size of the per thread trace ring buffer (events)", true);
+
+  app.add_flag("--async-log", cfg.asyncLog, "Write the log messages from a background thread");
+  app.add_flag("--fixed-timing", cfg.fixedTiming, "Disable the adaptive response timeout and batch size");
+  app.add_option("--capabilities", cfg.capFile, "Skip the registers rejected in this probe database (see probe)");
+  app.add_option("--connections", cfg.connections, "Number of parallel connections to the inverter (TCP only)", true)
+      ->check(CLI::Range(1, 16));
+  app.add_option("--low-memory", cfg.metadataSize, "Load descriptions on demand and cache this many (0 = disabled)");
+  app.add_option("--derived", cfg.derived, "Load computed registers from this file")->check(CLI::ExistingFile);
+
   auto lFlagV = app.add_flag("-v,--verbose", "Verbose logging");
   auto lFlagQ = app.add_flag("-q,--quiet", "Will only log warnings and errors");
 
@@ -74,8 +223,52 @@ int main(int argc, char *argv[]) {
 
   CLI::App *print = app.add_subcommand("print", "Print all registers")->fallthrough()->ignore_case();
   print->add_option("--min", cfg.print.min, "Minimum register address to print");
-  print->add_option("--max", cfg.print.min, "Maximum register address to print");
-  print->add_option("-C,--csv", cfg.print.csv, "Where to save the CSV file");
+  print->add_option("--max", cfg.print.max, "Maximum register address to print");
+  print->add_option("-o,-C,--output,--csv", cfg.print.output, "Where to save the output ('-' for stdout)", true);
+  print->add_option("-f,--format", cfg.print.format, "Output format: csv, jsonl or bin", true);
+  print->add_option("--chunk", cfg.print.chunkSize, "Number of registers per export chunk", true);
+  print->add_option("-j,--jobs", cfg.print.jobs, "Number of formatting threads (0 = number of CPU cores)", true);
+  print->add_option("--unit", cfg.print.unit, "Only print registers with this unit");
+  print->add_option("--data-format", cfg.print.dataFormat, "Only print registers with this data format (FIX0, ...)");
+  print->add_option("-s,--search", cfg.print.search, "Only print registers with these words in the description");
+
+  CLI::App *poll = app.add_subcommand("poll", "Continuously poll registers")->fallthrough()->ignore_case();
+  poll->add_option("-i,--interval", cfg.poll.interval, "Poll interval in seconds", true);
+  poll->add_option("-r,--registers", cfg.poll.registers, "Registers to poll (default: all readable in [min, max])");
+  poll->add_option("--min", cfg.poll.min, "Minimum register address to poll");
+  poll->add_option("--max", cfg.poll.max, "Maximum register address to poll");
+  poll->add_option("-n,--count", cfg.poll.count, "Number of poll cycles (0 = infinite)", true);
+  poll->add_option("-s,--socket", cfg.poll.socket, "Path of the Unix control socket");
+  poll->add_option("-m,--metrics", cfg.poll.metrics, "Serve OpenMetrics on this TCP port (0 = disabled)", true);
+  poll->add_option("--metrics-bind", cfg.poll.bind, "Address of the OpenMetrics endpoint", true);
+  poll->add_option("--shm", cfg.poll.shm, "Publish the values in this POSIX shared memory segment (see ShmReader)");
+  poll->add_option("--history", cfg.poll.history, "Record the values in this sqlite database");
+  poll->add_option("--history-commit", cfg.poll.historyCommit, "Number of cycles per history transaction", true);
+  poll->add_flag("--aggregate", cfg.poll.aggregate, "Maintain min / max / mean / delta windows (socket command 'agg')");
+  poll->add_option("--rules", cfg.poll.rules, "Evaluate the alert rules in this file (socket command 'alerts')")
+      ->check(CLI::ExistingFile);
+  poll->add_flag("-D,--daemon", cfg.poll.daemon, "Detach from the terminal (implies --no-stdout)");
+  poll->add_flag("--no-stdout", cfg.poll.noStdout, "Do not write the values to stdout");
+
+  CLI::App *probe = app.add_subcommand("probe", "Probe and store the supported registers")->fallthrough();
+  probe->ignore_case();
+  probe->add_option("-o,--output", cfg.probe.output, "Database for the probe results", true);
+
+  CLI::App *gateway = app.add_subcommand("gateway", "Caching Modbus TCP gateway for many clients")->fallthrough();
+  gateway->ignore_case();
+  gateway->add_option("-b,--bind", cfg.gateway.bind, "Address to listen on", true);
+  gateway->add_option("-p,--listen-port", cfg.gateway.port, "Modbus TCP port of the gateway", true);
+  gateway->add_option("--ttl", cfg.gateway.ttl, "Time to live of the cached registers in seconds", true)
+      ->check(CLI::Range(0.0, 1e9));
+  gateway->add_option("--register-ttl", cfg.gateway.registerTTL, "TTL of single registers: <register>=<seconds>");
+
+  CLI::App *discover = app.add_subcommand("discover", "Scan address ranges for SMA inverters")->ignore_case();
+  discover->add_option("-r,--range", cfg.discover.ranges, "Address, subnet (a.b.c.d/n) or range (a.b.c.d-e)")
+      ->required();
+  discover->add_option("-p,--port", cfg.discover.ports, "Modbus TCP ports to scan (default: 502)");
+  discover->add_option("-t,--timeout", cfg.discover.timeout, "Connect timeout in ms", true);
+  discover->add_option("-j,--parallel", cfg.discover.parallel, "Number of parallel connects", true);
+  discover->add_flag("--jsonl", cfg.discover.jsonl, "Print the devices as JSON Lines");
 
   app.require_subcommand();
 
@@ -91,16 +284,37 @@ int main(int argc, char *argv[]) {
   /*                                                                  */
 
 
+  // The thread of the async logger does not survive fork(), so the logger is created after daemonizing
+  bool daemonized = !(*poll && cfg.poll.daemon) || Poller::daemonize();
+  auto logger     = log::initialize({}, cfg.asyncLog ? log::Mode::ASYNC : log::Mode::SYNC);
+
   if (lFlagQ->count() > 0 && lFlagQ->count() > lFlagV->count()) { logger->set_level(level::warn); }
   if (lFlagV->count() > 0 && lFlagV->count() > lFlagQ->count()) { logger->set_level(level::debug); }
 
+  if (!daemonized) {
+    logger->error("Failed to daemonize");
+    return 1;
+  }
+
+  trace::Session traceSession(cfg.trace, cfg.traceBuffer); // Writes the trace file when main() returns
+  if (*discover) { return runDiscovery(cfg.db, cfg.discover); }
+
   ModbusAPI mapi("127.0.0.1", 512, cfg.db); // Config will be overwritten later
 
-  logger->info("Starting the modbus CLI server");
+  SPDLOG_LOGGER_INFO(logger, "Starting the modbus CLI server");
 
   if (*tcpIP) { mapi.setConnectionTCP_IP(cfg.tcpIP.ip, cfg.tcpIP.port); }
   if (*tcpIP_PI) { mapi.setConnectionTCP_IP_PI(cfg.tcpIP_PI.node, cfg.tcpIP_PI.service); }
   if (*rtu) { mapi.setConnectionRTU(cfg.rtu.device, cfg.rtu.baud, cfg.rtu.parity, cfg.rtu.dataBit, cfg.rtu.stopBit); }
+  if (cfg.fixedTiming) { mapi.setAdaptiveTuning(false); }
+  mapi.setConnectionCount(cfg.connections);
+  mapi.setMetadataCache(cfg.metadataSize);
+
+  if (!cfg.derived.empty()) {
+    auto derived = make_shared<DerivedRegisters>();
+    if (derived->loadFile(cfg.derived) != ErrorCode::OK) { return 1; }
+    mapi.setDerivedRegisters(derived);
+  }
 
   result = mapi.setup();
 
@@ -109,45 +323,55 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  if (*probe) { return runProbe(mapi, cfg.probe); }
+  if (!cfg.capFile.empty()) { loadCapabilities(mapi, cfg.capFile); }
+
   if (*print) {
-    std::ofstream csvFile(cfg.print.csv);
-    if (!csvFile.is_open()) {
-      logger->error("Failed to oppen '{}' for writing", cfg.print.csv);
+    ExportFormat format;
+    if (!exportFormatFromStr(cfg.print.format, format)) {
+      logger->error("Unknown output format '{}'", cfg.print.format);
       return 2;
     }
 
-    csvFile << "register,description,value,unit,format,type,access" << endl;
+    std::ofstream outFile;
+    if (cfg.print.output != "-") {
+      outFile.open(cfg.print.output, format == ExportFormat::BINARY ? ios::out | ios::binary : ios::out);
+      if (!outFile.is_open()) {
+        logger->error("Failed to oppen '{}' for writing", cfg.print.output);
+        return 2;
+      }
+    }
+
+    RegisterIndex::Query query;
+    query.unit     = cfg.print.unit;
+    query.words    = cfg.print.search;
+    query.min      = cfg.print.min;
+    query.max      = cfg.print.max;
+    query.readable = true;
+    if (!cfg.print.dataFormat.empty()) {
+      query.format = enum2Str::formatFromStr(cfg.print.dataFormat);
+      if (query.format == DataFormat::__UNKNOWN__) {
+        logger->error("Unknown data format '{}'", cfg.print.dataFormat);
+        return 2;
+      }
+    }
 
-    auto             registerHandler = mapi.getRegisters();
-    vector<Register> registerList    = registerHandler->getRegisters();
-    auto             startIter       = lower_bound(begin(registerList), end(registerList), cfg.print.min);
-    auto             endIter         = upper_bound(begin(registerList), end(registerList), cfg.print.max);
-    vector<Register> toUpdate;
-    copy_if(startIter, endIter, std::back_inserter(toUpdate), [](const Register &i) { return i.canRead(); });
+    ostream &      out      = cfg.print.output == "-" ? cout : outFile;
+    auto           toExport = mapi.getRegisters()->index().find(query);
+    ExportPipeline pipeline(mapi, out, format, cfg.print.chunkSize, cfg.print.jobs);
 
-    if (mapi.updateRegisters(toUpdate) != ErrorCode::OK) {
+    if (pipeline.run(toExport) != ErrorCode::OK) {
       logger->error("Failed to fetch the registers");
       return 1;
     }
+  }
 
-    vector<Register> toPrint;
-    registerList = registerHandler->getRegisters();
-    startIter    = lower_bound(begin(registerList), end(registerList), cfg.print.min);
-    endIter      = upper_bound(begin(registerList), end(registerList), cfg.print.max);
-    copy_if(startIter, endIter, std::back_inserter(toPrint), [](const Register &i) { return i.canRead(); });
-
-    string line;
-    for (Register &i : toPrint) {
-      csvFile << fmt::format("{},\"{}\",{},{},{},{},{}\n",
-                             i.reg(),
-                             i.desc(),
-                             i.value(),
-                             i.unit(),
-                             enum2Str::toStr(i.format()),
-                             enum2Str::toStr(i.type()),
-                             enum2Str::toStr(i.access()));
-    }
+  if (*poll) {
+    Poller poller(mapi, cfg.poll);
+    return poller.run();
   }
 
+  if (*gateway) { return runGateway(mapi, cfg.gateway); }
+
   return 0;
 }
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <string>
+#include <vector>
+
+struct CFG {
+  std::string           db       = SMA_MODBUS_DEFAULT_DB;
+  std::vector<uint32_t> devices  = {};
+  std::string           bind     = "127.0.0.1";
+  uint16_t              port     = 5020;
+  uint16_t              numPorts = 1;
+  uint16_t              numUnits = 1;
+  uint16_t              unitBase = 3;
+  size_t                threads  = 1;
+  uint32_t              serial   = 1900000000;
+  uint64_t              seed     = 0;
+
+  double latency        = 0.0; //!< Base response latency in ms.
+  double jitter         = 0.0; //!< Additional random latency in ms (uniform distribution).
+  double exceptionRate  = 0.0; //!< Probability of a SERVER_BUSY exception.
+  double timeoutRate    = 0.0; //!< Probability of not responding at all.
+  double disconnectRate = 0.0; //!< Probability of closing the connection.
+};
@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Simulator.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <map>
+
+#include "Logging.hpp"
+
+using namespace std;
+using namespace std::chrono;
+using namespace modbusSMA;
+using namespace modbusSMA::sim;
+
+const uint16_t UNIT_ID_REGISTER   = 42109;
+const uint16_t UNIT_ID_SIZE       = 4;
+const uint8_t  DEFAULT_UNIT_ID    = 1;
+const double   DEFAULT_NOMINAL_W  = 5000.0;
+const double   POWER_CURVE_PERIOD = 3600.0; //!< Period of the simulated power curve in seconds.
+
+//! Guesses the nominal power from the device name (for instance 10000 for `Sunny Tripower STP 10000TL-10`).
+double nominalPowerFromName(string const &_name) {
+  for (size_t i = 0; i < _name.size(); ++i) {
+    if (!isdigit((unsigned char)_name[i])) { continue; }
+
+    size_t end = i;
+    while (end < _name.size() && isdigit((unsigned char)_name[end])) { ++end; }
+
+    double value = stod(_name.substr(i, end - i));
+    if (value >= 1000.0) { return value; }
+    i = end;
+  }
+
+  return DEFAULT_NOMINAL_W;
+}
+
+//! Encodes a string as STR32 (two characters per word, zero padded).
+vector<uint16_t> encodeString(string const &_str) {
+  vector<uint16_t> data(16, 0);
+  for (size_t i = 0; i < _str.size() && i < 32; ++i) {
+    data[i / 2] |= (uint16_t)((uint8_t)_str[i] << (i % 2 == 0 ? 8 : 0));
+  }
+  return data;
+}
+
+//! Encodes an integer with the given number of words (most significant word first).
+vector<uint16_t> encodeInt(uint64_t _value, uint32_t _numWords) {
+  vector<uint16_t> data(_numWords, 0);
+  for (uint32_t i = 0; i < _numWords; ++i) { data[_numWords - i - 1] = (uint16_t)(_value >> (16 * i)); }
+  return data;
+}
+
+
+
+/*!
+ * \brief Loads the registers of a device type
+ *
+ * \param _db  The register database (must be connected)
+ * \param _dev The device type
+ */
+DeviceModel::DeviceModel(DataBase &_db, DataBase::DevEnum const &_dev)
+    : mTypeID(_dev.id), mName(_dev.name), mNominalPower(nominalPowerFromName(_dev.name)), mWords(UINT16_MAX + 1) {
+  map<uint16_t, Register> registers;
+  for (string table : {string("ALL"), _dev.table}) {
+    for (Register &i : _db.getRegisters(table)) { registers.insert_or_assign(i.reg(), i); }
+  }
+
+  mEntries.reserve(registers.size());
+  for (auto &i : registers) {
+    Register reg         = i.second;
+    auto     table       = reg.enums();
+    auto &   enums       = table->values();
+    uint32_t enumDefault = enums.empty() ? 0 : enums.front();
+
+    for (uint32_t j = 0; j < reg.size() && reg.reg() + j <= UINT16_MAX; ++j) {
+      mWords[reg.reg() + j] = {(int32_t)mEntries.size(), (uint8_t)j};
+    }
+
+    mEntries.push_back({reg, reg.getNaN(), enumDefault});
+  }
+}
+
+
+
+/*!
+ * \brief Creates the simulator (call addPort() to add devices)
+ *
+ * \param _cfg    The simulator configuration
+ * \param _models The device types. The devices of a port cycle through this list.
+ * \param _seed   Seed for the fault injection
+ */
+Simulator::Simulator(CFG _cfg, vector<shared_ptr<DeviceModel const>> _models, uint64_t _seed)
+    : mCfg(_cfg), mModels(_models), mRandom(_seed) {}
+
+/*!
+ * \brief Listens on an additional port and creates the devices for this port
+ *
+ * The serial numbers are derived from the port, so they are unique across all Simulator instances with the same
+ * configuration.
+ */
+ErrorCode Simulator::addPort(uint16_t _port) {
+  if (mModels.empty()) { return ErrorCode::INVALID_STATE; }
+
+  ErrorCode result = listen(mCfg.bind, _port);
+  if (result != ErrorCode::OK) { return result; }
+
+  for (uint16_t i = 0; i < mCfg.numUnits; ++i) {
+    uint32_t index  = (uint32_t)(_port - mCfg.port) * mCfg.numUnits + i;
+    uint8_t  unitID = (uint8_t)(mCfg.unitBase + i);
+    uint32_t serial = mCfg.serial + index;
+
+    mDevices[((uint32_t)_port << 8) | unitID] = {
+        mModels[index % mModels.size()].get(), serial, 128, unitID, (double)(serial % 997) / 997.0 * 2 * M_PI, {}};
+  }
+
+  return ErrorCode::OK;
+}
+
+//! Returns the device for a request (unit ID 1 is mapped to the first device of the port).
+Device *Simulator::findDevice(uint16_t _port, uint8_t _unit) {
+  if (_unit == DEFAULT_UNIT_ID) { _unit = (uint8_t)mCfg.unitBase; }
+
+  auto iter = mDevices.find(((uint32_t)_port << 8) | _unit);
+  return iter == end(mDevices) ? nullptr : &iter->second;
+}
+
+/*!
+ * \brief Generates the current value of a register
+ *
+ * The value only depends on the device and the time, so it is consistent across requests (and batch sizes).
+ */
+vector<uint16_t> Simulator::generate(Device const &_dev, DeviceModel::Entry const &_entry, double _now) const {
+  Register const &reg   = _entry.reg;
+  string const &  unit  = reg.unit();
+  string const &  desc  = reg.desc();
+  double          load  = 0.5 + 0.45 * sin(2 * M_PI * _now / POWER_CURVE_PERIOD + _dev.phase);
+  double          power = _dev.model->nominalPower() * load;
+
+  switch (reg.reg()) {
+    case 30001: return encodeInt(3, reg.size()); // Version of the Modbus profile
+    case 30003: return encodeInt(_dev.susyID, reg.size());
+    case 30005:
+    case 30057:
+    case 40067: return encodeInt(_dev.serial, reg.size());
+    case 30007: return encodeInt((uint64_t)_now, reg.size()); // Data change counter
+    case 30053: return encodeInt(_dev.model->typeID(), reg.size());
+    default: break;
+  }
+
+  if (reg.type() == DataType::STR32) {
+    if (desc.find("IP address") != string::npos) { return encodeString(fmt::format("10.0.1.{}", _dev.unitID)); }
+    if (desc.find("subnet") != string::npos) { return encodeString("255.255.255.0"); }
+    if (desc.find("address") != string::npos) { return encodeString("10.0.1.1"); } // Gateway and DNS server
+    if (desc.find("MAC") != string::npos) {
+      return encodeString(fmt::format("00:40:AD:{:02X}:{:02X}:{:02X}",
+                                      (_dev.serial >> 16) & 0xFF,
+                                      (_dev.serial >> 8) & 0xFF,
+                                      _dev.serial & 0xFF));
+    }
+    return encodeString(fmt::format("SIM {}", _dev.serial));
+  }
+
+  double value = 0.0;
+  double scale = 1.0;
+
+  switch (reg.format()) {
+    case DataFormat::ENUM: return encodeInt(_entry.enumDefault, reg.size());
+    case DataFormat::DT:
+    case DataFormat::TM: return encodeInt((uint64_t)_now, reg.size());
+    case DataFormat::FW: return encodeInt(0x020A0504, reg.size()); // 2.10.05.R
+    case DataFormat::REV: return encodeInt(0x01000000, reg.size());
+    case DataFormat::IP4: return encodeInt(0x0A000100 | _dev.unitID, reg.size());
+    case DataFormat::RAW:
+    case DataFormat::HW: return encodeInt(1, reg.size());
+    case DataFormat::TEMP: return encodeInt((uint64_t)llround(350 + 50 * load), reg.size());
+    case DataFormat::FIX1: scale = 10.0; break;
+    case DataFormat::FIX2: scale = 100.0; break;
+    case DataFormat::FIX3: scale = 1000.0; break;
+    case DataFormat::FIX4: scale = 10000.0; break;
+    default: break;
+  }
+
+  if (unit == "W" || unit == "VA") {
+    value = power;
+  } else if (unit == "VAr") {
+    value = 0.05 * power;
+  } else if (unit == "V") {
+    value = 230.0 + 2.0 * sin(_now / 60.0 + _dev.phase);
+  } else if (unit == "A") {
+    value = power / (3 * 230.0);
+  } else if (unit == "Hz") {
+    value = 50.0 + 0.02 * sin(_now / 10.0 + _dev.phase);
+  } else if (unit == "Wh" || unit == "kWh" || unit == "MWh") {
+    value = 0.5 * _dev.model->nominalPower() * (_now - 1.5e9) / 3600.0; // Monotonic energy counter
+    value = desc.compare(0, 5, "Daily") == 0 ? fmod(value, 0.5 * _dev.model->nominalPower() * 24) : value;
+    value /= unit == "Wh" ? 1.0 : unit == "kWh" ? 1e3 : 1e6;
+  } else if (unit == "%") {
+    value = 100.0 * load;
+  } else if (unit == "Ohms") {
+    value = 2e6;
+  } else if (unit == "s") {
+    value = fmod(_now, 365 * 24 * 3600.0);
+  } else if (unit == "ms") {
+    value = 1000.0;
+  }
+
+  return encodeInt((uint64_t)llround(value * scale), reg.size());
+}
+
+//! Answers a read request. Every requested word must belong to a register (as on real devices).
+MBResponse Simulator::read(Device const &_dev, MBRequest const &_req, double _now) const {
+  MBResponse resp;
+  uint32_t   end = (uint32_t)_req.address + _req.count;
+
+  resp.data.reserve(_req.count);
+
+  if (_req.address >= UNIT_ID_REGISTER && end <= UNIT_ID_REGISTER + UNIT_ID_SIZE) {
+    uint16_t unitID[UNIT_ID_SIZE] = {
+        (uint16_t)(_dev.serial >> 16), (uint16_t)(_dev.serial & 0xFFFF), _dev.susyID, _dev.unitID};
+    for (uint32_t i = _req.address; i < end; ++i) { resp.data.push_back(unitID[i - UNIT_ID_REGISTER]); }
+    return resp;
+  }
+
+  DeviceModel const &model = *_dev.model;
+  vector<uint16_t>   current;
+
+  for (uint32_t i = _req.address; i < end; ++i) {
+    DeviceModel::Word const &word = model.word((uint16_t)i);
+    if (word.entry < 0 || (i == _req.address && word.offset != 0)) {
+      return {MBResponse::Action::EXCEPTION, MBException::ILLEGAL_DATA_ADDRESS};
+    }
+
+    DeviceModel::Entry const &entry = model.entry(word.entry);
+    if (word.offset == 0 || current.empty()) {
+      current = entry.reg.canRead() ? generate(_dev, entry, _now) : entry.nan; // Write only registers return NaN
+    }
+
+    auto overrideIter = _dev.overrides.find((uint16_t)i);
+    resp.data.push_back(overrideIter != _dev.overrides.end() ? overrideIter->second : current[word.offset]);
+  }
+
+  return resp;
+}
+
+//! Answers a write request. Only writable registers can be written.
+MBResponse Simulator::write(Device &_dev, MBRequest const &_req) {
+  uint32_t end = (uint32_t)_req.address + _req.count;
+
+  for (uint32_t i = _req.address; i < end; ++i) {
+    DeviceModel::Word const &word = _dev.model->word((uint16_t)i);
+    if (word.entry < 0 || !_dev.model->entry(word.entry).reg.canWrite()) {
+      return {MBResponse::Action::EXCEPTION, MBException::ILLEGAL_DATA_ADDRESS};
+    }
+  }
+
+  for (uint32_t i = _req.address; i < end; ++i) { _dev.overrides[(uint16_t)i] = _req.data[i - _req.address]; }
+  return {};
+}
+
+//! Answers all requests of one event loop iteration.
+void Simulator::handleRequests(vector<MBRequest> const &_requests, vector<MBResponse> &_responses) {
+  double now = duration<double>(system_clock::now().time_since_epoch()).count();
+
+  for (size_t i = 0; i < _requests.size(); ++i) {
+    MBRequest const &req  = _requests[i];
+    MBResponse &     resp = _responses[i];
+    Device *         dev  = findDevice(req.port, req.unit);
+
+    ++mNumRequests;
+
+    double fault = mUniform(mRandom);
+    if (fault < mCfg.disconnectRate) {
+      resp.action = MBResponse::Action::DISCONNECT;
+    } else if ((fault -= mCfg.disconnectRate) < mCfg.timeoutRate) {
+      resp.action = MBResponse::Action::DROP;
+    } else if ((fault -= mCfg.timeoutRate) < mCfg.exceptionRate) {
+      resp = {MBResponse::Action::EXCEPTION, MBException::SERVER_BUSY};
+    } else if (!dev) {
+      resp = {MBResponse::Action::EXCEPTION, MBException::GATEWAY_TARGET};
+    } else {
+      switch ((MBFunction)req.function) {
+        case MBFunction::READ_HOLDING_REGISTERS:
+        case MBFunction::READ_INPUT_REGISTERS: resp = read(*dev, req, now); break;
+        case MBFunction::WRITE_SINGLE_REGISTER:
+        case MBFunction::WRITE_MULTIPLE_REGISTERS: resp = write(*dev, req); break;
+      }
+    }
+
+    double delay = mCfg.latency + mCfg.jitter * mUniform(mRandom);
+    resp.delay   = microseconds((int64_t)(delay * 1000.0));
+  }
+}
@@ -0,0 +1,124 @@
+//! \file
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "CFG.hpp"
+#include "DataBase.hpp"
+#include "MBServer.hpp"
+
+namespace modbusSMA::sim {
+
+/*!
+ * \brief The register layout of one inverter type (shared by all simulated devices of this type)
+ *
+ * Contains the registers of the `ALL` table and of the device table, and a lookup table from every register word to
+ * the register it belongs to.
+ */
+class DeviceModel {
+ public:
+  //! Precomputed information for one register.
+  struct Entry {
+    Register              reg;         //!< The register definition.
+    std::vector<uint16_t> nan;         //!< The NaN value of the register.
+    uint32_t              enumDefault; //!< The first ENUM value (ENUM registers only).
+  };
+
+  //! Location of one register word.
+  struct Word {
+    int32_t entry  = -1; //!< Index of the Entry (-1 if the address is not defined).
+    uint8_t offset = 0;  //!< Offset of the word inside the register.
+  };
+
+ private:
+  uint32_t           mTypeID;
+  std::string        mName;
+  double             mNominalPower;
+  std::vector<Entry> mEntries;
+  std::vector<Word>  mWords;
+
+ public:
+  DeviceModel() = delete;
+  DeviceModel(DataBase &_db, DataBase::DevEnum const &_dev);
+
+  inline uint32_t           typeID() const { return mTypeID; }              //!< The DeviceENUM ID.
+  inline std::string const &name() const { return mName; }                  //!< The device name.
+  inline double             nominalPower() const { return mNominalPower; } //!< Nominal AC power in W.
+  inline size_t             size() const { return mEntries.size(); }       //!< Number of registers.
+
+  inline Word const & word(uint16_t _address) const { return mWords[_address]; }        //!< Looks up a register word.
+  inline Entry const &entry(int32_t _index) const { return mEntries[(size_t)_index]; } //!< Returns an entry.
+};
+
+//! One simulated inverter.
+struct Device {
+  DeviceModel const *                    model;     //!< The register layout.
+  uint32_t                               serial;    //!< The serial number.
+  uint16_t                               susyID;    //!< The SusyID.
+  uint8_t                                unitID;    //!< The Modbus unit ID.
+  double                                 phase;     //!< Offset of the simulated power curve.
+  std::unordered_map<uint16_t, uint16_t> overrides; //!< Written register words.
+};
+
+/*!
+ * \brief Simulates SMA inverters on one or more Modbus TCP ports
+ *
+ * Every port serves the same set of unit IDs (see CFG). Unit ID 1 is an alias for the first device of the port, so
+ * ModbusAPI::initialize() can discover the real unit ID with register 42109 (as on real devices). All other registers
+ * are taken from the register database of the device type. Values are generated from the register unit and format
+ * and vary over time (power, energy counters, timestamps). Written values are stored per device.
+ *
+ * Latency, jitter, exception responses and disconnects can be injected for testing and benchmarking.
+ */
+class Simulator : public MBServer {
+ private:
+  CFG                                             mCfg;
+  std::vector<std::shared_ptr<DeviceModel const>> mModels;
+  std::unordered_map<uint32_t, Device>            mDevices; //!< (port << 8 | unit ID) --> device.
+  std::mt19937_64                                 mRandom;
+  std::uniform_real_distribution<double>          mUniform     = std::uniform_real_distribution<double>(0.0, 1.0);
+  uint64_t                                        mNumRequests = 0;
+
+  Device *findDevice(uint16_t _port, uint8_t _unit);
+
+  MBResponse read(Device const &_dev, MBRequest const &_req, double _now) const;
+  MBResponse write(Device &_dev, MBRequest const &_req);
+
+  std::vector<uint16_t> generate(Device const &_dev, DeviceModel::Entry const &_entry, double _now) const;
+
+ protected:
+  void handleRequests(std::vector<MBRequest> const &_requests, std::vector<MBResponse> &_responses) override;
+
+ public:
+  Simulator() = delete;
+  Simulator(CFG _cfg, std::vector<std::shared_ptr<DeviceModel const>> _models, uint64_t _seed);
+
+  ErrorCode addPort(uint16_t _port);
+
+  inline size_t   numDevices() const { return mDevices.size(); } //!< Number of simulated devices.
+  inline uint64_t numRequests() const { return mNumRequests; }   //!< Number of handled requests.
+};
+
+} // namespace modbusSMA::sim
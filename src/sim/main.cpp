@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <csignal>
+#include <iostream>
+#include <thread>
+
+#include "CFG.hpp"
+#include "CLI11.hpp"
+#include "Logging.hpp"
+#include "Simulator.hpp"
+
+using namespace std;
+using namespace spdlog;
+using namespace modbusSMA;
+using namespace modbusSMA::sim;
+
+vector<unique_ptr<Simulator>> gSimulators;
+
+void stopHandler(int) {
+  for (auto &i : gSimulators) { i->stop(); } // stop() only writes to a pipe
+}
+
+int main(int argc, char *argv[]) {
+  auto logger = log::get();
+  CFG  cfg;
+
+  CLI::App app{"modbusSMA inverter simulator"};
+
+  app.add_option("-d,--database", cfg.db, "Path to the modbusSMA database", true)->check(CLI::ExistingFile);
+  app.add_option("--device", cfg.devices, "DeviceENUM IDs of the simulated inverters (default: the first one)");
+  app.add_option("-b,--bind", cfg.bind, "Address to listen on", true);
+  app.add_option("-P,--port", cfg.port, "First TCP port", true);
+  app.add_option("--ports", cfg.numPorts, "Number of TCP ports (consecutive)", true);
+  app.add_option("--units", cfg.numUnits, "Number of simulated devices (unit IDs) per port", true);
+  app.add_option("--unit-base", cfg.unitBase, "First unit ID", true);
+  app.add_option("-t,--threads", cfg.threads, "Number of server threads (the ports are distributed)", true);
+  app.add_option("--serial", cfg.serial, "Serial number of the first device", true);
+  app.add_option("--seed", cfg.seed, "Seed for the fault injection", true);
+  app.add_option("--latency", cfg.latency, "Response latency in ms", true);
+  app.add_option("--jitter", cfg.jitter, "Additional random latency in ms", true);
+  app.add_option("--exception-rate", cfg.exceptionRate, "Probability of a SERVER_BUSY exception", true);
+  app.add_option("--timeout-rate", cfg.timeoutRate, "Probability of not responding to a request", true);
+  app.add_option("--disconnect-rate", cfg.disconnectRate, "Probability of closing the connection", true);
+
+  auto lFlagV = app.add_flag("-v,--verbose", "Verbose logging");
+  auto lFlagQ = app.add_flag("-q,--quiet", "Will only log warnings and errors");
+
+  CLI11_PARSE(app, argc, argv);
+
+  if (lFlagQ->count() > 0 && lFlagQ->count() > lFlagV->count()) { logger->set_level(level::warn); }
+  if (lFlagV->count() > 0 && lFlagV->count() > lFlagQ->count()) { logger->set_level(level::debug); }
+
+  if (cfg.numUnits == 0 || cfg.unitBase < 2 || cfg.unitBase + cfg.numUnits > 248) {
+    logger->error("Invalid unit IDs: the simulated unit IDs must be in the range [2, 247]");
+    return 2;
+  }
+
+  if (cfg.numPorts == 0 || (uint32_t)cfg.port + cfg.numPorts > UINT16_MAX + 1u || cfg.threads == 0) {
+    logger->error("Invalid port range or number of threads");
+    return 2;
+  }
+
+  // Load the device types
+  DataBase db(cfg.db);
+  if (db.connect() != ErrorCode::OK) { return 1; }
+
+  auto devEnums = db.getDeviceEnums();
+  if (devEnums.empty()) { return 1; }
+  if (cfg.devices.empty()) { cfg.devices = {devEnums[0].id}; }
+
+  vector<shared_ptr<DeviceModel const>> models;
+  for (uint32_t id : cfg.devices) {
+    auto iter = find_if(begin(devEnums), end(devEnums), [id](auto const &i) { return i.id == id; });
+    if (iter == end(devEnums)) {
+      logger->error("Unknown device ID {}", id);
+      return 2;
+    }
+
+    models.push_back(make_shared<DeviceModel const>(db, *iter));
+    logger->info("Simulating '{}' ({} registers)", iter->name, models.back()->size());
+  }
+
+  db.disconnect();
+
+  // Create the servers
+  cfg.threads = min<size_t>(cfg.threads, cfg.numPorts);
+  for (size_t i = 0; i < cfg.threads; ++i) { gSimulators.push_back(make_unique<Simulator>(cfg, models, cfg.seed + i)); }
+
+  for (uint32_t i = 0; i < cfg.numPorts; ++i) {
+    if (gSimulators[i % cfg.threads]->addPort((uint16_t)(cfg.port + i)) != ErrorCode::OK) { return 1; }
+  }
+
+  logger->info("Serving {} devices on {}:{}-{} (unit IDs {}-{}, {} threads)",
+               (size_t)cfg.numPorts * cfg.numUnits,
+               cfg.bind,
+               cfg.port,
+               cfg.port + cfg.numPorts - 1,
+               cfg.unitBase,
+               cfg.unitBase + cfg.numUnits - 1,
+               cfg.threads);
+
+  signal(SIGINT, stopHandler);
+  signal(SIGTERM, stopHandler);
+  signal(SIGPIPE, SIG_IGN);
+
+  vector<thread> threads;
+  for (auto &i : gSimulators) { threads.emplace_back(&Simulator::run, i.get()); }
+  for (auto &i : threads) { i.join(); }
+
+  uint64_t numRequests = 0;
+  for (auto &i : gSimulators) { numRequests += i->numRequests(); }
+  logger->info("Simulator stopped after {} requests", numRequests);
+  return 0;
+}
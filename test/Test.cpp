@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "Test.hpp"
+
+#include "Logging.hpp"
+
+using namespace std;
+using namespace modbusSMA;
+using namespace modbusSMA::sim;
+using namespace modbusSMA::test;
+
+//! Records the result of one check and prints failures to stderr. Returns _cond.
+bool Context::check(bool _cond, char const *_expr, char const *_file, int _line) {
+  ++mChecks;
+  if (!_cond) {
+    ++mFailed;
+    fmt::print(stderr, "{}: {}:{}: CHECK({}) failed\n", mSuite, _file, _line, _expr);
+  }
+
+  return _cond;
+}
+
+//! Returns an unused port for a simulator of this suite.
+uint16_t Context::nextPort() { return (uint16_t)(mOpts.simPort + mPorts++); }
+
+//! Starts the simulator (check running()).
+SimFixture::SimFixture(Context &_ctx) {
+  auto logger = log::get();
+  mDB         = make_shared<DataBase>(_ctx.options().db);
+  if (mDB->connect() != ErrorCode::OK) { return; }
+
+  auto devices = mDB->getDeviceEnums();
+  auto iter    = find_if(begin(devices), end(devices), [](auto const &i) { return i.table == "STP_TL_10"; });
+  if (iter == end(devices)) {
+    logger->error("SimFixture: the database has no STP_TL_10 device");
+    return;
+  }
+
+  vector<shared_ptr<DeviceModel const>> models = {make_shared<DeviceModel const>(*mDB, *iter)};
+
+  mDevice   = *iter;
+  mCfg.port = _ctx.nextPort();
+  mSim      = make_unique<Simulator>(mCfg, models, 0);
+  if (mSim->addPort(mCfg.port) != ErrorCode::OK) {
+    logger->error("SimFixture: failed to start the simulator on port {}", mCfg.port);
+    return;
+  }
+
+  mThread = thread(&Simulator::run, mSim.get());
+}
+
+//! Stops the simulator.
+SimFixture::~SimFixture() {
+  if (!mThread.joinable()) { return; }
+  mSim->stop();
+  mThread.join();
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "mSMAConfig.hpp"
+
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "DataBase.hpp"
+#include "Simulator.hpp"
+
+namespace modbusSMA::test {
+
+//! Global test options.
+struct Options {
+  std::string db      = SMA_MODBUS_DEFAULT_DB; //!< The register database.
+  uint16_t    simPort = 25040;                 //!< First port for the in process simulators.
+};
+
+/*!
+ * \brief Collects the results of the checks of one test suite
+ *
+ * Failed checks are printed to stderr with the file, line and the checked expression (see CHECK()).
+ */
+class Context {
+ private:
+  Options     mOpts;
+  std::string mSuite;
+  size_t      mChecks = 0;
+  size_t      mFailed = 0;
+  uint16_t    mPorts  = 0;
+
+ public:
+  Context() = delete;
+  Context(Options _opts, std::string _suite) : mOpts(_opts), mSuite(_suite) {} //!< Creates the context.
+
+  bool     check(bool _cond, char const *_expr, char const *_file, int _line);
+  uint16_t nextPort();
+
+  inline Options const &options() const { return mOpts; }  //!< Returns the options.
+  inline size_t         checks() const { return mChecks; } //!< Number of executed checks.
+  inline size_t         failed() const { return mFailed; } //!< Number of failed checks.
+};
+
+/*!
+ * \brief Simulates one STP 10000TL-10 on a loopback port in a background thread
+ *
+ * The simulator is stopped by the destructor.
+ */
+class SimFixture {
+ private:
+  std::shared_ptr<DataBase> mDB;
+  CFG                       mCfg;
+  DataBase::DevEnum         mDevice = {0, "", ""};
+
+  std::unique_ptr<sim::Simulator> mSim;
+  std::thread                     mThread;
+
+ public:
+  SimFixture() = delete;
+  SimFixture(Context &_ctx);
+  ~SimFixture();
+
+  SimFixture(SimFixture const &) = delete;
+  void operator=(SimFixture const &) = delete;
+
+  inline bool                      running() const { return mThread.joinable(); } //!< Whether the simulator runs.
+  inline std::shared_ptr<DataBase> db() const { return mDB; }                     //!< The connected DataBase.
+  inline CFG const &               cfg() const { return mCfg; }                   //!< The simulator configuration.
+  inline DataBase::DevEnum const & device() const { return mDevice; }             //!< The simulated device type.
+};
+
+ErrorCode testAggregator(Context &_ctx);
+ErrorCode testAlerts(Context &_ctx);
+ErrorCode testDerived(Context &_ctx);
+ErrorCode testDiscovery(Context &_ctx);
+ErrorCode testTuning(Context &_ctx);
+
+} // namespace modbusSMA::test
+
+//! Checks _expr and records a failure (with the expression) in the Context _ctx.
+#define CHECK(_ctx, _expr) (_ctx).check(static_cast<bool>(_expr), #_expr, __FILE__, __LINE__)
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <iostream>
+
+#include "CLI11.hpp"
+#include "Logging.hpp"
+#include "Test.hpp"
+
+using namespace std;
+using namespace spdlog;
+using namespace modbusSMA;
+using namespace modbusSMA::test;
+
+int main(int argc, char *argv[]) {
+  auto           logger = log::get();
+  Options        opts;
+  vector<string> suites = {"aggregator", "alerts", "derived", "discovery", "tuning"};
+
+  CLI::App app{"modbusSMA tests"};
+
+  app.add_option("-d,--database", opts.db, "Path to the modbusSMA database", true)->check(CLI::ExistingFile);
+  app.add_option("-s,--suite", suites, "Test suites to run", true);
+  app.add_option("-P,--port", opts.simPort, "First port of the in process simulators", true);
+
+  auto lFlagV = app.add_flag("-v,--verbose", "Verbose logging");
+
+  CLI11_PARSE(app, argc, argv);
+
+  logger->set_level(lFlagV->count() > 0 ? level::debug : level::off); // Most tests provoke errors on purpose
+
+  bool failed = false;
+  for (auto const &i : suites) {
+    Context   ctx(opts, i);
+    ErrorCode res = ErrorCode::OK;
+    if (i == "aggregator") {
+      res = testAggregator(ctx);
+    } else if (i == "alerts") {
+      res = testAlerts(ctx);
+    } else if (i == "derived") {
+      res = testDerived(ctx);
+    } else if (i == "discovery") {
+      res = testDiscovery(ctx);
+    } else if (i == "tuning") {
+      res = testTuning(ctx);
+    } else {
+      fmt::print(stderr, "Unknown test suite '{}'\n", i);
+      return 2;
+    }
+
+    if (res != ErrorCode::OK) {
+      fmt::print(stderr, "{}: setup failed with '{}'\n", i, enum2Str::toStr(res));
+      failed = true;
+      continue;
+    }
+
+    fmt::print("{:<10} {:>4} checks {:>4} failed\n", i, ctx.checks(), ctx.failed());
+    failed = failed || ctx.failed() > 0;
+  }
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cmath>
+
+#include "Aggregator.hpp"
+#include "Test.hpp"
+
+using namespace std;
+using namespace modbusSMA;
+using namespace modbusSMA::test;
+
+namespace {
+
+using Kind = Aggregator::Kind;
+
+} // namespace
+
+//! The tumbling and sliding windows of the Aggregator.
+ErrorCode modbusSMA::test::testAggregator(Context &_ctx) {
+  Aggregator::Result res;
+
+  // Finished tumbling windows are not returned as the current window
+  {
+    Aggregator agg({{1000, Kind::TUMBLING}});
+    agg.add(30775, 1100, 5);
+    agg.add(30775, 1900, 7);
+
+    CHECK(_ctx, agg.query(30775, 0, res, 1999));
+    CHECK(_ctx, res.start == 1000 && res.end == 2000 && res.count == 2 && res.max == 7);
+    CHECK(_ctx, !agg.query(30775, 0, res, 2000));
+    CHECK(_ctx, !agg.query(30775, 0, res, 5000));
+    CHECK(_ctx, agg.query(30775, 2000).empty());
+
+    // The late sample still closes the old window
+    vector<Aggregator::Result> closed;
+    agg.subscribe([&](Aggregator::Result const &_res) { closed.push_back(_res); });
+    agg.add(30775, 5100, 1);
+    CHECK(_ctx, closed.size() == 1 && closed[0].start == 1000 && closed[0].count == 2 && closed[0].mean == 6);
+    CHECK(_ctx, agg.query(30775, 0, res, 5100) && res.start == 5000 && res.count == 1);
+  }
+
+  // Tumbling rollover, min / max / mean / delta
+  {
+    Aggregator                 agg({{1000, Kind::TUMBLING}});
+    vector<Aggregator::Result> closed;
+    agg.subscribe([&](Aggregator::Result const &_res) { closed.push_back(_res); });
+
+    for (double i : {10.0, 4.0, 16.0}) { agg.add(30529, 2000 + (int64_t)i, i); }
+    CHECK(_ctx, agg.query(30529, 0, res, 2500));
+    CHECK(_ctx, res.count == 3 && res.min == 4 && res.max == 16 && res.mean == 10 && res.delta == 6);
+    CHECK(_ctx, closed.empty());
+
+    agg.add(30529, 3000, 20); // First sample of the next window
+    CHECK(_ctx, closed.size() == 1 && closed[0].start == 2000 && closed[0].end == 3000 && closed[0].delta == 6);
+    CHECK(_ctx, agg.query(30529, 0, res, 3000) && res.count == 1 && res.min == 20 && res.delta == 0);
+
+    agg.add(30529, 2999, 1); // Older than the current window
+    CHECK(_ctx, agg.query(30529, 0, res, 3000) && res.count == 1 && res.min == 20);
+
+    agg.add(30529, 3500, NAN);
+    CHECK(_ctx, agg.query(30529, 0, res, 3500) && res.count == 1);
+    CHECK(_ctx, closed.size() == 1);
+
+    agg.add(30529, 4200, 25);
+    agg.add(30529, 7000, 30); // Windows without samples are skipped
+    CHECK(_ctx, closed.size() == 3 && closed[1].start == 3000 && closed[2].start == 4000 && closed[2].count == 1);
+  }
+
+  // Sliding eviction (samples in (now - length, now])
+  {
+    Aggregator agg({{1000, Kind::SLIDING}});
+    agg.add(30775, 0, 5);
+    agg.add(30775, 400, 9);
+    agg.add(30775, 800, 1);
+
+    CHECK(_ctx, agg.query(30775, 0, res, 800));
+    CHECK(_ctx, res.count == 3 && res.min == 1 && res.max == 9 && res.mean == 5 && res.delta == -4);
+
+    agg.add(30775, 1000, 3); // Evicts the sample at 0
+    CHECK(_ctx, agg.query(30775, 0, res, 1000) && res.count == 3 && res.max == 9 && res.delta == -6);
+    CHECK(_ctx, res.start == 0 && res.end == 1000);
+
+    // Queries evict without new samples
+    CHECK(_ctx, agg.query(30775, 0, res, 1400) && res.count == 2 && res.max == 3 && res.min == 1);
+    CHECK(_ctx, agg.query(30775, 0, res, 1800) && res.count == 1 && res.min == 3 && res.delta == 0);
+    CHECK(_ctx, !agg.query(30775, 0, res, 2000));
+
+    // The window never moves back
+    CHECK(_ctx, !agg.query(30775, 0, res, 1500));
+    agg.add(30775, 2100, 4);
+    CHECK(_ctx, agg.query(30775, 0, res, 2100) && res.count == 1 && res.mean == 4 && res.start == 1100);
+  }
+
+  // Sliding min / max with monotonic values
+  {
+    Aggregator agg({{500, Kind::SLIDING}});
+    for (int64_t i = 0; i < 20; ++i) { agg.add(30775, i * 100, (double)i); }
+    CHECK(_ctx, agg.query(30775, 0, res, 1900) && res.count == 5 && res.min == 15 && res.max == 19);
+    CHECK(_ctx, res.mean == 17 && res.delta == 4);
+
+    for (int64_t i = 20; i < 40; ++i) { agg.add(30775, i * 100, (double)(40 - i)); }
+    CHECK(_ctx, agg.query(30775, 0, res, 3900) && res.count == 5 && res.min == 1 && res.max == 5);
+  }
+
+  // All windows of a register and update()
+  {
+    RegisterContainer container;
+    container.addRegisters({Register(30775, "Power", "W", DataType::S32, DataFormat::FIX0, DataAccess::RO),
+                            Register(30783, "Voltage", "V", DataType::U32, DataFormat::FIX2, DataAccess::RO)});
+    container.updateRegister(30775, vector<uint16_t>{0, 1500});
+
+    Aggregator agg({{1000, Kind::TUMBLING}, {0, Kind::TUMBLING}, {5000, Kind::SLIDING}});
+    CHECK(_ctx, agg.windows().size() == 2);
+
+    agg.update(container, {30775, 30783}, 10000); // 30783 is NaN
+    CHECK(_ctx, agg.query(30775, 10500).size() == 2);
+    CHECK(_ctx, agg.query(30775, 11000).size() == 1);
+    CHECK(_ctx, agg.query(30783, 10500).empty());
+    CHECK(_ctx, !agg.query(30775, 2, res, 10500));
+    CHECK(_ctx, agg.query(30775, 1, res, 10500) && res.mean == 1500 && res.window.kind == Kind::SLIDING);
+  }
+
+  return ErrorCode::OK;
+}
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cstdio>
+#include <fstream>
+
+#include "AlertEngine.hpp"
+#include "Test.hpp"
+
+using namespace std;
+using namespace modbusSMA;
+using namespace modbusSMA::test;
+
+namespace {
+
+using Kind = AlertEngine::Kind;
+
+//! Writes _content to _path and loads it into a new AlertEngine.
+ErrorCode loadRules(string const &_path, string const &_content) {
+  ofstream(_path) << _content;
+  return AlertEngine().loadFile(_path);
+}
+
+//! Sets the U32 register _reg to _val and runs the rules of _alerts at _time.
+void apply(AlertEngine &_alerts, RegisterContainer &_cont, uint16_t _reg, uint32_t _val, int64_t _time) {
+  _cont.updateRegister(_reg, vector<uint16_t>{(uint16_t)(_val >> 16), (uint16_t)(_val & 0xFFFF)});
+  _alerts.update(_cont, {_reg}, _time);
+}
+
+//! Like apply(), but returns the new events.
+vector<AlertEngine::Event> feed(
+    AlertEngine &_alerts, RegisterContainer &_cont, uint16_t _reg, uint32_t _val, int64_t _time) {
+  apply(_alerts, _cont, _reg, _val, _time);
+
+  vector<AlertEngine::Event> events;
+  _alerts.drain(events);
+  return events;
+}
+
+} // namespace
+
+//! Parsing of the rule files and the evaluation of all rule kinds.
+ErrorCode modbusSMA::test::testAlerts(Context &_ctx) {
+  string path = "alerts_test.txt";
+
+  // Rule files
+  {
+    ofstream(path) << "# name;register;kind;a;b\n\n"
+                   << "grid voltage L1;30783;threshold;207;253 # comment\n"
+                   << "  insulation ; 30225 ; HYSTERESIS ; 500 ; 1000\n"
+                   << "power ramp;30775;rate;;2000\n"
+                   << "fault;30201;transition;*;35\n";
+
+    AlertEngine alerts;
+    CHECK(_ctx, alerts.loadFile(path) == ErrorCode::OK);
+
+    auto const &rules = alerts.rules();
+    if (CHECK(_ctx, rules.size() == 4)) {
+      CHECK(_ctx, rules[0].name == "grid voltage L1" && rules[0].reg == 30783 && rules[0].kind == Kind::THRESHOLD);
+      CHECK(_ctx, rules[0].low == 207 && rules[0].high == 253);
+      CHECK(_ctx, rules[1].name == "insulation" && rules[1].reg == 30225 && rules[1].kind == Kind::HYSTERESIS);
+      CHECK(_ctx, rules[1].set == 500 && rules[1].clear == 1000);
+      CHECK(_ctx, rules[2].kind == Kind::RATE && rules[2].low == -HUGE_VAL && rules[2].high == 2000);
+      CHECK(_ctx, rules[3].kind == Kind::TRANSITION && rules[3].from == AlertEngine::ANY && rules[3].to == 35);
+    }
+  }
+
+  CHECK(_ctx, loadRules(path, "") == ErrorCode::OK);
+  CHECK(_ctx, loadRules(path, "# only a comment\n") == ErrorCode::OK);
+
+  for (char const *i : {"a;30783;threshold;1\n",           // Missing field
+                        "a;30783;threshold;1;2;3\n",       // Too many fields
+                        "a;70000;threshold;1;2\n",         // Register out of range
+                        "a;-1;threshold;1;2\n",            // Negative register
+                        "a;abc;threshold;1;2\n",           // Register is not a number
+                        "a;30783;between;1;2\n",           // Unknown kind
+                        "a;30783;threshold;x;2\n",         // Limit is not a number
+                        "a;30783;threshold;3;2\n",         // low > high
+                        "a;30783;rate;nan;2\n",            // NaN limit
+                        "a;30783;hysteresis;;2\n",         // Missing set limit
+                        "a;30783;hysteresis;2;2\n",        // set == clear
+                        "a;30783;transition;7;7\n",        // from == to
+                        "a;30783;transition;x;7\n",        // Raw value is not a number
+                        "ok;30783;threshold;1;2\na;1\n"}) { // Error after a valid rule
+    CHECK(_ctx, loadRules(path, i) == ErrorCode::ERROR);
+  }
+
+  remove(path.c_str());
+  CHECK(_ctx, AlertEngine().loadFile(path) == ErrorCode::FILE_NOT_FOUND);
+
+  // Evaluation
+  RegisterContainer cont;
+  cont.addRegisters({Register(30783, "Voltage", "V", DataType::U32, DataFormat::FIX0, DataAccess::RO),
+                     Register(30225, "Insulation", "Ohm", DataType::U32, DataFormat::FIX0, DataAccess::RO),
+                     Register(30775, "Power", "W", DataType::U32, DataFormat::FIX0, DataAccess::RO),
+                     Register(30201, "Status", "", DataType::U32, DataFormat::RAW, DataAccess::RO)});
+
+  AlertEngine alerts(3);
+  CHECK(_ctx, alerts.add({"voltage", 30783, Kind::THRESHOLD, 207, 253}) == ErrorCode::OK);
+  CHECK(_ctx, alerts.add({"insulation", 30225, Kind::HYSTERESIS, 0, 0, 500, 1000}) == ErrorCode::OK);
+  CHECK(_ctx, alerts.add({"ramp", 30775, Kind::RATE, -100, 100}) == ErrorCode::OK);
+  CHECK(_ctx, alerts.add({"fault", 30201, Kind::TRANSITION, 0, 0, 0, 0, AlertEngine::ANY, 35}) == ErrorCode::OK);
+
+  // Threshold
+  CHECK(_ctx, feed(alerts, cont, 30783, 230, 0).empty());
+  auto events = feed(alerts, cont, 30783, 260, 1000);
+  CHECK(_ctx, events.size() == 1 && events[0].rule == 0 && events[0].active && events[0].value == 260);
+  CHECK(_ctx, events.size() == 1 && events[0].previous == 230 && events[0].time == 1000);
+  CHECK(_ctx, alerts.active() == vector<size_t>({0}));
+  CHECK(_ctx, feed(alerts, cont, 30783, 255, 2000).empty());
+  events = feed(alerts, cont, 30783, 253, 3000);
+  CHECK(_ctx, events.size() == 1 && !events[0].active);
+
+  // Hysteresis (alarm on low values)
+  CHECK(_ctx, feed(alerts, cont, 30225, 2000, 0).empty());
+  events = feed(alerts, cont, 30225, 500, 1000);
+  CHECK(_ctx, events.size() == 1 && events[0].rule == 1 && events[0].active);
+  CHECK(_ctx, feed(alerts, cont, 30225, 999, 2000).empty());
+  events = feed(alerts, cont, 30225, 1000, 3000);
+  CHECK(_ctx, events.size() == 1 && !events[0].active);
+
+  // Rate (change per second)
+  CHECK(_ctx, feed(alerts, cont, 30775, 1000, 0).empty());
+  CHECK(_ctx, feed(alerts, cont, 30775, 1100, 2000).empty());
+  events = feed(alerts, cont, 30775, 1400, 3000);
+  CHECK(_ctx, events.size() == 1 && events[0].rule == 2 && events[0].active && events[0].value == 300);
+  events = feed(alerts, cont, 30775, 1400, 4000);
+  CHECK(_ctx, events.size() == 1 && !events[0].active && events[0].value == 0);
+
+  // Transition (the first value only initializes the rule)
+  CHECK(_ctx, feed(alerts, cont, 30201, 35, 0).empty());
+  CHECK(_ctx, feed(alerts, cont, 30201, 307, 1000).empty());
+  events = feed(alerts, cont, 30201, 35, 2000);
+  CHECK(_ctx, events.size() == 1 && events[0].rule == 3 && events[0].value == 35 && events[0].previous == 307);
+
+  // NaN values are ignored
+  size_t evaluated = alerts.evaluated();
+  CHECK(_ctx, feed(alerts, cont, 30783, 0xFFFFFFFF, 5000).empty());
+  CHECK(_ctx, alerts.evaluated() == evaluated);
+
+  // Bounded event queue (4 events, 3 queued)
+  apply(alerts, cont, 30783, 300, 6000);
+  apply(alerts, cont, 30225, 100, 6000);
+  for (uint32_t i : {307, 35, 307, 35}) { apply(alerts, cont, 30201, i, 7000 + i); }
+
+  events.clear();
+  CHECK(_ctx, alerts.drain(events) == 3);
+  CHECK(_ctx, alerts.dropped() == 1);
+  CHECK(_ctx, alerts.active() == vector<size_t>({0, 1}));
+
+  return ErrorCode::OK;
+}
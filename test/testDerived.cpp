@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+
+#include "DerivedRegisters.hpp"
+#include "ModbusAPI.hpp"
+#include "Test.hpp"
+
+using namespace std;
+using namespace modbusSMA;
+using namespace modbusSMA::test;
+
+namespace {
+
+//! Evaluates the constant expression _expr (FIX4). Returns NaN if the expression is invalid or the result is NaN.
+double evalConst(string const &_expr) {
+  RegisterContainer container;
+  DerivedRegisters  derived;
+  if (derived.add({1000, "", "", DataFormat::FIX4, _expr}) != ErrorCode::OK) { return NAN; }
+  if (derived.attach(container) != ErrorCode::OK) { return NAN; }
+
+  derived.update(container, {});
+  Register const *reg = container.get(1000);
+  return !reg || reg->isNaN() ? NAN : reg->valueDouble();
+}
+
+} // namespace
+
+//! The expression compiler, the dependency graph and derived registers on a simulated inverter.
+ErrorCode modbusSMA::test::testDerived(Context &_ctx) {
+  // Syntax
+  for (char const *i : {"1", "r30775", "-r30775 + abs(-3)", "min(r30775, 2) * max(1, 2)", "((1))", "1.5e3 / 2"}) {
+    CHECK(_ctx, DerivedRegisters().add({1000, "", "", DataFormat::FIX0, i}) == ErrorCode::OK);
+  }
+
+  for (char const *i : {"", "1 +", "(1", "1)", "1 2", "foo(1)", "min(1)", "abs(1, 2)", "r", "r70000", "1 $ 2"}) {
+    CHECK(_ctx, DerivedRegisters().add({1000, "", "", DataFormat::FIX0, i}) != ErrorCode::OK);
+  }
+
+  CHECK(_ctx, DerivedRegisters().add({1000, "", "", DataFormat::ENUM, "1"}) != ErrorCode::OK);
+  CHECK(_ctx, DerivedRegisters().add({1000, "", "", DataFormat::FIX4, "1"}) == ErrorCode::OK);
+
+  // Evaluation (precedence, functions, NaN)
+  CHECK(_ctx, evalConst("1 + 2 * 3") == 7.0);
+  CHECK(_ctx, evalConst("(1 + 2) * 3") == 9.0);
+  CHECK(_ctx, evalConst("10 - 4 - 3") == 3.0);
+  CHECK(_ctx, evalConst("12 / 4 / 3") == 1.0);
+  CHECK(_ctx, evalConst("-2 * -3") == 6.0);
+  CHECK(_ctx, evalConst("2 - -3") == 5.0);
+  CHECK(_ctx, evalConst("min(4, 2) + max(4, 2) + abs(-1.5)") == 7.5);
+  CHECK(_ctx, evalConst("1 / 8") == 0.125);
+  CHECK(_ctx, isnan(evalConst("1 / 0")));
+  CHECK(_ctx, isnan(evalConst("1 / (2 - 2)")));
+
+  // Dependency graph
+  {
+    RegisterContainer container;
+    container.addRegisters({Register(30775, "Power", "W", DataType::S32, DataFormat::FIX0, DataAccess::RO)});
+
+    DerivedRegisters cycle;
+    CHECK(_ctx, cycle.add({40900, "", "", DataFormat::FIX0, "r40901 + 1"}) == ErrorCode::OK);
+    CHECK(_ctx, cycle.add({40901, "", "", DataFormat::FIX0, "r40900 + 1"}) == ErrorCode::OK);
+    CHECK(_ctx, cycle.attach(container) != ErrorCode::OK);
+
+    DerivedRegisters unknown;
+    CHECK(_ctx, unknown.add({40900, "", "", DataFormat::FIX0, "r30777"}) == ErrorCode::OK);
+    CHECK(_ctx, unknown.attach(container) != ErrorCode::OK);
+
+    DerivedRegisters used;
+    CHECK(_ctx, used.add({30775, "", "", DataFormat::FIX0, "1"}) == ErrorCode::OK);
+    CHECK(_ctx, used.attach(container) != ErrorCode::OK);
+
+    // Defined in reverse order of the dependencies
+    DerivedRegisters chain;
+    CHECK(_ctx, chain.add({40902, "", "", DataFormat::FIX0, "r40901 * 2"}) == ErrorCode::OK);
+    CHECK(_ctx, chain.add({40901, "", "", DataFormat::FIX0, "r40900 + 1"}) == ErrorCode::OK);
+    CHECK(_ctx, chain.add({40900, "", "", DataFormat::FIX0, "r30775"}) == ErrorCode::OK);
+    CHECK(_ctx, chain.attach(container) == ErrorCode::OK);
+
+    vector<uint16_t> inputs = {40902};
+    chain.addInputs(inputs);
+    CHECK(_ctx, find(begin(inputs), end(inputs), 30775) != end(inputs));
+
+    vector<uint16_t> changed;
+    container.updateRegister(30775, vector<uint16_t>{0, 10});
+    chain.update(container, {30775}, &changed);
+    CHECK(_ctx, changed == vector<uint16_t>({40900, 40901, 40902}));
+    CHECK(_ctx, container.get(40902)->valueInt() == 22);
+
+    // Unchanged inputs are not evaluated again
+    size_t evaluations = chain.evaluations();
+    changed.clear();
+    chain.update(container, {30775}, &changed);
+    CHECK(_ctx, changed.empty());
+    CHECK(_ctx, chain.evaluations() == evaluations);
+  }
+
+  // Definition files
+  {
+    string path = "derived_test.txt";
+    ofstream(path) << "# address;format;unit;description;expression\n\n"
+                   << "40900;FIX2;W;Double power;2 * r30775 # comment\n"
+                   << "40901;FIX0;V;Spread;max(r30783, r30785) - min(r30783, r30785)\n";
+
+    DerivedRegisters file;
+    CHECK(_ctx, file.loadFile(path) == ErrorCode::OK);
+    CHECK(_ctx, file.definitions().size() == 2);
+    CHECK(_ctx, file.definitions()[0].desc == "Double power" && file.definitions()[0].format == DataFormat::FIX2);
+    CHECK(_ctx, file.definitions()[0].expression == "2 * r30775");
+
+    ofstream(path) << "40900;FIX2;W;Missing expression\n";
+    CHECK(_ctx, DerivedRegisters().loadFile(path) != ErrorCode::OK);
+    ofstream(path) << "70000;FIX2;W;Invalid address;1\n";
+    CHECK(_ctx, DerivedRegisters().loadFile(path) != ErrorCode::OK);
+
+    remove(path.c_str());
+    CHECK(_ctx, DerivedRegisters().loadFile(path) == ErrorCode::FILE_NOT_FOUND);
+  }
+
+  // Simulated inverter: derived registers are read like normal registers
+  SimFixture sim(_ctx);
+  if (!sim.running()) { return ErrorCode::INITIALIZATION_FAILED; }
+
+  auto derived = make_shared<DerivedRegisters>();
+  CHECK(_ctx, derived->add({40900, "Double power", "W", DataFormat::FIX2, "2 * r30775"}) == ErrorCode::OK);
+  CHECK(_ctx, derived->add({40901, "Spread", "V", DataFormat::FIX2, "max(r30783, r30785) - min(r30783, r30785)"}) ==
+                  ErrorCode::OK);
+  CHECK(_ctx, derived->add({40902, "Power plus one", "W", DataFormat::FIX0, "r40900 / 2 + 1"}) == ErrorCode::OK);
+
+  ModbusAPI mapi("127.0.0.1", sim.cfg().port, sim.db());
+  CHECK(_ctx, mapi.setDerivedRegisters(derived) == ErrorCode::OK);
+  if (!CHECK(_ctx, mapi.setup() == ErrorCode::OK)) { return ErrorCode::OK; }
+
+  // Only the derived registers are requested, their inputs are read implicitly
+  CHECK(_ctx, mapi.updateRegisters(vector<uint16_t>{40901, 40902}) == ErrorCode::OK);
+
+  auto            container = mapi.getRegisters();
+  Register const *power     = container->get(30775);
+  Register const *l1        = container->get(30783);
+  Register const *l2        = container->get(30785);
+  if (!CHECK(_ctx, power && l1 && l2 && !power->isNaN() && !l1->isNaN() && !l2->isNaN())) { return ErrorCode::OK; }
+
+  double spread = fabs(l1->valueDouble() - l2->valueDouble());
+  CHECK(_ctx, container->get(40900)->isVirtual());
+  CHECK(_ctx, container->get(40900)->valueDouble() == 2 * power->valueDouble());
+  CHECK(_ctx, fabs(container->get(40901)->valueDouble() - spread) < 0.005);
+  CHECK(_ctx, container->get(40902)->valueDouble() == power->valueDouble() + 1);
+
+  return ErrorCode::OK;
+}
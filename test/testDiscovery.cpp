@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "Discovery.hpp"
+#include "Test.hpp"
+
+using namespace std;
+using namespace modbusSMA;
+using namespace modbusSMA::test;
+
+//! Address parsing and a scan of the loopback interface with one simulated inverter.
+ErrorCode modbusSMA::test::testDiscovery(Context &_ctx) {
+  SimFixture sim(_ctx);
+  if (!sim.running()) { return ErrorCode::INITIALIZATION_FAILED; }
+
+  Discovery::Settings settings;
+  settings.connectTimeout = chrono::milliseconds(200);
+  settings.probeTimeout   = chrono::milliseconds(500);
+
+  // Address parsing
+  Discovery parser(sim.db(), settings);
+  for (char const *i : {"127.0.0.1", "10.0.0.0/24", "10.0.0.1/32", "10.0.0.5-10", "10.0.0.5-10.0.1.7"}) {
+    CHECK(_ctx, parser.addRange(i) == ErrorCode::OK);
+  }
+
+  for (char const *i : {"", "abc", "256.0.0.1", "1.2.3", "1.2.3.4/33", "1.2.3.4/", "1.2.3.4/8x", "1.2.3.9-3"}) {
+    CHECK(_ctx, parser.addRange(i) != ErrorCode::OK);
+  }
+
+  CHECK(_ctx, Discovery::toStr(0x7F000001) == "127.0.0.1");
+  CHECK(_ctx, Discovery::toStr(0xC0A8B201) == "192.168.178.1");
+
+  // Scan: the simulator port and a closed port
+  uint16_t  closed = _ctx.nextPort();
+  Discovery disc(sim.db(), settings);
+  CHECK(_ctx, disc.addRange("127.0.0.1") == ErrorCode::OK);
+  disc.addPort(sim.cfg().port);
+  disc.addPort(closed);
+  disc.addPort(closed); // Duplicates are ignored
+
+  auto devices = disc.run();
+  if (!CHECK(_ctx, devices.size() == 1)) { return ErrorCode::OK; }
+
+  Discovery::Device const &dev = devices[0];
+  CHECK(_ctx, dev.ip == "127.0.0.1");
+  CHECK(_ctx, dev.port == sim.cfg().port);
+  CHECK(_ctx, dev.serial == sim.cfg().serial);
+  CHECK(_ctx, dev.unitID == sim.cfg().unitBase);
+  CHECK(_ctx, dev.typeID == sim.device().id);
+  CHECK(_ctx, dev.known);
+  CHECK(_ctx, dev.type == sim.device().name);
+
+  // Nothing listens on the closed port
+  Discovery empty(sim.db(), settings);
+  CHECK(_ctx, empty.addRange("127.0.0.1") == ErrorCode::OK);
+  empty.addPort(closed);
+  CHECK(_ctx, empty.run().empty());
+
+  return ErrorCode::OK;
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2018 Daniel Mensinger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cerrno>
+#include <cmath>
+#include <modbus/modbus.h>
+
+#include "AdaptiveTuning.hpp"
+#include "Test.hpp"
+
+using namespace std;
+using namespace std::chrono;
+using namespace modbusSMA;
+using namespace modbusSMA::test;
+
+namespace {
+
+const uint32_t MAX_BATCH = SMA_MODBUS_MAX_REGISTER_COUNT;
+
+//! Records _num successful requests of _numRegisters registers that took _duration.
+void succeed(AdaptiveTuning &_tuning, size_t _num, uint32_t _numRegisters, microseconds _duration) {
+  for (size_t i = 0; i < _num; ++i) { _tuning.record(_numRegisters, _duration, 0); }
+}
+
+} // namespace
+
+//! The linear model, the response timeout and the batch size limit of AdaptiveTuning (synthetic durations).
+ErrorCode modbusSMA::test::testTuning(Context &_ctx) {
+  // Least squares fit of `duration = rtt + n * wordCost`
+  {
+    AdaptiveTuning tuning;
+    for (size_t i = 0; i < 8; ++i) {
+      for (uint32_t n : {2u, 10u, 40u, 80u, 120u}) { tuning.record(n, microseconds(3000 + 25 * n), 0); }
+    }
+
+    auto snap = tuning.snapshot();
+    CHECK(_ctx, fabs(snap.rtt - 3000) < 0.01 && fabs(snap.wordCost - 25) < 0.001);
+
+    // Constant batch sizes keep the per register estimate
+    succeed(tuning, 64, 60, microseconds(3000 + 25 * 60));
+    snap = tuning.snapshot();
+    CHECK(_ctx, fabs(snap.rtt - 3000) < 0.01 && fabs(snap.wordCost - 25) < 0.001);
+
+    AdaptiveTuning constant;
+    succeed(constant, 16, 60, microseconds(5000));
+    CHECK(_ctx, constant.snapshot().wordCost == 0 && fabs(constant.snapshot().rtt - 5000) < 0.01);
+
+    // Negative slopes are clamped
+    AdaptiveTuning negative;
+    for (size_t i = 0; i < 8; ++i) {
+      for (uint32_t n : {10u, 100u}) { negative.record(n, microseconds(10000 - 50 * n), 0); }
+    }
+    CHECK(_ctx, negative.snapshot().wordCost == 0 && negative.snapshot().rtt > 0);
+  }
+
+  // Response timeout: timeoutFactor * percentile, clamped to [minTimeout, maxTimeout]
+  {
+    AdaptiveTuning tuning;
+    tuning.initialize(milliseconds(500));
+    tuning.initialize(milliseconds(700)); // Only the first call sets the timeout
+    CHECK(_ctx, tuning.timeout() == milliseconds(500));
+
+    succeed(tuning, 7, 10, milliseconds(50));
+    CHECK(_ctx, tuning.timeout() == milliseconds(500)); // Not enough samples yet
+    CHECK(_ctx, tuning.record(10, milliseconds(50), 0));
+    CHECK(_ctx, tuning.timeout() == milliseconds(100));
+
+    succeed(tuning, 64, 10, milliseconds(1)); // Below minTimeout
+    CHECK(_ctx, tuning.timeout() == milliseconds(100));
+
+    succeed(tuning, 64, 10, seconds(8)); // Above maxTimeout
+    CHECK(_ctx, tuning.timeout() == seconds(10));
+
+    // The 99th percentile of the last 64 durations is the largest one
+    succeed(tuning, 63, 10, milliseconds(200));
+    succeed(tuning, 1, 10, milliseconds(300));
+    CHECK(_ctx, tuning.timeout() == milliseconds(600));
+
+    AdaptiveTuning::Settings settings;
+    settings.percentile    = 0.5;
+    settings.timeoutFactor = 3.0;
+    AdaptiveTuning median(settings);
+    for (int64_t i = 1; i <= 16; ++i) { median.record(10, milliseconds(100 * i), 0); }
+    CHECK(_ctx, median.timeout() == milliseconds(2400)); // 3 * 800ms
+  }
+
+  // Timeouts double the response timeout until the next success
+  {
+    AdaptiveTuning tuning;
+    tuning.initialize(milliseconds(500));
+    CHECK(_ctx, tuning.record(10, milliseconds(500), ETIMEDOUT));
+    CHECK(_ctx, tuning.timeout() == milliseconds(1000));
+    for (size_t i = 0; i < 8; ++i) { tuning.record(10, milliseconds(500), ETIMEDOUT); }
+    CHECK(_ctx, tuning.timeout() == seconds(10));
+    CHECK(_ctx, !tuning.record(10, milliseconds(500), ECONNRESET));
+
+    succeed(tuning, 7, 10, milliseconds(100));
+    CHECK(_ctx, tuning.timeout() == seconds(10));
+    tuning.record(10, milliseconds(100), 0);
+    CHECK(_ctx, tuning.timeout() == milliseconds(200));
+
+    tuning.record(10, milliseconds(100), ETIMEDOUT);
+    CHECK(_ctx, tuning.timeout() == milliseconds(400));
+    tuning.record(10, milliseconds(100), 0); // Recomputed on the first success after a timeout
+    CHECK(_ctx, tuning.timeout() == milliseconds(200));
+  }
+
+  // AIMD batch size limit
+  {
+    AdaptiveTuning tuning;
+    CHECK(_ctx, tuning.batchLimit() == MAX_BATCH);
+
+    // Only size related errors of large requests reduce the limit
+    tuning.record(MAX_BATCH, milliseconds(1), ECONNRESET);
+    tuning.record(MAX_BATCH, milliseconds(1), EMBXILADD);
+    tuning.record(8, milliseconds(1), ETIMEDOUT);
+    CHECK(_ctx, tuning.batchLimit() == MAX_BATCH);
+
+    tuning.record(MAX_BATCH, milliseconds(1), ETIMEDOUT);
+    uint32_t half = MAX_BATCH / 2;
+    CHECK(_ctx, tuning.batchLimit() == half);
+    tuning.record(MAX_BATCH, milliseconds(1), EMBXILVAL); // Larger than the limit
+    CHECK(_ctx, tuning.batchLimit() == half);
+    tuning.record(half, milliseconds(1), EMBXILVAL);
+    CHECK(_ctx, tuning.batchLimit() == half / 2);
+    tuning.record(12, milliseconds(1), EMBXILVAL);
+    tuning.record(9, milliseconds(1), EMBBADDATA); // Corrupt frame, clamped to minBatch
+    CHECK(_ctx, tuning.batchLimit() == 8);
+
+    // Additive increase after increaseAfter successes close to the limit
+    succeed(tuning, 15, 8, milliseconds(1));
+    CHECK(_ctx, tuning.batchLimit() == 8);
+    succeed(tuning, 100, 3, milliseconds(1)); // Small requests do not count
+    CHECK(_ctx, tuning.batchLimit() == 8);
+    succeed(tuning, 1, 4, milliseconds(1));
+    CHECK(_ctx, tuning.batchLimit() == 16);
+    succeed(tuning, 16, 16, milliseconds(1));
+    CHECK(_ctx, tuning.batchLimit() == 24);
+    succeed(tuning, 16 * MAX_BATCH, MAX_BATCH, milliseconds(1));
+    CHECK(_ctx, tuning.batchLimit() == MAX_BATCH);
+
+    // Disabled tuning ignores all requests
+    tuning.setEnabled(false);
+    CHECK(_ctx, !tuning.record(MAX_BATCH, milliseconds(1), ETIMEDOUT));
+    tuning.setEnabled(true);
+    CHECK(_ctx, tuning.batchLimit() == MAX_BATCH);
+
+    tuning.record(MAX_BATCH, milliseconds(1), ETIMEDOUT);
+    tuning.reset();
+    CHECK(_ctx, tuning.batchLimit() == MAX_BATCH && tuning.timeout() == microseconds(0));
+  }
+
+  // The model caps the limit, so the largest batch finishes in maxTimeout / 2
+  {
+    AdaptiveTuning tuning;
+    for (size_t i = 0; i < 8; ++i) {
+      for (uint32_t n : {10u, 20u}) { tuning.record(n, microseconds(1000 + 100000 * n), 0); }
+    }
+
+    CHECK(_ctx, tuning.batchLimit() == 49); // (5s - 1ms) / 100ms
+  }
+
+  return ErrorCode::OK;
+}